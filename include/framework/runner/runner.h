@@ -24,6 +24,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "framework/test/test.h"
 #include "util/cru_vec.h"
 
 typedef enum runner_isolation_mode runner_isolation_mode_t;
@@ -46,9 +47,30 @@ struct runner_opts {
     bool no_fork;
     bool no_cleanup_phase;
     bool no_image_dumps;
+    test_dump_format_t image_dump_format;
+
+    /// If set, each test process appends its image dumps to one archive in
+    /// this directory.
+    const char *image_dump_archive_dir;
+
+    /// zlib level of dump archives. Negative selects the fastest.
+    int image_dump_zlib_level;
+
     bool use_separate_cleanup_threads;
     bool run_all_queues;
     bool verbose;
+    bool gpu_compare;
+
+    /// If set, tests load and save their pipeline cache in this directory.
+    const char *pipeline_cache_dir;
+
+    /// Each test accounts for the host memory of its Vulkan instance and
+    /// device, and reports it with its result.
+    bool host_alloc_stats;
+    bool no_host_alloc_poison;
+
+    /// \see test_create_info::params
+    const cru_cstr_vec_t *params;
 
     /// The runner will write JUnit XML to this path, if not NULL.
     const char *junit_xml_filepath;
@@ -22,14 +22,44 @@
 #pragma once
 
 #include "tapi/t.h"
+#include "util/cru_dump_archive.h"
+#include "util/cru_vec.h"
 
 typedef struct test test_t;
 typedef struct test_create_info test_create_info_t;
+typedef enum test_dump_format test_dump_format_t;
+typedef struct test_host_mem_summary test_host_mem_summary_t;
+
+/// File format of images dumped by t_dump_image_f() and t_dump_seq_image().
+enum test_dump_format {
+    TEST_DUMP_FORMAT_PNG,
+
+    /// Faster to encode than PNG. Dumped filenames ending in ".png" end in
+    /// ".qoi" instead.
+    TEST_DUMP_FORMAT_QOI,
+};
+
+/// Host memory that the Vulkan implementation allocated through the test's
+/// VkAllocationCallbacks. All zero unless test_create_info::host_alloc_stats
+/// is set.
+struct test_host_mem_summary {
+    uint64_t peak_bytes;
+    uint64_t num_allocs;
+
+    /// Bytes still allocated after the device or instance was destroyed.
+    uint64_t leaked_bytes;
+};
 
 struct test_create_info {
     const test_def_t *def;
 
     bool enable_dump;
+    test_dump_format_t dump_format;
+
+    /// If set, dumped images are appended to the archive instead of being
+    /// written to the data directory.
+    cru_dump_archive_t *dump_archive;
+
     bool enable_cleanup_phase;
     bool enable_separate_cleanup_thread;
     bool enable_bootstrap;
@@ -37,6 +67,24 @@ struct test_create_info {
     uint32_t queue_num;
     bool run_all_queues;
     bool verbose;
+    bool gpu_compare;
+
+    /// If set, the test seeds t_pipeline_cache from a file in this
+    /// directory and writes the merged cache back during cleanup.
+    const char *pipeline_cache_dir;
+
+    /// Account for the host memory that the Vulkan implementation allocates.
+    ///
+    /// \see test_get_host_mem_summary()
+    bool host_alloc_stats;
+
+    /// Don't fill host allocations with garbage.
+    bool no_host_alloc_poison;
+
+    /// Parameters for t_param_u64(), each "[<glob>.]<name>=<value>". The
+    /// parameter applies to the tests whose name matches <glob>, or to all
+    /// tests if there is no glob. Later parameters override earlier ones.
+    const cru_cstr_vec_t *params;
 
     uint32_t bootstrap_image_width;
     uint32_t bootstrap_image_height;
@@ -59,3 +107,4 @@ bool test_is_current(void);
 void test_start(test_t *test);
 void test_wait(test_t *test);
 test_result_t test_get_result(test_t *test);
+void test_get_host_mem_summary(test_t *test, test_host_mem_summary_t *summary);
@@ -23,6 +23,7 @@
 
 #include "util/misc.h"
 #include "util/cru_vec.h"
+#include "util/string.h"
 #include "tapi/t_def.h"
 
 typedef struct test_def_vec test_def_vec_t;
@@ -37,6 +38,16 @@ extern test_def_t __start_test_defs, __stop_test_defs;
 bool test_def_match(const test_def_t *def, const char *glob);
 const test_def_t *cru_find_def(const char *name);
 
+bool test_def_declares_requirements(const test_def_t *def);
+bool test_def_check_requirements(const test_def_t *def,
+                                 uint32_t api_version,
+                                 const VkPhysicalDeviceFeatures *features,
+                                 const VkExtensionProperties *instance_exts,
+                                 uint32_t instance_ext_count,
+                                 const VkExtensionProperties *device_exts,
+                                 uint32_t device_ext_count,
+                                 string_t *missing);
+
 static pure inline uint64_t
 test_def_get_id(const test_def_t *def)
 {
@@ -86,6 +86,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 #include "util/vk_wrapper.h"
 
 #ifdef __cplusplus
@@ -99,8 +101,76 @@ typedef struct QoMemoryAllocateFromRequirementsInfo {
     VkDeviceSize            allocationSize;
     uint32_t                memoryTypeIndex;
     VkMemoryPropertyFlags   properties;
+
+    /// Place the buffer or image in the test's memory arena instead of
+    /// giving it its own VkDeviceMemory. qoAllocBufferMemory() and
+    /// qoAllocImageMemory() then also bind the object, because the returned
+    /// memory is shared and the object's offset in it isn't zero. Don't
+    /// bind it again.
+    bool                    suballocate;
 } QoMemoryAllocateFromRequirementsInfo;
 
+/// \brief A pool of large VkDeviceMemory blocks that buffers and images are
+/// placed in.
+///
+/// Each memory type has its own blocks. Buffers and images never share a
+/// block, and each image is padded to bufferImageGranularity, so neighbors
+/// never alias in a way that bufferImageGranularity forbids. All blocks are
+/// freed when the arena is destroyed at the end of the test.
+///
+/// \see qoCreateMemoryArena()
+typedef struct QoMemoryArena QoMemoryArena;
+
+/// \brief Staging memory for qoUploadBuffer() and qoUploadImage().
+///
+/// Each test has a ring for its queue. Small uploads are batched into one
+/// command buffer and submitted together. The ring reuses its staging memory
+/// once the GPU has finished copying from it.
+typedef struct QoUploadRing QoUploadRing;
+
+typedef struct QoUploadImageInfo {
+    /// Must be VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL or VK_IMAGE_LAYOUT_GENERAL.
+    VkImageLayout imageLayout;
+    uint32_t bufferRowLength;
+    uint32_t bufferImageHeight;
+    VkImageSubresourceLayers imageSubresource;
+    VkOffset3D imageOffset;
+    VkExtent3D imageExtent;
+} QoUploadImageInfo;
+
+typedef struct QoMemoryArenaCreateInfo {
+    /// Size of each block. Requests that don't fit get a block of their own.
+    /// The arena uses smaller blocks on heaps smaller than 8 blocks.
+    VkDeviceSize blockSize;
+} QoMemoryArenaCreateInfo;
+
+typedef struct QoSubAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} QoSubAllocation;
+
+typedef struct QoMemoryArenaStats {
+    uint32_t blockCount;
+    uint32_t allocationCount;
+
+    /// Total size of the blocks.
+    VkDeviceSize blockBytes;
+
+    /// Bytes in live sub-allocations, including alignment padding.
+    VkDeviceSize usedBytes;
+
+    uint32_t freeRangeCount;
+    VkDeviceSize largestFreeRange;
+
+    /// usedBytes / blockBytes.
+    float utilization;
+
+    /// 1 - largestFreeRange / (blockBytes - usedBytes). 0 if all free space
+    /// is contiguous.
+    float fragmentation;
+} QoMemoryArenaStats;
+
 typedef struct QoExtraGraphicsPipelineCreateInfo_ {
     VkGraphicsPipelineCreateInfo *pNext;
     VkPrimitiveTopology topology;
@@ -127,6 +197,18 @@ typedef struct QoShaderModuleCreateInfo_ {
 #define QO_MEMORY_ALLOCATE_FROM_REQUIREMENTS_INFO_DEFAULTS \
     .memoryTypeIndex = QO_MEMORY_TYPE_INDEX_INVALID
 
+#define QO_UPLOAD_IMAGE_INFO_DEFAULTS \
+    .imageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, \
+    .imageSubresource = { \
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, \
+        .mipLevel = 0, \
+        .baseArrayLayer = 0, \
+        .layerCount = 1, \
+    }
+
+#define QO_MEMORY_ARENA_CREATE_INFO_DEFAULTS \
+    .blockSize = 32 * 1024 * 1024
+
 #define QO_BUFFER_CREATE_INFO_DEFAULTS \
     .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,			\
     .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
@@ -330,6 +412,96 @@ void *qoMapMemory(VkDevice dev, VkDeviceMemory mem,
                   VkDeviceSize offset, VkDeviceSize size,
                   VkMemoryMapFlags flags);
 
+uint32_t qoFindMemoryTypeIndex(const VkMemoryRequirements *mem_reqs,
+                               VkMemoryPropertyFlags properties);
+
+#ifdef DOXYGEN
+QoMemoryArena *qoCreateMemoryArena(VkDevice dev, ...);
+#else
+#define qoCreateMemoryArena(dev, ...) \
+    __qoCreateMemoryArena((dev), \
+        &(QoMemoryArenaCreateInfo) { \
+            QO_MEMORY_ARENA_CREATE_INFO_DEFAULTS, \
+            ##__VA_ARGS__ , \
+        })
+#endif
+
+#ifdef DOXYGEN
+QoSubAllocation
+qoArenaAllocMemory(QoMemoryArena *arena,
+                   const VkMemoryRequirements *mem_reqs,
+                   const QoMemoryAllocateFromRequirementsInfo *va_args override_info);
+#else
+#define qoArenaAllocMemory(arena, mem_reqs, ...) \
+    __qoArenaAllocMemory((arena), (mem_reqs), false, \
+        &(QoMemoryAllocateFromRequirementsInfo) { \
+            QO_MEMORY_ALLOCATE_FROM_REQUIREMENTS_INFO_DEFAULTS, \
+            ##__VA_ARGS__ , \
+        })
+#endif
+
+#ifdef DOXYGEN
+QoSubAllocation
+qoArenaAllocBufferMemory(QoMemoryArena *arena, VkBuffer buffer,
+                         const QoMemoryAllocateFromRequirementsInfo *va_args override_info);
+#else
+#define qoArenaAllocBufferMemory(arena, buffer, ...) \
+    __qoArenaAllocBufferMemory((arena), (buffer), \
+        &(QoMemoryAllocateFromRequirementsInfo) { \
+            QO_MEMORY_ALLOCATE_FROM_REQUIREMENTS_INFO_DEFAULTS, \
+            ##__VA_ARGS__ , \
+        })
+#endif
+
+#ifdef DOXYGEN
+QoSubAllocation
+qoArenaAllocImageMemory(QoMemoryArena *arena, VkImage image,
+                        const QoMemoryAllocateFromRequirementsInfo *va_args override_info);
+#else
+#define qoArenaAllocImageMemory(arena, image, ...) \
+    __qoArenaAllocImageMemory((arena), (image), \
+        &(QoMemoryAllocateFromRequirementsInfo) { \
+            QO_MEMORY_ALLOCATE_FROM_REQUIREMENTS_INFO_DEFAULTS, \
+            ##__VA_ARGS__ , \
+        })
+#endif
+
+void qoArenaFree(QoMemoryArena *arena, const QoSubAllocation *alloc);
+void *qoArenaMapMemory(QoMemoryArena *arena, const QoSubAllocation *alloc);
+void qoGetMemoryArenaStats(QoMemoryArena *arena, QoMemoryArenaStats *stats);
+
+QoUploadRing *qoCreateUploadRing(VkDevice dev, VkQueue queue,
+                                 uint32_t queue_family_index);
+
+/// \brief Copy data into a buffer through the test's upload ring.
+///
+/// The copy is recorded, not submitted. qoQueueSubmit() to the test's queue
+/// submits pending uploads ahead of its own work. Before using the data
+/// through vkQueueSubmit(), call qoFlushUploads(). Before using it from
+/// another queue, call qoFinishUploads().
+///
+/// The buffer needs VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+void qoUploadBuffer(VkDevice dev, VkBuffer buffer, VkDeviceSize offset,
+                    const void *data, VkDeviceSize size);
+
+#ifdef DOXYGEN
+/// \brief Copy data into an image through the test's upload ring.
+///
+/// Like qoUploadBuffer(). The image must already be in imageLayout.
+void qoUploadImage(VkDevice dev, VkImage image, const void *data,
+                   VkDeviceSize size, ...);
+#else
+#define qoUploadImage(dev, image, data, size, ...) \
+    __qoUploadImage((dev), (image), (data), (size), \
+        &(QoUploadImageInfo) { \
+            QO_UPLOAD_IMAGE_INFO_DEFAULTS, \
+            ##__VA_ARGS__ , \
+        })
+#endif
+
+void qoFlushUploads(VkDevice dev);
+void qoFinishUploads(VkDevice dev);
+
 #ifdef DOXYGEN
 VkBuffer qoCreateBuffer(VkDevice dev, ...);
 #else
@@ -511,6 +683,12 @@ VkDeviceMemory __qoAllocMemory(VkDevice dev, const VkMemoryAllocateInfo *info);
 VkDeviceMemory __qoAllocMemoryFromRequirements(VkDevice dev, const VkMemoryRequirements *mem_reqs, const QoMemoryAllocateFromRequirementsInfo *info);
 VkDeviceMemory __qoAllocBufferMemory(VkDevice dev, VkBuffer buffer, const QoMemoryAllocateFromRequirementsInfo *info);
 VkDeviceMemory __qoAllocImageMemory(VkDevice dev, VkImage image, const QoMemoryAllocateFromRequirementsInfo *info);
+QoMemoryArena *__qoCreateMemoryArena(VkDevice dev, const QoMemoryArenaCreateInfo *info);
+QoSubAllocation __qoArenaAllocMemory(QoMemoryArena *arena, const VkMemoryRequirements *mem_reqs, bool image, const QoMemoryAllocateFromRequirementsInfo *info);
+QoSubAllocation __qoArenaAllocBufferMemory(QoMemoryArena *arena, VkBuffer buffer, const QoMemoryAllocateFromRequirementsInfo *info);
+QoSubAllocation __qoArenaAllocImageMemory(QoMemoryArena *arena, VkImage image, const QoMemoryAllocateFromRequirementsInfo *info);
+void __qoUploadImage(VkDevice dev, VkImage image, const void *data, VkDeviceSize size, const QoUploadImageInfo *info);
+void __qoFlushUploadsForQueue(VkQueue queue);
 VkBuffer __qoCreateBuffer(VkDevice dev, const VkBufferCreateInfo *info);
 VkBufferView __qoCreateBufferView(VkDevice dev, const VkBufferViewCreateInfo *info);
 VkQueryPool __qoCreateQueryPool(VkDevice dev, const VkQueryPoolCreateInfo *info);
@@ -528,6 +706,22 @@ VkRenderPass __qoCreateRenderPass(VkDevice dev, const VkRenderPassCreateInfo *in
 VkPipeline qoCreateGraphicsPipeline(VkDevice dev,
                                     VkPipelineCache pipeline_cache,
                                     const QoExtraGraphicsPipelineCreateInfo *info);
+void qoCreateGraphicsPipelines(VkDevice dev,
+                               VkPipelineCache pipeline_cache,
+                               uint32_t count,
+                               const QoExtraGraphicsPipelineCreateInfo *infos,
+                               VkPipeline *pipelines);
+void qoCreateComputePipelines(VkDevice dev,
+                              VkPipelineCache pipeline_cache,
+                              uint32_t count,
+                              const VkComputePipelineCreateInfo *infos,
+                              VkPipeline *pipelines);
+VkResult qoTryCreateComputePipelines(VkDevice dev,
+                                     VkPipelineCache pipeline_cache,
+                                     uint32_t count,
+                                     const VkComputePipelineCreateInfo *infos,
+                                     VkPipeline *pipelines,
+                                     VkResult *results);
 VkImage __qoCreateImage(VkDevice dev, const VkImageCreateInfo *info);
 VkImageView __qoCreateImageView(VkDevice dev, const VkImageViewCreateInfo *info);
 VkShaderModule __qoCreateShaderModule(VkDevice dev, const QoShaderModuleCreateInfo *info);
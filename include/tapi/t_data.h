@@ -31,6 +31,8 @@
 #include "util/vk_wrapper.h"
 
 typedef struct cru_image cru_image_t;
+typedef struct QoMemoryArena QoMemoryArena;
+typedef struct QoUploadRing QoUploadRing;
 
 #define t_name __t_name()
 #define t_user_data __t_user_data()
@@ -40,6 +42,7 @@ typedef struct cru_image cru_image_t;
 #define t_physical_dev_props  (__t_physical_dev_props())
 #define t_physical_dev_mem_props  (__t_physical_dev_mem_props())
 #define t_device (*__t_device())
+#define t_device_features  (__t_device_features())
 #define t_queue (*__t_queue())
 #define t_queue_idx(q) (*__t_queue_idx(q))
 #define t_descriptor_pool (*__t_descriptor_pool())
@@ -54,6 +57,8 @@ typedef struct cru_image cru_image_t;
 #define t_render_pass (*__t_render_pass())
 #define t_framebuffer (*__t_framebuffer())
 #define t_pipeline_cache (*__t_pipeline_cache())
+#define t_memory_arena (__t_memory_arena())
+#define t_upload_ring (__t_upload_ring())
 #define t_width (*__t_width())
 #define t_height (*__t_height())
 #define t_queue_num (*__t_queue_num())
@@ -65,6 +70,7 @@ const char *__t_name(void);
 const void *__t_user_data(void);
 const VkInstance *__t_instance(void);
 const VkDevice *__t_device(void);
+const VkPhysicalDeviceFeatures *__t_device_features(void);
 const VkPhysicalDevice *__t_physical_dev(void);
 const VkPhysicalDeviceFeatures *__t_physical_dev_features(void);
 const VkPhysicalDeviceProperties *__t_physical_dev_props(void);
@@ -82,6 +88,8 @@ const VkImageView *__t_depthstencil_image_view(void);
 const VkRenderPass *__t_render_pass(void);
 const VkFramebuffer *__t_framebuffer(void);
 const VkPipelineCache *__t_pipeline_cache(void);
+QoMemoryArena *__t_memory_arena(void);
+QoUploadRing *__t_upload_ring(void);
 const uint32_t *__t_height(void);
 const uint32_t *__t_width(void);
 const uint32_t * __t_queue_num(void);
@@ -87,10 +87,38 @@ struct test_def {
     /// and/or transfer operations.
     enum test_queue_setup queue_setup;
 
+    /// \brief Vulkan version requested when creating the instance.
+    ///
+    /// This is also the minimum version of the device. The runner skips the
+    /// test if the device's major and minor version are older.
     const uint32_t api_version;
 
     const bool robust_buffer_access;
 
+    /// \brief Extensions and features that the test requires.
+    ///
+    /// The runner checks these once against the device and skips unsupported
+    /// tests without dispatching them. The extension lists are
+    /// NULL-terminated.
+    ///
+    /// A test that declares any extension or feature gets an instance and
+    /// device that enable only those, and t_has_ext() and
+    /// t_require_feature() see only what the test declared. Other tests get
+    /// everything that the device supports.
+    ///
+    /// Example:
+    ///
+    ///    .device_extensions = (const char *const[]) {
+    ///        "VK_AMD_gcn_shader",
+    ///        NULL,
+    ///    },
+    ///    .device_features = &(VkPhysicalDeviceFeatures) {
+    ///        .shaderFloat64 = true,
+    ///    },
+    const char *const *const instance_extensions;
+    const char *const *const device_extensions;
+    const VkPhysicalDeviceFeatures *const device_features;
+
     /// \brief Private data for the test framework.
     ///
     /// Test authors shouldn't touch this struct.
@@ -41,12 +41,28 @@ typedef struct cru_image_array cru_image_array_t;
 malloclike cru_image_t *
 t_new_cru_image_from_filename(const char *filename);
 
+/// \brief Create a read-only Crucible image from a file, scaled down.
+///
+/// This is a wrapper around cru_image_from_filename_scaled(). On success, the
+/// new image is pushed onto the test thread's cleanup stack.  On failure, the
+/// test fails.
+///
+/// \see cru_image_from_filename_scaled()
+///
+malloclike cru_image_t *
+t_new_cru_image_from_filename_scaled(const char *filename, uint32_t width,
+                                     uint32_t height);
+
 /// \brief Create a Crucible image from a Vulkan image.
 ///
 /// This is a wrapper around cru_image_from_vk_image(). On success, the new
 /// image is pushed onto the test thread's cleanup stack.  On failure, the test
 /// fails.
 ///
+/// Images on the test's current queue share the test's image context, and
+/// with it the pooled staging buffers. Images on other queues get a private
+/// context.
+///
 /// \see cru_image_from_vk_image()
 ///
 malloclike cru_image_t *
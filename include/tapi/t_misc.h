@@ -24,6 +24,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "util/vk_wrapper.h"
 
 typedef struct cru_format_info cru_format_info_t;
@@ -32,3 +35,17 @@ typedef struct cru_format_info cru_format_info_t;
 ///
 /// If Crucible does not have info for the given format, then the test fails.
 const cru_format_info_t *t_format_info(VkFormat format);
+
+/// \brief Allocate zeroed memory that lives as long as the test.
+///
+/// The memory is freed all at once when the test is destroyed, so there is
+/// no need to push a cleanup for it. Never returns NULL.
+void *t_arena_alloc(size_t size);
+void *t_arena_allocn(size_t n, size_t size);
+
+/// \brief Return a workload parameter from the command line.
+///
+/// Return the value given by the last `crucible run -D [<glob>.]<name>=<value>`
+/// whose glob matches the test's name, or \a default_value if there is none.
+/// The test fails if the value isn't an unsigned integer.
+uint64_t t_param_u64(const char *name, uint64_t default_value);
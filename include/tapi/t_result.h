@@ -63,7 +63,7 @@ bool t_has_ext(const char *extension_name);
 void t_require_ext(const char *extension_name);
 
 #define  t_require_feature(feature) do {     \
-        if (!t_physical_dev_features->feature)   \
+        if (!t_device_features->feature)        \
             t_skip();                           \
     } while (0)
 
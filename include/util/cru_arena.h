@@ -0,0 +1,60 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "util/macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cru_arena cru_arena_t;
+typedef struct cru_arena_chunk cru_arena_chunk_t;
+
+/// \brief A threadsafe bump allocator whose memory is freed all at once.
+///
+/// Allocations can't be freed individually. Use it for bookkeeping that
+/// lives as long as its owner, such as a test.
+struct cru_arena {
+    pthread_mutex_t mutex;
+
+    /// The chunk being bumped, followed by the full ones.
+    cru_arena_chunk_t *chunks;
+    char *next;
+    char *end;
+};
+
+void cru_arena_init(cru_arena_t *arena);
+
+/// Free all memory allocated from the arena.
+void cru_arena_finish(cru_arena_t *arena);
+
+/// Return zeroed memory suitably aligned for any type. Never returns NULL.
+malloclike void *cru_arena_alloc(cru_arena_t *arena, size_t size);
+malloclike void *cru_arena_allocn(cru_arena_t *arena, size_t n, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
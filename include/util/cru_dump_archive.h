@@ -0,0 +1,105 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#pragma once
+
+/// \file
+/// \brief Single-file archive of dumped images.
+///
+/// A dump archive collects the images that a process dumps into one file.
+/// Each image is appended as a record: a fixed header, the test name, the
+/// image label, and the pixels, either raw or deflated. Closing the archive
+/// appends an index of all records. An archive whose writer crashed before
+/// writing the index can still be read by scanning its records.
+///
+/// The writer is safe to use from multiple threads. So is
+/// cru_dump_archive_read_pixels().
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/cru_image.h"
+#include "util/vk_wrapper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cru_dump_archive cru_dump_archive_t;
+typedef struct cru_dump_archive_entry cru_dump_archive_entry_t;
+
+struct cru_dump_archive_entry {
+    const char *test_name;
+    const char *label;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+
+    /// Size of the stored pixels, which may be compressed.
+    uint64_t data_size;
+
+    /// Size of the tightly packed pixels.
+    uint64_t raw_size;
+};
+
+/// \brief Create an archive for writing, replacing any existing file.
+///
+/// Pixels are deflated at \a zlib_level, 0 to 9, and stored raw if deflating
+/// doesn't shrink them. A negative level selects the fastest compression.
+malloclike cru_dump_archive_t *
+cru_dump_archive_create(const char *filename, int zlib_level);
+
+/// \brief Append an image to an archive opened with cru_dump_archive_create().
+///
+/// The image is labeled with the name of the test that dumped it and a label
+/// that is unique within the test, such as "ref.png".
+bool cru_dump_archive_add_image(cru_dump_archive_t *ar, const char *test_name,
+                                const char *label, cru_image_t *image);
+
+/// \brief Append an image to the archive on a background thread.
+///
+/// \see cru_image_write_file_async()
+bool cru_dump_archive_add_image_async(cru_dump_archive_t *ar,
+                                      const char *test_name,
+                                      const char *label, cru_image_t *image);
+
+/// \brief Open an existing archive for reading.
+malloclike cru_dump_archive_t *
+cru_dump_archive_open(const char *filename);
+
+uint32_t cru_dump_archive_get_num_entries(cru_dump_archive_t *ar);
+const cru_dump_archive_entry_t *
+cru_dump_archive_get_entry(cru_dump_archive_t *ar, uint32_t index);
+
+/// \brief Read the tightly packed pixels of an entry.
+///
+/// Return NULL on failure. The caller must free the pixels.
+void *cru_dump_archive_read_pixels(cru_dump_archive_t *ar, uint32_t index);
+
+/// \brief Close the archive and free it.
+///
+/// A writable archive gets its index first. Return false if writing the
+/// index fails.
+bool cru_dump_archive_close(cru_dump_archive_t *ar);
+
+#ifdef __cplusplus
+}
+#endif
@@ -31,14 +31,29 @@ extern "C" {
 #endif
 
 typedef struct cru_format_info cru_format_info_t;
+typedef struct cru_format_channel cru_format_channel_t;
 
 enum cru_num_type {
     CRU_NUM_TYPE_UNDEFINED = 0,
     CRU_NUM_TYPE_UNORM,
+    CRU_NUM_TYPE_SNORM,
     CRU_NUM_TYPE_UINT,
     CRU_NUM_TYPE_SFLOAT,
 };
 
+/// Layout of one channel of a pixel.
+struct cru_format_channel {
+    /// The RGBA component that the channel holds, 0 through 3. Depth and
+    /// stencil channels hold component 0.
+    uint8_t component;
+
+    /// Offset and width of the channel in bits. For packed formats the offset
+    /// is from the least significant bit of the packed word, otherwise it is
+    /// from the start of the pixel.
+    uint8_t offset;
+    uint8_t bits;
+};
+
 struct cru_format_info {
     /// For example, "VK_FORMAT_R8_UNORM".
     const char *name;
@@ -48,6 +63,10 @@ struct cru_format_info {
     uint8_t num_channels;
     uint8_t cpp;
 
+    /// The first num_channels entries, in storage order. Compressed and
+    /// combined depth-stencil formats have none.
+    cru_format_channel_t channels[4];
+
     /// This is zero (VK_FORMAT_UNDEFINED) if and only if the format has no
     /// depth component.
     VkFormat depth_format;
@@ -58,6 +77,12 @@ struct cru_format_info {
 
     bool is_color:1;
     bool has_alpha:1;
+
+    /// The channels are bitfields of a single 32-bit word.
+    bool is_packed:1;
+
+    /// The RGB channels are sRGB-encoded. Alpha is always linear.
+    bool is_srgb:1;
 };
 
 /// \brief Lookup info for VkFormat.
@@ -65,6 +90,31 @@ struct cru_format_info {
 /// If Crucible does not have info for the given format, then return NULL.
 const struct cru_format_info *cru_format_get_info(VkFormat format);
 
+/// \brief Return true if cru_format_convert_rect() can read and write the
+/// format.
+///
+/// Compressed and combined depth-stencil formats can't be converted; convert
+/// the depth or stencil aspect on its own instead.
+bool cru_format_is_convertible(const struct cru_format_info *info);
+
+/// \brief Convert a rectangle of pixels from one format to another.
+///
+/// Channels are matched by component, so B8G8R8A8 converts to R8G8B8A8 with
+/// a swizzle. Components missing from the source read as 0, except alpha,
+/// which reads as 1. Conversions between normalized and floating-point
+/// formats are by value. If either format is UINT, the raw integer values are
+/// copied instead, clamped to the destination's range; that is how stencil
+/// images round-trip through R8_UNORM PNG files. A missing alpha is then the
+/// destination's encoding of 1: 1 for UINT and float formats, and the largest
+/// value for normalized formats.
+///
+/// Return false if either format is not convertible.
+bool cru_format_convert_rect(const struct cru_format_info *dest_info,
+                             void *dest, uint32_t dest_stride,
+                             const struct cru_format_info *src_info,
+                             const void *src, uint32_t src_stride,
+                             uint32_t width, uint32_t height);
+
 #ifdef __cplusplus
 }
 #endif
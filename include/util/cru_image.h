@@ -47,6 +47,7 @@ extern "C" {
 
 typedef struct cru_image cru_image_t;
 typedef struct cru_image_array cru_image_array_t;
+typedef struct cru_vk_image_context cru_vk_image_context_t;
 enum {
    CRU_IMAGE_MAP_ACCESS_READ = 0x1,
    CRU_IMAGE_MAP_ACCESS_WRITE = 0x2,
@@ -79,30 +80,110 @@ cru_image_from_pixels(void *restrict pixels, VkFormat format,
 malloclike cru_image_t *
 cru_image_from_filename(const char *filename);
 
+/// \brief Create a read-only Crucible image from a file, scaled down to
+/// \a width x \a height.
+///
+/// The file is decoded once per process. Smaller extents are box-filtered
+/// from it, halving each dimension per step where possible, and cached, so
+/// later requests for the same extent copy nothing. The extent must evenly
+/// divide the file's extent, and the file's format must have 8-bit UNORM or
+/// UINT channels.
+///
+/// If writing a test, consider using t_new_cru_image_from_filename_scaled().
+malloclike cru_image_t *
+cru_image_from_filename_scaled(const char *filename, uint32_t width,
+                               uint32_t height);
+
+/// \brief Create a context for reading back and writing Vulkan images.
+///
+/// The context owns the command pool, command buffer, and fence that
+/// Crucible uses to copy between Vulkan images and host memory, and a pool of
+/// host-visible staging buffers that is reused across images. Submissions go
+/// to \a queue, which must belong to \a queue_family_index and support
+/// transfer operations.
+///
+/// The context is reference-counted, and each image created with it holds a
+/// reference.
+malloclike cru_vk_image_context_t *
+cru_vk_image_context_create(VkDevice dev, VkQueue queue,
+                            uint32_t queue_family_index);
+void cru_vk_image_context_reference(cru_vk_image_context_t *ctx);
+void cru_vk_image_context_release(cru_vk_image_context_t *ctx);
+
 /// \brief Create a Crucible image from a Vulkan image.
 ///
 /// If writing a test, consider using t_new_cru_image_from_vk_image(), which
 /// has a simpler interface.
 ///
 /// If Crucible submits any Vulkan commands on the \a image, then it will do
-/// so using the provided VkQueue. Crucible may allocate temporary
-/// VkDeviceMemory using the provided VkMemoryType index, which must be
-/// host-visible.
+/// so using the context's queue. Staging memory comes from the context's pool
+/// and is held only while the image is mapped or prefetched.
 ///
 malloclike cru_image_t *
-cru_image_from_vk_image(VkDevice dev, VkQueue queue, VkImage image,
+cru_image_from_vk_image(cru_vk_image_context_t *ctx, VkImage image,
                         VkFormat format, VkImageAspectFlagBits aspect,
                         uint32_t level0_width, uint32_t level0_height,
-                        uint32_t miplevel, uint32_t array_slice,
-                        VkMemoryPropertyFlags tmp_mem_props);
+                        uint32_t miplevel, uint32_t array_slice);
+
+/// \brief Read back several Vulkan images in a single submission.
+///
+/// The next cru_image_map() with CRU_IMAGE_MAP_ACCESS_READ of each image
+/// returns the prefetched pixels without another copy. Images that are not
+/// Vulkan images, or that are already mapped or prefetched, are skipped. All
+/// remaining images must share a context.
+bool cru_vk_image_prefetch(cru_image_t *const images[], uint32_t count);
 
 bool cru_image_write_file(cru_image_t *image, const char *filename);
+
+/// \brief Write the image to a file on a background thread.
+///
+/// Snapshot the image's pixels and queue the snapshot for a pool of writer
+/// threads, so the caller is free to change or destroy the image as soon as
+/// this returns. If the queue is full, block until a writer frees a slot.
+/// Failures are logged by the writer thread.
+///
+/// Return false if the image can't be snapshotted.
+bool cru_image_write_file_async(cru_image_t *image, const char *filename);
+
+/// \brief Wait until all writes queued by cru_image_write_file_async() are
+/// done.
+void cru_image_wait_async_writes(void);
+
+/// \brief Set the zlib compression level, 0 to 9, of PNG files written by
+/// Crucible. A negative level restores libpng's default. Levels 0 and 1 also
+/// disable row filtering.
+void cru_image_set_png_compression_level(int level);
 bool cru_image_copy(cru_image_t *dest, cru_image_t *src);
 bool cru_image_compare(cru_image_t *a, cru_image_t *b);
 bool cru_image_compare_rect(cru_image_t *a, uint32_t a_x, uint32_t a_y,
                             cru_image_t *b, uint32_t b_x, uint32_t b_y,
                             uint32_t width, uint32_t height);
 
+typedef struct cru_image_diff cru_image_diff_t;
+
+struct cru_image_diff {
+    uint64_t num_pixels;
+
+    /// Number of pixels with any differing channel.
+    uint64_t num_diff_pixels;
+
+    /// Largest absolute difference of any channel. Channels are compared by
+    /// value, so normalized channels differ by at most 1.0.
+    double max_error;
+
+    /// Root mean square of the per-channel differences.
+    double rms_error;
+};
+
+/// \brief Measure how much two images of the same extent differ.
+///
+/// Unlike cru_image_compare(), examine every pixel. If \a diff_image is not
+/// NULL, it must be a writable VK_FORMAT_R8G8B8A8_UNORM image of the same
+/// extent; each pixel that differs is written red, and each pixel that matches
+/// is written as a dimmed copy of \a a.
+bool cru_image_diff(cru_image_t *a, cru_image_t *b, cru_image_t *diff_image,
+                    cru_image_diff_t *out_diff);
+
 /// \brief Map the image to an array of pixels.
 ///
 /// The pixel format is cru_image::format. The array is tightly packed (that
@@ -133,6 +214,7 @@ cru_image_array_from_filename(const char *filename);
 void cru_image_array_reference(cru_image_array_t *ia);
 void cru_image_array_release(cru_image_array_t *ia);
 cru_image_t *cru_image_array_get_image(cru_image_array_t *ia, int index);
+int cru_image_array_get_num_images(cru_image_array_t *ia);
 #ifdef __cplusplus
 }
 #endif
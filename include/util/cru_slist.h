@@ -63,18 +63,23 @@ cru_slist_prepend(cru_slist_t **list, void *data)
     *list = elem;
 }
 
+/// Like cru_slist_prepend_atomic(), but the caller owns the node's memory.
 static inline void
-cru_slist_prepend_atomic(cru_slist_t **list, void *data)
+cru_slist_prepend_node_atomic(cru_slist_t **list, cru_slist_t *elem,
+                              void *data)
 {
-    cru_slist_t *elem;
-
-    elem = xmalloc(sizeof(*elem));
     elem->data = data;
     elem->next = atomic_load(list);
 
     while (!atomic_compare_exchange_strong(list, &elem->next, elem)) {}
 }
 
+static inline void
+cru_slist_prepend_atomic(cru_slist_t **list, void *data)
+{
+    cru_slist_prepend_node_atomic(list, xmalloc(sizeof(cru_slist_t)), data);
+}
+
 /// Pop off the list's first node and return the node's data.
 ///
 /// Not threadsafe. Return NULL if the list is empty or if the node has no
@@ -0,0 +1,73 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#pragma once
+
+/// \file
+/// \brief Compare a Vulkan image against a reference on the GPU.
+///
+/// Only a small summary of the comparison is read back, plus a diff mask
+/// when the images differ, instead of the whole image.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/cru_image.h"
+#include "util/vk_wrapper.h"
+
+typedef struct gpu_image_compare_result gpu_image_compare_result_t;
+
+struct gpu_image_compare_result {
+    /// Number of pixels with a channel that differs by more than the
+    /// tolerance.
+    uint32_t mismatch_count;
+
+    /// Largest per-channel difference over all pixels.
+    uint32_t max_error;
+
+    /// Bounding box of the mismatching pixels. Only meaningful if
+    /// mismatch_count is nonzero.
+    uint32_t min_x, min_y;
+    uint32_t max_x, max_y;
+
+    /// If mismatch_count is nonzero, an R8_UNORM image of the same size as
+    /// the compared images that is 0xff at each mismatching pixel and 0
+    /// elsewhere. The caller must free() it.
+    uint8_t *mask;
+};
+
+/// Return true if gpu_image_compare() can compare images of this format.
+bool gpu_image_compare_supports_format(VkFormat format);
+
+/// \brief Compare miplevel 0, array slice 0 of \a image against \a ref.
+///
+/// The image must be in VK_IMAGE_LAYOUT_GENERAL. Each channel is compared as
+/// an 8-bit value, and a pixel mismatches if any channel differs by more
+/// than \a tolerance. The work is submitted to the test's current queue.
+///
+/// Return false, without touching \a result, if the format is unsupported
+/// or \a ref can't be converted to it. The caller should then compare on
+/// the CPU.
+bool gpu_image_compare(VkImage image, VkFormat format,
+                       VkImageAspectFlagBits aspect,
+                       uint32_t width, uint32_t height,
+                       cru_image_t *ref, uint32_t tolerance,
+                       gpu_image_compare_result_t *result);
@@ -51,6 +51,7 @@ typedef int cru_err_t;
 noreturn void cru_oom(void);
 
 cru_err_t cru_getenv_bool(const char *name, bool default_, bool *result);
+bool cru_parse_u64(const char *str, uint64_t *result);
 
 static inline bool
 cru_streq(const char *a, const char *b)
@@ -1,4 +1,4 @@
-__crucible_commands="bootstrap dump-image test help ls-tests run version"
+__crucible_commands="bootstrap dump-image test help img-diff ls-tests run version"
 
 __crucible_bootstrap()
 {
@@ -15,6 +15,11 @@ __crucible_help()
     COMPREPLY=($(compgen -W "$__crucible_commands" -- ${COMP_WORDS[COMP_CWORD]}))
 }
 
+__crucible_img_diff()
+{
+   COMPREPLY=($(compgen -o filenames -A file -W "--help --jobs --output --json" -- ${COMP_WORDS[COMP_CWORD]}))
+}
+
 __crucible_ls_tests()
 {
     COMPREPLY=($(compgen -W "--help" -- ${COMP_WORDS[COMP_CWORD]}))
@@ -68,6 +73,7 @@ __crucible()
 	bootstrap) __crucible_bootstrap $1 ;;
 	dump-image) __crucible_dump_image $1 ;;
 	help) __crucible_help ;;
+	img-diff) __crucible_img_diff $1 ;;
 	ls-tests) __crucible_ls_tests $1 ;;
 	run) __crucible_run $1 ;;
 	*) COMPREPLY=() ;;
@@ -1,6 +1,8 @@
 #! /usr/bin/env python3
 
 import argparse
+import concurrent.futures
+import hashlib
 import io
 import os
 import re
@@ -102,6 +104,37 @@ class Shader:
             out_file.close()
             return (spirv, out)
 
+    def cache_key(self):
+        """Hash everything that affects the output of glslang."""
+        h = hashlib.sha256()
+        h.update(glslang_id.encode('utf-8') + b'\0')
+        h.update(self.stage.encode('utf-8') + b'\0')
+        h.update(self.target_env.encode('utf-8') + b'\0')
+        h.update(self.glsl.encode('utf-8'))
+        return h.hexdigest()
+
+    def __read_cache(self, key):
+        base = os.path.join(cache_dir, key[:2], key)
+        try:
+            with open(base + '.spv', 'rb') as f:
+                spirv = f.read()
+            with open(base + '.txt', 'rb') as f:
+                assembly = f.read()
+        except FileNotFoundError:
+            return None
+        return (spirv, assembly)
+
+    def __write_cache(self, key, spirv, assembly):
+        # Several scrapers may share the cache. Rename each file into place
+        # so that none of them reads a partial file. The disassembly is
+        # renamed last, because the lookup opens it last.
+        subdir = os.path.join(cache_dir, key[:2])
+        os.makedirs(subdir, exist_ok=True)
+        for ext, data in (('.spv', spirv), ('.txt', assembly)):
+            with tempfile.NamedTemporaryFile(dir=subdir, delete=False) as f:
+                f.write(data)
+            os.replace(f.name, os.path.join(subdir, key + ext))
+
     def compile(self):
         def dwords(f):
             while True:
@@ -111,7 +144,15 @@ class Shader:
                 assert len(dword_str) == 4
                 yield struct.unpack('I', dword_str)[0]
 
-        (spirv, assembly) = self.__run_glslang()
+        key = self.cache_key()
+        cached = self.__read_cache(key) if cache_dir else None
+        if cached:
+            (spirv, assembly) = cached
+        else:
+            (spirv, assembly) = self.__run_glslang()
+            if cache_dir:
+                self.__write_cache(key, spirv, assembly)
+
         self.dwords = list(dwords(io.BytesIO(spirv)))
         self.assembly = str(assembly, 'utf-8')
 
@@ -145,18 +186,59 @@ class Shader:
             line_start += 6
         f.write('\n};\n')
 
-    def dump_c_code(self, f):
+    def _dump_spirv_incbin(self, f, emitted):
+        # Emit each module in a COMDAT group named after its hash. The linker
+        # keeps one copy of each group, so a module shared by many files is
+        # stored once in the binary, and the assembler copies it from the
+        # cache instead of the compiler parsing it as an initializer.
+        # The section and symbol types use '%', because the ARM assembler
+        # parses '@' as the start of a comment.
+        key = self.cache_key()
+        sym = '__qonos_spirv_' + key[:32]
+        if key in emitted:
+            return sym
+        emitted.add(key)
+
+        base = os.path.abspath(os.path.join(cache_dir, key[:2], key))
+        if '"' in base or '\\' in base:
+            raise RuntimeError('cannot .incbin path {!r}'.format(base))
+
+        f.write('\n// SPIR-V assembly: {0}.txt\n'.format(base))
+        f.write(dedent("""\
+            __asm__(
+                ".pushsection .rodata.{0},\\"aG\\",%progbits,{0},comdat\\n"
+                ".globl {0}\\n"
+                ".hidden {0}\\n"
+                ".type {0}, %object\\n"
+                ".balign 4\\n"
+                "{0}:\\n"
+                ".incbin \\"{1}.spv\\"\\n"
+                ".size {0}, . - {0}\\n"
+                ".popsection\\n");
+            extern const uint32_t {0}[] __attribute__((visibility("hidden")));
+            """.format(sym, base)))
+
+        return sym
+
+    def dump_c_code(self, f, emitted=None):
         f.write('\n\n')
         var_prefix = '__qonos_shader{0}'.format(self.end_line)
 
-        self._dump_glsl_code(f)
-        self._dump_spirv_code(f, var_prefix + '_spir_v_src')
+        if emitted is None:
+            self._dump_glsl_code(f)
+            self._dump_spirv_code(f, var_prefix + '_spir_v_src')
+            spirv_var = var_prefix + '_spir_v_src'
+            spirv_size = 'sizeof({0})'.format(spirv_var)
+        else:
+            f.write('// GLSL code: line {0}\n'.format(self.start_line))
+            spirv_var = self._dump_spirv_incbin(f, emitted)
+            spirv_size = str(4 * len(self.dwords))
 
         f.write(dedent("""\
             static const QoShaderModuleCreateInfo {0}_info = {{
-                .spirvSize = sizeof({0}_spir_v_src),
-                .pSpirv = {0}_spir_v_src,
-            """.format(var_prefix)))
+                .spirvSize = {1},
+                .pSpirv = {2},
+            """.format(var_prefix, spirv_size, spirv_var)))
 
         if self.stage in ['RAYGEN', 'ANY_HIT', 'CLOSEST_HIT',
                           'MISS', 'INTERSECTION', 'CALLABLE']:
@@ -281,22 +363,81 @@ def parse_args():
                         default='glslangValidator',
                         dest='glslang',
                         help='Full path to the glslangValidator shader compiler.')
+    p.add_argument('--cache-dir', metavar='DIR',
+                        help=('Reuse the SPIR-V of previously compiled '
+                              'shaders stored in DIR, and store newly '
+                              'compiled shaders there.'))
+    p.add_argument('--embed', choices=('arrays', 'incbin'), default='arrays',
+                        help=('How to embed the SPIR-V. "arrays" writes each '
+                              'module as a C array commented with its GLSL '
+                              'and disassembly. "incbin" assembles the '
+                              'modules from the cache, one copy per binary, '
+                              'and leaves the disassembly in the cache '
+                              '(requires --cache-dir and an ELF target).'))
+    p.add_argument('--depfile', metavar='FILE',
+                        help=('Write a Makefile-style depfile to FILE that '
+                              'lists the cached modules which the output '
+                              '.incbins, so that the build regenerates the '
+                              'output if one of them is deleted.'))
+    p.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help=('Number of glslang processes to run at once '
+                              '(default: number of CPUs).'))
     p.add_argument('infile', metavar='INFILE')
 
     return p.parse_args()
 
+def get_glslang_id(glslang):
+    """Identify the glslang build, so that upgrading it invalidates the
+    cache."""
+    path = shutil.which(glslang) or glslang
+    st = os.stat(path)
+    return '{}:{}:{}'.format(os.path.realpath(path), st.st_size,
+                             st.st_mtime_ns)
+
+def write_depfile(name, target, deps):
+    def escape(path):
+        return path.replace('\\', '\\\\').replace(' ', '\\ ')
+
+    with open(name, 'w') as f:
+        f.write(escape(target) + ':')
+        for dep in deps:
+            f.write(' \\\n  ' + escape(dep))
+        f.write('\n')
+
+def compile_shaders(shaders, jobs):
+    # Identical shaders within the file compile only once.
+    shaders_by_key = {}
+    for shader in shaders:
+        shaders_by_key.setdefault(shader.cache_key(), []).append(shader)
+
+    def compile_group(group):
+        group[0].compile()
+        for shader in group[1:]:
+            shader.dwords = group[0].dwords
+            shader.assembly = group[0].assembly
+
+    # glslang does the work in child processes, so threads are enough to
+    # keep several of them running.
+    with concurrent.futures.ThreadPoolExecutor(max(1, jobs)) as pool:
+        for f in [pool.submit(compile_group, group)
+                  for group in shaders_by_key.values()]:
+            f.result()
+
 
 args = parse_args()
 infname = args.infile
 outfname = args.outfile
 glslang = args.glslang
+cache_dir = args.cache_dir
+if args.embed == 'incbin' and not cache_dir:
+    sys.exit('glsl_scraper.py: error: --embed=incbin requires --cache-dir')
+glslang_id = get_glslang_id(glslang)
 
 with open_file(infname, 'r') as infile:
     parser = Parser(infile)
     parser.run()
 
-for shader in parser.shaders:
-    shader.compile()
+compile_shaders(parser.shaders, args.jobs)
 
 with open_file(outfname, 'w') as outfile:
     outfile.write(dedent("""\
@@ -316,5 +457,13 @@ with open_file(outfname, 'w') as outfile:
             __qoCreateShaderModule((dev), &__QO_SHADER_INFO_VAR(__LINE__))
         """))
 
+    emitted = set() if args.embed == 'incbin' else None
     for shader in parser.shaders:
-        shader.dump_c_code(outfile)
+        shader.dump_c_code(outfile, emitted)
+
+if args.depfile:
+    deps = []
+    for key in sorted(emitted or ()):
+        deps.append(os.path.abspath(
+            os.path.join(cache_dir, key[:2], key + '.spv')))
+    write_depfile(args.depfile, outfname, deps)
@@ -19,11 +19,13 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "util/cru_dump_archive.h"
 #include "util/cru_format.h"
 #include "util/cru_image.h"
 #include "util/string.h"
@@ -31,6 +33,10 @@
 #include "cmd.h"
 
 static string_t arg_filename = STRING_INIT;
+static char *opt_archive = NULL;
+static int opt_list = 0;
+static int opt_extract = 0;
+static char *opt_extract_dir = NULL;
 
 // From man:getopt(3) :
 //
@@ -44,10 +50,21 @@ static string_t arg_filename = STRING_INIT;
 //    above) of optstring is a colon (':'),  then getopt() returns ':' instead
 //    of '?' to indicate a missing option argument.
 //
-static const char *shortopts = "+:h";
+static const char *shortopts = "+:ha:";
+
+enum opt_name {
+    OPT_NAME_HELP = 'h',
+    OPT_NAME_ARCHIVE = 'a',
+
+    // Begin long-only options.
+    OPT_NAME_EXTRACT = 128,
+};
 
 static const struct option longopts[] = {
-    {"help",          no_argument,       NULL,           'h'},
+    {"help",          no_argument,       NULL,           OPT_NAME_HELP},
+    {"archive",       required_argument, NULL,           OPT_NAME_ARCHIVE},
+    {"list",          no_argument,       &opt_list,      true},
+    {"extract",       optional_argument, NULL,           OPT_NAME_EXTRACT},
     {0},
 };
 
@@ -70,10 +87,17 @@ parse_args(const cru_command_t *cmd, int argc, char **argv)
             goto done_getopt;
 	case 0:
 	    break;
-        case 'h':
+        case OPT_NAME_HELP:
             cru_command_page_help(cmd);
             exit(0);
             break;
+        case OPT_NAME_ARCHIVE:
+            opt_archive = optarg;
+            break;
+        case OPT_NAME_EXTRACT:
+            opt_extract = true;
+            opt_extract_dir = optarg;
+            break;
         case ':':
             cru_usage_error(cmd, "%s requires an argument", argv[optind-1]);
             break;
@@ -85,8 +109,22 @@ parse_args(const cru_command_t *cmd, int argc, char **argv)
     }
 
 done_getopt:
-    if (optind == argc)
-        cru_usage_error(cmd, "missing <filename>");
+    if (!opt_archive && (opt_list || opt_extract))
+        cru_usage_error(cmd, "--list and --extract require --archive");
+
+    if (opt_list && opt_extract)
+        cru_usage_error(cmd, "--list and --extract are mutually exclusive");
+
+    if (opt_list || opt_extract) {
+        if (optind < argc)
+            cru_usage_error(cmd, "trailing arguments after options");
+        return;
+    }
+
+    if (optind == argc) {
+        cru_usage_error(cmd, opt_archive ? "missing <name>"
+                                         : "missing <filename>");
+    }
 
     string_copy_cstr(&arg_filename, argv[optind]);
     ++optind;
@@ -107,34 +145,14 @@ die(const char *format, ...)
     exit(EXIT_FAILURE);
 }
 
-static int
-cmd_start(const cru_command_t *cmd, int argc, char **argv)
+static void
+print_pixels(const uint8_t *map, VkFormat format, uint32_t width,
+             uint32_t height)
 {
-    parse_args(cmd, argc, argv);
-
-    // cru_image_from_filename() interprets relative filenames as relative to
-    // Crucible's data directory. That is useful for tests, but not what anyone
-    // expects from a cmdline tool.  So convert the filename given on the
-    // cmdline into an absolute path.
-    string_t abs_filename = STRING_INIT;
-    path_to_abs(&abs_filename, &arg_filename);
-
-    cru_image_t *img = cru_image_from_filename(string_data(&abs_filename));
-    if (!img)
-        exit(EXIT_FAILURE);
-
-    VkFormat format = cru_image_get_format(img);
-
     const cru_format_info_t *finfo = cru_format_get_info(format);
     if (!finfo)
         die("file has unknown VkFormat %d", format);
 
-    const uint8_t *map = cru_image_map(img, CRU_IMAGE_MAP_ACCESS_READ);
-    if (!map)
-        die("failed to read file");
-
-    uint32_t width = cru_image_get_width(img);
-    uint32_t height = cru_image_get_height(img);
     uint32_t cpp = finfo->cpp;
     uint32_t stride = width * cpp;
 
@@ -162,6 +180,143 @@ cmd_start(const cru_command_t *cmd, int argc, char **argv)
     }
 
     fflush(stdout);
+}
+
+static void
+list_archive(cru_dump_archive_t *ar)
+{
+    const uint32_t n = cru_dump_archive_get_num_entries(ar);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const cru_dump_archive_entry_t *e = cru_dump_archive_get_entry(ar, i);
+        const cru_format_info_t *finfo = cru_format_get_info(e->format);
+
+        printf("%s.%s %s %ux%u %" PRIu64 "\n", e->test_name, e->label,
+               finfo ? finfo->name : "VK_FORMAT_UNDEFINED",
+               e->width, e->height, e->data_size);
+    }
+
+    fflush(stdout);
+}
+
+/// Write each image to a file named "<test>.<label>" in the directory.
+static bool
+extract_archive(cru_dump_archive_t *ar, const char *dir)
+{
+    const uint32_t n = cru_dump_archive_get_num_entries(ar);
+    bool ok = true;
+
+    // cru_image_write_file() interprets relative filenames as relative to
+    // Crucible's data directory.
+    string_t abs_dir = STRING_INIT;
+    string_t tmp = STRING_INIT;
+    string_copy_cstr(&tmp, dir ? dir : ".");
+    path_to_abs(&abs_dir, &tmp);
+    string_finish(&tmp);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const cru_dump_archive_entry_t *e = cru_dump_archive_get_entry(ar, i);
+
+        void *pixels = cru_dump_archive_read_pixels(ar, i);
+        if (!pixels) {
+            ok = false;
+            continue;
+        }
+
+        string_t path = STRING_INIT;
+        string_copy(&path, &abs_dir);
+        path_appendf(&path, "%s.%s", e->test_name, e->label);
+
+        cru_image_t *img = cru_image_from_pixels(pixels, e->format,
+                                                 e->width, e->height);
+        if (!img || !cru_image_write_file(img, string_data(&path)))
+            ok = false;
+
+        if (img)
+            cru_image_release(img);
+        string_finish(&path);
+        free(pixels);
+    }
+
+    string_finish(&abs_dir);
+
+    return ok;
+}
+
+/// Print the archived image named "<test>.<label>".
+static void
+dump_archived_image(cru_dump_archive_t *ar, const char *name)
+{
+    const uint32_t n = cru_dump_archive_get_num_entries(ar);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const cru_dump_archive_entry_t *e = cru_dump_archive_get_entry(ar, i);
+        const size_t test_len = strlen(e->test_name);
+
+        if (strncmp(name, e->test_name, test_len) != 0 ||
+            name[test_len] != '.' ||
+            strcmp(name + test_len + 1, e->label) != 0)
+            continue;
+
+        uint8_t *pixels = cru_dump_archive_read_pixels(ar, i);
+        if (!pixels)
+            die("failed to read image %s", name);
+
+        print_pixels(pixels, e->format, e->width, e->height);
+        free(pixels);
+        return;
+    }
+
+    die("archive has no image %s", name);
+}
+
+static int
+cmd_start_archive(void)
+{
+    cru_dump_archive_t *ar = cru_dump_archive_open(opt_archive);
+    if (!ar)
+        exit(EXIT_FAILURE);
+
+    bool ok = true;
+
+    if (opt_list) {
+        list_archive(ar);
+    } else if (opt_extract) {
+        ok = extract_archive(ar, opt_extract_dir);
+    } else {
+        dump_archived_image(ar, string_data(&arg_filename));
+    }
+
+    cru_dump_archive_close(ar);
+
+    return ok ? 0 : EXIT_FAILURE;
+}
+
+static int
+cmd_start(const cru_command_t *cmd, int argc, char **argv)
+{
+    parse_args(cmd, argc, argv);
+
+    if (opt_archive)
+        return cmd_start_archive();
+
+    // cru_image_from_filename() interprets relative filenames as relative to
+    // Crucible's data directory. That is useful for tests, but not what anyone
+    // expects from a cmdline tool.  So convert the filename given on the
+    // cmdline into an absolute path.
+    string_t abs_filename = STRING_INIT;
+    path_to_abs(&abs_filename, &arg_filename);
+
+    cru_image_t *img = cru_image_from_filename(string_data(&abs_filename));
+    if (!img)
+        exit(EXIT_FAILURE);
+
+    const uint8_t *map = cru_image_map(img, CRU_IMAGE_MAP_ACCESS_READ);
+    if (!map)
+        die("failed to read file");
+
+    print_pixels(map, cru_image_get_format(img), cru_image_get_width(img),
+                 cru_image_get_height(img));
 
     return 0;
 }
@@ -0,0 +1,739 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/cru_dump_archive.h"
+#include "util/cru_image.h"
+#include "util/cru_vec.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include "util/xalloc.h"
+
+#include "cmd.h"
+
+static int opt_jobs = 0;
+static int opt_json = 0;
+static const char *opt_output_dir = NULL;
+static const char *arg_a = NULL;
+static const char *arg_b = NULL;
+
+// See dump-image.c for the meaning of the leading "+:".
+static const char *shortopts = "+:hj:o:";
+
+enum opt_name {
+    OPT_NAME_HELP = 'h',
+    OPT_NAME_JOBS = 'j',
+    OPT_NAME_OUTPUT = 'o',
+};
+
+static const struct option longopts[] = {
+    {"help",          no_argument,       NULL,           OPT_NAME_HELP},
+    {"jobs",          required_argument, NULL,           OPT_NAME_JOBS},
+    {"output",        required_argument, NULL,           OPT_NAME_OUTPUT},
+    {"json",          no_argument,       &opt_json,      true},
+    {0},
+};
+
+/// An image in one of the two sources, named like its dump file without the
+/// ".png" or ".qoi" extension.
+struct source_image {
+    char *name;
+
+    /// Absolute path of a loose image file, or NULL if the image is
+    /// archived.
+    char *path;
+
+    cru_dump_archive_t *archive;
+    uint32_t index;
+};
+
+typedef struct source_image_vec source_image_vec_t;
+CRU_VEC_DEFINE(struct source_image_vec, struct source_image)
+
+typedef struct archive_vec archive_vec_t;
+CRU_VEC_DEFINE(struct archive_vec, cru_dump_archive_t *)
+
+enum pair_status {
+    PAIR_STATUS_IDENTICAL,
+    PAIR_STATUS_DIFFERENT,
+    PAIR_STATUS_EXTENT_MISMATCH,
+    PAIR_STATUS_ONLY_A,
+    PAIR_STATUS_ONLY_B,
+    PAIR_STATUS_ERROR,
+};
+
+static const char *const pair_status_names[] = {
+    [PAIR_STATUS_IDENTICAL] = "identical",
+    [PAIR_STATUS_DIFFERENT] = "different",
+    [PAIR_STATUS_EXTENT_MISMATCH] = "extent-mismatch",
+    [PAIR_STATUS_ONLY_A] = "only-a",
+    [PAIR_STATUS_ONLY_B] = "only-b",
+    [PAIR_STATUS_ERROR] = "error",
+};
+
+struct pair {
+    const struct source_image *a;
+    const struct source_image *b;
+
+    enum pair_status status;
+    cru_image_diff_t diff;
+    uint32_t a_width, a_height;
+    uint32_t b_width, b_height;
+
+    /// Path of the written diff image, if any.
+    char *diff_path;
+};
+
+typedef struct pair_vec pair_vec_t;
+CRU_VEC_DEFINE(struct pair_vec, struct pair)
+
+static archive_vec_t archives = CRU_VEC_INIT;
+static pair_vec_t pairs = CRU_VEC_INIT;
+static atomic_uint next_pair;
+
+static bool
+parse_i32(const char *str, int32_t *i32)
+{
+    char *endptr;
+    long l;
+
+    if (str[0] == 0)
+        return false;
+
+    l = strtol(str, &endptr, 10);
+    if (endptr[0] != 0) {
+        // Entire string was not parsed.
+        return false;
+    } else if (l < INT32_MIN || l > INT32_MAX) {
+        return false;
+    }
+
+    *i32 = l;
+    return true;
+}
+
+static void
+parse_args(const cru_command_t *cmd, int argc, char **argv)
+{
+    // Suppress getopt from printing error messages.
+    opterr = 0;
+
+    // Reset getopt.
+    optind = 1;
+
+    while (true) {
+        int optchar;
+
+        optchar = getopt_long(argc, argv, shortopts, longopts, NULL);
+
+        switch (optchar) {
+        case -1:
+            goto done_getopt;
+        case 0:
+            break;
+        case OPT_NAME_HELP:
+            cru_command_page_help(cmd);
+            exit(0);
+            break;
+        case OPT_NAME_JOBS:
+            if (!parse_i32(optarg, &opt_jobs) || opt_jobs <= 0)
+                cru_usage_error(cmd, "--jobs must be a positive integer");
+            break;
+        case OPT_NAME_OUTPUT:
+            opt_output_dir = optarg;
+            break;
+        case ':':
+            cru_usage_error(cmd, "%s requires an argument", argv[optind-1]);
+            break;
+        case '?':
+        default:
+            cru_usage_error(cmd, "unknown option: %s", argv[optind-1]);
+            break;
+        }
+    }
+
+done_getopt:
+    if (argc - optind < 2)
+        cru_usage_error(cmd, "requires two directories or archives");
+
+    if (argc - optind > 2)
+        cru_usage_error(cmd, "trailing arguments after <b>");
+
+    arg_a = argv[optind];
+    arg_b = argv[optind + 1];
+}
+
+/// Strip the ".png" or ".qoi" extension. Return NULL if the name has neither.
+static char *
+image_name(const char *filename)
+{
+    string_t name = STRING_INIT;
+    string_copy_cstr(&name, filename);
+
+    if (name.len <= 4 || (!string_endswith_cstr(&name, ".png") &&
+                          !string_endswith_cstr(&name, ".qoi"))) {
+        string_finish(&name);
+        return NULL;
+    }
+
+    string_truncate(&name, name.len - 4);
+    return string_detach(&name);
+}
+
+static bool
+add_archive(source_image_vec_t *images, const char *filename)
+{
+    cru_dump_archive_t *ar = cru_dump_archive_open(filename);
+    if (!ar)
+        return false;
+
+    *cru_vec_push(&archives, 1) = ar;
+
+    const uint32_t n = cru_dump_archive_get_num_entries(ar);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const cru_dump_archive_entry_t *e = cru_dump_archive_get_entry(ar, i);
+
+        string_t label = STRING_INIT;
+        string_printf(&label, "%s.%s", e->test_name, e->label);
+
+        char *name = image_name(string_data(&label));
+        if (!name)
+            name = string_detach(&label);
+
+        string_finish(&label);
+
+        *cru_vec_push(images, 1) = (struct source_image) {
+            .name = name,
+            .archive = ar,
+            .index = i,
+        };
+    }
+
+    return true;
+}
+
+/// Collect the loose images and archived images of a directory, or the
+/// images of a single archive.
+static bool
+collect_images(source_image_vec_t *images, const char *arg)
+{
+    struct stat st;
+    bool ok = true;
+
+    if (stat(arg, &st) == -1) {
+        loge("failed to stat %s: %s", arg, strerror(errno));
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+        return add_archive(images, arg);
+
+    DIR *dir = opendir(arg);
+    if (!dir) {
+        loge("failed to open directory %s: %s", arg, strerror(errno));
+        return false;
+    }
+
+    string_t dir_path = STRING_INIT;
+    string_t tmp = STRING_INIT;
+    string_copy_cstr(&tmp, arg);
+    path_to_abs(&dir_path, &tmp);
+    string_finish(&tmp);
+
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        string_t path = STRING_INIT;
+        string_copy(&path, &dir_path);
+        path_append_cstr(&path, ent->d_name);
+
+        const size_t len = strlen(ent->d_name);
+        char *name = image_name(ent->d_name);
+
+        if (name) {
+            *cru_vec_push(images, 1) = (struct source_image) {
+                .name = name,
+                .path = string_detach(&path),
+            };
+        } else if (len > 4 && strcmp(ent->d_name + len - 4, ".cda") == 0) {
+            ok &= add_archive(images, string_data(&path));
+        }
+
+        string_finish(&path);
+    }
+
+    closedir(dir);
+    string_finish(&dir_path);
+
+    return ok;
+}
+
+static int
+compare_source_images(const void *x, const void *y)
+{
+    const struct source_image *a = x;
+    const struct source_image *b = y;
+
+    return strcmp(a->name, b->name);
+}
+
+/// Sort the images by name and drop all but the first of each name.
+static void
+sort_images(source_image_vec_t *images, const char *arg)
+{
+    if (images->len == 0)
+        return;
+
+    qsort(images->data, images->len, sizeof(images->data[0]),
+          compare_source_images);
+
+    size_t n = 1;
+    for (size_t i = 1; i < images->len; ++i) {
+        if (strcmp(images->data[i].name, images->data[n - 1].name) == 0) {
+            logw("%s: ignoring duplicate image %s", arg,
+                 images->data[i].name);
+            continue;
+        }
+
+        images->data[n++] = images->data[i];
+    }
+
+    images->len = n;
+}
+
+static void
+pair_images(const source_image_vec_t *a, const source_image_vec_t *b)
+{
+    size_t i = 0, j = 0;
+
+    while (i < a->len || j < b->len) {
+        struct pair *p = cru_vec_push(&pairs, 1);
+        *p = (struct pair) {0};
+
+        int c;
+        if (i == a->len)
+            c = 1;
+        else if (j == b->len)
+            c = -1;
+        else
+            c = strcmp(a->data[i].name, b->data[j].name);
+
+        if (c <= 0)
+            p->a = &a->data[i++];
+        if (c >= 0)
+            p->b = &b->data[j++];
+    }
+}
+
+/// Load an image. Archived images hold their pixels in *pixels, which the
+/// caller must free after releasing the image.
+static cru_image_t *
+load_image(const struct source_image *s, void **pixels)
+{
+    *pixels = NULL;
+
+    if (s->path)
+        return cru_image_from_filename(s->path);
+
+    const cru_dump_archive_entry_t *e =
+        cru_dump_archive_get_entry(s->archive, s->index);
+
+    *pixels = cru_dump_archive_read_pixels(s->archive, s->index);
+    if (!*pixels)
+        return NULL;
+
+    return cru_image_from_pixels(*pixels, e->format, e->width, e->height);
+}
+
+static void
+write_diff_image(struct pair *p, cru_image_t *diff_image)
+{
+    string_t path = STRING_INIT;
+    string_t tmp = STRING_INIT;
+
+    string_copy_cstr(&tmp, opt_output_dir);
+    path_to_abs(&path, &tmp);
+    path_appendf(&path, "%s.diff.png", p->a->name);
+    string_finish(&tmp);
+
+    if (cru_image_write_file(diff_image, string_data(&path)))
+        p->diff_path = string_detach(&path);
+
+    string_finish(&path);
+}
+
+static void
+diff_pair(struct pair *p)
+{
+    cru_image_t *a = NULL, *b = NULL, *diff_image = NULL;
+    void *a_pixels = NULL, *b_pixels = NULL, *diff_pixels = NULL;
+
+    if (!p->b) {
+        p->status = PAIR_STATUS_ONLY_A;
+        return;
+    }
+
+    if (!p->a) {
+        p->status = PAIR_STATUS_ONLY_B;
+        return;
+    }
+
+    p->status = PAIR_STATUS_ERROR;
+
+    a = load_image(p->a, &a_pixels);
+    b = load_image(p->b, &b_pixels);
+    if (!a || !b) {
+        loge("failed to load image %s", p->a->name);
+        goto cleanup;
+    }
+
+    p->a_width = cru_image_get_width(a);
+    p->a_height = cru_image_get_height(a);
+    p->b_width = cru_image_get_width(b);
+    p->b_height = cru_image_get_height(b);
+
+    if (p->a_width != p->b_width || p->a_height != p->b_height) {
+        p->status = PAIR_STATUS_EXTENT_MISMATCH;
+        goto cleanup;
+    }
+
+    if (opt_output_dir) {
+        diff_pixels = xmalloc(4 * (size_t) p->a_width * p->a_height);
+        diff_image = cru_image_from_pixels(diff_pixels,
+                                           VK_FORMAT_R8G8B8A8_UNORM,
+                                           p->a_width, p->a_height);
+        if (!diff_image)
+            goto cleanup;
+    }
+
+    if (!cru_image_diff(a, b, diff_image, &p->diff)) {
+        loge("failed to compare image %s", p->a->name);
+        goto cleanup;
+    }
+
+    if (p->diff.num_diff_pixels == 0) {
+        p->status = PAIR_STATUS_IDENTICAL;
+    } else {
+        p->status = PAIR_STATUS_DIFFERENT;
+
+        if (diff_image)
+            write_diff_image(p, diff_image);
+    }
+
+cleanup:
+    if (a)
+        cru_image_release(a);
+    if (b)
+        cru_image_release(b);
+    if (diff_image)
+        cru_image_release(diff_image);
+    free(a_pixels);
+    free(b_pixels);
+    free(diff_pixels);
+}
+
+static void *
+worker_main(void *arg)
+{
+    for (;;) {
+        const unsigned i = atomic_fetch_add(&next_pair, 1);
+        if (i >= pairs.len)
+            break;
+
+        diff_pair(&pairs.data[i]);
+    }
+
+    return NULL;
+}
+
+static void
+diff_pairs(void)
+{
+    uint32_t num_jobs = opt_jobs;
+
+    if (num_jobs == 0) {
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        num_jobs = n > 0 ? n : 1;
+    }
+
+    num_jobs = MIN(num_jobs, MAX(pairs.len, 1));
+
+    pthread_t *threads = xmalloc(num_jobs * sizeof(*threads));
+    uint32_t num_threads = 0;
+
+    atomic_init(&next_pair, 0);
+
+    // The calling thread works too, so start one fewer thread than jobs.
+    for (uint32_t i = 1; i < num_jobs; ++i) {
+        if (pthread_create(&threads[num_threads], NULL, worker_main, NULL))
+            break;
+        num_threads++;
+    }
+
+    worker_main(NULL);
+
+    for (uint32_t i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
+
+/// Rank problems first, then differences by decreasing error, then identical
+/// images. Ties are broken by name.
+static int
+compare_pairs(const void *x, const void *y)
+{
+    const struct pair *a = x;
+    const struct pair *b = y;
+
+    const int a_rank = a->status == PAIR_STATUS_IDENTICAL ? 2 :
+                       a->status == PAIR_STATUS_DIFFERENT ? 1 : 0;
+    const int b_rank = b->status == PAIR_STATUS_IDENTICAL ? 2 :
+                       b->status == PAIR_STATUS_DIFFERENT ? 1 : 0;
+
+    if (a_rank != b_rank)
+        return a_rank - b_rank;
+
+    if (a->status == PAIR_STATUS_DIFFERENT) {
+        if (a->diff.max_error != b->diff.max_error)
+            return a->diff.max_error > b->diff.max_error ? -1 : 1;
+
+        if (a->diff.rms_error != b->diff.rms_error)
+            return a->diff.rms_error > b->diff.rms_error ? -1 : 1;
+    }
+
+    const char *a_name = a->a ? a->a->name : a->b->name;
+    const char *b_name = b->a ? b->a->name : b->b->name;
+
+    return strcmp(a_name, b_name);
+}
+
+static void
+print_json_string(const char *s)
+{
+    putchar('"');
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+
+    putchar('"');
+}
+
+/// JSON has no infinity, so print it as null.
+static void
+print_json_number(double d)
+{
+    if (isfinite(d))
+        printf("%.9g", d);
+    else
+        printf("null");
+}
+
+static void
+print_json(uint32_t counts[])
+{
+    printf("{\n");
+    printf("  \"a\": ");
+    print_json_string(arg_a);
+    printf(",\n  \"b\": ");
+    print_json_string(arg_b);
+    printf(",\n  \"counts\": {");
+
+    for (uint32_t s = 0; s < ARRAY_LENGTH(pair_status_names); ++s) {
+        printf("%s\"%s\": %u", s ? ", " : "", pair_status_names[s],
+               counts[s]);
+    }
+
+    printf("},\n  \"images\": [");
+
+    for (size_t i = 0; i < pairs.len; ++i) {
+        const struct pair *p = &pairs.data[i];
+
+        printf("%s\n    {\"name\": ", i ? "," : "");
+        print_json_string(p->a ? p->a->name : p->b->name);
+        printf(", \"status\": \"%s\"", pair_status_names[p->status]);
+
+        if (p->status == PAIR_STATUS_IDENTICAL ||
+            p->status == PAIR_STATUS_DIFFERENT) {
+            printf(", \"pixels\": %" PRIu64 ", \"diff_pixels\": %" PRIu64,
+                   p->diff.num_pixels, p->diff.num_diff_pixels);
+            printf(", \"max_error\": ");
+            print_json_number(p->diff.max_error);
+            printf(", \"rms_error\": ");
+            print_json_number(p->diff.rms_error);
+        } else if (p->status == PAIR_STATUS_EXTENT_MISMATCH) {
+            printf(", \"a_extent\": [%u, %u], \"b_extent\": [%u, %u]",
+                   p->a_width, p->a_height, p->b_width, p->b_height);
+        }
+
+        if (p->diff_path) {
+            printf(", \"diff_image\": ");
+            print_json_string(p->diff_path);
+        }
+
+        printf("}");
+    }
+
+    printf("\n  ]\n}\n");
+}
+
+static void
+print_text(uint32_t counts[])
+{
+    for (size_t i = 0; i < pairs.len; ++i) {
+        const struct pair *p = &pairs.data[i];
+        const char *name = p->a ? p->a->name : p->b->name;
+
+        switch (p->status) {
+        case PAIR_STATUS_IDENTICAL:
+            break;
+        case PAIR_STATUS_DIFFERENT:
+            printf("%s: max %.6g rms %.6g pixels %" PRIu64 "/%" PRIu64 "\n",
+                   name, p->diff.max_error, p->diff.rms_error,
+                   p->diff.num_diff_pixels, p->diff.num_pixels);
+            break;
+        case PAIR_STATUS_EXTENT_MISMATCH:
+            printf("%s: extent %ux%u vs %ux%u\n", name, p->a_width,
+                   p->a_height, p->b_width, p->b_height);
+            break;
+        case PAIR_STATUS_ONLY_A:
+            printf("%s: only in %s\n", name, arg_a);
+            break;
+        case PAIR_STATUS_ONLY_B:
+            printf("%s: only in %s\n", name, arg_b);
+            break;
+        case PAIR_STATUS_ERROR:
+            printf("%s: error\n", name);
+            break;
+        }
+    }
+
+    printf("%zu images: %u identical, %u different, %u extent mismatches, "
+           "%u only in a, %u only in b, %u errors\n", pairs.len,
+           counts[PAIR_STATUS_IDENTICAL], counts[PAIR_STATUS_DIFFERENT],
+           counts[PAIR_STATUS_EXTENT_MISMATCH], counts[PAIR_STATUS_ONLY_A],
+           counts[PAIR_STATUS_ONLY_B], counts[PAIR_STATUS_ERROR]);
+}
+
+static void
+free_images(source_image_vec_t *images)
+{
+    struct source_image *s;
+
+    cru_vec_foreach(s, images) {
+        free(s->name);
+        free(s->path);
+    }
+
+    cru_vec_finish(images);
+}
+
+static int
+cmd_start(const cru_command_t *cmd, int argc, char **argv)
+{
+    source_image_vec_t a_images = CRU_VEC_INIT;
+    source_image_vec_t b_images = CRU_VEC_INIT;
+    uint32_t counts[ARRAY_LENGTH(pair_status_names)] = {0};
+    struct pair *p;
+    int status;
+
+    parse_args(cmd, argc, argv);
+
+    if (!collect_images(&a_images, arg_a) ||
+        !collect_images(&b_images, arg_b)) {
+        status = 2;
+        goto cleanup;
+    }
+
+    if (opt_output_dir && mkdir(opt_output_dir, 0777) == -1 &&
+        errno != EEXIST) {
+        loge("failed to create directory %s: %s", opt_output_dir,
+             strerror(errno));
+        status = 2;
+        goto cleanup;
+    }
+
+    sort_images(&a_images, arg_a);
+    sort_images(&b_images, arg_b);
+    pair_images(&a_images, &b_images);
+    diff_pairs();
+
+    if (pairs.len > 0) {
+        qsort(pairs.data, pairs.len, sizeof(pairs.data[0]), compare_pairs);
+    }
+
+    cru_vec_foreach(p, &pairs) {
+        counts[p->status]++;
+    }
+
+    if (opt_json)
+        print_json(counts);
+    else
+        print_text(counts);
+
+    fflush(stdout);
+
+    // Follow diff(1): 0 if the inputs are the same, 1 if they differ, and 2
+    // on trouble.
+    if (counts[PAIR_STATUS_ERROR] > 0)
+        status = 2;
+    else if (counts[PAIR_STATUS_IDENTICAL] < pairs.len)
+        status = 1;
+    else
+        status = 0;
+
+cleanup:
+    cru_vec_foreach(p, &pairs) {
+        free(p->diff_path);
+    }
+
+    cru_vec_finish(&pairs);
+    free_images(&a_images);
+    free_images(&b_images);
+
+    cru_dump_archive_t **ar;
+    cru_vec_foreach(ar, &archives) {
+        cru_dump_archive_close(*ar);
+    }
+
+    cru_vec_finish(&archives);
+
+    return status;
+}
+
+cru_define_command {
+    .name = "img-diff",
+    .start = cmd_start,
+};
@@ -41,6 +41,13 @@ static char *opt_junit_xml = NULL;
 static int opt_device_id = 1;
 static int opt_verbose = 0;
 static int opt_all_queues = 0;
+static int opt_gpu_compare = 0;
+static int opt_host_alloc_stats = 0;
+static int opt_host_alloc_poison = 1;
+static test_dump_format_t opt_dump_format = TEST_DUMP_FORMAT_PNG;
+static int opt_dump_zlib_level = -1;
+static char *opt_dump_archive = NULL;
+static char *opt_pipeline_cache_dir = NULL;
 
 // From man:getopt(3) :
 //
@@ -54,17 +61,22 @@ static int opt_all_queues = 0;
 //    above) of optstring is a colon (':'),  then getopt() returns ':' instead
 //    of '?' to indicate a missing option argument.
 //
-static const char *shortopts = "+:hj:I:d:";
+static const char *shortopts = "+:hj:I:d:D:";
 
 enum opt_name {
     OPT_NAME_HELP = 'h',
     OPT_NAME_JOBS = 'j',
     OPT_NAME_ISLOATION = 'I',
     OPT_NAME_DEVICE_ID = 'd',
+    OPT_NAME_DEFINE = 'D',
 
     // Begin long-only options. They begin with the first char value outside
     // the ASCII range.
     OPT_NAME_JUNIT_XML = 128,
+    OPT_NAME_DUMP_FORMAT,
+    OPT_NAME_DUMP_ZLIB_LEVEL,
+    OPT_NAME_DUMP_ARCHIVE,
+    OPT_NAME_PIPELINE_CACHE_DIR,
 };
 
 static const struct option longopts[] = {
@@ -77,13 +89,24 @@ static const struct option longopts[] = {
     {"no-cleanup",    no_argument,       &opt_no_cleanup, true},
     {"dump",          no_argument,       &opt_dump,       true},
     {"no-dump",       no_argument,       &opt_dump,       false},
+    {"dump-format",   required_argument, NULL,            OPT_NAME_DUMP_FORMAT},
+    {"dump-zlib-level", required_argument, NULL,          OPT_NAME_DUMP_ZLIB_LEVEL},
+    {"dump-archive",  required_argument, NULL,            OPT_NAME_DUMP_ARCHIVE},
+    {"pipeline-cache-dir", required_argument, NULL,       OPT_NAME_PIPELINE_CACHE_DIR},
     {"junit-xml",     required_argument, NULL,            OPT_NAME_JUNIT_XML},
     {"device-id",     required_argument, NULL,            OPT_NAME_DEVICE_ID},
+    {"define",        required_argument, NULL,            OPT_NAME_DEFINE},
     {"all-queues",    no_argument,       &opt_all_queues, true},
 
     {"separate-cleanup-threads",    no_argument, &opt_separate_cleanup_thread, true},
     {"no-separate-cleanup-threads", no_argument, &opt_separate_cleanup_thread, false},
 
+    {"gpu-compare",    no_argument, &opt_gpu_compare, true},
+    {"no-gpu-compare", no_argument, &opt_gpu_compare, false},
+    {"host-alloc-stats", no_argument, &opt_host_alloc_stats, true},
+    {"host-alloc-poison", no_argument, &opt_host_alloc_poison, true},
+    {"no-host-alloc-poison", no_argument, &opt_host_alloc_poison, false},
+
     {"verbose",    no_argument, &opt_verbose, true},
     {"no-verbose", no_argument, &opt_verbose, false},
 
@@ -91,6 +114,7 @@ static const struct option longopts[] = {
 };
 
 static cru_cstr_vec_t test_patterns = CRU_VEC_INIT;
+static cru_cstr_vec_t opt_params = CRU_VEC_INIT;
 
 static bool
 parse_i32(const char *str, int32_t *i32)
@@ -157,6 +181,40 @@ parse_args(const cru_command_t *cmd, int argc, char **argv)
         case OPT_NAME_JUNIT_XML:
             opt_junit_xml = strdup(optarg);
             break;
+        case OPT_NAME_DUMP_FORMAT:
+            if (cru_streq(optarg, "png")) {
+                opt_dump_format = TEST_DUMP_FORMAT_PNG;
+            } else if (cru_streq(optarg, "qoi")) {
+                opt_dump_format = TEST_DUMP_FORMAT_QOI;
+            } else {
+                cru_usage_error(cmd, "invalid value '%s' for --dump-format",
+                                optarg);
+            }
+            break;
+        case OPT_NAME_DUMP_ZLIB_LEVEL:
+            if (!parse_i32(optarg, &opt_dump_zlib_level) ||
+                opt_dump_zlib_level < 0 || opt_dump_zlib_level > 9) {
+                cru_usage_error(cmd, "--dump-zlib-level must be in [0, 9]");
+            }
+            break;
+        case OPT_NAME_DUMP_ARCHIVE:
+            opt_dump_archive = strdup(optarg);
+            opt_dump = true;
+            break;
+        case OPT_NAME_DEFINE: {
+            const char *eq = strchr(optarg, '=');
+            uint64_t u64;
+            if (!eq || eq == optarg || eq[-1] == '.' ||
+                !cru_parse_u64(eq + 1, &u64)) {
+                cru_usage_error(cmd, "-D expects [<glob>.]<name>=<integer>, "
+                                "got '%s'", optarg);
+            }
+            *cru_vec_push(&opt_params, 1) = optarg;
+            break;
+        }
+        case OPT_NAME_PIPELINE_CACHE_DIR:
+            opt_pipeline_cache_dir = strdup(optarg);
+            break;
         case OPT_NAME_DEVICE_ID:
             opt_device_id = strtol(optarg, NULL, 10);
             if (opt_device_id <= 0) {
@@ -275,15 +333,26 @@ cmd_start(const cru_command_t *cmd, int argc, char **argv)
         .no_cleanup_phase = opt_no_cleanup,
         .use_separate_cleanup_threads = opt_separate_cleanup_thread,
         .no_image_dumps = !opt_dump,
+        .image_dump_format = opt_dump_format,
+        .image_dump_archive_dir = opt_dump_archive,
+        .image_dump_zlib_level = opt_dump_zlib_level,
         .junit_xml_filepath = opt_junit_xml,
         .device_id = opt_device_id,
         .run_all_queues = opt_all_queues,
         .verbose = opt_verbose,
+        .gpu_compare = opt_gpu_compare,
+        .pipeline_cache_dir = opt_pipeline_cache_dir,
+        .host_alloc_stats = opt_host_alloc_stats,
+        .no_host_alloc_poison = !opt_host_alloc_poison,
+        .params = &opt_params,
     });
 
     if (opt_log_pids)
         log_print_pids(true);
 
+    // Test processes inherit the level.
+    cru_image_set_png_compression_level(opt_dump_zlib_level);
+
     if (!ok) {
         loge("failed to initialize the test runner");
         exit(EXIT_FAILURE);
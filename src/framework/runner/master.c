@@ -22,6 +22,7 @@
 /// \file
 /// \brief The runner's master process
 
+#include <inttypes.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -117,11 +118,22 @@ static struct master {
     uint32_t num_skip;
     uint32_t num_lost;
 
+    /// Host memory of the tests, if runner_opts::host_alloc_stats is set.
+    struct {
+        uint64_t peak_bytes;
+        char peak_test[256];
+        uint32_t num_leaking_tests;
+    } host_mem;
+
     uint32_t num_slaves;
     slave_t slaves[64];
 
     uint32_t num_vulkan_queues;
 
+    /// Capabilities of the test device, for skipping unsupported tests
+    /// without dispatching them.
+    runner_vk_caps_t vk_caps;
+
     struct {
         char *filepath;
         FILE *file;
@@ -154,7 +166,8 @@ static void master_cleanup_dead_slave(slave_t *slave);
 static void master_collect_result(int timeout_ms);
 
 static void master_report_result(const test_def_t *def, uint32_t queue_num,
-                                 pid_t pid, test_result_t result);
+                                 pid_t pid, test_result_t result,
+                                 const test_host_mem_summary_t *host_mem);
 static bool master_send_packet(slave_t *slave, const dispatch_packet_t *pk);
 
 static void master_kill_all_slaves(void);
@@ -253,6 +266,19 @@ junit_init(void)
                                             /*context*/ NULL);
     xmlNewProp(testsuite_node, u("name"), u("crucible"));
 
+    // Record the test parameters, so the run can be reproduced.
+    if (runner_opts.params && runner_opts.params->len > 0) {
+        xmlNodePtr properties_node = xmlNewChild(testsuite_node, NULL,
+                                                 u("properties"), NULL);
+        char **param;
+        cru_vec_foreach(param, runner_opts.params) {
+            xmlNodePtr property_node = xmlNewChild(properties_node, NULL,
+                                                   u("property"), NULL);
+            xmlNewProp(property_node, u("name"), u("define"));
+            xmlNewProp(property_node, u("value"), u(*param));
+        }
+    }
+
     master.junit.doc = doc;
     master.junit.testsuite_node = testsuite_node;
 
@@ -380,6 +406,7 @@ master_run(uint32_t num_tests)
 
     set_sigint_handler(SIG_DFL);
     master_finish_epoll();
+    runner_vk_caps_finish(&master.vk_caps);
 
     if (!junit_finish())
         return false;
@@ -399,6 +426,14 @@ master_print_header(void)
 {
     log_align_tags(true);
     logi("running %u tests", master.num_tests);
+
+    if (runner_opts.params) {
+        char **param;
+        cru_vec_foreach(param, runner_opts.params) {
+            logi("with -D %s", *param);
+        }
+    }
+
     logi("================================");
 
 }
@@ -416,16 +451,25 @@ master_print_summary(void)
     logi("fail %u", master.num_fail);
     logi("skip %u", master.num_skip);
     logi("lost %u", master.num_lost);
+
+    if (runner_opts.host_alloc_stats) {
+        // Running with -j N needs up to N times the peak.
+        logi("peak host memory %"PRIu64" bytes (%s)",
+             master.host_mem.peak_bytes,
+             master.host_mem.peak_test);
+        logi("tests leaking host memory %u",
+             master.host_mem.num_leaking_tests);
+    }
 }
 
 static void
 master_gather_vulkan_info(void)
 {
-    uint32_t num_vulkan_queues;
-
     if (runner_opts.no_fork) {
-        if (!runner_get_vulkan_queue_count(&master.num_vulkan_queues))
-            master.goto_next_phase = true;
+        if (!runner_get_vulkan_caps(runner_opts.device_id, &master.vk_caps))
+            goto fail_no_fork;
+
+        master.num_vulkan_queues = master.vk_caps.queue_count;
         return;
     }
     slave_pipe_t pipe;
@@ -438,28 +482,28 @@ master_gather_vulkan_info(void)
     }
 
     if (pid == 0) {
+        runner_vk_caps_t caps;
+
         // Send any child process (driver) output to /dev/null while
-        // reading the number of queues.
+        // gathering the device's capabilities.
         int devnull = open("/dev/null", O_WRONLY);
         dup2(devnull, 1);
         dup2(devnull, 2);
 
-        // Read the number of queues and send it through the pipe
+        // Gather the capabilities and send them through the pipe
         slave_pipe_become_writer(&pipe);
-        if (!runner_get_vulkan_queue_count(&num_vulkan_queues)) {
+        if (!runner_get_vulkan_caps(runner_opts.device_id, &caps) ||
+            !runner_vk_caps_write(&caps, pipe.write_fd))
             exit(EXIT_FAILURE);
-        } else {
-            if (write(pipe.write_fd, &num_vulkan_queues,
-                      sizeof(num_vulkan_queues)) != sizeof(num_vulkan_queues))
-                exit(EXIT_FAILURE);
-        }
+
         exit(EXIT_SUCCESS);
     } else {
-        // Read the number of queues from the pipe
+        // Read the capabilities from the pipe
         slave_pipe_become_reader(&pipe);
-        if (read(pipe.read_fd, &num_vulkan_queues,
-                 sizeof(num_vulkan_queues)) != sizeof(num_vulkan_queues))
+        if (!runner_vk_caps_read(&master.vk_caps, pipe.read_fd)) {
+            waitpid(pid, NULL, 0);
             goto fail;
+        }
     }
 
     int result;
@@ -469,15 +513,39 @@ master_gather_vulkan_info(void)
         goto fail;
 
     slave_pipe_finish(&pipe);
-    master.num_vulkan_queues = num_vulkan_queues;
+    master.num_vulkan_queues = master.vk_caps.queue_count;
     return;
 
  fail:
     slave_pipe_finish(&pipe);
+ fail_no_fork:
+    runner_vk_caps_finish(&master.vk_caps);
     loge("test runner failed to gather vulkan info");
     master.goto_next_phase = true;
 }
 
+/// Return false, and say why, if the device lacks a requirement that the
+/// test declares.
+static bool
+master_test_is_supported(const test_def_t *def)
+{
+    const runner_vk_caps_t *caps = &master.vk_caps;
+    string_t missing = STRING_INIT;
+
+    bool supported = test_def_check_requirements(def,
+        caps->api_version, &caps->features,
+        caps->instance_extensions, caps->instance_extension_count,
+        caps->device_extensions, caps->device_extension_count,
+        &missing);
+
+    if (!supported)
+        logi("%s: device lacks required %s", def->name, string_data(&missing));
+
+    string_finish(&missing);
+
+    return supported;
+}
+
 static void
 master_enter_dispatch_phase(void)
 {
@@ -529,7 +597,11 @@ master_dispatch_loop_no_fork(void)
             queue_end = def->priv.queue_num + 1;
         }
 
+        const bool supported = def->priv.enable && !def->skip &&
+                               master_test_is_supported(def);
+
         for (uint32_t qi = queue_start; qi < queue_end; qi++) {
+            test_host_mem_summary_t host_mem;
             test_result_t result;
 
             if (!def->priv.enable)
@@ -537,20 +609,22 @@ master_dispatch_loop_no_fork(void)
 
             if (qi >= master.num_vulkan_queues) {
                 logi("queue-family-index %d does not exist", qi);
-                master_report_result(def, qi, 0, TEST_RESULT_SKIP);
+                master_report_result(def, qi, 0, TEST_RESULT_SKIP, NULL);
                 continue;
             }
 
-            if (def->skip) {
-                master_report_result(def, qi, 0, TEST_RESULT_SKIP);
+            if (def->skip || !supported) {
+                master_report_result(def, qi, 0, TEST_RESULT_SKIP, NULL);
                 continue;
             }
 
             log_tag("start", 0, "%s.q%d", def->name, qi);
-            result = run_test_def(def, qi);
-            master_report_result(def, qi, 0, result);
+            result = run_test_def(def, qi, &host_mem);
+            master_report_result(def, qi, 0, result, &host_mem);
         }
     }
+
+    runner_finish_dumps();
 }
 
 /// Dispatch tests to slave processes.
@@ -569,18 +643,21 @@ master_dispatch_loop_with_fork(void)
             queue_end = def->priv.queue_num + 1;
         }
 
+        const bool supported = def->priv.enable && !def->skip &&
+                               master_test_is_supported(def);
+
         for (uint32_t qi = queue_start; qi < queue_end; qi++) {
             if (!def->priv.enable)
                 continue;
 
             if (qi >= master.num_vulkan_queues) {
                 logi("queue-family-index %d does not exist", qi);
-                master_report_result(def, qi, 0, TEST_RESULT_SKIP);
+                master_report_result(def, qi, 0, TEST_RESULT_SKIP, NULL);
                 continue;
             }
 
-            if (def->skip) {
-                master_report_result(def, qi, 0, TEST_RESULT_SKIP);
+            if (def->skip || !supported) {
+                master_report_result(def, qi, 0, TEST_RESULT_SKIP, NULL);
                 continue;
             }
 
@@ -773,7 +850,7 @@ master_cleanup_dead_slave(slave_t *slave)
     // Any remaining tests owned by the slave are lost.
     for (uint32_t i = 0; i < slave->tests.len; ++i) {
         const test_def_t *def = slave->tests.data[i];
-        master_report_result(def, 0, slave->pid, TEST_RESULT_LOST);
+        master_report_result(def, 0, slave->pid, TEST_RESULT_LOST, NULL);
     }
 
     assert(master.cur_dispatched_tests >= slave->tests.len);
@@ -828,13 +905,23 @@ master_collect_result(int timeout_ms)
 
 static void
 master_report_result(const test_def_t *def, uint32_t queue_num,
-                     pid_t pid, test_result_t result)
+                     pid_t pid, test_result_t result,
+                     const test_host_mem_summary_t *host_mem)
 {
     string_t name = STRING_INIT;
     string_printf(&name, "%s.q%d", def->name, queue_num);
     log_tag(test_result_to_string(result), pid, "%s", string_data(&name));
     fflush(stdout);
 
+    if (host_mem && host_mem->peak_bytes > master.host_mem.peak_bytes) {
+        master.host_mem.peak_bytes = host_mem->peak_bytes;
+        snprintf(master.host_mem.peak_test,
+                 sizeof(master.host_mem.peak_test), "%s", string_data(&name));
+    }
+
+    if (host_mem && host_mem->leaked_bytes > 0)
+        master.host_mem.num_leaking_tests++;
+
     switch (result) {
     case TEST_RESULT_PASS: master.num_pass++; break;
     case TEST_RESULT_FAIL: master.num_fail++; break;
@@ -1218,7 +1305,7 @@ slave_drain_result_pipe(slave_t *slave)
 
         slave_rm_test(slave, pk.test_def);
         master_report_result(pk.test_def, pk.queue_num, slave->pid,
-                             pk.result);
+                             pk.result, &pk.host_mem);
     }
 }
 
@@ -32,9 +32,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <errno.h>
 #include <regex.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "util/cru_dump_archive.h"
 #include "util/log.h"
+#include "util/string.h"
 
 #include "framework/runner/runner.h"
 #include "framework/test/test.h"
@@ -47,6 +52,10 @@ static uint32_t runner_num_tests;
 static bool runner_is_init = false;
 runner_opts_t runner_opts = {0};
 
+/// The dump archive of this test process, created by its first test.
+static cru_dump_archive_t *runner_dump_archive;
+static bool runner_dump_archive_failed = false;
+
 #define ASSERT_RUNNER_IS_INIT \
     do { \
         if (!runner_is_init) { \
@@ -85,8 +94,55 @@ runner_init(runner_opts_t *opts)
     return true;
 }
 
+/// Return the dump archive of this process, creating it if needed. Return
+/// NULL if tests should dump to loose files.
+static cru_dump_archive_t *
+runner_get_dump_archive(void)
+{
+    const char *dir = runner_opts.image_dump_archive_dir;
+
+    if (!dir || runner_opts.no_image_dumps || runner_dump_archive_failed)
+        return NULL;
+
+    if (runner_dump_archive)
+        return runner_dump_archive;
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        loge("failed to create directory %s: %s", dir, strerror(errno));
+        runner_dump_archive_failed = true;
+        return NULL;
+    }
+
+    string_t filename = STRING_INIT;
+    string_copy_cstr(&filename, dir);
+    path_appendf(&filename, "crucible-%d.cda", getpid());
+
+    runner_dump_archive =
+        cru_dump_archive_create(string_data(&filename),
+                                runner_opts.image_dump_zlib_level);
+    string_finish(&filename);
+
+    if (!runner_dump_archive) {
+        logw("dumping images to the data directory instead");
+        runner_dump_archive_failed = true;
+    }
+
+    return runner_dump_archive;
+}
+
+/// Finish writing the image dumps of all tests run by this process.
+void
+runner_finish_dumps(void)
+{
+    cru_image_wait_async_writes();
+
+    cru_dump_archive_close(runner_dump_archive);
+    runner_dump_archive = NULL;
+}
+
 test_result_t
-run_test_def(const test_def_t *def, uint32_t queue_num)
+run_test_def(const test_def_t *def, uint32_t queue_num,
+             test_host_mem_summary_t *host_mem)
 {
     ASSERT_RUNNER_IS_INIT;
 
@@ -95,21 +151,32 @@ run_test_def(const test_def_t *def, uint32_t queue_num)
 
     assert(def->priv.enable);
 
+    *host_mem = (test_host_mem_summary_t) {0};
+
     test = test_create(.def = def,
                        .enable_dump = !runner_opts.no_image_dumps,
+                       .dump_format = runner_opts.image_dump_format,
+                       .dump_archive = runner_get_dump_archive(),
                        .enable_cleanup_phase = !runner_opts.no_cleanup_phase,
                        .enable_separate_cleanup_thread =
                             runner_opts.use_separate_cleanup_threads,
                        .device_id = runner_opts.device_id,
                        .queue_num = queue_num,
                        .run_all_queues = runner_opts.run_all_queues,
-                       .verbose = runner_opts.verbose);
+                       .verbose = runner_opts.verbose,
+                       .gpu_compare = runner_opts.gpu_compare,
+                       .pipeline_cache_dir = runner_opts.pipeline_cache_dir,
+                       .host_alloc_stats = runner_opts.host_alloc_stats,
+                       .no_host_alloc_poison =
+                            runner_opts.no_host_alloc_poison,
+                       .params = runner_opts.params);
     if (!test)
         return TEST_RESULT_FAIL;
 
     test_start(test);
     test_wait(test);
     result = test_get_result(test);
+    test_get_host_mem_summary(test, host_mem);
     test_destroy(test);
 
     return result;
@@ -39,8 +39,11 @@ struct result_packet {
     const test_def_t *test_def;
     uint32_t queue_num;
     test_result_t result;
+    test_host_mem_summary_t host_mem;
 };
 
 extern runner_opts_t runner_opts;
 
-test_result_t run_test_def(const test_def_t *def, uint32_t queue_num);
+test_result_t run_test_def(const test_def_t *def, uint32_t queue_num,
+                           test_host_mem_summary_t *host_mem);
+void runner_finish_dumps(void);
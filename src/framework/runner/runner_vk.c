@@ -25,46 +25,73 @@
 #include "runner_vk.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include "util/vk_wrapper.h"
 
-bool
-runner_get_vulkan_queue_count(uint32_t *count)
+static bool
+get_instance_extensions(runner_vk_caps_t *caps)
 {
-    if (count == NULL)
-        return false;
-
     VkResult res;
-    uint32_t instance_extension_count;
+
     res = vkEnumerateInstanceExtensionProperties(NULL,
-        &instance_extension_count, NULL);
+        &caps->instance_extension_count, NULL);
     if (res != VK_SUCCESS)
         return false;
 
-    VkExtensionProperties *instance_extension_props;
-    instance_extension_props =
-        malloc(instance_extension_count * sizeof(*instance_extension_props));
-    if (instance_extension_props == NULL)
+    caps->instance_extensions =
+        calloc(caps->instance_extension_count + 1,
+               sizeof(*caps->instance_extensions));
+    if (caps->instance_extensions == NULL)
         return false;
 
     res = vkEnumerateInstanceExtensionProperties(NULL,
-        &instance_extension_count, instance_extension_props);
-    if (res != VK_SUCCESS) {
-        free(instance_extension_props);
+        &caps->instance_extension_count, caps->instance_extensions);
+    return res == VK_SUCCESS;
+}
+
+static bool
+get_device_extensions(VkPhysicalDevice phy_dev, runner_vk_caps_t *caps)
+{
+    VkResult res;
+
+    res = vkEnumerateDeviceExtensionProperties(phy_dev, NULL,
+        &caps->device_extension_count, NULL);
+    if (res != VK_SUCCESS)
         return false;
-    }
 
-    const char **ext_names;
-    ext_names = malloc(instance_extension_count * sizeof(*ext_names));
-    if (ext_names == NULL) {
-        free(instance_extension_props);
+    caps->device_extensions =
+        calloc(caps->device_extension_count + 1,
+               sizeof(*caps->device_extensions));
+    if (caps->device_extensions == NULL)
         return false;
-    }
 
-    for (uint32_t i = 0; i < instance_extension_count; i++) {
-        ext_names[i] = instance_extension_props[i].extensionName;
+    res = vkEnumerateDeviceExtensionProperties(phy_dev, NULL,
+        &caps->device_extension_count, caps->device_extensions);
+    return res == VK_SUCCESS;
+}
+
+/// Gather the capabilities of the physical device that tests run on, which
+/// is 1-based like the runner's device id.
+bool
+runner_get_vulkan_caps(int device_id, runner_vk_caps_t *caps)
+{
+    memset(caps, 0, sizeof(*caps));
+
+    if (!get_instance_extensions(caps))
+        goto fail;
+
+    const char **ext_names;
+    ext_names = malloc((caps->instance_extension_count + 1) *
+                       sizeof(*ext_names));
+    if (ext_names == NULL)
+        goto fail;
+
+    for (uint32_t i = 0; i < caps->instance_extension_count; i++) {
+        ext_names[i] = caps->instance_extensions[i].extensionName;
     }
 
+    VkResult res;
     VkInstance instance;
     res = vkCreateInstance(
         &(VkInstanceCreateInfo) {
@@ -74,27 +101,44 @@ runner_get_vulkan_queue_count(uint32_t *count)
                 .pApplicationName = "crucible",
                 .apiVersion = VK_MAKE_VERSION(1, 0, 0),
             },
-            .enabledExtensionCount = instance_extension_count,
+            .enabledExtensionCount = caps->instance_extension_count,
             .ppEnabledExtensionNames = ext_names,
         }, NULL, &instance);
-    free(instance_extension_props);
     free(ext_names);
     if (res != VK_SUCCESS)
-        return false;
+        goto fail;
 
     uint32_t phy_dev_count = 0;
     res = vkEnumeratePhysicalDevices(instance, &phy_dev_count, NULL);
-    if (res != VK_SUCCESS || phy_dev_count == 0) {
+    if (res != VK_SUCCESS || phy_dev_count == 0 || device_id < 1 ||
+        (uint32_t) device_id > phy_dev_count) {
         vkDestroyInstance(instance, NULL);
-        return false;
+        goto fail;
     }
 
-    VkPhysicalDevice phy_dev;
-    phy_dev_count = 1;
-    res = vkEnumeratePhysicalDevices(instance, &phy_dev_count, &phy_dev);
-    if ((res != VK_SUCCESS && res != VK_INCOMPLETE) || phy_dev_count != 1) {
+    VkPhysicalDevice *phy_devs = malloc(phy_dev_count * sizeof(*phy_devs));
+    if (phy_devs == NULL) {
         vkDestroyInstance(instance, NULL);
-        return false;
+        goto fail;
+    }
+
+    res = vkEnumeratePhysicalDevices(instance, &phy_dev_count, phy_devs);
+    VkPhysicalDevice phy_dev = phy_devs[device_id - 1];
+    free(phy_devs);
+    if (res != VK_SUCCESS) {
+        vkDestroyInstance(instance, NULL);
+        goto fail;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phy_dev, &props);
+    caps->api_version = props.apiVersion;
+
+    vkGetPhysicalDeviceFeatures(phy_dev, &caps->features);
+
+    if (!get_device_extensions(phy_dev, caps)) {
+        vkDestroyInstance(instance, NULL);
+        goto fail;
     }
 
     uint32_t queue_family_count;
@@ -102,26 +146,110 @@ runner_get_vulkan_queue_count(uint32_t *count)
                                              &queue_family_count, NULL);
     if (queue_family_count == 0) {
         vkDestroyInstance(instance, NULL);
-        return false;
+        goto fail;
     }
 
     VkQueueFamilyProperties *family_props;
     family_props = malloc(queue_family_count * sizeof(*family_props));
     if (family_props == NULL) {
         vkDestroyInstance(instance, NULL);
-        return false;
+        goto fail;
     }
 
     vkGetPhysicalDeviceQueueFamilyProperties(phy_dev,
                                              &queue_family_count, family_props);
 
-    uint32_t queue_count = 0;
     for (uint32_t i = 0; i < queue_family_count; i++) {
-        queue_count += family_props[i].queueCount;
+        caps->queue_count += family_props[i].queueCount;
     }
     free(family_props);
-    *count = queue_count;
 
     vkDestroyInstance(instance, NULL);
     return true;
+
+fail:
+    runner_vk_caps_finish(caps);
+    return false;
+}
+
+void
+runner_vk_caps_finish(runner_vk_caps_t *caps)
+{
+    free(caps->instance_extensions);
+    free(caps->device_extensions);
+    memset(caps, 0, sizeof(*caps));
+}
+
+static bool
+write_all(int fd, const void *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n <= 0)
+            return false;
+
+        data = (const char *) data + n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool
+read_all(int fd, void *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = read(fd, data, size);
+        if (n <= 0)
+            return false;
+
+        data = (char *) data + n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/// Send the capabilities through a pipe: the struct itself, then the
+/// instance extensions, then the device extensions.
+bool
+runner_vk_caps_write(const runner_vk_caps_t *caps, int fd)
+{
+    return write_all(fd, caps, sizeof(*caps)) &&
+           write_all(fd, caps->instance_extensions,
+                     caps->instance_extension_count *
+                     sizeof(*caps->instance_extensions)) &&
+           write_all(fd, caps->device_extensions,
+                     caps->device_extension_count *
+                     sizeof(*caps->device_extensions));
+}
+
+bool
+runner_vk_caps_read(runner_vk_caps_t *caps, int fd)
+{
+    if (!read_all(fd, caps, sizeof(*caps))) {
+        memset(caps, 0, sizeof(*caps));
+        return false;
+    }
+
+    // The pointers belong to the writer's process.
+    caps->instance_extensions =
+        calloc(caps->instance_extension_count + 1,
+               sizeof(*caps->instance_extensions));
+    caps->device_extensions =
+        calloc(caps->device_extension_count + 1,
+               sizeof(*caps->device_extensions));
+
+    if (!caps->instance_extensions || !caps->device_extensions ||
+        !read_all(fd, caps->instance_extensions,
+                  caps->instance_extension_count *
+                  sizeof(*caps->instance_extensions)) ||
+        !read_all(fd, caps->device_extensions,
+                  caps->device_extension_count *
+                  sizeof(*caps->device_extensions))) {
+        runner_vk_caps_finish(caps);
+        return false;
+    }
+
+    return true;
 }
@@ -24,4 +24,25 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-bool runner_get_vulkan_queue_count(uint32_t *count);
+#include "util/vk_wrapper.h"
+
+typedef struct runner_vk_caps runner_vk_caps_t;
+
+/// What the device that tests run on supports. The master gathers this once,
+/// so that it can skip tests whose declared requirements the device lacks.
+struct runner_vk_caps {
+    uint32_t queue_count;
+    uint32_t api_version;
+    VkPhysicalDeviceFeatures features;
+
+    uint32_t instance_extension_count;
+    VkExtensionProperties *instance_extensions;
+
+    uint32_t device_extension_count;
+    VkExtensionProperties *device_extensions;
+};
+
+bool runner_get_vulkan_caps(int device_id, runner_vk_caps_t *caps);
+bool runner_vk_caps_write(const runner_vk_caps_t *caps, int fd);
+bool runner_vk_caps_read(runner_vk_caps_t *caps, int fd);
+void runner_vk_caps_finish(runner_vk_caps_t *caps);
@@ -50,12 +50,14 @@ slave_recv_test(const test_def_t **test_def, uint32_t *queue_num)
 
 static bool
 slave_send_result(const test_def_t *def, uint32_t queue_num,
-                  test_result_t result)
+                  test_result_t result,
+                  const test_host_mem_summary_t *host_mem)
 {
     const result_packet_t pk = {
         .test_def = def,
         .queue_num = queue_num,
         .result = result,
+        .host_mem = *host_mem,
     };
 
     static_assert(sizeof(pk) <= PIPE_BUF, "result packets will not be read "
@@ -70,6 +72,7 @@ slave_loop(void)
     const test_def_t *def;
 
     for (;;) {
+        test_host_mem_summary_t host_mem;
         test_result_t result;
         uint32_t queue_num;
 
@@ -77,8 +80,8 @@ slave_loop(void)
         if (!def)
             return;
 
-        result = run_test_def(def, queue_num);
-        slave_send_result(def, queue_num, result);
+        result = run_test_def(def, queue_num, &host_mem);
+        slave_send_result(def, queue_num, result, &host_mem);
     }
 }
 
@@ -92,4 +95,7 @@ slave_run(int _dispatch_fd, int _result_fd)
     result_fd = _result_fd;
 
     slave_loop();
+
+    // Finish writing the tests' image dumps before the slave exits.
+    runner_finish_dumps();
 }
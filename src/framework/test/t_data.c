@@ -58,6 +58,15 @@ __t_physical_dev_features(void)
     return &t->vk.physical_dev_features;
 }
 
+const VkPhysicalDeviceFeatures *
+__t_device_features(void)
+{
+    ASSERT_TEST_IN_MAJOR_PHASE;
+    GET_CURRENT_TEST(t);
+
+    return &t->vk.device_features;
+}
+
 const VkPhysicalDeviceProperties *
 __t_physical_dev_props(void)
 {
@@ -207,6 +216,24 @@ __t_pipeline_cache(void)
     return &t->vk.pipeline_cache;
 }
 
+QoMemoryArena *
+__t_memory_arena(void)
+{
+    ASSERT_TEST_IN_MAJOR_PHASE;
+    GET_CURRENT_TEST(t);
+
+    return t->vk.memory_arena;
+}
+
+QoUploadRing *
+__t_upload_ring(void)
+{
+    ASSERT_TEST_IN_MAJOR_PHASE;
+    GET_CURRENT_TEST(t);
+
+    return t->vk.upload_ring;
+}
+
 const uint32_t *
 __t_height(void)
 {
@@ -23,6 +23,30 @@
 #include <inttypes.h>
 #include "test.h"
 
+/// Queue the image for writing in the background, in the test's dump format.
+/// The filename is the test name followed by a dot and the image's label.
+static void
+t_dump_image_file(cru_image_t *image, string_t *filename)
+{
+    GET_CURRENT_TEST(t);
+
+    if (t->opt.dump_format == TEST_DUMP_FORMAT_QOI &&
+        string_endswith_cstr(filename, ".png")) {
+        string_truncate(filename, filename->len - strlen(".png"));
+        string_append_cstr(filename, ".qoi");
+    }
+
+    if (t->opt.dump_archive) {
+        const char *label = string_data(filename) + strlen(t_name) + 1;
+        cru_dump_archive_add_image_async(t->opt.dump_archive, t_name, label,
+                                         image);
+    } else {
+        cru_image_write_file_async(image, string_data(filename));
+    }
+
+    string_finish(filename);
+}
+
 bool
 t_is_dump_enabled(void)
 {
@@ -46,7 +70,7 @@ t_dump_seq_image(cru_image_t *image)
 
     string_t filename = STRING_INIT;
     string_printf(&filename, "%s.seq%04" PRIu64 ".png", t_name, seq);
-    cru_image_write_file(image, string_data(&filename));
+    t_dump_image_file(image, &filename);
 }
 
 void printflike(2, 3)
@@ -75,5 +99,5 @@ t_dump_image_fv(cru_image_t *image, const char *format, va_list va)
     string_append_char(&filename, '.');
     string_vappendf(&filename, format, va);
 
-    cru_image_write_file(image, string_data(&filename));
+    t_dump_image_file(image, &filename);
 }
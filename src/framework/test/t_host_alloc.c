@@ -0,0 +1,352 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief The VkAllocationCallbacks of each test's instance and device.
+///
+/// Each allocation is prefixed with a header that records its size and
+/// scope, so that frees and reallocations can be accounted for.
+
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdalign.h>
+
+#include "test.h"
+
+struct alloc_header {
+    size_t size;
+    uint32_t offset;
+    uint32_t scope;
+};
+
+static const char *const scope_names[] = {
+    [VK_SYSTEM_ALLOCATION_SCOPE_COMMAND] = "command",
+    [VK_SYSTEM_ALLOCATION_SCOPE_OBJECT] = "object",
+    [VK_SYSTEM_ALLOCATION_SCOPE_CACHE] = "cache",
+    [VK_SYSTEM_ALLOCATION_SCOPE_DEVICE] = "device",
+    [VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE] = "instance",
+};
+
+static_assert(ARRAY_LENGTH(scope_names) == TEST_HOST_ALLOC_NUM_SCOPES,
+              "scope_names does not cover every VkSystemAllocationScope");
+
+static struct alloc_header *
+get_header(void *mem)
+{
+    return (struct alloc_header *) mem - 1;
+}
+
+static void
+add_counters(struct test_host_alloc_counters *c, int64_t size, int64_t n)
+{
+    c->live_bytes += size;
+    c->live_allocs += n;
+
+    if (n > 0) {
+        c->num_allocs += n;
+        c->peak_bytes = MAX(c->peak_bytes, c->live_bytes);
+    }
+}
+
+static void
+account(test_t *t, uint32_t scope, size_t size, int64_t n)
+{
+    struct test_host_alloc *ha = &t->host_alloc;
+
+    if (!t->opt.host_alloc_stats)
+        return;
+
+    int64_t delta = n > 0 ? (int64_t) size : -(int64_t) size;
+
+    pthread_mutex_lock(&ha->mutex);
+
+    add_counters(&ha->total, delta, n);
+    add_counters(&ha->scope[scope], delta, n);
+
+    if (n > 0) {
+        uint32_t bucket = size ? 63 - __builtin_clzll(size) : 0;
+        ha->size_histogram[bucket]++;
+    }
+
+    pthread_mutex_unlock(&ha->mutex);
+}
+
+static void *
+host_alloc(void *user_data, size_t size, size_t alignment,
+           VkSystemAllocationScope scope)
+{
+    test_t *t = user_data;
+    void *block;
+
+    assert(scope < TEST_HOST_ALLOC_NUM_SCOPES);
+
+    // The header goes immediately before the returned pointer.
+    alignment = MAX(alignment, alignof(struct alloc_header));
+    size_t offset = (sizeof(struct alloc_header) + alignment - 1) &
+                    ~(alignment - 1);
+
+    if (posix_memalign(&block, alignment, offset + size) != 0)
+        return NULL;
+
+    char *mem = (char *) block + offset;
+    *get_header(mem) = (struct alloc_header) {
+        .size = size,
+        .offset = offset,
+        .scope = scope,
+    };
+
+    // Catch implementations that read memory they didn't initialize.
+    if (!t->opt.no_host_alloc_poison)
+        memset(mem, 139, size);
+
+    account(t, scope, size, 1);
+
+    return mem;
+}
+
+static void
+host_free(void *user_data, void *mem)
+{
+    test_t *t = user_data;
+
+    if (!mem)
+        return;
+
+    struct alloc_header *header = get_header(mem);
+    account(t, header->scope, header->size, -1);
+    free((char *) mem - header->offset);
+}
+
+static void *
+host_realloc(void *user_data, void *orig, size_t size, size_t alignment,
+             VkSystemAllocationScope scope)
+{
+    if (!orig)
+        return host_alloc(user_data, size, alignment, scope);
+
+    if (size == 0) {
+        host_free(user_data, orig);
+        return NULL;
+    }
+
+    // Copying keeps the alignment, which realloc() can't promise.
+    void *mem = host_alloc(user_data, size, alignment, scope);
+    if (!mem)
+        return NULL;
+
+    memcpy(mem, orig, MIN(size, get_header(orig)->size));
+    host_free(user_data, orig);
+
+    return mem;
+}
+
+static void
+host_internal_alloc(void *user_data, size_t size,
+                    VkInternalAllocationType type,
+                    VkSystemAllocationScope scope)
+{
+    test_t *t = user_data;
+
+    if (!t->opt.host_alloc_stats)
+        return;
+
+    pthread_mutex_lock(&t->host_alloc.mutex);
+    add_counters(&t->host_alloc.internal, size, 1);
+    pthread_mutex_unlock(&t->host_alloc.mutex);
+}
+
+static void
+host_internal_free(void *user_data, size_t size,
+                   VkInternalAllocationType type,
+                   VkSystemAllocationScope scope)
+{
+    test_t *t = user_data;
+
+    if (!t->opt.host_alloc_stats)
+        return;
+
+    pthread_mutex_lock(&t->host_alloc.mutex);
+    add_counters(&t->host_alloc.internal, -(int64_t) size, -1);
+    pthread_mutex_unlock(&t->host_alloc.mutex);
+}
+
+void
+test_host_alloc_init(test_t *t)
+{
+    pthread_mutex_init(&t->host_alloc.mutex, NULL);
+
+    t->vk.alloc_cb = (VkAllocationCallbacks) {
+        .pUserData = t,
+        .pfnAllocation = host_alloc,
+        .pfnReallocation = host_realloc,
+        .pfnFree = host_free,
+        .pfnInternalAllocation = host_internal_alloc,
+        .pfnInternalFree = host_internal_free,
+    };
+}
+
+void
+test_host_alloc_finish(test_t *t)
+{
+    pthread_mutex_destroy(&t->host_alloc.mutex);
+}
+
+/// Illegal to call before test_wait().
+void
+test_get_host_mem_summary(test_t *t, test_host_mem_summary_t *summary)
+{
+    ASSERT_NOT_IN_TEST_THREAD;
+    ASSERT_TEST_IN_STOPPED_PHASE(t);
+
+    struct test_host_alloc *ha = &t->host_alloc;
+
+    pthread_mutex_lock(&ha->mutex);
+    *summary = (test_host_mem_summary_t) {
+        .peak_bytes = ha->total.peak_bytes,
+        .num_allocs = ha->total.num_allocs,
+        .leaked_bytes = ha->leaked_bytes,
+    };
+    pthread_mutex_unlock(&ha->mutex);
+}
+
+/// Bytes that are live in the scopes that a device's allocations use.
+static uint64_t
+live_device_bytes(const struct test_host_alloc *ha, uint64_t *allocs)
+{
+    uint64_t bytes = 0;
+
+    *allocs = 0;
+    for (uint32_t s = 0; s < VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE; s++) {
+        bytes += ha->scope[s].live_bytes;
+        *allocs += ha->scope[s].live_allocs;
+    }
+
+    return bytes;
+}
+
+/// Leaks are found while the cleanup stacks unwind. Only one thread runs
+/// then, and the result isn't read until the test stops, so the result can
+/// still be changed even if the test already called t_pass().
+static void
+fail_leaking_test(test_t *t)
+{
+    assert(t->phase == TEST_PHASE_CLEANUP);
+    test_result_merge(&t->result, TEST_RESULT_FAIL);
+}
+
+static void
+check_device_leaks(void *data)
+{
+    test_t *t = data;
+    struct test_host_alloc *ha = &t->host_alloc;
+    uint64_t allocs;
+
+    pthread_mutex_lock(&ha->mutex);
+    uint64_t bytes = live_device_bytes(ha, &allocs);
+    if (bytes > ha->device_baseline_bytes) {
+        bytes -= ha->device_baseline_bytes;
+        allocs -= MIN(allocs, ha->device_baseline_allocs);
+        ha->leaked_bytes += bytes;
+    } else {
+        bytes = 0;
+    }
+    pthread_mutex_unlock(&ha->mutex);
+
+    if (bytes) {
+        loge("%s: device leaked %"PRIu64" bytes of host memory in "
+             "%"PRIu64" allocations", string_data(&t->name), bytes, allocs);
+        fail_leaking_test(t);
+    }
+}
+
+static void
+log_counters(const test_t *t, const char *what,
+             const struct test_host_alloc_counters *c)
+{
+    logi("%s: host memory: %s: peak %"PRIu64" bytes, %"PRIu64" allocations",
+         string_data(&t->name), what, c->peak_bytes, c->num_allocs);
+}
+
+static void
+check_instance_leaks(void *data)
+{
+    test_t *t = data;
+    struct test_host_alloc *ha = &t->host_alloc;
+
+    // Every other thread is gone, so don't bother locking.
+    if (ha->total.live_allocs > 0) {
+        loge("%s: instance leaked %"PRIu64" bytes of host memory in "
+             "%"PRIu64" allocations", string_data(&t->name),
+             ha->total.live_bytes, ha->total.live_allocs);
+        ha->leaked_bytes = MAX(ha->leaked_bytes, ha->total.live_bytes);
+        fail_leaking_test(t);
+    }
+
+    log_counters(t, "total", &ha->total);
+
+    for (uint32_t s = 0; s < TEST_HOST_ALLOC_NUM_SCOPES; s++) {
+        if (ha->scope[s].num_allocs)
+            log_counters(t, scope_names[s], &ha->scope[s]);
+    }
+
+    if (ha->internal.num_allocs)
+        log_counters(t, "internal", &ha->internal);
+
+    string_t hist = STRING_INIT;
+    for (uint32_t i = 0; i < ARRAY_LENGTH(ha->size_histogram); i++) {
+        if (ha->size_histogram[i]) {
+            string_appendf(&hist, " <%"PRIu64":%"PRIu64,
+                           (uint64_t) 2 << i, ha->size_histogram[i]);
+        }
+    }
+    logi("%s: host memory: allocations by size:%s", string_data(&t->name),
+         string_data(&hist));
+    string_finish(&hist);
+}
+
+void
+t_host_alloc_track_instance(void)
+{
+    GET_CURRENT_TEST(t);
+
+    if (t->opt.host_alloc_stats)
+        t_cleanup_push_callback(check_instance_leaks, t);
+}
+
+void
+t_host_alloc_track_device(void)
+{
+    GET_CURRENT_TEST(t);
+    struct test_host_alloc *ha = &t->host_alloc;
+
+    if (!t->opt.host_alloc_stats)
+        return;
+
+    // Instance-level objects, such as debug report callbacks, may use the
+    // same scopes as the device. Only allocations made after this point
+    // must be gone once the device is.
+    pthread_mutex_lock(&ha->mutex);
+    ha->device_baseline_bytes = live_device_bytes(ha,
+                                                  &ha->device_baseline_allocs);
+    pthread_mutex_unlock(&ha->mutex);
+
+    t_cleanup_push_callback(check_device_leaks, t);
+}
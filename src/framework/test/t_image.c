@@ -20,6 +20,7 @@
 // IN THE SOFTWARE.
 
 #include "tapi/t.h"
+#include "test.h"
 #include "tapi/t_thread.h"
 #include "util/cru_image.h"
 
@@ -37,6 +38,22 @@ t_new_cru_image_from_filename(const char *filename)
     return cimg;
 }
 
+malloclike cru_image_t *
+t_new_cru_image_from_filename_scaled(const char *filename, uint32_t width,
+                                     uint32_t height)
+{
+    t_thread_yield();
+
+    cru_image_t *cimg = cru_image_from_filename_scaled(filename, width,
+                                                       height);
+    if (!cimg)
+        t_failf("%s: failed to create image", __func__);
+
+    t_cleanup_push_cru_image(cimg);
+
+    return cimg;
+}
+
 malloclike cru_image_array_t *
 t_new_cru_image_array_from_filename(const char *filename)
 {
@@ -57,11 +74,34 @@ t_new_cru_image_from_vk_image(VkDevice dev, VkQueue queue, VkImage image,
                               uint32_t level0_width, uint32_t level0_height,
                               uint32_t miplevel, uint32_t array_slice)
 {
+    GET_CURRENT_TEST(t);
+    cru_vk_image_context_t *ctx = NULL;
+
     t_thread_yield();
 
-    cru_image_t *cimg = cru_image_from_vk_image(t_device, queue, image,
+    if (queue == t->vk.queue[t_queue_num]) {
+        ctx = t->vk.image_context;
+        cru_vk_image_context_reference(ctx);
+    } else {
+        // Find the queue's family so that the context's command pool can
+        // submit to it.
+        for (uint32_t qfam = 0, q = 0; qfam < t->vk.queue_family_count; qfam++) {
+            uint32_t queues_in_fam = t->vk.queue_family_props[qfam].queueCount;
+            for (uint32_t j = 0; j < queues_in_fam; j++) {
+                if (t->vk.queue[q + j] == queue)
+                    ctx = cru_vk_image_context_create(t_device, queue, qfam);
+            }
+            q += queues_in_fam;
+        }
+    }
+
+    if (!ctx)
+        t_failf("%s: failed to create image context", __func__);
+
+    cru_image_t *cimg = cru_image_from_vk_image(ctx, image,
             format, aspect, level0_width, level0_height, miplevel,
-            array_slice, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+            array_slice);
+    cru_vk_image_context_release(ctx);
     if (!cimg)
         t_failf("%s: failed to create image", __func__);
 
@@ -20,53 +20,16 @@
 // IN THE SOFTWARE.
 
 #define __STDC_FORMAT_MACROS
+#include <errno.h>
 #include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "test.h"
 #include "t_phase_setup.h"
 
 /* Maximum supported physical devs. */
 #define MAX_PHYSICAL_DEVS 4
 
-static void *
-test_vk_alloc(void *pUserData, size_t size, size_t alignment,
-              VkSystemAllocationScope scope)
-{
-    assert(pUserData == (void *)0xdeadbeef);
-    void *mem = malloc(size);
-    memset(mem, 139, size);
-    return mem;
-}
-
-static void *
-test_vk_realloc(void *pUserData, void *pOriginal, size_t size,
-                size_t alignment, VkSystemAllocationScope scope)
-{
-    assert(pUserData == (void *)0xdeadbeef);
-    return realloc(pOriginal, size);
-}
-
-static void
-test_vk_free(void *pUserData, void *pMem)
-{
-    assert(pUserData == (void *)0xdeadbeef);
-    free(pMem);
-}
-
-static void
-test_vk_dummy_notify(void *pUserData, size_t size,
-                     VkInternalAllocationType allocationType,
-                     VkSystemAllocationScope allocationScope)
-{ }
-
-static const VkAllocationCallbacks test_alloc_cb = {
-    .pUserData = (void *)0xdeadbeef,
-    .pfnAllocation = test_vk_alloc,
-    .pfnReallocation = test_vk_realloc,
-    .pfnFree = test_vk_free,
-    .pfnInternalAllocation = test_vk_dummy_notify,
-    .pfnInternalFree = test_vk_dummy_notify,
-};
-
 static void
 t_setup_phys_dev(void)
 {
@@ -325,6 +288,226 @@ t_setup_descriptor_pool(void)
     t_cleanup_push_vk_descriptor_pool(t->vk.device, t->vk.descriptor_pool);
 }
 
+/// A pipeline cache that persists across runs in
+/// test_create_info::pipeline_cache_dir.
+struct pipeline_cache_file {
+    VkDevice device;
+    VkPipelineCache cache;
+    string_t dir;
+    string_t filename;
+
+    /// The data the cache was seeded with, or NULL on a miss.
+    void *initial_data;
+    size_t initial_size;
+
+    /// The file existed but was written by another driver or device.
+    bool stale;
+};
+
+/// Return true if the data was produced by this physical device and driver.
+/// The driver must already reject incompatible data, but checking it here
+/// lets us report the miss.
+static bool
+pipeline_cache_data_matches(const void *data, size_t size)
+{
+    GET_CURRENT_TEST(t);
+    const VkPhysicalDeviceProperties *props = &t->vk.physical_dev_props;
+
+    // VkPipelineCacheHeaderVersionOne, which older headers lack.
+    struct {
+        uint32_t headerSize;
+        uint32_t headerVersion;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    } header;
+
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerSize <= size &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props->vendorID &&
+           header.deviceID == props->deviceID &&
+           memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID,
+                  VK_UUID_SIZE) == 0;
+}
+
+/// Return the contents of the file, or NULL if it can't be read.
+static void *
+read_pipeline_cache_file(const char *filename, size_t *size)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        if (errno != ENOENT)
+            logw("failed to open %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    void *data = NULL;
+
+    if (fstat(fileno(f), &st) != 0 || st.st_size <= 0)
+        goto done;
+
+    data = xmalloc(st.st_size);
+    if (fread(data, 1, st.st_size, f) != (size_t) st.st_size) {
+        logw("failed to read %s", filename);
+        free(data);
+        data = NULL;
+        goto done;
+    }
+
+    *size = st.st_size;
+
+done:
+    fclose(f);
+    return data;
+}
+
+/// Write the file through a temporary file in the same directory and rename
+/// it into place, so that concurrent tests never see a partial cache.
+static bool
+write_pipeline_cache_file(const struct pipeline_cache_file *pcf,
+                          const void *data, size_t size)
+{
+    const char *filename = string_data(&pcf->filename);
+    bool ok = false;
+
+    if (mkdir(string_data(&pcf->dir), 0777) != 0 && errno != EEXIST) {
+        logw("failed to create directory %s: %s", string_data(&pcf->dir),
+             strerror(errno));
+        return false;
+    }
+
+    string_t tmp = STRING_INIT;
+    string_printf(&tmp, "%s.XXXXXX", filename);
+
+    int fd = mkstemp(string_data(&tmp));
+    if (fd < 0) {
+        logw("failed to create %s: %s", string_data(&tmp), strerror(errno));
+        goto done;
+    }
+
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(string_data(&tmp));
+        goto done;
+    }
+
+    ok = fwrite(data, 1, size, f) == size;
+    ok &= fclose(f) == 0;
+
+    if (ok && rename(string_data(&tmp), filename) != 0) {
+        logw("failed to rename %s to %s: %s", string_data(&tmp), filename,
+             strerror(errno));
+        ok = false;
+    }
+
+    if (!ok)
+        unlink(string_data(&tmp));
+
+done:
+    string_finish(&tmp);
+    return ok;
+}
+
+/// Write the merged cache back to disk and report its statistics. Cleanup
+/// runs this before the pipeline cache and device are destroyed.
+static void
+save_pipeline_cache(void *data)
+{
+    struct pipeline_cache_file *pcf = data;
+    void *blob = NULL;
+    size_t size = 0;
+    VkResult res;
+
+    res = vkGetPipelineCacheData(pcf->device, pcf->cache, &size, NULL);
+    if (res == VK_SUCCESS && size > 0) {
+        blob = xmalloc(size);
+        res = vkGetPipelineCacheData(pcf->device, pcf->cache, &size, blob);
+    }
+
+    if (res != VK_SUCCESS) {
+        logw("failed to get pipeline cache data: VkResult %d", res);
+        goto done;
+    }
+
+    // Vulkan doesn't report per-pipeline hits, but if the cache didn't grow
+    // then every pipeline came from it.
+    bool unchanged = pcf->initial_data && size == pcf->initial_size &&
+                     memcmp(blob, pcf->initial_data, size) == 0;
+    bool saved = !unchanged && size > 0 &&
+                 write_pipeline_cache_file(pcf, blob, size);
+
+    logi("pipeline cache %s: %s, loaded %zu bytes, %s %zu bytes",
+         string_data(&pcf->filename),
+         pcf->initial_data ? "hit" : pcf->stale ? "stale" : "miss",
+         pcf->initial_size,
+         unchanged ? "unchanged at" : saved ? "saved" : "failed to save",
+         size);
+
+done:
+    free(blob);
+    free(pcf->initial_data);
+    string_finish(&pcf->dir);
+    string_finish(&pcf->filename);
+}
+
+/// Create t_pipeline_cache, seeding it from the on-disk cache if the runner
+/// enabled one. Without --pipeline-cache-dir every test compiles every
+/// pipeline, which is what most test runs want.
+static void
+t_setup_pipeline_cache(void)
+{
+    ASSERT_TEST_IN_SETUP_PHASE;
+    GET_CURRENT_TEST(t);
+
+    if (!t->opt.pipeline_cache_dir) {
+        t->vk.pipeline_cache = qoCreatePipelineCache(t->vk.device);
+        return;
+    }
+
+    const VkPhysicalDeviceProperties *props = &t->vk.physical_dev_props;
+    struct pipeline_cache_file *pcf = t_arena_alloc(sizeof(*pcf));
+
+    pcf->device = t->vk.device;
+    pcf->dir = STRING_INIT;
+    pcf->filename = STRING_INIT;
+
+    string_copy_cstr(&pcf->dir, t->opt.pipeline_cache_dir);
+    string_copy(&pcf->filename, &pcf->dir);
+    path_appendf(&pcf->filename, "%s.%04x-%04x-%08x-", t->def->name,
+                 props->vendorID, props->deviceID, props->driverVersion);
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+        string_appendf(&pcf->filename, "%02x", props->pipelineCacheUUID[i]);
+    string_append_cstr(&pcf->filename, ".vkpc");
+
+    size_t size = 0;
+    void *data = read_pipeline_cache_file(string_data(&pcf->filename), &size);
+    if (data && !pipeline_cache_data_matches(data, size)) {
+        pcf->stale = true;
+        free(data);
+        data = NULL;
+        size = 0;
+    }
+
+    pcf->initial_data = data;
+    pcf->initial_size = size;
+
+    pcf->cache = qoCreatePipelineCache(t->vk.device,
+                                       .initialDataSize = size,
+                                       .pInitialData = data);
+    t->vk.pipeline_cache = pcf->cache;
+
+    // Pushed after the cache's own cleanup, so it runs first.
+    t_cleanup_push_callback(save_pipeline_cache, pcf);
+}
+
 static VkBool32 debug_cb(VkDebugReportFlagsEXT flags,
     VkDebugReportObjectTypeEXT objectType,
     uint64_t object,
@@ -359,6 +542,17 @@ static VkBool32 debug_cb(VkDebugReportFlagsEXT flags,
     return false;
 }
 
+static bool
+has_instance_ext(const test_t *t, const char *name)
+{
+    for (uint32_t i = 0; i < t->vk.instance_extension_count; i++) {
+        if (strcmp(name, t->vk.instance_extension_props[i].extensionName) == 0)
+            return true;
+    }
+
+    return false;
+}
+
 void
 t_setup_vulkan(void)
 {
@@ -371,16 +565,20 @@ t_setup_vulkan(void)
     t_assert(res == VK_SUCCESS);
 
     t->vk.instance_extension_props =
-        malloc(t->vk.instance_extension_count * sizeof(*t->vk.instance_extension_props));
-    t_assert(t->vk.instance_extension_props);
-    t_cleanup_push_free(t->vk.instance_extension_props);
+        t_arena_allocn(t->vk.instance_extension_count,
+                       sizeof(*t->vk.instance_extension_props));
 
     res = vkEnumerateInstanceExtensionProperties(NULL,
         &t->vk.instance_extension_count, t->vk.instance_extension_props);
     t_assert(res == VK_SUCCESS);
 
-    ext_names = malloc(t->vk.instance_extension_count * sizeof(*ext_names));
-    t_assert(ext_names);
+    // Leave room for the declared extensions and VK_EXT_debug_report.
+    uint32_t max_ext_count = t->vk.instance_extension_count + 1;
+    for (const char *const *name = t->def->instance_extensions;
+         name && *name; name++)
+        max_ext_count++;
+
+    ext_names = t_arena_allocn(max_ext_count, sizeof(*ext_names));
 
     bool has_debug_report = false;
     VkDebugReportCallbackCreateInfoEXT debug_report_info = {
@@ -398,15 +596,37 @@ t_setup_vulkan(void)
     }
 
     for (uint32_t i = 0; i < t->vk.instance_extension_count; i++) {
-        ext_names[i] = t->vk.instance_extension_props[i].extensionName;
-
-        if (strcmp(ext_names[i], "VK_EXT_debug_report") == 0)
+        if (strcmp(t->vk.instance_extension_props[i].extensionName,
+                   "VK_EXT_debug_report") == 0)
             has_debug_report = true;
     }
 
+    // Tests that declare their requirements get only what they declare, plus
+    // the debug report extension that the framework itself uses.
+    const bool minimal = test_def_declares_requirements(t->def);
+    uint32_t ext_count = 0;
+
+    if (minimal) {
+        for (const char *const *name = t->def->instance_extensions;
+             name && *name; name++) {
+            if (!has_instance_ext(t, *name))
+                t_skipf("missing required extension %s", *name);
+            ext_names[ext_count++] = *name;
+        }
+
+        if (has_debug_report)
+            ext_names[ext_count++] = "VK_EXT_debug_report";
+    } else {
+        for (uint32_t i = 0; i < t->vk.instance_extension_count; i++)
+            ext_names[ext_count++] =
+                t->vk.instance_extension_props[i].extensionName;
+    }
+
     uint32_t api_version = t->def->api_version ?
         t->def->api_version : VK_MAKE_VERSION(1, 0, 0);
 
+    t_host_alloc_track_instance();
+
     res = vkCreateInstance(
         &(VkInstanceCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -418,12 +638,11 @@ t_setup_vulkan(void)
                 .pApplicationName = "crucible",
                 .apiVersion = api_version
             },
-            .enabledExtensionCount = t->vk.instance_extension_count,
+            .enabledExtensionCount = ext_count,
             .ppEnabledExtensionNames = ext_names,
-        }, &test_alloc_cb, &t->vk.instance);
-    free(ext_names);
+        }, &t->vk.alloc_cb, &t->vk.instance);
     t_assert(res == VK_SUCCESS);
-    t_cleanup_push_vk_instance(t->vk.instance, &test_alloc_cb);
+    t_cleanup_push_vk_instance(t->vk.instance, &t->vk.alloc_cb);
 
     if (has_debug_report) {
 #define RESOLVE(func)\
@@ -449,10 +668,8 @@ t_setup_vulkan(void)
     vkGetPhysicalDeviceQueueFamilyProperties(t->vk.physical_dev,
                                              &t->vk.queue_family_count, NULL);
 
-    t->vk.queue_family_props = malloc(t->vk.queue_family_count *
-                                      sizeof(VkQueueFamilyProperties));
-    t_assert(t->vk.queue_family_props);
-    t_cleanup_push_free(t->vk.queue_family_props);
+    t->vk.queue_family_props = t_arena_allocn(t->vk.queue_family_count,
+                                              sizeof(VkQueueFamilyProperties));
     vkGetPhysicalDeviceQueueFamilyProperties(t->vk.physical_dev,
                                              &t->vk.queue_family_count,
                                              t->vk.queue_family_props);
@@ -514,22 +731,62 @@ t_setup_vulkan(void)
     t_assert(res == VK_SUCCESS);
 
     t->vk.device_extension_props =
-        malloc(t->vk.device_extension_count * sizeof(*t->vk.device_extension_props));
-    t_assert(t->vk.device_extension_props);
-    t_cleanup_push_free(t->vk.device_extension_props);
+        t_arena_allocn(t->vk.device_extension_count,
+                       sizeof(*t->vk.device_extension_props));
 
     res = vkEnumerateDeviceExtensionProperties(t->vk.physical_dev, NULL,
         &t->vk.device_extension_count, t->vk.device_extension_props);
     t_assert(res == VK_SUCCESS);
 
-    ext_names = malloc(t->vk.device_extension_count * sizeof(*ext_names));
-    t_assert(ext_names);
+    VkPhysicalDeviceFeatures pdf;
+    const char *const *dev_ext_names;
+
+    if (minimal) {
+        string_t missing = STRING_INIT;
+
+        if (!test_def_check_requirements(t->def,
+                t->vk.physical_dev_props.apiVersion,
+                &t->vk.physical_dev_features,
+                t->vk.instance_extension_props,
+                t->vk.instance_extension_count,
+                t->vk.device_extension_props,
+                t->vk.device_extension_count, &missing)) {
+            char what[256];
+            snprintf(what, sizeof(what), "%s", string_data(&missing));
+            string_finish(&missing);
+            t_skipf("device lacks required %s", what);
+        }
+
+        string_finish(&missing);
+
+        ext_count = 0;
+        for (const char *const *name = t->def->device_extensions;
+             name && *name; name++)
+            ext_count++;
+
+        dev_ext_names = t->def->device_extensions;
+
+        if (t->def->device_features)
+            pdf = *t->def->device_features;
+        else
+            memset(&pdf, 0, sizeof(pdf));
+    } else {
+        ext_names = t_arena_allocn(t->vk.device_extension_count,
+                                   sizeof(*ext_names));
 
-    for (uint32_t i = 0; i < t->vk.device_extension_count; i++)
-        ext_names[i] = t->vk.device_extension_props[i].extensionName;
+        for (uint32_t i = 0; i < t->vk.device_extension_count; i++)
+            ext_names[i] = t->vk.device_extension_props[i].extensionName;
 
-    VkDeviceQueueCreateInfo *qci = calloc(t->vk.queue_count, sizeof(*qci));
-    t_assert(qci);
+        ext_count = t->vk.device_extension_count;
+        dev_ext_names = ext_names;
+        pdf = t->vk.physical_dev_features;
+    }
+
+    pdf.robustBufferAccess = t->def->robust_buffer_access;
+    t->vk.device_features = pdf;
+
+    VkDeviceQueueCreateInfo *qci = t_arena_allocn(t->vk.queue_count,
+                                                  sizeof(*qci));
 
     const float priority = 1.0f;
     for (uint32_t i = 0; i < t->vk.queue_family_count; i++) {
@@ -539,31 +796,33 @@ t_setup_vulkan(void)
         qci[i].pQueuePriorities = &priority;
     }
 
-    VkPhysicalDeviceFeatures pdf;
-    vkGetPhysicalDeviceFeatures(t->vk.physical_dev, &pdf);
-    pdf.robustBufferAccess = t->def->robust_buffer_access;
+    // The device has always been created without allocation callbacks, so
+    // only give it the test's callbacks when their accounting is wanted.
+    const VkAllocationCallbacks *device_alloc_cb =
+        t->opt.host_alloc_stats ? &t->vk.alloc_cb : NULL;
+
+    t_host_alloc_track_device();
 
     res = vkCreateDevice(t->vk.physical_dev,
         &(VkDeviceCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .queueCreateInfoCount = t->vk.queue_family_count,
             .pQueueCreateInfos = qci,
-            .enabledExtensionCount = t->vk.device_extension_count,
-            .ppEnabledExtensionNames = ext_names,
+            .enabledExtensionCount = ext_count,
+            .ppEnabledExtensionNames = dev_ext_names,
             .pEnabledFeatures = &pdf,
-        }, NULL, &t->vk.device);
-    free(qci);
-    free(ext_names);
+        }, device_alloc_cb, &t->vk.device);
     t_assert(res == VK_SUCCESS);
-    t_cleanup_push_vk_device(t->vk.device, NULL);
+    t_cleanup_push_vk_device(t->vk.device, device_alloc_cb);
+
+    // The arena allocates no memory until a test suballocates from it.
+    t->vk.memory_arena = qoCreateMemoryArena(t->vk.device);
 
     t_setup_descriptor_pool();
 
     t_setup_framebuffer();
 
-    t->vk.queue = calloc(t->vk.queue_count, sizeof(*t->vk.queue));
-    t_assert(t->vk.queue);
-    t_cleanup_push_free(t->vk.queue);
+    t->vk.queue = t_arena_allocn(t->vk.queue_count, sizeof(*t->vk.queue));
 
     for (uint32_t qfam = 0, q = 0; qfam < t->vk.queue_family_count; qfam++) {
         uint32_t queues_in_fam = t->vk.queue_family_props[qfam].queueCount;
@@ -573,12 +832,10 @@ t_setup_vulkan(void)
         q += queues_in_fam;
     }
 
-    t->vk.pipeline_cache = qoCreatePipelineCache(t->vk.device);
+    t_setup_pipeline_cache();
 
-    t->vk.cmd_pool =
-        calloc(t->vk.queue_count, sizeof(*t->vk.cmd_pool));
-    t_assert(t->vk.cmd_pool);
-    t_cleanup_push_free(t->vk.cmd_pool);
+    t->vk.cmd_pool = t_arena_allocn(t->vk.queue_count,
+                                    sizeof(*t->vk.cmd_pool));
 
     for (uint32_t qfam = 0, q = 0; qfam < t->vk.queue_family_count; qfam++) {
         uint32_t queues_in_fam = t->vk.queue_family_props[qfam].queueCount;
@@ -634,6 +891,22 @@ t_setup_vulkan(void)
         q += t->vk.queue_family_props[qfam].queueCount;
     }
 
+    for (uint32_t qfam = 0, q = 0; qfam < t->vk.queue_family_count; qfam++) {
+        uint32_t queues_in_fam = t->vk.queue_family_props[qfam].queueCount;
+        if (t_queue_num >= q && t_queue_num < q + queues_in_fam) {
+            t->vk.image_context =
+                cru_vk_image_context_create(t->vk.device, t_queue, qfam);
+            t->vk.upload_ring =
+                qoCreateUploadRing(t->vk.device, t_queue, qfam);
+            break;
+        }
+        q += queues_in_fam;
+    }
+    t_assert(t->vk.image_context);
+    t_cleanup_push_callback(
+        (cru_cleanup_callback_func_t) cru_vk_image_context_release,
+        t->vk.image_context);
+
     t->vk.cmd_buffer = qoAllocateCommandBuffer(t->vk.device, t_cmd_pool);
 
     qoBeginCommandBuffer(t->vk.cmd_buffer);
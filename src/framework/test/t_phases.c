@@ -100,9 +100,14 @@ t_unwind_cleanup_stacks(void *ignore)
     GET_CURRENT_TEST(t);
     assert(t->phase == TEST_PHASE_CLEANUP);
 
-    cru_cleanup_stack_t *cleanup;
+    cru_slist_t *elem;
+
+    // The list nodes belong to the test's arena, so unlink them without
+    // freeing them.
+    while ((elem = t->cleanup_stacks)) {
+        cru_cleanup_stack_t *cleanup = elem->data;
+        t->cleanup_stacks = elem->next;
 
-    while ((cleanup = cru_slist_pop(&t->cleanup_stacks))) {
         if (t->opt.no_cleanup)
             cru_cleanup_pop_all_noop(cleanup);
 
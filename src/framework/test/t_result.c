@@ -19,6 +19,8 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include "util/gpu_image_compare.h"
+
 #include "test.h"
 #include "t_thread.h"
 
@@ -191,6 +193,23 @@ t_has_ext(const char *name)
 {
     GET_CURRENT_TEST(t);
 
+    // Only the declared extensions are enabled for tests that declare them.
+    if (test_def_declares_requirements(t->def)) {
+        for (const char *const *ext = t->def->instance_extensions;
+             ext && *ext; ext++) {
+            if (!strcmp(name, *ext))
+                return true;
+        }
+
+        for (const char *const *ext = t->def->device_extensions;
+             ext && *ext; ext++) {
+            if (!strcmp(name, *ext))
+                return true;
+        }
+
+        return false;
+    }
+
     for (uint32_t i = 0; i < t->vk.instance_extension_count; i++) {
         if (!strcmp(name, t->vk.instance_extension_props[i].extensionName))
             return true;
@@ -210,23 +229,61 @@ t_require_ext(const char *name)
         t_skipf("missing required extension %s", name);
 }
 
+/// Write an image for inspection to Crucible's data directory, naming it
+/// after the test. The write happens in the background.
+static void
+t_write_result_image(cru_image_t *image, const char *suffix)
+{
+    string_t path = STRING_INIT;
+    string_copy(&path, cru_prefix_path());
+    path_append_cstr(&path, "data");
+    path_append_cstr(&path, t_name);
+    string_append_cstr(&path, suffix);
+    cru_image_write_file_async(image, string_data(&path));
+    string_finish(&path);
+}
+
+/// The GPU comparison must reach the same verdict as cru_image_compare(),
+/// which is exact. self.gpu-image-compare.* checks that the two agree.
+#define GPU_COMPARE_TOLERANCE 0
+
+/// Compare the color image on the GPU. Return false if the GPU can't compare
+/// the images, and set \a *match otherwise.
 static bool
-t_compare_color_image(void)
+t_gpu_compare_color_image(cru_image_t *actual_image, bool *match)
 {
-    ASSERT_TEST_IN_MAJOR_PHASE;
     GET_CURRENT_TEST(t);
+    gpu_image_compare_result_t res;
 
-    // Fail if the user accidentially tries to check the image in a non-image
-    // test.
-    t_assert(!t->def->no_image);
+    if (!gpu_image_compare(t->vk.color_image, VK_FORMAT_R8G8B8A8_UNORM,
+                           VK_IMAGE_ASPECT_COLOR_BIT, t->ref.width,
+                           t->ref.height, t->ref.image,
+                           GPU_COMPARE_TOLERANCE, &res))
+        return false;
 
-    assert(t->ref.width > 0);
-    assert(t->ref.height > 0);
+    *match = res.mismatch_count == 0;
+    if (*match)
+        return true;
 
-    cru_image_t *actual_image = t_new_cru_image_from_vk_image(t->vk.device,
-            t->vk.queue[t_queue_num], t->vk.color_image,
-            VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, t->ref.width,
-            t->ref.height, /*miplevel*/ 0, /*array_slice*/ 0);
+    loge("actual and reference images differ in %u pixels "
+         "(max channel error %u) within (%u, %u)-(%u, %u)",
+         res.mismatch_count, res.max_error,
+         res.min_x, res.min_y, res.max_x, res.max_y);
+
+    t_cleanup_push_free(res.mask);
+    cru_image_t *mask = t_new_cru_image_from_pixels(res.mask,
+            VK_FORMAT_R8_UNORM, t->ref.width, t->ref.height);
+
+    t_write_result_image(actual_image, ".actual.png");
+    t_write_result_image(mask, ".diff.png");
+
+    return true;
+}
+
+static bool
+t_compare_color_image(cru_image_t *actual_image)
+{
+    GET_CURRENT_TEST(t);
 
     if (t->opt.bootstrap) {
         assert(!t->ref.image);
@@ -237,18 +294,17 @@ t_compare_color_image(void)
 
     assert(t->ref.image);
 
+    bool match;
+    if (t->opt.gpu_compare && t_gpu_compare_color_image(actual_image, &match))
+        return match;
+
     if (!cru_image_compare(actual_image, t->ref.image)) {
         loge("actual and reference images differ");
 
         // Dump the actual image for inspection.
         //
         // FINISHME: Dump the image diff too.
-        string_t actual_path = STRING_INIT;
-        string_copy(&actual_path, cru_prefix_path());
-        path_append_cstr(&actual_path, "data");
-        path_append_cstr(&actual_path, t_name);
-        string_append_cstr(&actual_path, ".actual.png");
-        cru_image_write_file(actual_image, string_data(&actual_path));
+        t_write_result_image(actual_image, ".actual.png");
 
         return false;
     }
@@ -256,21 +312,15 @@ t_compare_color_image(void)
     return true;
 }
 
-static bool
-t_compare_stencil_image(void)
+/// Return NULL if the test has no reference stencil image or if the stencil
+/// aspect can't be read back.
+static cru_image_t *
+t_new_actual_stencil_image(void)
 {
-    ASSERT_TEST_IN_MAJOR_PHASE;
     GET_CURRENT_TEST(t);
 
-    // Fail if the user accidentially tries to check the image in a non-image
-    // test.
-    t_assert(!t->def->no_image);
-
-    assert(t->ref.width > 0);
-    assert(t->ref.height > 0);
-
     if (!t->def->ref_stencil_filename)
-        return true;
+        return NULL;
 
     // Check to see if we can actually blit from this format.  Not all
     // hardware supports reading stencil after all.
@@ -280,14 +330,20 @@ t_compare_stencil_image(void)
                                         &format_props);
     if (!(format_props.optimalTilingFeatures &
           VK_FORMAT_FEATURE_BLIT_SRC_BIT))
-        return true;
+        return NULL;
 
     const cru_format_info_t *finfo = t_format_info(t->def->depthstencil_format);
 
-    cru_image_t *actual_image = t_new_cru_image_from_vk_image(t->vk.device,
+    return t_new_cru_image_from_vk_image(t->vk.device,
             t->vk.queue[t_queue_num], t->vk.ds_image,
             finfo->stencil_format, VK_IMAGE_ASPECT_STENCIL_BIT, t->ref.width,
             t->ref.height, /*miplevel*/ 0, /*array_slice*/ 0);
+}
+
+static bool
+t_compare_stencil_image(cru_image_t *actual_image)
+{
+    GET_CURRENT_TEST(t);
 
     if (t->opt.bootstrap) {
         assert(!t->ref.stencil_image);
@@ -304,12 +360,7 @@ t_compare_stencil_image(void)
         // Dump the actual image for inspection.
         //
         // FINISHME: Dump the image diff too.
-        string_t actual_path = STRING_INIT;
-        string_copy(&actual_path, cru_prefix_path());
-        path_append_cstr(&actual_path, "data");
-        path_append_cstr(&actual_path, t_name);
-        string_append_cstr(&actual_path, ".actual-stencil.png");
-        cru_image_write_file(actual_image, string_data(&actual_path));
+        t_write_result_image(actual_image, ".actual-stencil.png");
 
         return false;
     }
@@ -322,13 +373,40 @@ void
 t_compare_image(void)
 {
     ASSERT_TEST_IN_MAJOR_PHASE;
+    GET_CURRENT_TEST(t);
 
     t_thread_yield();
 
+    // Fail if the user accidentially tries to check the image in a non-image
+    // test.
+    t_assert(!t->def->no_image);
+
+    assert(t->ref.width > 0);
+    assert(t->ref.height > 0);
+
+    cru_image_t *actual[2];
+
+    actual[0] = t_new_cru_image_from_vk_image(t->vk.device,
+            t->vk.queue[t_queue_num], t->vk.color_image,
+            VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, t->ref.width,
+            t->ref.height, /*miplevel*/ 0, /*array_slice*/ 0);
+    actual[1] = t_new_actual_stencil_image();
+
+    // Read back both aspects in one submission. On failure, the images fall
+    // back to reading themselves back when mapped. The GPU comparison reads
+    // the color image itself, so skip it then, unless bootstrapping.
+    const bool gpu_color = t->opt.gpu_compare && !t->opt.bootstrap &&
+        gpu_image_compare_supports_format(VK_FORMAT_R8G8B8A8_UNORM);
+    const uint32_t first = gpu_color ? 1 : 0;
+    if (!cru_vk_image_prefetch(&actual[first], ARRAY_LENGTH(actual) - first))
+        logw("failed to prefetch actual images");
+
     bool ok = true;
 
-    ok &= t_compare_color_image();
-    ok &= t_compare_stencil_image();
+    ok &= t_compare_color_image(actual[0]);
+
+    if (actual[1])
+        ok &= t_compare_stencil_image(actual[1]);
 
     if (!ok) {
         // Fail silently because the aspect-specific comparison functions have
@@ -29,7 +29,6 @@ test_thread_start(void *arg)
     ASSERT_NOT_IN_TEST_THREAD;
 
     test_thread_arg_t targ = *(test_thread_arg_t *) arg;
-    free(arg);
 
     test_t *t = targ.test;
     cru_cleanup_stack_t *cleanup = NULL;
@@ -44,7 +43,8 @@ test_thread_start(void *arg)
         abort();
     }
 
-    cru_slist_prepend_atomic(&targ.test->cleanup_stacks, cleanup);
+    cru_slist_t *elem = cru_arena_alloc(&t->arena, sizeof(*elem));
+    cru_slist_prepend_node_atomic(&t->cleanup_stacks, elem, cleanup);
 
     // Bind the thread to the test before entering the thread's real start
     // function.
@@ -84,7 +84,7 @@ test_thread_create(test_t *t, void (*start)(void *arg), void *arg)
     pthread_t thread;
     test_thread_arg_t *targ;
 
-    targ = xmalloc(sizeof(*targ));
+    targ = cru_arena_alloc(&t->arena, sizeof(*targ));
     *targ = (test_thread_arg_t) {
         .test = t,
         .start_func = start,
@@ -19,6 +19,10 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#define __STDC_FORMAT_MACROS
+#include <fnmatch.h>
+#include <inttypes.h>
+
 #include "test.h"
 #include "t_thread.h"
 
@@ -124,6 +128,8 @@ test_destroy(test_t *t)
     string_finish(&t->name);
     string_finish(&t->ref.filename);
     string_finish(&t->ref.stencil_filename);
+    cru_arena_finish(&t->arena);
+    test_host_alloc_finish(t);
 
     free(t);
 }
@@ -144,9 +150,13 @@ test_create_s(const test_create_info_t *info)
     t->result = TEST_RESULT_PASS;
     t->ref.filename = STRING_INIT;
     t->ref.stencil_filename = STRING_INIT;
+    cru_arena_init(&t->arena);
+    test_host_alloc_init(t);
 
     t->def = info->def;
     t->opt.no_dump = !info->enable_dump;
+    t->opt.dump_format = info->dump_format;
+    t->opt.dump_archive = info->dump_archive;
     t->opt.no_cleanup = !info->enable_cleanup_phase;
     t->opt.no_separate_cleanup_thread = !info->enable_separate_cleanup_thread;
     t->opt.bootstrap = info->enable_bootstrap;
@@ -154,6 +164,11 @@ test_create_s(const test_create_info_t *info)
     t->opt.run_all_queues = info->run_all_queues;
     t->opt.device_id = info->device_id;
     t->opt.verbose = info->verbose;
+    t->opt.gpu_compare = info->gpu_compare;
+    t->opt.pipeline_cache_dir = info->pipeline_cache_dir;
+    t->opt.host_alloc_stats = info->host_alloc_stats;
+    t->opt.no_host_alloc_poison = info->no_host_alloc_poison;
+    t->opt.params = info->params;
 
     if (info->enable_bootstrap) {
         if (info->enable_cleanup_phase) {
@@ -230,6 +245,80 @@ t_format_info(VkFormat format)
     return info;
 }
 
+void *
+t_arena_alloc(size_t size)
+{
+    GET_CURRENT_TEST(t);
+    return cru_arena_alloc(&t->arena, size);
+}
+
+void *
+t_arena_allocn(size_t n, size_t size)
+{
+    GET_CURRENT_TEST(t);
+    return cru_arena_allocn(&t->arena, n, size);
+}
+
+/// Return true if the parameter "[<glob>.]<name>=<value>" sets \a name for
+/// the test, and point \a value at its value.
+static bool
+param_matches(const test_t *t, const char *param, const char *name,
+              const char **value)
+{
+    const char *eq = strchr(param, '=');
+    if (!eq)
+        return false;
+
+    // Test names contain dots, but parameter names don't.
+    const char *dot = memrchr(param, '.', eq - param);
+    const char *pname = dot ? dot + 1 : param;
+
+    if (strlen(name) != (size_t) (eq - pname) ||
+        strncmp(pname, name, eq - pname) != 0)
+        return false;
+
+    if (dot) {
+        char glob[dot - param + 1];
+        memcpy(glob, param, dot - param);
+        glob[dot - param] = '\0';
+
+        if (fnmatch(glob, t->def->name, 0) != 0)
+            return false;
+    }
+
+    *value = eq + 1;
+    return true;
+}
+
+uint64_t
+t_param_u64(const char *name, uint64_t default_value)
+{
+    ASSERT_TEST_IN_MAJOR_PHASE;
+    GET_CURRENT_TEST(t);
+
+    const char *value = NULL;
+    uint64_t u64;
+
+    if (t->opt.params) {
+        char **param;
+        cru_vec_foreach(param, t->opt.params) {
+            param_matches(t, *param, name, &value);
+        }
+    }
+
+    if (!value)
+        return default_value;
+
+    t_assertf(cru_parse_u64(value, &u64),
+              "parameter %s=%s is not an unsigned integer", name, value);
+
+    // Record overridden values in the test's output, so the run can be
+    // reproduced.
+    logi("parameter %s = %"PRIu64, name, u64);
+
+    return u64;
+}
+
 static void
 t_thread_release_wrapper(void *ignore)
 {
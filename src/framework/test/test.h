@@ -28,8 +28,10 @@
 #include <string.h>
 
 #include "framework/test/test.h"
+#include "framework/test/test_def.h"
 #include "qonos/qonos.h"
 #include "tapi/t.h"
+#include "util/cru_arena.h"
 #include "util/cru_format.h"
 #include "util/cru_image.h"
 #include "util/log.h"
@@ -42,6 +44,8 @@
 typedef enum test_phase test_phase_t;
 typedef struct cru_current_test cru_current_test_t;
 typedef struct test test_t;
+
+#define TEST_HOST_ALLOC_NUM_SCOPES (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
 typedef struct test_thread_arg test_thread_arg_t;
 
 /// Tests proceed through the stages in the order listed.
@@ -85,6 +89,11 @@ struct test {
     /// begins with "t_".
     cru_slist_t *cleanup_stacks;
 
+    /// \brief Bookkeeping memory that lives as long as the test.
+    ///
+    /// \see t_arena_alloc()
+    cru_arena_t arena;
+
     /// Threads coordinate activity with the phase.
     _Atomic test_phase_t phase;
 
@@ -126,8 +135,49 @@ struct test {
         bool run_all_queues;
 
         bool verbose;
+
+        test_dump_format_t dump_format;
+
+        /// \see test_create_info::dump_archive
+        cru_dump_archive_t *dump_archive;
+
+        /// If set, t_compare_image() compares the color image on the GPU
+        /// when its format allows.
+        bool gpu_compare;
+
+        /// \see test_create_info::pipeline_cache_dir
+        const char *pipeline_cache_dir;
+
+        bool host_alloc_stats;
+        bool no_host_alloc_poison;
+
+        /// \see test_create_info::params
+        const cru_cstr_vec_t *params;
     } opt;
 
+    /// Accounting for cru_test::vk::alloc_cb. Only updated if
+    /// cru_test_options::host_alloc_stats is set.
+    struct test_host_alloc {
+        pthread_mutex_t mutex;
+
+        struct test_host_alloc_counters {
+            uint64_t live_bytes;
+            uint64_t peak_bytes;
+            uint64_t live_allocs;
+            uint64_t num_allocs;
+        } total, scope[TEST_HOST_ALLOC_NUM_SCOPES], internal;
+
+        /// Number of allocations whose size is in [2^i, 2^(i+1)).
+        uint64_t size_histogram[64];
+
+        /// Live bytes and allocations outside the instance scope when the
+        /// device was created.
+        uint64_t device_baseline_bytes;
+        uint64_t device_baseline_allocs;
+
+        uint64_t leaked_bytes;
+    } host_alloc;
+
     /// Atomic counter for t_dump_seq_image().
     cru_refcount_t dump_seq;
 
@@ -146,6 +196,10 @@ struct test {
     /// Vulkan data
     struct {
         VkInstance instance;
+
+        /// Used for the instance and the device.
+        VkAllocationCallbacks alloc_cb;
+
         uint32_t instance_extension_count;
         VkExtensionProperties *instance_extension_props;
         VkPhysicalDevice physical_dev;
@@ -153,6 +207,11 @@ struct test {
         VkPhysicalDeviceProperties physical_dev_props;
         VkPhysicalDeviceMemoryProperties physical_dev_mem_props;
         VkDevice device;
+
+        /// Features enabled on the device. A subset of
+        /// physical_dev_features if the test declares its requirements.
+        VkPhysicalDeviceFeatures device_features;
+
         uint32_t device_extension_count;
         VkExtensionProperties *device_extension_props;
         uint32_t queue_family_count;
@@ -181,9 +240,21 @@ struct test {
 
         VkDescriptorPool descriptor_pool;
         VkPipelineCache pipeline_cache;
+
+        /// Arena for qoAllocBufferMemory(.suballocate = true) and friends.
+        QoMemoryArena *memory_arena;
+
+        /// Staging ring for qoUploadBuffer() and qoUploadImage() on the
+        /// test's queue.
+        QoUploadRing *upload_ring;
+
         VkCommandPool *cmd_pool;
         VkCommandBuffer cmd_buffer;
         VkRenderPass render_pass;
+
+        /// Readback context for Crucible images on the current queue.
+        cru_vk_image_context_t *image_context;
+
         VkFramebuffer framebuffer;
 
         VkImage color_image;
@@ -199,6 +270,10 @@ struct test {
 };
 
 void test_broadcast_stop(test_t *t);
+void test_host_alloc_init(test_t *t);
+void test_host_alloc_finish(test_t *t);
+void t_host_alloc_track_instance(void);
+void t_host_alloc_track_device(void);
 void t_compare_image(void);
 
 extern __thread cru_current_test_t current
@@ -20,6 +20,7 @@
 // IN THE SOFTWARE.
 
 #include <fnmatch.h>
+#include <stddef.h>
 
 #include "framework/test/test_def.h"
 
@@ -67,3 +68,155 @@ cru_find_def(const char *name)
 
     return NULL;
 }
+
+#define FEATURE(name) { offsetof(VkPhysicalDeviceFeatures, name), #name }
+
+static const struct {
+    size_t offset;
+    const char *name;
+} feature_names[] = {
+    FEATURE(robustBufferAccess),
+    FEATURE(fullDrawIndexUint32),
+    FEATURE(imageCubeArray),
+    FEATURE(independentBlend),
+    FEATURE(geometryShader),
+    FEATURE(tessellationShader),
+    FEATURE(sampleRateShading),
+    FEATURE(dualSrcBlend),
+    FEATURE(logicOp),
+    FEATURE(multiDrawIndirect),
+    FEATURE(drawIndirectFirstInstance),
+    FEATURE(depthClamp),
+    FEATURE(depthBiasClamp),
+    FEATURE(fillModeNonSolid),
+    FEATURE(depthBounds),
+    FEATURE(wideLines),
+    FEATURE(largePoints),
+    FEATURE(alphaToOne),
+    FEATURE(multiViewport),
+    FEATURE(samplerAnisotropy),
+    FEATURE(textureCompressionETC2),
+    FEATURE(textureCompressionASTC_LDR),
+    FEATURE(textureCompressionBC),
+    FEATURE(occlusionQueryPrecise),
+    FEATURE(pipelineStatisticsQuery),
+    FEATURE(vertexPipelineStoresAndAtomics),
+    FEATURE(fragmentStoresAndAtomics),
+    FEATURE(shaderTessellationAndGeometryPointSize),
+    FEATURE(shaderImageGatherExtended),
+    FEATURE(shaderStorageImageExtendedFormats),
+    FEATURE(shaderStorageImageMultisample),
+    FEATURE(shaderStorageImageReadWithoutFormat),
+    FEATURE(shaderStorageImageWriteWithoutFormat),
+    FEATURE(shaderUniformBufferArrayDynamicIndexing),
+    FEATURE(shaderSampledImageArrayDynamicIndexing),
+    FEATURE(shaderStorageBufferArrayDynamicIndexing),
+    FEATURE(shaderStorageImageArrayDynamicIndexing),
+    FEATURE(shaderClipDistance),
+    FEATURE(shaderCullDistance),
+    FEATURE(shaderFloat64),
+    FEATURE(shaderInt64),
+    FEATURE(shaderInt16),
+    FEATURE(shaderResourceResidency),
+    FEATURE(shaderResourceMinLod),
+    FEATURE(sparseBinding),
+    FEATURE(sparseResidencyBuffer),
+    FEATURE(sparseResidencyImage2D),
+    FEATURE(sparseResidencyImage3D),
+    FEATURE(sparseResidency2Samples),
+    FEATURE(sparseResidency4Samples),
+    FEATURE(sparseResidency8Samples),
+    FEATURE(sparseResidency16Samples),
+    FEATURE(sparseResidencyAliased),
+    FEATURE(variableMultisampleRate),
+    FEATURE(inheritedQueries),
+};
+
+#undef FEATURE
+
+cru_static_assert(ARRAY_LENGTH(feature_names) * sizeof(VkBool32) ==
+                  sizeof(VkPhysicalDeviceFeatures));
+
+/// Return true if the test declares extensions or features, and so gets a
+/// device that enables only those.
+bool
+test_def_declares_requirements(const test_def_t *def)
+{
+    return def->instance_extensions || def->device_extensions ||
+           def->device_features;
+}
+
+static bool
+has_ext(const char *name, const VkExtensionProperties *exts, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (cru_streq(name, exts[i].extensionName))
+            return true;
+    }
+
+    return false;
+}
+
+static bool
+check_exts(const char *const *names, const VkExtensionProperties *exts,
+           uint32_t count, string_t *missing)
+{
+    for (; names && *names; names++) {
+        if (!has_ext(*names, exts, count)) {
+            string_printf(missing, "extension %s", *names);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// Return true if a device with the given version, features, and extensions
+/// supports the test's declared requirements. Otherwise describe the first
+/// missing requirement in \a missing.
+bool
+test_def_check_requirements(const test_def_t *def,
+                            uint32_t api_version,
+                            const VkPhysicalDeviceFeatures *features,
+                            const VkExtensionProperties *instance_exts,
+                            uint32_t instance_ext_count,
+                            const VkExtensionProperties *device_exts,
+                            uint32_t device_ext_count,
+                            string_t *missing)
+{
+    if (def->api_version &&
+        VK_MAKE_VERSION(VK_VERSION_MAJOR(api_version),
+                        VK_VERSION_MINOR(api_version), 0) <
+        VK_MAKE_VERSION(VK_VERSION_MAJOR(def->api_version),
+                        VK_VERSION_MINOR(def->api_version), 0)) {
+        string_printf(missing, "Vulkan %u.%u",
+                      VK_VERSION_MAJOR(def->api_version),
+                      VK_VERSION_MINOR(def->api_version));
+        return false;
+    }
+
+    if (!check_exts(def->instance_extensions, instance_exts,
+                    instance_ext_count, missing))
+        return false;
+
+    if (!check_exts(def->device_extensions, device_exts, device_ext_count,
+                    missing))
+        return false;
+
+    if (def->device_features) {
+        const char *want = (const char *) def->device_features;
+        const char *have = (const char *) features;
+
+        for (size_t i = 0; i < ARRAY_LENGTH(feature_names); i++) {
+            const size_t offset = feature_names[i].offset;
+
+            if (*(const VkBool32 *) (want + offset) &&
+                !*(const VkBool32 *) (have + offset)) {
+                string_printf(missing, "feature %s", feature_names[i].name);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
@@ -99,6 +99,8 @@ qoQueueSubmit(VkQueue queue, uint32_t cmdBufferCount,
 {
     VkResult result;
 
+    __qoFlushUploadsForQueue(queue);
+
     result = vkQueueSubmit(queue, 1,
         &(VkSubmitInfo) {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -138,6 +140,25 @@ __qoAllocMemory(VkDevice dev, const VkMemoryAllocateInfo *info)
     return memory;
 }
 
+/// Return the first memory type allowed by \a mem_reqs that has all of
+/// \a properties, or QO_MEMORY_TYPE_INDEX_INVALID.
+uint32_t
+qoFindMemoryTypeIndex(const VkMemoryRequirements *mem_reqs,
+                      VkMemoryPropertyFlags properties)
+{
+    const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        const VkMemoryType *type = &props->memoryTypes[i];
+        if ((mem_reqs->memoryTypeBits & (1 << i)) &&
+            (type->propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    return QO_MEMORY_TYPE_INDEX_INVALID;
+}
+
 VkDeviceMemory
 __qoAllocMemoryFromRequirements(VkDevice dev,
                                 const VkMemoryRequirements *mem_reqs,
@@ -155,16 +176,13 @@ __qoAllocMemoryFromRequirements(VkDevice dev,
 
     t_assert(alloc_info.allocationSize >= mem_reqs->size);
 
+    // Without an object to bind, the caller couldn't learn the offset.
+    t_assertf(!info->suballocate,
+              "use qoArenaAllocMemory to suballocate raw memory");
+
     if (alloc_info.memoryTypeIndex == QO_MEMORY_TYPE_INDEX_INVALID) {
-        const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
-        for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
-            const VkMemoryType *type = &props->memoryTypes[i];
-            if ((mem_reqs->memoryTypeBits & (1 << i)) &&
-                (type->propertyFlags & info->properties) == info->properties) {
-                alloc_info.memoryTypeIndex = i;
-                break;
-            }
-        }
+        alloc_info.memoryTypeIndex =
+            qoFindMemoryTypeIndex(mem_reqs, info->properties);
     }
 
     t_assert(alloc_info.memoryTypeIndex != QO_MEMORY_TYPE_INDEX_INVALID);
@@ -177,6 +195,11 @@ VkDeviceMemory
 __qoAllocBufferMemory(VkDevice dev, VkBuffer buffer,
                       const QoMemoryAllocateFromRequirementsInfo *info)
 {
+    if (info->suballocate) {
+        t_assert(dev == t_device);
+        return __qoArenaAllocBufferMemory(t_memory_arena, buffer, info).memory;
+    }
+
     VkMemoryRequirements mem_reqs =
         qoGetBufferMemoryRequirements(dev, buffer);
 
@@ -187,6 +210,11 @@ VkDeviceMemory
 __qoAllocImageMemory(VkDevice dev, VkImage image,
                      const QoMemoryAllocateFromRequirementsInfo *info)
 {
+    if (info->suballocate) {
+        t_assert(dev == t_device);
+        return __qoArenaAllocImageMemory(t_memory_arena, image, info).memory;
+    }
+
     VkMemoryRequirements mem_reqs =
         qoGetImageMemoryRequirements(dev, image);
 
@@ -0,0 +1,408 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "qonos/qonos.h"
+#include "tapi/t_cleanup.h"
+#include "tapi/t_data.h"
+#include "tapi/t_result.h"
+#include "util/cru_vec.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+struct free_range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+CRU_VEC_DEFINE(struct free_range_vec, struct free_range)
+
+struct block {
+    VkDeviceMemory memory;
+    uint32_t memory_type_index;
+
+    /// Images and buffers never share a block.
+    bool image;
+
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t allocation_count;
+
+    /// The whole block, mapped on the first qoArenaMapMemory().
+    void *map;
+
+    /// Sorted by offset. Neighboring ranges are always merged.
+    struct free_range_vec free_ranges;
+};
+
+CRU_VEC_DEFINE(struct block_vec, struct block *)
+
+struct QoMemoryArena {
+    VkDevice device;
+    VkDeviceSize block_size;
+    VkDeviceSize buffer_image_granularity;
+    VkDeviceSize non_coherent_atom_size;
+
+    pthread_mutex_t mutex;
+    struct block_vec blocks;
+};
+
+static VkDeviceSize
+align_u64(VkDeviceSize n, VkDeviceSize a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static void
+destroy_arena(void *data)
+{
+    QoMemoryArena *arena = data;
+    struct block **b;
+
+    cru_vec_foreach(b, &arena->blocks) {
+        // Freeing the memory also unmaps it.
+        vkFreeMemory(arena->device, (*b)->memory, NULL);
+        cru_vec_finish(&(*b)->free_ranges);
+        free(*b);
+    }
+
+    cru_vec_finish(&arena->blocks);
+    pthread_mutex_destroy(&arena->mutex);
+    free(arena);
+}
+
+QoMemoryArena *
+__qoCreateMemoryArena(VkDevice dev, const QoMemoryArenaCreateInfo *info)
+{
+    const VkPhysicalDeviceLimits *limits = &t_physical_dev_props->limits;
+
+    t_assert(info->blockSize > 0);
+
+    QoMemoryArena *arena = xzalloc(sizeof(*arena));
+    arena->device = dev;
+    arena->block_size = info->blockSize;
+    arena->buffer_image_granularity = MAX(limits->bufferImageGranularity, 1);
+    arena->non_coherent_atom_size = MAX(limits->nonCoherentAtomSize, 1);
+    pthread_mutex_init(&arena->mutex, NULL);
+    cru_vec_init(&arena->blocks);
+
+    t_cleanup_push_callback(destroy_arena, arena);
+
+    return arena;
+}
+
+/// Carve \a size bytes aligned to \a alignment out of the block. Return false
+/// if no free range is large enough.
+static bool
+block_alloc(struct block *b, VkDeviceSize size, VkDeviceSize alignment,
+            VkDeviceSize *offset)
+{
+    for (size_t i = 0; i < b->free_ranges.len; i++) {
+        struct free_range *r = &b->free_ranges.data[i];
+        const VkDeviceSize start = align_u64(r->offset, alignment);
+        const VkDeviceSize end = r->offset + r->size;
+
+        if (start > end || end - start < size)
+            continue;
+
+        const struct free_range before = { r->offset, start - r->offset };
+        const struct free_range after = { start + size, end - start - size };
+
+        if (before.size > 0 && after.size > 0) {
+            // Split the range in two.
+            cru_vec_push(&b->free_ranges, 1);
+            r = &b->free_ranges.data[i];
+            memmove(r + 1, r,
+                    (b->free_ranges.len - i - 1) * sizeof(*r));
+            r[0] = before;
+            r[1] = after;
+        } else if (before.size > 0) {
+            *r = before;
+        } else if (after.size > 0) {
+            *r = after;
+        } else {
+            memmove(r, r + 1, (b->free_ranges.len - i - 1) * sizeof(*r));
+            cru_vec_pop(&b->free_ranges, 1);
+        }
+
+        b->used += size;
+        b->allocation_count++;
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+static void
+block_free(struct block *b, VkDeviceSize offset, VkDeviceSize size)
+{
+    struct free_range_vec *v = &b->free_ranges;
+    size_t i = 0;
+
+    while (i < v->len && v->data[i].offset < offset)
+        i++;
+
+    const bool merge_prev =
+        i > 0 && v->data[i - 1].offset + v->data[i - 1].size == offset;
+    const bool merge_next =
+        i < v->len && offset + size == v->data[i].offset;
+
+    if (merge_prev && merge_next) {
+        v->data[i - 1].size += size + v->data[i].size;
+        memmove(&v->data[i], &v->data[i + 1],
+                (v->len - i - 1) * sizeof(v->data[0]));
+        cru_vec_pop(v, 1);
+    } else if (merge_prev) {
+        v->data[i - 1].size += size;
+    } else if (merge_next) {
+        v->data[i].offset = offset;
+        v->data[i].size += size;
+    } else {
+        cru_vec_push(v, 1);
+        memmove(&v->data[i + 1], &v->data[i],
+                (v->len - i - 1) * sizeof(v->data[0]));
+        v->data[i] = (struct free_range) { offset, size };
+    }
+
+    b->used -= size;
+    b->allocation_count--;
+}
+
+static struct block *
+create_block(QoMemoryArena *arena, uint32_t memory_type_index, bool image,
+             VkDeviceSize min_size)
+{
+    const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
+    const uint32_t heap = props->memoryTypes[memory_type_index].heapIndex;
+
+    // Don't let a few blocks exhaust a small heap, such as a BAR heap.
+    VkDeviceSize size = MIN(arena->block_size,
+                            props->memoryHeaps[heap].size / 8);
+    size = MAX(size, min_size);
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult result = vkAllocateMemory(arena->device,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = size,
+            .memoryTypeIndex = memory_type_index,
+        }, NULL, &memory);
+    t_assert(result == VK_SUCCESS);
+    t_assert(memory != VK_NULL_HANDLE);
+
+    struct block *b = xzalloc(sizeof(*b));
+    b->memory = memory;
+    b->memory_type_index = memory_type_index;
+    b->image = image;
+    b->size = size;
+    cru_vec_init(&b->free_ranges);
+    *cru_vec_push(&b->free_ranges, 1) = (struct free_range) { 0, size };
+
+    *cru_vec_push(&arena->blocks, 1) = b;
+
+    return b;
+}
+
+static struct block *
+find_block(QoMemoryArena *arena, VkDeviceMemory memory)
+{
+    struct block **b;
+
+    cru_vec_foreach(b, &arena->blocks) {
+        if ((*b)->memory == memory)
+            return *b;
+    }
+
+    return NULL;
+}
+
+QoSubAllocation
+__qoArenaAllocMemory(QoMemoryArena *arena,
+                     const VkMemoryRequirements *mem_reqs, bool image,
+                     const QoMemoryAllocateFromRequirementsInfo *info)
+{
+    const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
+
+    // The blocks are plain allocations. Dedicated or exported memory needs
+    // its own VkDeviceMemory.
+    t_assertf(info->pNext == NULL,
+              "suballocations can't chain allocation structs");
+
+    uint32_t type = info->memoryTypeIndex;
+    if (type == QO_MEMORY_TYPE_INDEX_INVALID)
+        type = qoFindMemoryTypeIndex(mem_reqs, info->properties);
+
+    t_assert(type != QO_MEMORY_TYPE_INDEX_INVALID);
+    t_assert((1 << type) & mem_reqs->memoryTypeBits);
+
+    VkDeviceSize size = MAX(info->allocationSize, mem_reqs->size);
+    VkDeviceSize alignment = MAX(mem_reqs->alignment, 1);
+
+    // Pad images to whole pages of bufferImageGranularity so that a linear
+    // image never shares a page with an optimal one.
+    if (image) {
+        alignment = MAX(alignment, arena->buffer_image_granularity);
+        size = align_u64(size, arena->buffer_image_granularity);
+    }
+
+    // Keep flushes and invalidates of one allocation from touching its
+    // neighbors.
+    const VkMemoryPropertyFlags flags = props->memoryTypes[type].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+        !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        alignment = MAX(alignment, arena->non_coherent_atom_size);
+        size = align_u64(size, arena->non_coherent_atom_size);
+    }
+
+    QoSubAllocation alloc = { .size = size };
+
+    pthread_mutex_lock(&arena->mutex);
+
+    struct block **it;
+    struct block *b = NULL;
+
+    cru_vec_foreach(it, &arena->blocks) {
+        if ((*it)->memory_type_index == type && (*it)->image == image &&
+            block_alloc(*it, size, alignment, &alloc.offset)) {
+            b = *it;
+            break;
+        }
+    }
+
+    if (!b) {
+        b = create_block(arena, type, image, size);
+        bool ok = block_alloc(b, size, alignment, &alloc.offset);
+        assert(ok);
+        (void) ok;
+    }
+
+    alloc.memory = b->memory;
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return alloc;
+}
+
+QoSubAllocation
+__qoArenaAllocBufferMemory(QoMemoryArena *arena, VkBuffer buffer,
+                           const QoMemoryAllocateFromRequirementsInfo *info)
+{
+    VkMemoryRequirements mem_reqs =
+        qoGetBufferMemoryRequirements(arena->device, buffer);
+
+    QoSubAllocation alloc =
+        __qoArenaAllocMemory(arena, &mem_reqs, false, info);
+    qoBindBufferMemory(arena->device, buffer, alloc.memory, alloc.offset);
+
+    return alloc;
+}
+
+QoSubAllocation
+__qoArenaAllocImageMemory(QoMemoryArena *arena, VkImage image,
+                          const QoMemoryAllocateFromRequirementsInfo *info)
+{
+    VkMemoryRequirements mem_reqs =
+        qoGetImageMemoryRequirements(arena->device, image);
+
+    QoSubAllocation alloc =
+        __qoArenaAllocMemory(arena, &mem_reqs, true, info);
+    qoBindImageMemory(arena->device, image, alloc.memory, alloc.offset);
+
+    return alloc;
+}
+
+/// Return the sub-allocation to the arena. The blocks themselves are kept
+/// until the arena is destroyed.
+void
+qoArenaFree(QoMemoryArena *arena, const QoSubAllocation *alloc)
+{
+    pthread_mutex_lock(&arena->mutex);
+
+    struct block *b = find_block(arena, alloc->memory);
+    t_assert(b);
+    block_free(b, alloc->offset, alloc->size);
+
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+/// Return a CPU pointer to the sub-allocation. Each block is mapped once and
+/// stays mapped, so sub-allocations that share a block can be mapped at the
+/// same time.
+void *
+qoArenaMapMemory(QoMemoryArena *arena, const QoSubAllocation *alloc)
+{
+    pthread_mutex_lock(&arena->mutex);
+
+    struct block *b = find_block(arena, alloc->memory);
+    t_assert(b);
+
+    if (!b->map) {
+        VkResult result = vkMapMemory(arena->device, b->memory, 0,
+                                      VK_WHOLE_SIZE, 0, &b->map);
+        t_assert(result == VK_SUCCESS);
+        t_assert(b->map);
+    }
+
+    void *map = (char *) b->map + alloc->offset;
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return map;
+}
+
+void
+qoGetMemoryArenaStats(QoMemoryArena *arena, QoMemoryArenaStats *stats)
+{
+    struct block **b;
+    struct free_range *r;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&arena->mutex);
+
+    cru_vec_foreach(b, &arena->blocks) {
+        stats->blockCount++;
+        stats->allocationCount += (*b)->allocation_count;
+        stats->blockBytes += (*b)->size;
+        stats->usedBytes += (*b)->used;
+
+        cru_vec_foreach(r, &(*b)->free_ranges) {
+            stats->freeRangeCount++;
+            stats->largestFreeRange = MAX(stats->largestFreeRange, r->size);
+        }
+    }
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    const VkDeviceSize free_bytes = stats->blockBytes - stats->usedBytes;
+
+    if (stats->blockBytes > 0)
+        stats->utilization = (float) stats->usedBytes / stats->blockBytes;
+
+    if (free_bytes > 0) {
+        stats->fragmentation =
+            1.0f - (float) stats->largestFreeRange / free_bytes;
+    }
+}
@@ -20,21 +20,25 @@
 // IN THE SOFTWARE.
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "qonos/qonos.h"
 #include "src/qonos/qonos_pipeline-spirv.h"
 #include "tapi/t_cleanup.h"
 #include "tapi/t_data.h"
 #include "tapi/t_result.h"
+#include "util/log.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
 
 #define NUM_SHADER_STAGES 6
 
-VkPipeline
-qoCreateGraphicsPipeline(VkDevice device,
-                         VkPipelineCache pipeline_cache,
-                         const QoExtraGraphicsPipelineCreateInfo *extra)
-{
+/// Storage for the default state that fill_graphics_pipeline_info() points
+/// the create info at. It must not move once filled.
+struct graphics_pipeline_state {
     VkGraphicsPipelineCreateInfo pipeline_info;
     VkPipelineInputAssemblyStateCreateInfo ia_info;
     VkViewport viewport;
@@ -50,8 +54,48 @@ qoCreateGraphicsPipeline(VkDevice device,
     // QoExtraGraphicsPipelineCreateInfo.
     VkDynamicState dynamic_states[32];
     VkPipelineDynamicStateCreateInfo dy_info;
-    VkPipeline pipeline;
-    VkResult result;
+};
+
+static const VkPipelineVertexInputStateCreateInfo default_vi_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    .vertexBindingDescriptionCount = 2,
+    .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
+        {
+            .binding = 0,
+            .stride = 8,
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        },
+        {
+            .binding = 1,
+            .stride = 16,
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        }
+    },
+    .vertexAttributeDescriptionCount = 2,
+    .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
+        {
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = 0
+        },
+        {
+            .location = 1,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = 0
+        }
+    }
+};
+
+/// Fill in the defaults of a graphics pipeline. Creates the default shaders
+/// if needed, so it must run on a test thread.
+static void
+fill_graphics_pipeline_info(VkDevice device,
+                            const QoExtraGraphicsPipelineCreateInfo *extra,
+                            struct graphics_pipeline_state *st)
+{
+    VkGraphicsPipelineCreateInfo pipeline_info;
 
     if (extra->pNext) {
         // We must make a copy so that we can change the pNext pointer.
@@ -64,88 +108,88 @@ qoCreateGraphicsPipeline(VkDevice device,
     };
 
     if (pipeline_info.pInputAssemblyState == NULL) {
-        ia_info = (VkPipelineInputAssemblyStateCreateInfo) {
+        st->ia_info = (VkPipelineInputAssemblyStateCreateInfo) {
             QO_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO_DEFAULTS,
             .topology = extra->topology,
         };
-        pipeline_info.pInputAssemblyState = &ia_info;
+        pipeline_info.pInputAssemblyState = &st->ia_info;
     }
 
     if (pipeline_info.pRasterizationState == NULL) {
-        rs_info = (VkPipelineRasterizationStateCreateInfo) {
+        st->rs_info = (VkPipelineRasterizationStateCreateInfo) {
             QO_PIPELINE_RASTERIZATION_STATE_CREATE_INFO_DEFAULTS,
         };
-        pipeline_info.pRasterizationState = &rs_info;
+        pipeline_info.pRasterizationState = &st->rs_info;
     }
 
     if (!pipeline_info.pRasterizationState->rasterizerDiscardEnable &&
         pipeline_info.pViewportState == NULL) {
-        vp_info = (VkPipelineViewportStateCreateInfo) {
+        st->vp_info = (VkPipelineViewportStateCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
             .viewportCount = 1,
             .scissorCount = 1,
         };
 
         if (!(extra->dynamicStates & (1u << VK_DYNAMIC_STATE_VIEWPORT))) {
-            viewport = (VkViewport) {
+            st->viewport = (VkViewport) {
                 0.0, 0.0,
                 t_width, t_height,
                 0.0, 1.0
             };
-            vp_info.pViewports = &viewport;
+            st->vp_info.pViewports = &st->viewport;
         }
 
         if (!(extra->dynamicStates & (1u << VK_DYNAMIC_STATE_SCISSOR))) {
-            scissor = (VkRect2D) {
+            st->scissor = (VkRect2D) {
                 { 0, 0 },
                 {t_width, t_height }
             };
-            vp_info.pScissors = &scissor;
+            st->vp_info.pScissors = &st->scissor;
         }
 
-        pipeline_info.pViewportState = &vp_info;
+        pipeline_info.pViewportState = &st->vp_info;
     }
 
     if (pipeline_info.pMultisampleState == NULL) {
-        ms_info = (VkPipelineMultisampleStateCreateInfo) {
+        st->ms_info = (VkPipelineMultisampleStateCreateInfo) {
             QO_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO_DEFAULTS,
         };
-        pipeline_info.pMultisampleState = &ms_info;
+        pipeline_info.pMultisampleState = &st->ms_info;
     }
 
     if (pipeline_info.pDepthStencilState == NULL) {
-        ds_info = (VkPipelineDepthStencilStateCreateInfo) {
+        st->ds_info = (VkPipelineDepthStencilStateCreateInfo) {
             QO_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO_DEFAULTS,
         };
-        pipeline_info.pDepthStencilState = &ds_info;
+        pipeline_info.pDepthStencilState = &st->ds_info;
     }
 
     if (pipeline_info.pColorBlendState == NULL) {
-        cb_att = (VkPipelineColorBlendAttachmentState) {
+        st->cb_att = (VkPipelineColorBlendAttachmentState) {
             QO_PIPELINE_COLOR_BLEND_ATTACHMENT_STATE_DEFAULTS,
         };
-        cb_info = (VkPipelineColorBlendStateCreateInfo) {
+        st->cb_info = (VkPipelineColorBlendStateCreateInfo) {
             QO_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO_DEFAULTS,
             .attachmentCount = 1,
-            .pAttachments = &cb_att,
+            .pAttachments = &st->cb_att,
         };
-        pipeline_info.pColorBlendState = &cb_info;
+        pipeline_info.pColorBlendState = &st->cb_info;
     }
 
     if (pipeline_info.pDynamicState == NULL) {
         int count = 0;
         for (int s = 0; s < 32; s++) {
             if (extra->dynamicStates & (1u << s))
-                dynamic_states[count++] = s;
+                st->dynamic_states[count++] = s;
         }
 
         if (count > 0) {
-           dy_info = (VkPipelineDynamicStateCreateInfo) {
+           st->dy_info = (VkPipelineDynamicStateCreateInfo) {
                .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
                .dynamicStateCount = count,
-               .pDynamicStates = dynamic_states,
+               .pDynamicStates = st->dynamic_states,
            };
-           pipeline_info.pDynamicState = &dy_info;
+           pipeline_info.pDynamicState = &st->dy_info;
         }
     }
 
@@ -164,50 +208,18 @@ qoCreateGraphicsPipeline(VkDevice device,
         }
     }
 
-    VkPipelineVertexInputStateCreateInfo vi_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 2,
-        .pVertexBindingDescriptions = (VkVertexInputBindingDescription[]) {
-            {
-                .binding = 0,
-                .stride = 8,
-                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
-            },
-            {
-                .binding = 1,
-                .stride = 16,
-                .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
-            }
-        },
-        .vertexAttributeDescriptionCount = 2,
-        .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[]) {
-            {
-                .location = 0,
-                .binding = 0,
-                .format = VK_FORMAT_R32G32_SFLOAT,
-                .offset = 0
-            },
-            {
-                .location = 1,
-                .binding = 1,
-                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                .offset = 0
-            }
-        }
-    };
-
     if (pipeline_info.pVertexInputState == NULL) {
         /* They should be using one of our shaders if they use this */
         assert(!has_vs || !has_fs);
-        pipeline_info.pVertexInputState = &vi_info;
+        pipeline_info.pVertexInputState = &default_vi_info;
     }
 
     if (!has_vs || !has_fs || extra->geometryShader != VK_NULL_HANDLE) {
         /* Make a copy of the shader stages so that we can modify it */
         assert(pipeline_info.stageCount < NUM_SHADER_STAGES);
-        memcpy(stage_info, pipeline_info.pStages,
+        memcpy(st->stage_info, pipeline_info.pStages,
                pipeline_info.stageCount * sizeof(*pipeline_info.pStages));
-        pipeline_info.pStages = stage_info;
+        pipeline_info.pStages = st->stage_info;
     }
 
     if (!has_vs) {
@@ -226,7 +238,7 @@ qoCreateGraphicsPipeline(VkDevice device,
             );
         }
 
-        stage_info[pipeline_info.stageCount++] =
+        st->stage_info[pipeline_info.stageCount++] =
             (VkPipelineShaderStageCreateInfo) {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .stage = VK_SHADER_STAGE_VERTEX_BIT,
@@ -239,7 +251,7 @@ qoCreateGraphicsPipeline(VkDevice device,
     if (extra->geometryShader != VK_NULL_HANDLE) {
         // We're assuming here that they didn't try to set the geometry
         // shader both ways (through extra and normally).
-        stage_info[pipeline_info.stageCount++] =
+        st->stage_info[pipeline_info.stageCount++] =
             (VkPipelineShaderStageCreateInfo) {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .stage = VK_SHADER_STAGE_GEOMETRY_BIT,
@@ -263,7 +275,7 @@ qoCreateGraphicsPipeline(VkDevice device,
             );
         }
 
-        stage_info[pipeline_info.stageCount++] =
+        st->stage_info[pipeline_info.stageCount++] =
             (VkPipelineShaderStageCreateInfo) {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
@@ -273,8 +285,22 @@ qoCreateGraphicsPipeline(VkDevice device,
             };
     }
 
+    st->pipeline_info = pipeline_info;
+}
+
+VkPipeline
+qoCreateGraphicsPipeline(VkDevice device,
+                         VkPipelineCache pipeline_cache,
+                         const QoExtraGraphicsPipelineCreateInfo *extra)
+{
+    struct graphics_pipeline_state st;
+    VkPipeline pipeline;
+    VkResult result;
+
+    fill_graphics_pipeline_info(device, extra, &st);
+
     result = vkCreateGraphicsPipelines(device, pipeline_cache,
-                                       1, &pipeline_info, NULL, &pipeline);
+                                       1, &st.pipeline_info, NULL, &pipeline);
 
     t_assert(result == VK_SUCCESS);
     t_assert(pipeline != VK_NULL_HANDLE);
@@ -282,3 +308,234 @@ qoCreateGraphicsPipeline(VkDevice device,
 
     return pipeline;
 }
+
+/// A batch of pipelines that worker threads create one at a time.
+struct pipeline_batch {
+    VkDevice device;
+    VkPipelineCache pipeline_cache;
+    uint32_t count;
+    const VkGraphicsPipelineCreateInfo *graphics_infos;
+    const VkComputePipelineCreateInfo *compute_infos;
+    VkPipeline *pipelines;
+    VkResult *results;
+
+    atomic_uint next;
+};
+
+/// Create pipelines until none is left to claim.
+static void *
+create_batch_pipelines(void *arg)
+{
+    struct pipeline_batch *b = arg;
+
+    for (;;) {
+        const uint32_t i = atomic_fetch_add(&b->next, 1);
+        if (i >= b->count)
+            break;
+
+        if (b->graphics_infos) {
+            b->results[i] = vkCreateGraphicsPipelines(b->device,
+                b->pipeline_cache, 1, &b->graphics_infos[i], NULL,
+                &b->pipelines[i]);
+        } else {
+            b->results[i] = vkCreateComputePipelines(b->device,
+                b->pipeline_cache, 1, &b->compute_infos[i], NULL,
+                &b->pipelines[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/// Create the pipelines across threads, one pipeline per call so that the
+/// driver compiles them in parallel. The pipeline cache is internally
+/// synchronized, so the threads share it. Each pipeline and its VkResult are
+/// written to their own slots, so the output order doesn't depend on the
+/// scheduling.
+///
+/// The workers are plain threads rather than test threads, because they
+/// only call the driver. The calling thread claims pipelines too, so the
+/// batch completes even if no worker ever gets to run, and it joins the
+/// workers before returning, so that none outlives the batch. If a thread
+/// can't be started, the others do its share.
+///
+/// The cleanups are pushed here, on the calling thread, because each test
+/// thread has its own cleanup stack. Return VK_SUCCESS if every pipeline
+/// was created, and otherwise the result of the first one that failed.
+static VkResult
+create_pipeline_batch(struct pipeline_batch *b)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t num_threads = CLAMP(num_cpus, 1, b->count);
+
+    if (num_threads == 1) {
+        // No parallelism to gain. Let the driver see the whole batch.
+        VkResult result;
+
+        if (b->graphics_infos) {
+            result = vkCreateGraphicsPipelines(b->device, b->pipeline_cache,
+                                               b->count, b->graphics_infos,
+                                               NULL, b->pipelines);
+        } else {
+            result = vkCreateComputePipelines(b->device, b->pipeline_cache,
+                                              b->count, b->compute_infos,
+                                              NULL, b->pipelines);
+        }
+
+        // On failure the spec sets the pipelines that failed to
+        // VK_NULL_HANDLE, but doesn't say which error each one hit.
+        for (uint32_t i = 0; i < b->count; i++) {
+            b->results[i] = b->pipelines[i] != VK_NULL_HANDLE ?
+                            VK_SUCCESS : result;
+        }
+    } else {
+        pthread_t *threads = xmallocn(num_threads - 1, sizeof(*threads));
+        uint32_t num_started = 0;
+
+        atomic_init(&b->next, 0);
+
+        for (uint32_t i = 0; i < num_threads - 1; i++) {
+            if (pthread_create(&threads[num_started], NULL,
+                               create_batch_pipelines, b) != 0)
+                break;
+            num_started++;
+        }
+
+        create_batch_pipelines(b);
+
+        for (uint32_t i = 0; i < num_started; i++)
+            pthread_join(threads[i], NULL);
+
+        free(threads);
+    }
+
+    VkResult first_failure = VK_SUCCESS;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        if (b->results[i] == VK_SUCCESS && b->pipelines[i] != VK_NULL_HANDLE) {
+            t_cleanup_push_vk_pipeline(b->device, b->pipelines[i]);
+        } else {
+            if (b->results[i] == VK_SUCCESS)
+                b->results[i] = VK_ERROR_UNKNOWN;
+            if (first_failure == VK_SUCCESS)
+                first_failure = b->results[i];
+            b->pipelines[i] = VK_NULL_HANDLE;
+        }
+    }
+
+    return first_failure;
+}
+
+/// Fail the test if any pipeline of the batch failed, after logging each
+/// failure. Free \a results first, because a failed assertion doesn't
+/// return.
+static void
+assert_pipeline_batch(uint32_t count, VkResult *results)
+{
+    uint32_t num_failed = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (results[i] != VK_SUCCESS) {
+            loge("pipeline %u of %u failed with VkResult %d",
+                 i, count, results[i]);
+            num_failed++;
+        }
+    }
+
+    free(results);
+
+    t_assertf(num_failed == 0, "failed to create %u of %u pipelines",
+              num_failed, count);
+}
+
+/// \brief Create many graphics pipelines at once.
+///
+/// Each info is filled in with the same defaults as qoCreateGraphicsPipeline().
+/// pipelines[i] is created from infos[i].
+void
+qoCreateGraphicsPipelines(VkDevice device,
+                          VkPipelineCache pipeline_cache,
+                          uint32_t count,
+                          const QoExtraGraphicsPipelineCreateInfo *infos,
+                          VkPipeline *pipelines)
+{
+    if (count == 0)
+        return;
+
+    struct graphics_pipeline_state *states =
+        xmallocn(count, sizeof(*states));
+    VkGraphicsPipelineCreateInfo *graphics_infos =
+        xmallocn(count, sizeof(*graphics_infos));
+
+    // This may create the default shaders, which needs a test thread with
+    // a cleanup stack, so do it before fanning out.
+    for (uint32_t i = 0; i < count; i++) {
+        fill_graphics_pipeline_info(device, &infos[i], &states[i]);
+        graphics_infos[i] = states[i].pipeline_info;
+    }
+
+    VkResult *results = xmallocn(count, sizeof(*results));
+
+    create_pipeline_batch(&(struct pipeline_batch) {
+        .device = device,
+        .pipeline_cache = pipeline_cache,
+        .count = count,
+        .graphics_infos = graphics_infos,
+        .pipelines = pipelines,
+        .results = results,
+    });
+
+    free(graphics_infos);
+    free(states);
+
+    assert_pipeline_batch(count, results);
+}
+
+/// \brief Create many compute pipelines at once.
+///
+/// pipelines[i] is created from infos[i]. Fail the test if any pipeline
+/// can't be created.
+void
+qoCreateComputePipelines(VkDevice device,
+                         VkPipelineCache pipeline_cache,
+                         uint32_t count,
+                         const VkComputePipelineCreateInfo *infos,
+                         VkPipeline *pipelines)
+{
+    if (count == 0)
+        return;
+
+    VkResult *results = xmallocn(count, sizeof(*results));
+
+    qoTryCreateComputePipelines(device, pipeline_cache, count, infos,
+                                pipelines, results);
+
+    assert_pipeline_batch(count, results);
+}
+
+/// \brief Like qoCreateComputePipelines(), but report failures instead of
+/// failing the test.
+///
+/// results[i] is the result of creating pipelines[i]. A pipeline that
+/// failed is VK_NULL_HANDLE. Return VK_SUCCESS if every pipeline was
+/// created, and otherwise the result of the first one that failed.
+VkResult
+qoTryCreateComputePipelines(VkDevice device,
+                            VkPipelineCache pipeline_cache,
+                            uint32_t count,
+                            const VkComputePipelineCreateInfo *infos,
+                            VkPipeline *pipelines,
+                            VkResult *results)
+{
+    if (count == 0)
+        return VK_SUCCESS;
+
+    return create_pipeline_batch(&(struct pipeline_batch) {
+        .device = device,
+        .pipeline_cache = pipeline_cache,
+        .count = count,
+        .compute_infos = infos,
+        .pipelines = pipelines,
+        .results = results,
+    });
+}
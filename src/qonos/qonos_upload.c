@@ -0,0 +1,543 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "qonos/qonos.h"
+#include "tapi/t_cleanup.h"
+#include "tapi/t_data.h"
+#include "tapi/t_result.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+/// The ring is split into segments, each with its own command buffer and
+/// fence. Uploads are appended to the current segment. A full segment is
+/// submitted, and the CPU moves on to the next one while the GPU copies, so
+/// large uploads pipeline the memcpy with the copy.
+#define NUM_SEGMENTS 4
+#define SEGMENT_SIZE (4 * 1024 * 1024)
+
+/// bufferOffset of a buffer-to-image copy must be a multiple of the texel
+/// block size, which is 1, 2, 3, 4, 6, 8, 12 or 16 for the formats tests
+/// upload. 48 is their least common multiple.
+#define IMAGE_COPY_ALIGNMENT 48
+
+struct segment {
+    VkCommandBuffer cmd;
+    VkFence fence;
+    VkDeviceSize base;
+    VkDeviceSize used;
+
+    /// The command buffer has begun and may hold copies.
+    bool recording;
+
+    /// Submitted, and the fence hasn't been waited on.
+    bool pending;
+};
+
+struct QoUploadRing {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_family_index;
+
+    pthread_mutex_t mutex;
+
+    /// The Vulkan objects are created on the first upload, so tests that
+    /// never upload don't pay for the staging memory.
+    bool initialized;
+
+    VkCommandPool cmd_pool;
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void *map;
+    bool coherent;
+    VkDeviceSize buffer_copy_alignment;
+    VkDeviceSize image_copy_alignment;
+
+    struct segment segments[NUM_SEGMENTS];
+    uint32_t current;
+};
+
+/// t_assert() for code that holds the ring's lock. A failed assertion doesn't
+/// return, so release the lock first. Other threads, and destroy_ring(),
+/// still need it.
+#define ring_assert(ring, cond) \
+    do { \
+        if (!(cond)) { \
+            pthread_mutex_unlock(&(ring)->mutex); \
+            __t_assert(__FILE__, __LINE__, false, #cond); \
+        } \
+    } while (0)
+
+static VkDeviceSize
+align_npot(VkDeviceSize n, VkDeviceSize a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static VkDeviceSize
+gcd(VkDeviceSize a, VkDeviceSize b)
+{
+    while (b) {
+        VkDeviceSize t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static void
+wait_segment(QoUploadRing *ring, struct segment *seg)
+{
+    if (!seg->pending)
+        return;
+
+    VkResult result = vkWaitForFences(ring->device, 1, &seg->fence, true,
+                                      UINT64_MAX);
+    ring_assert(ring, result == VK_SUCCESS);
+    seg->pending = false;
+
+    result = vkResetFences(ring->device, 1, &seg->fence);
+    ring_assert(ring, result == VK_SUCCESS);
+}
+
+static void
+destroy_ring(void *data)
+{
+    QoUploadRing *ring = data;
+
+    // init_ring() may have failed part way, so destroy whatever exists.
+    // Destroying VK_NULL_HANDLE does nothing.
+    for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+        struct segment *seg = &ring->segments[i];
+
+        if (seg->pending)
+            vkWaitForFences(ring->device, 1, &seg->fence, true, UINT64_MAX);
+
+        vkDestroyFence(ring->device, seg->fence, NULL);
+    }
+
+    vkDestroyCommandPool(ring->device, ring->cmd_pool, NULL);
+    vkDestroyBuffer(ring->device, ring->buffer, NULL);
+    vkFreeMemory(ring->device, ring->memory, NULL);
+
+    pthread_mutex_destroy(&ring->mutex);
+    free(ring);
+}
+
+/// Create the upload ring for a queue. Nothing is allocated from the device
+/// until the first upload.
+QoUploadRing *
+qoCreateUploadRing(VkDevice dev, VkQueue queue, uint32_t queue_family_index)
+{
+    QoUploadRing *ring = xzalloc(sizeof(*ring));
+
+    ring->device = dev;
+    ring->queue = queue;
+    ring->queue_family_index = queue_family_index;
+    pthread_mutex_init(&ring->mutex, NULL);
+
+    t_cleanup_push_callback(destroy_ring, ring);
+
+    return ring;
+}
+
+static void
+init_ring(QoUploadRing *ring)
+{
+    VkDevice dev = ring->device;
+    VkResult result;
+
+    result = vkCreateCommandPool(dev,
+        &(VkCommandPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                     VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = ring->queue_family_index,
+        }, NULL, &ring->cmd_pool);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    result = vkCreateBuffer(dev,
+        &(VkBufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = NUM_SEGMENTS * SEGMENT_SIZE,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        }, NULL, &ring->buffer);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    // The CPU only writes the staging memory, so uncached write-combined
+    // memory is fine. Prefer coherent memory to skip the flushes.
+    VkMemoryRequirements mem_reqs =
+        qoGetBufferMemoryRequirements(dev, ring->buffer);
+    uint32_t type = qoFindMemoryTypeIndex(&mem_reqs,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    ring->coherent = true;
+
+    if (type == QO_MEMORY_TYPE_INDEX_INVALID) {
+        type = qoFindMemoryTypeIndex(&mem_reqs,
+                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        ring->coherent = false;
+    }
+
+    ring_assert(ring, type != QO_MEMORY_TYPE_INDEX_INVALID);
+
+    result = vkAllocateMemory(dev,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = mem_reqs.size,
+            .memoryTypeIndex = type,
+        }, NULL, &ring->memory);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    result = vkBindBufferMemory(dev, ring->buffer, ring->memory, 0);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    result = vkMapMemory(dev, ring->memory, 0, VK_WHOLE_SIZE, 0, &ring->map);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    const VkPhysicalDeviceLimits *limits = &t_physical_dev_props->limits;
+    VkDeviceSize align = MAX(limits->optimalBufferCopyOffsetAlignment, 1);
+    if (!ring->coherent)
+        align = MAX(align, limits->nonCoherentAtomSize);
+
+    ring->buffer_copy_alignment = align;
+    ring->image_copy_alignment =
+        align / gcd(align, IMAGE_COPY_ALIGNMENT) * IMAGE_COPY_ALIGNMENT;
+
+    for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+        struct segment *seg = &ring->segments[i];
+
+        result = vkAllocateCommandBuffers(dev,
+            &(VkCommandBufferAllocateInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = ring->cmd_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+            }, &seg->cmd);
+        ring_assert(ring, result == VK_SUCCESS);
+
+        result = vkCreateFence(dev,
+            &(VkFenceCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            }, NULL, &seg->fence);
+        ring_assert(ring, result == VK_SUCCESS);
+
+        seg->base = i * SEGMENT_SIZE;
+    }
+
+    ring->initialized = true;
+}
+
+static void
+submit_segment(QoUploadRing *ring, struct segment *seg)
+{
+    VkResult result;
+
+    if (!seg->recording)
+        return;
+
+    // Make the copies visible to everything submitted to the queue later.
+    vkCmdPipelineBarrier(seg->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1,
+        &(VkMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                             VK_ACCESS_MEMORY_WRITE_BIT,
+        }, 0, NULL, 0, NULL);
+
+    result = vkEndCommandBuffer(seg->cmd);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    if (!ring->coherent) {
+        result = vkFlushMappedMemoryRanges(ring->device, 1,
+            &(VkMappedMemoryRange) {
+                .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                .memory = ring->memory,
+                .offset = seg->base,
+                .size = SEGMENT_SIZE,
+            });
+        ring_assert(ring, result == VK_SUCCESS);
+    }
+
+    result = vkQueueSubmit(ring->queue, 1,
+        &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &seg->cmd,
+        }, seg->fence);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    seg->recording = false;
+    seg->pending = true;
+    ring->current = (ring->current + 1) % NUM_SEGMENTS;
+}
+
+/// Reserve \a size bytes of staging memory. Return the segment whose command
+/// buffer the copy must be recorded in.
+static struct segment *
+reserve(QoUploadRing *ring, VkDeviceSize size, VkDeviceSize alignment,
+        VkDeviceSize *offset)
+{
+    assert(ring->initialized);
+    assert(size <= SEGMENT_SIZE);
+
+    for (;;) {
+        struct segment *seg = &ring->segments[ring->current];
+
+        if (!seg->recording) {
+            // Wrap around only once the GPU is done with the segment.
+            wait_segment(ring, seg);
+
+            VkResult result = vkBeginCommandBuffer(seg->cmd,
+                &(VkCommandBufferBeginInfo) {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                });
+            ring_assert(ring, result == VK_SUCCESS);
+
+            seg->recording = true;
+            seg->used = 0;
+        }
+
+        VkDeviceSize start = align_npot(seg->used, alignment);
+        if (start + size <= SEGMENT_SIZE) {
+            seg->used = start + size;
+            *offset = seg->base + start;
+            return seg;
+        }
+
+        submit_segment(ring, seg);
+    }
+}
+
+static QoUploadRing *
+get_ring(VkDevice dev)
+{
+    QoUploadRing *ring = t_upload_ring;
+
+    t_assert(ring);
+    t_assert(dev == ring->device);
+
+    return ring;
+}
+
+/// Take the ring's lock, and create its Vulkan objects on first use.
+static void
+lock_ring(QoUploadRing *ring)
+{
+    pthread_mutex_lock(&ring->mutex);
+
+    if (!ring->initialized)
+        init_ring(ring);
+}
+
+void
+qoUploadBuffer(VkDevice dev, VkBuffer buffer, VkDeviceSize offset,
+               const void *data, VkDeviceSize size)
+{
+    QoUploadRing *ring = get_ring(dev);
+
+    lock_ring(ring);
+
+    // Split large uploads so that the GPU copies one chunk while the CPU
+    // fills the next.
+    while (size > 0) {
+        VkDeviceSize chunk = MIN(size, SEGMENT_SIZE);
+        VkDeviceSize staging_offset;
+
+        struct segment *seg = reserve(ring, chunk,
+                                      ring->buffer_copy_alignment,
+                                      &staging_offset);
+
+        memcpy((char *) ring->map + staging_offset, data, chunk);
+
+        vkCmdCopyBuffer(seg->cmd, ring->buffer, buffer, 1,
+            &(VkBufferCopy) {
+                .srcOffset = staging_offset,
+                .dstOffset = offset,
+                .size = chunk,
+            });
+
+        data = (const char *) data + chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+/// Upload an image that doesn't fit in a segment through a staging buffer of
+/// its own, and wait for the copy. Earlier uploads are submitted first, so
+/// the order of uploads is kept.
+static void
+upload_large_image(QoUploadRing *ring, VkImage image, const void *data,
+                   VkDeviceSize size, const VkBufferImageCopy *region,
+                   VkImageLayout layout)
+{
+    VkDevice dev = ring->device;
+    VkCommandBuffer cmd;
+    VkResult result;
+
+    // The qo helpers fail the test on error, so use them before taking the
+    // lock.
+    VkBuffer buffer = qoCreateBuffer(dev, .size = size,
+                                     .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    VkDeviceMemory mem = qoAllocBufferMemory(dev, buffer,
+        .properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    qoBindBufferMemory(dev, buffer, mem, 0);
+    memcpy(qoMapMemory(dev, mem, 0, size, 0), data, size);
+
+    lock_ring(ring);
+
+    submit_segment(ring, &ring->segments[ring->current]);
+
+    // The command pool belongs to the ring, so allocate from it under the
+    // lock.
+    result = vkAllocateCommandBuffers(dev,
+        &(VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = ring->cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        }, &cmd);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    result = vkBeginCommandBuffer(cmd,
+        &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        });
+    ring_assert(ring, result == VK_SUCCESS);
+
+    vkCmdCopyBufferToImage(cmd, buffer, image, layout, 1, region);
+
+    result = vkEndCommandBuffer(cmd);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    // Not qoQueueSubmit(), which would flush the ring and take its lock.
+    result = vkQueueSubmit(ring->queue, 1,
+        &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmd,
+        }, VK_NULL_HANDLE);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    result = vkQueueWaitIdle(ring->queue);
+    ring_assert(ring, result == VK_SUCCESS);
+
+    vkFreeCommandBuffers(dev, ring->cmd_pool, 1, &cmd);
+
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+void
+__qoUploadImage(VkDevice dev, VkImage image, const void *data,
+                VkDeviceSize size, const QoUploadImageInfo *info)
+{
+    QoUploadRing *ring = get_ring(dev);
+
+    t_assert(info->imageLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ||
+             info->imageLayout == VK_IMAGE_LAYOUT_GENERAL);
+
+    VkBufferImageCopy region = {
+        .bufferRowLength = info->bufferRowLength,
+        .bufferImageHeight = info->bufferImageHeight,
+        .imageSubresource = info->imageSubresource,
+        .imageOffset = info->imageOffset,
+        .imageExtent = info->imageExtent,
+    };
+
+    if (size > SEGMENT_SIZE) {
+        upload_large_image(ring, image, data, size, &region,
+                           info->imageLayout);
+        return;
+    }
+
+    lock_ring(ring);
+
+    VkDeviceSize staging_offset;
+    struct segment *seg = reserve(ring, size, ring->image_copy_alignment,
+                                  &staging_offset);
+
+    memcpy((char *) ring->map + staging_offset, data, size);
+    region.bufferOffset = staging_offset;
+
+    vkCmdCopyBufferToImage(seg->cmd, ring->buffer, image,
+                           info->imageLayout, 1, &region);
+
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+static void
+flush_ring(QoUploadRing *ring)
+{
+    pthread_mutex_lock(&ring->mutex);
+
+    if (ring->initialized)
+        submit_segment(ring, &ring->segments[ring->current]);
+
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+/// Submit the pending uploads. Work submitted to the upload queue after this
+/// sees the uploaded data.
+void
+qoFlushUploads(VkDevice dev)
+{
+    flush_ring(get_ring(dev));
+}
+
+/// Submit the pending uploads and wait for them, so that the data can be
+/// used from any queue.
+void
+qoFinishUploads(VkDevice dev)
+{
+    QoUploadRing *ring = get_ring(dev);
+
+    pthread_mutex_lock(&ring->mutex);
+
+    if (ring->initialized) {
+        submit_segment(ring, &ring->segments[ring->current]);
+
+        for (uint32_t i = 0; i < NUM_SEGMENTS; i++)
+            wait_segment(ring, &ring->segments[i]);
+    }
+
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+/// Called by qoQueueSubmit() so that uploads land before the work that uses
+/// them.
+void
+__qoFlushUploadsForQueue(VkQueue queue)
+{
+    QoUploadRing *ring = t_upload_ring;
+
+    if (ring && ring->queue == queue)
+        flush_ring(ring);
+}
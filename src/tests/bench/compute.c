@@ -0,0 +1,727 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Compute dispatch overhead and throughput
+///
+/// The dispatch tests record a command buffer full of empty dispatches and
+/// report both the CPU cost of recording them and the rate at which the GPU
+/// retires them. The remaining tests run a fixed amount of work with an
+/// ALU-, memory-, shared-memory- or subgroup-bound kernel and report the
+/// throughput from timestamp queries, sweeping the workgroup size where that
+/// is a free parameter.
+
+#include "tapi/t.h"
+#include "util/misc.h"
+#include <math.h>
+#include <time.h>
+
+#include "src/tests/bench/compute-spirv.h"
+
+#define MB (1024 * 1024)
+
+#define DISPATCHES_PER_CMD 4096
+#define DISPATCH_RUNS 4
+#define KERNEL_RUNS 4
+
+#define KERNEL_INVOCATIONS (1 << 20)
+#define ALU_ITERATIONS 256
+#define ALU_FLOPS_PER_ITERATION 16
+#define BANDWIDTH_SIZE (128 * MB)
+#define SHARED_ITERATIONS 256
+#define SUBGROUP_ITERATIONS 256
+
+static const uint32_t workgroup_sizes[] = {
+    32, 64, 128, 256, 512, 1024,
+};
+
+typedef struct bench_context {
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSet set;
+    VkQueryPool timestamps;
+} bench_context_t;
+
+static uint64_t
+gettime_ns()
+{
+    struct timespec current;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &current);
+    t_assert (ret >= 0);
+    if (ret < 0)
+        return 0;
+
+    return (uint64_t) current.tv_sec * 1000000000ULL + current.tv_nsec;
+}
+
+static VkBuffer
+create_device_buffer(VkDeviceSize size)
+{
+    VkBuffer buffer = qoCreateBuffer(t_device, .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    VkDeviceMemory mem = qoAllocBufferMemory(t_device, buffer,
+        .properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    qoBindBufferMemory(t_device, buffer, mem, 0);
+
+    return buffer;
+}
+
+/// Every kernel reads from the buffer at binding 0 and writes to the one at
+/// binding 1, each buffer_size bytes.
+static bench_context_t
+init_context(VkDeviceSize buffer_size)
+{
+    bench_context_t ctx;
+
+    if (!t_physical_dev_props->limits.timestampComputeAndGraphics)
+        t_skipf("timestamps not supported on compute queues");
+
+    ctx.set_layout = qoCreateDescriptorSetLayout(t_device,
+        .bindingCount = 2,
+        .pBindings = (VkDescriptorSetLayoutBinding[]) {
+            {
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            {
+                .binding = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+        });
+
+    ctx.pipeline_layout = qoCreatePipelineLayout(t_device,
+        .setLayoutCount = 1,
+        .pSetLayouts = &ctx.set_layout);
+
+    ctx.set = qoAllocateDescriptorSet(t_device,
+        .descriptorPool = t_descriptor_pool,
+        .pSetLayouts = &ctx.set_layout);
+
+    VkBuffer src = create_device_buffer(buffer_size);
+    VkBuffer dst = create_device_buffer(buffer_size);
+
+    vkUpdateDescriptorSets(t_device, 2,
+        (VkWriteDescriptorSet[]) {
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = ctx.set,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &(VkDescriptorBufferInfo) {
+                    .buffer = src,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+                },
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = ctx.set,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &(VkDescriptorBufferInfo) {
+                    .buffer = dst,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+                },
+            },
+        }, 0, NULL);
+
+    ctx.timestamps = qoCreateQueryPool(t_device,
+                                       .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                                       .queryCount = 2);
+
+    return ctx;
+}
+
+/// Specialization constant 0 is the workgroup width and 1 is the iteration
+/// count. Kernels that don't use one just ignore it.
+static const VkSpecializationMapEntry spec_entries[] = {
+    { 0, 0, sizeof(uint32_t) },
+    { 1, sizeof(uint32_t), sizeof(uint32_t) },
+};
+
+/// Fill \a info for the kernel. \a spec and \a spec_info must outlive
+/// \a info.
+static void
+fill_pipeline_info(const bench_context_t *ctx, VkShaderModule cs,
+                   uint32_t local_size, uint32_t iterations,
+                   uint32_t spec[2], VkSpecializationInfo *spec_info,
+                   VkComputePipelineCreateInfo *info)
+{
+    spec[0] = local_size;
+    spec[1] = iterations;
+
+    *spec_info = (VkSpecializationInfo) {
+        .mapEntryCount = ARRAY_LENGTH(spec_entries),
+        .pMapEntries = spec_entries,
+        .dataSize = 2 * sizeof(uint32_t),
+        .pData = spec,
+    };
+
+    *info = (VkComputePipelineCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = cs,
+            .pName = "main",
+            .pSpecializationInfo = spec_info,
+        },
+        .layout = ctx->pipeline_layout,
+    };
+}
+
+static VkPipeline
+create_pipeline(const bench_context_t *ctx, VkShaderModule cs,
+                uint32_t local_size, uint32_t iterations)
+{
+    uint32_t spec[2];
+    VkSpecializationInfo spec_info;
+    VkComputePipelineCreateInfo info;
+
+    fill_pipeline_info(ctx, cs, local_size, iterations, spec, &spec_info,
+                       &info);
+
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(t_device, t_pipeline_cache, 1,
+                                               &info, NULL, &pipeline);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_pipeline(t_device, pipeline);
+
+    return pipeline;
+}
+
+static void
+cmd_bind(const bench_context_t *ctx, VkCommandBuffer cmd, VkPipeline pipeline)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            ctx->pipeline_layout, 0, 1, &ctx->set, 0, NULL);
+}
+
+/// Submit cmd, wait for it and return the GPU time between the two
+/// timestamps it wrote.
+static double
+submit_and_time(const bench_context_t *ctx, VkCommandBuffer cmd)
+{
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+
+    uint64_t ts[2];
+    VkResult result = vkGetQueryPoolResults(t_device, ctx->timestamps, 0, 2,
+                                            sizeof(ts), ts, sizeof(ts[0]),
+                                            VK_QUERY_RESULT_64_BIT |
+                                            VK_QUERY_RESULT_WAIT_BIT);
+    t_assert(result == VK_SUCCESS);
+
+    return (ts[1] - ts[0]) * (double)t_physical_dev_props->limits.timestampPeriod;
+}
+
+/// Run a single dispatch of the pipeline KERNEL_RUNS times and return the
+/// best GPU time in nanoseconds. The first run doubles as a warm-up.
+static double
+time_kernel(const bench_context_t *ctx, VkPipeline pipeline,
+            uint32_t group_count)
+{
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdResetQueryPool(cmd, ctx->timestamps, 0, 2);
+    cmd_bind(ctx, cmd, pipeline);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        ctx->timestamps, 0);
+    vkCmdDispatch(cmd, group_count, 1, 1);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        ctx->timestamps, 1);
+    qoEndCommandBuffer(cmd);
+
+    double best_ns = INFINITY;
+    for (uint32_t run = 0; run < KERNEL_RUNS; run++)
+        best_ns = MIN(best_ns, submit_and_time(ctx, cmd));
+
+    return best_ns;
+}
+
+static bool
+workgroup_size_supported(uint32_t local_size)
+{
+    const VkPhysicalDeviceLimits *limits = &t_physical_dev_props->limits;
+
+    return local_size <= limits->maxComputeWorkGroupSize[0] &&
+           local_size <= limits->maxComputeWorkGroupInvocations;
+}
+
+/// Create the kernel's pipeline for each of workgroup_sizes[] in one batch,
+/// so that the driver compiles them in parallel. The pipelines of
+/// unsupported sizes are VK_NULL_HANDLE.
+static void
+create_workgroup_size_pipelines(const bench_context_t *ctx, VkShaderModule cs,
+                                uint32_t iterations, VkPipeline *pipelines)
+{
+    const uint32_t num_sizes = ARRAY_LENGTH(workgroup_sizes);
+    uint32_t spec[num_sizes][2];
+    VkSpecializationInfo spec_infos[num_sizes];
+    VkComputePipelineCreateInfo infos[num_sizes];
+    VkPipeline created[num_sizes];
+    uint32_t size_index[num_sizes];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < num_sizes; i++) {
+        pipelines[i] = VK_NULL_HANDLE;
+        if (!workgroup_size_supported(workgroup_sizes[i]))
+            continue;
+
+        fill_pipeline_info(ctx, cs, workgroup_sizes[i], iterations,
+                           spec[count], &spec_infos[count], &infos[count]);
+        size_index[count++] = i;
+    }
+
+    qoCreateComputePipelines(t_device, t_pipeline_cache, count, infos,
+                             created);
+
+    for (uint32_t i = 0; i < count; i++)
+        pipelines[size_index[i]] = created[i];
+}
+
+typedef struct dispatch_params {
+    bool indirect;
+    bool barrier;
+} dispatch_params_t;
+
+static void
+test_dispatch(void)
+{
+    const dispatch_params_t *params = t_user_data;
+    bench_context_t ctx = init_context(4096);
+
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x = 1) in;
+
+        void main() {
+        }
+    );
+    VkPipeline pipeline = create_pipeline(&ctx, cs, 1, 1);
+
+    VkBuffer indirect_buf = qoCreateBuffer(t_device,
+        .size = sizeof(VkDispatchIndirectCommand),
+        .usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    VkDeviceMemory indirect_mem = qoAllocBufferMemory(t_device, indirect_buf,
+        .properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    qoBindBufferMemory(t_device, indirect_buf, indirect_mem, 0);
+
+    VkDispatchIndirectCommand *indirect_map =
+        qoMapMemory(t_device, indirect_mem, 0,
+                    sizeof(VkDispatchIndirectCommand), 0);
+    *indirect_map = (VkDispatchIndirectCommand) { 1, 1, 1 };
+
+    uint64_t best_record_ns = UINT64_MAX;
+    double best_gpu_ns = INFINITY;
+
+    for (uint32_t run = 0; run < DISPATCH_RUNS; run++) {
+        VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+        qoBeginCommandBuffer(cmd);
+        vkCmdResetQueryPool(cmd, ctx.timestamps, 0, 2);
+        cmd_bind(&ctx, cmd, pipeline);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            ctx.timestamps, 0);
+
+        uint64_t start = gettime_ns();
+        for (uint32_t i = 0; i < DISPATCHES_PER_CMD; i++) {
+            if (params->indirect)
+                vkCmdDispatchIndirect(cmd, indirect_buf, 0);
+            else
+                vkCmdDispatch(cmd, 1, 1, 1);
+
+            if (params->barrier) {
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                    1, &(VkMemoryBarrier) {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                    }, 0, NULL, 0, NULL);
+            }
+        }
+        uint64_t record_ns = gettime_ns() - start;
+
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            ctx.timestamps, 1);
+        qoEndCommandBuffer(cmd);
+
+        best_record_ns = MIN(best_record_ns, record_ns);
+        best_gpu_ns = MIN(best_gpu_ns, submit_and_time(&ctx, cmd));
+    }
+
+    logi("%u %s dispatches%s: record %.1f ns/dispatch, "
+         "gpu %.1f ns/dispatch (%.0f dispatches/s)\n",
+         DISPATCHES_PER_CMD, params->indirect ? "indirect" : "direct",
+         params->barrier ? " with barriers" : "",
+         (double) best_record_ns / DISPATCHES_PER_CMD,
+         best_gpu_ns / DISPATCHES_PER_CMD,
+         DISPATCHES_PER_CMD * 1e9 / best_gpu_ns);
+}
+
+test_define {
+    .name = "bench.compute.dispatch.direct",
+    .start = test_dispatch,
+    .no_image = true,
+    .user_data = &(dispatch_params_t) {
+        .indirect = false,
+        .barrier = false,
+    },
+};
+
+test_define {
+    .name = "bench.compute.dispatch.direct-barrier",
+    .start = test_dispatch,
+    .no_image = true,
+    .user_data = &(dispatch_params_t) {
+        .indirect = false,
+        .barrier = true,
+    },
+};
+
+test_define {
+    .name = "bench.compute.dispatch.indirect",
+    .start = test_dispatch,
+    .no_image = true,
+    .user_data = &(dispatch_params_t) {
+        .indirect = true,
+        .barrier = false,
+    },
+};
+
+test_define {
+    .name = "bench.compute.dispatch.indirect-barrier",
+    .start = test_dispatch,
+    .no_image = true,
+    .user_data = &(dispatch_params_t) {
+        .indirect = true,
+        .barrier = true,
+    },
+};
+
+static void
+test_workgroup_size_alu(void)
+{
+    bench_context_t ctx = init_context(KERNEL_INVOCATIONS * 16);
+
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x_id = 0) in;
+        layout(constant_id = 1) const uint ITERATIONS = 1;
+
+        layout(set = 0, binding = 1, std430) buffer Dst {
+            vec4 dst[];
+        };
+
+        void main() {
+            vec4 a = vec4(gl_GlobalInvocationID.x) * 1e-6;
+            vec4 b = a + vec4(1.0, 2.0, 3.0, 4.0);
+
+            // Two dependent vec4 FMAs: 16 FLOPs per iteration.
+            for (uint i = 0; i < ITERATIONS; i++) {
+                a = fma(a, b, vec4(0.5));
+                b = fma(b, a, vec4(-0.5));
+            }
+
+            dst[gl_GlobalInvocationID.x] = a + b;
+        }
+    );
+
+    const double flops = (double) KERNEL_INVOCATIONS * ALU_ITERATIONS *
+                         ALU_FLOPS_PER_ITERATION;
+
+    VkPipeline pipelines[ARRAY_LENGTH(workgroup_sizes)];
+    create_workgroup_size_pipelines(&ctx, cs, ALU_ITERATIONS, pipelines);
+
+    for (uint32_t i = 0; i < ARRAY_LENGTH(workgroup_sizes); i++) {
+        const uint32_t local_size = workgroup_sizes[i];
+        if (pipelines[i] == VK_NULL_HANDLE)
+            continue;
+
+        double ns = time_kernel(&ctx, pipelines[i],
+                                KERNEL_INVOCATIONS / local_size);
+
+        // FLOPs per nanosecond is GFLOP/s.
+        logi("workgroup %4u: %9.1f us %8.1f GFLOP/s\n", local_size,
+             ns / 1000.0, flops / ns);
+    }
+}
+
+test_define {
+    .name = "bench.compute.workgroup-size.alu",
+    .start = test_workgroup_size_alu,
+    .no_image = true,
+};
+
+static void
+test_workgroup_size_bandwidth(void)
+{
+    const VkPhysicalDeviceLimits *limits = &t_physical_dev_props->limits;
+    bench_context_t ctx = init_context(BANDWIDTH_SIZE);
+
+    // Each invocation strides through the buffers so that the smallest
+    // workgroups don't need more groups than the device can dispatch.
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x_id = 0) in;
+
+        layout(set = 0, binding = 0, std430) readonly buffer Src {
+            vec4 src[];
+        };
+
+        layout(set = 0, binding = 1, std430) writeonly buffer Dst {
+            vec4 dst[];
+        };
+
+        void main() {
+            uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+            for (uint i = gl_GlobalInvocationID.x; i < dst.length(); i += stride)
+                dst[i] = src[i];
+        }
+    );
+
+    // Read plus write.
+    const double bytes = 2.0 * BANDWIDTH_SIZE;
+
+    VkPipeline pipelines[ARRAY_LENGTH(workgroup_sizes)];
+    create_workgroup_size_pipelines(&ctx, cs, 1, pipelines);
+
+    for (uint32_t i = 0; i < ARRAY_LENGTH(workgroup_sizes); i++) {
+        const uint32_t local_size = workgroup_sizes[i];
+        if (pipelines[i] == VK_NULL_HANDLE)
+            continue;
+
+        uint32_t group_count = MIN(BANDWIDTH_SIZE / 16 / local_size,
+                                   limits->maxComputeWorkGroupCount[0]);
+
+        double ns = time_kernel(&ctx, pipelines[i], group_count);
+
+        // Bytes per nanosecond is GB/s.
+        logi("workgroup %4u: %9.1f us %8.2f GB/s\n", local_size,
+             ns / 1000.0, bytes / ns);
+    }
+}
+
+test_define {
+    .name = "bench.compute.workgroup-size.bandwidth",
+    .start = test_workgroup_size_bandwidth,
+    .no_image = true,
+};
+
+static void
+test_shared_memory(void)
+{
+    bench_context_t ctx = init_context(KERNEL_INVOCATIONS * 16);
+
+    // 128 is the minimum maxComputeWorkGroupInvocations.
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x = 128) in;
+        layout(constant_id = 1) const uint ITERATIONS = 1;
+
+        layout(set = 0, binding = 1, std430) buffer Dst {
+            vec4 dst[];
+        };
+
+        shared vec4 tile[128];
+
+        void main() {
+            uint index = gl_LocalInvocationIndex;
+            vec4 v = vec4(index);
+
+            // One 16-byte store and one 16-byte load per iteration.
+            for (uint i = 0; i < ITERATIONS; i++) {
+                tile[index] = v;
+                barrier();
+                v += tile[(index + i + 1) & 127];
+                barrier();
+            }
+
+            dst[gl_GlobalInvocationID.x] = v;
+        }
+    );
+
+    VkPipeline pipeline = create_pipeline(&ctx, cs, 128, SHARED_ITERATIONS);
+    double ns = time_kernel(&ctx, pipeline, KERNEL_INVOCATIONS / 128);
+
+    const double bytes = (double) KERNEL_INVOCATIONS * SHARED_ITERATIONS * 32;
+
+    logi("shared memory: %9.1f us %8.2f GB/s\n", ns / 1000.0, bytes / ns);
+}
+
+test_define {
+    .name = "bench.compute.shared-memory",
+    .start = test_shared_memory,
+    .no_image = true,
+};
+
+enum subgroup_op {
+    SUBGROUP_OP_ADD,
+    SUBGROUP_OP_BALLOT,
+    SUBGROUP_OP_SHUFFLE,
+    SUBGROUP_OP_QUAD,
+};
+
+typedef struct subgroup_params {
+    enum subgroup_op op;
+    VkSubgroupFeatureFlags feature;
+} subgroup_params_t;
+
+/// Each kernel feeds the result of one subgroup operation into the next, so
+/// the loop is bound by subgroup operation latency and throughput.
+static VkShaderModule
+create_subgroup_shader(enum subgroup_op op)
+{
+    switch (op) {
+    case SUBGROUP_OP_ADD:
+        return qoCreateShaderModuleGLSL(t_device, COMPUTE,
+            QO_TARGET_ENV vulkan1.1
+            QO_EXTENSION GL_KHR_shader_subgroup_arithmetic: require
+
+            layout(local_size_x = 128) in;
+            layout(constant_id = 1) const uint ITERATIONS = 1;
+
+            layout(set = 0, binding = 1, std430) buffer Dst {
+                uint dst[];
+            };
+
+            void main() {
+                uint v = gl_GlobalInvocationID.x;
+                for (uint i = 0; i < ITERATIONS; i++)
+                    v = subgroupAdd(v) + i;
+                dst[gl_GlobalInvocationID.x] = v;
+            }
+        );
+    case SUBGROUP_OP_BALLOT:
+        return qoCreateShaderModuleGLSL(t_device, COMPUTE,
+            QO_TARGET_ENV vulkan1.1
+            QO_EXTENSION GL_KHR_shader_subgroup_ballot: require
+
+            layout(local_size_x = 128) in;
+            layout(constant_id = 1) const uint ITERATIONS = 1;
+
+            layout(set = 0, binding = 1, std430) buffer Dst {
+                uint dst[];
+            };
+
+            void main() {
+                uint v = gl_GlobalInvocationID.x;
+                for (uint i = 0; i < ITERATIONS; i++)
+                    v += subgroupBallotBitCount(subgroupBallot((v & 1) != 0));
+                dst[gl_GlobalInvocationID.x] = v;
+            }
+        );
+    case SUBGROUP_OP_SHUFFLE:
+        return qoCreateShaderModuleGLSL(t_device, COMPUTE,
+            QO_TARGET_ENV vulkan1.1
+            QO_EXTENSION GL_KHR_shader_subgroup_shuffle: require
+
+            layout(local_size_x = 128) in;
+            layout(constant_id = 1) const uint ITERATIONS = 1;
+
+            layout(set = 0, binding = 1, std430) buffer Dst {
+                uint dst[];
+            };
+
+            void main() {
+                uint v = gl_GlobalInvocationID.x;
+                for (uint i = 0; i < ITERATIONS; i++)
+                    v = subgroupShuffleXor(v, 1) + i;
+                dst[gl_GlobalInvocationID.x] = v;
+            }
+        );
+    case SUBGROUP_OP_QUAD:
+        return qoCreateShaderModuleGLSL(t_device, COMPUTE,
+            QO_TARGET_ENV vulkan1.1
+            QO_EXTENSION GL_KHR_shader_subgroup_quad: require
+
+            layout(local_size_x = 128) in;
+            layout(constant_id = 1) const uint ITERATIONS = 1;
+
+            layout(set = 0, binding = 1, std430) buffer Dst {
+                uint dst[];
+            };
+
+            void main() {
+                uint v = gl_GlobalInvocationID.x;
+                for (uint i = 0; i < ITERATIONS; i++)
+                    v = subgroupQuadSwapHorizontal(v) + i;
+                dst[gl_GlobalInvocationID.x] = v;
+            }
+        );
+    }
+
+    cru_unreachable;
+}
+
+static void
+test_subgroup(void)
+{
+    const subgroup_params_t *params = t_user_data;
+
+    VkPhysicalDeviceSubgroupProperties subgroup_props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+    };
+    vkGetPhysicalDeviceProperties2(t_physical_dev,
+        &(VkPhysicalDeviceProperties2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &subgroup_props,
+        });
+
+    if (!(subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT))
+        t_skipf("subgroup operations not supported in compute shaders");
+    if (!(subgroup_props.supportedOperations & params->feature))
+        t_skipf("subgroup operation not supported");
+
+    bench_context_t ctx = init_context(KERNEL_INVOCATIONS * 4);
+
+    VkShaderModule cs = create_subgroup_shader(params->op);
+    VkPipeline pipeline = create_pipeline(&ctx, cs, 128, SUBGROUP_ITERATIONS);
+    double ns = time_kernel(&ctx, pipeline, KERNEL_INVOCATIONS / 128);
+
+    const double ops = (double) KERNEL_INVOCATIONS * SUBGROUP_ITERATIONS;
+
+    // Invocation-operations per nanosecond is G/s.
+    logi("subgroup size %u: %9.1f us %8.2f Gops/s\n",
+         subgroup_props.subgroupSize, ns / 1000.0, ops / ns);
+}
+
+#define SUBGROUP_TEST(_name, _op, _feature) \
+test_define { \
+    .name = "bench.compute.subgroup." _name, \
+    .start = test_subgroup, \
+    .no_image = true, \
+    .user_data = &(subgroup_params_t) { \
+        .op = _op, \
+        .feature = _feature, \
+    }, \
+    .api_version = VK_MAKE_VERSION(1, 1, 0), \
+};
+
+SUBGROUP_TEST("add", SUBGROUP_OP_ADD, VK_SUBGROUP_FEATURE_ARITHMETIC_BIT)
+SUBGROUP_TEST("ballot", SUBGROUP_OP_BALLOT, VK_SUBGROUP_FEATURE_BALLOT_BIT)
+SUBGROUP_TEST("shuffle", SUBGROUP_OP_SHUFFLE, VK_SUBGROUP_FEATURE_SHUFFLE_BIT)
+SUBGROUP_TEST("quad", SUBGROUP_OP_QUAD, VK_SUBGROUP_FEATURE_QUAD_BIT)
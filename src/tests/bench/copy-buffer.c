@@ -20,6 +20,7 @@
 // IN THE SOFTWARE.
 
 #include "tapi/t.h"
+#include "util/misc.h"
 
 static unsigned
 bytes_to_unit_div(uint64_t val)
@@ -72,10 +73,18 @@ second_to_unit_str(double value)
 static void
 test_large_copy(void)
 {
-    // Make 256MiB buffers to ensure we easily blow caches
-    const unsigned buffer_size_log2 = 28;
+    // Make 256MiB buffers by default to ensure we easily blow caches
+    const uint64_t size_log2 = t_param_u64("size_log2", 28);
+    const uint64_t runs = t_param_u64("runs", 16);
+
+    t_assertf(size_log2 >= 2 && size_log2 <= 40,
+              "size_log2 must be in [2, 40]");
+    t_assertf(runs >= 1 && runs <= (1 << 20),
+              "runs must be in [1, %u]", 1 << 20);
+
+    const unsigned buffer_size_log2 = size_log2;
     const uint64_t buffer_size = 1ull << buffer_size_log2;
-    unsigned runs_per_size = 16;
+    unsigned runs_per_size = runs;
 
     VkBuffer buffer1 = qoCreateBuffer(t_device, .size = buffer_size);
     VkBuffer buffer2 = qoCreateBuffer(t_device, .size = buffer_size);
@@ -93,12 +102,12 @@ test_large_copy(void)
 
     // Fill the first buffer_size of the memory with a pattern
     uint32_t *map32 = map;
-    for (unsigned i = 0; i < buffer_size / sizeof(*map32); i++)
+    for (uint64_t i = 0; i < buffer_size / sizeof(*map32); i++)
         map32[i] = i;
 
     // Fill the rest with 0xdeadbeef
     uint32_t *map32_2 = map + buffer_size;
-    for (unsigned i = 0; i < buffer_size / sizeof(*map32); i++)
+    for (uint64_t i = 0; i < buffer_size / sizeof(*map32); i++)
         map32_2[i] = 0xdeadbeef;
 
     qoBindBufferMemory(t_device, buffer1, mem, 0);
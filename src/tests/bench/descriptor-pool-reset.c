@@ -24,9 +24,13 @@
 #include <time.h>
 #include <stdio.h>
 
+// Defaults of the "sets_per_pool" and "cycles" parameters.
 #define DESCRIPTOR_SETS_PER_POOL 4096
 #define CREATE_RESET_CYCLES 4096
 
+// Upper bound of both parameters.
+#define MAX_PARAM (1u << 20)
+
 static uint64_t
 gettime_ns()
 {
@@ -42,6 +46,18 @@ gettime_ns()
 static void
 test()
 {
+    const uint64_t sets_param =
+        t_param_u64("sets_per_pool", DESCRIPTOR_SETS_PER_POOL);
+    const uint64_t cycles_param = t_param_u64("cycles", CREATE_RESET_CYCLES);
+
+    t_assertf(sets_param >= 1 && sets_param <= MAX_PARAM,
+              "sets_per_pool must be in [1, %u]", MAX_PARAM);
+    t_assertf(cycles_param >= 1 && cycles_param <= MAX_PARAM,
+              "cycles must be in [1, %u]", MAX_PARAM);
+
+    const unsigned sets_per_pool = sets_param;
+    const unsigned cycles = cycles_param;
+
     VkDescriptorSetLayout layout = qoCreateDescriptorSetLayout(t_device,
         .bindingCount = 2,
         .pBindings = (VkDescriptorSetLayoutBinding[]) {
@@ -66,34 +82,35 @@ test()
         &(VkDescriptorPoolCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             .flags = 0,
-            .maxSets = DESCRIPTOR_SETS_PER_POOL,
+            .maxSets = sets_per_pool,
             .poolSizeCount = 2,
             .pPoolSizes = (VkDescriptorPoolSize[]) {
                 {
                     .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .descriptorCount = 2 * DESCRIPTOR_SETS_PER_POOL,
+                    .descriptorCount = 2 * sets_per_pool,
                 },
                 {
                     .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .descriptorCount = 1 * DESCRIPTOR_SETS_PER_POOL,
+                    .descriptorCount = 1 * sets_per_pool,
                 },
             }
         }, NULL, &pool);
     t_cleanup_push_vk_descriptor_pool(t_device, pool);
 
-    VkDescriptorSetLayout layouts[DESCRIPTOR_SETS_PER_POOL];
-    for (unsigned i = 0; i < DESCRIPTOR_SETS_PER_POOL; i++)
+    VkDescriptorSetLayout *layouts = t_arena_allocn(sets_per_pool,
+                                                    sizeof(*layouts));
+    for (unsigned i = 0; i < sets_per_pool; i++)
         layouts[i] = layout;
 
     uint64_t start = gettime_ns();
 
-    VkDescriptorSet sets[DESCRIPTOR_SETS_PER_POOL];
-    for (unsigned i = 0; i < CREATE_RESET_CYCLES; i++) {
+    VkDescriptorSet *sets = t_arena_allocn(sets_per_pool, sizeof(*sets));
+    for (unsigned i = 0; i < cycles; i++) {
         vkAllocateDescriptorSets(t_device,
             &(VkDescriptorSetAllocateInfo) {
                 .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
                 .descriptorPool = pool,
-                .descriptorSetCount = DESCRIPTOR_SETS_PER_POOL,
+                .descriptorSetCount = sets_per_pool,
                 .pSetLayouts = layouts,
             }, sets);
         vkResetDescriptorPool(t_device, pool, 0);
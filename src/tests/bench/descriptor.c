@@ -0,0 +1,584 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief CPU cost of the different ways of getting descriptors to a shader
+///
+/// Each test writes and binds NUM_SETS sets of `count` descriptors,
+/// NUM_ITERATIONS times over, and reports the time spent per descriptor
+/// written and per bind. Nothing is ever submitted; only the API overhead is
+/// measured.
+
+#include "tapi/t.h"
+#include "util/misc.h"
+#include <time.h>
+
+#define NUM_SETS 1024
+#define NUM_ITERATIONS 16
+#define MAX_COUNT 16
+#define NUM_SLOTS 64
+#define SLOT_SIZE 256
+
+#define GET_DEVICE_FUNCTION_PTR(name) \
+    PFN_##name name = (PFN_##name)vkGetDeviceProcAddr(t_device, #name)
+
+enum method {
+    /// vkUpdateDescriptorSets into one set per draw, then bind each set.
+    METHOD_UPDATE,
+
+    /// vkUpdateDescriptorSetWithTemplate into one set per draw, then bind.
+    METHOD_TEMPLATE,
+
+    /// vkCmdPushDescriptorSetKHR, which writes and binds in one call.
+    METHOD_PUSH,
+
+    /// One set of dynamic uniform buffers written once and rebound with new
+    /// dynamic offsets per draw, as in stress.lots-of-surface-state.*.dynamic.
+    METHOD_DYNAMIC,
+
+    /// Bindless: buffer device addresses are stored in a host-visible table
+    /// and the per-draw "bind" is a push constant holding the table address.
+    METHOD_BDA,
+};
+
+struct params {
+    enum method method;
+    VkDescriptorType type;
+    uint32_t count;
+};
+
+struct bench {
+    const struct params *params;
+
+    VkBuffer buffer;
+    VkSampler sampler;
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout pipeline_layout;
+    VkCommandBuffer cmd;
+
+    uint64_t write_ns;
+    uint64_t bind_ns;
+    uint64_t descriptors_written;
+    uint64_t binds;
+};
+
+static uint64_t
+gettime_ns()
+{
+    struct timespec current;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &current);
+    t_assert (ret >= 0);
+    if (ret < 0)
+        return 0;
+
+    return (uint64_t) current.tv_sec * 1000000000ULL + current.tv_nsec;
+}
+
+static const char *
+method_name(enum method method)
+{
+    switch (method) {
+    case METHOD_UPDATE:     return "update";
+    case METHOD_TEMPLATE:   return "template";
+    case METHOD_PUSH:       return "push";
+    case METHOD_DYNAMIC:    return "dynamic";
+    case METHOD_BDA:        return "bda";
+    }
+
+    cru_unreachable;
+}
+
+static bool
+is_sampler(VkDescriptorType type)
+{
+    return type == VK_DESCRIPTOR_TYPE_SAMPLER;
+}
+
+static void
+check_limits(const struct params *p)
+{
+    const VkPhysicalDeviceLimits *limits = &t_physical_dev_props->limits;
+    uint32_t max;
+
+    switch (p->type) {
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+        max = limits->maxPerStageDescriptorUniformBuffers;
+        break;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+        max = MIN(limits->maxPerStageDescriptorUniformBuffers,
+                  limits->maxDescriptorSetUniformBuffersDynamic);
+        break;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+        max = limits->maxPerStageDescriptorStorageBuffers;
+        break;
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+        max = limits->maxPerStageDescriptorSamplers;
+        break;
+    default:
+        cru_unreachable;
+    }
+
+    if (p->count > max)
+        t_skipf("%u descriptors exceeds the per-stage limit of %u",
+                p->count, max);
+}
+
+/// Descriptor i of set s points at its own slot of the shared buffer so that
+/// consecutive writes are not trivially identical.
+static VkDeviceSize
+slot_offset(uint32_t s, uint32_t i)
+{
+    return ((s + i) % NUM_SLOTS) * SLOT_SIZE;
+}
+
+static void
+fill_infos(struct bench *b, uint32_t s, VkDescriptorBufferInfo *buffer_infos,
+           VkDescriptorImageInfo *image_infos)
+{
+    for (uint32_t i = 0; i < b->params->count; i++) {
+        if (is_sampler(b->params->type)) {
+            image_infos[i] = (VkDescriptorImageInfo) {
+                .sampler = b->sampler,
+            };
+        } else {
+            buffer_infos[i] = (VkDescriptorBufferInfo) {
+                .buffer = b->buffer,
+                .offset = slot_offset(s, i),
+                .range = SLOT_SIZE,
+            };
+        }
+    }
+}
+
+static VkWriteDescriptorSet
+make_write(struct bench *b, VkDescriptorSet set,
+           const VkDescriptorBufferInfo *buffer_infos,
+           const VkDescriptorImageInfo *image_infos)
+{
+    bool sampler = is_sampler(b->params->type);
+
+    return (VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = b->params->count,
+        .descriptorType = b->params->type,
+        .pBufferInfo = sampler ? NULL : buffer_infos,
+        .pImageInfo = sampler ? image_infos : NULL,
+    };
+}
+
+static VkDescriptorPool
+create_pool(struct bench *b, uint32_t max_sets)
+{
+    VkDescriptorPool pool;
+    VkResult result = vkCreateDescriptorPool(t_device,
+        &(VkDescriptorPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = max_sets,
+            .poolSizeCount = 1,
+            .pPoolSizes = &(VkDescriptorPoolSize) {
+                .type = b->params->type,
+                .descriptorCount = max_sets * b->params->count,
+            },
+        }, NULL, &pool);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_descriptor_pool(t_device, pool);
+
+    return pool;
+}
+
+static void
+allocate_sets(struct bench *b, VkDescriptorPool pool, VkDescriptorSet *sets,
+              uint32_t num_sets)
+{
+    VkDescriptorSetLayout layouts[NUM_SETS];
+    for (uint32_t s = 0; s < num_sets; s++)
+        layouts[s] = b->set_layout;
+
+    VkResult result = vkAllocateDescriptorSets(t_device,
+        &(VkDescriptorSetAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = pool,
+            .descriptorSetCount = num_sets,
+            .pSetLayouts = layouts,
+        }, sets);
+    t_assert(result == VK_SUCCESS);
+}
+
+static void
+bind_sets(struct bench *b, const VkDescriptorSet *sets)
+{
+    uint64_t start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            vkCmdBindDescriptorSets(b->cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    b->pipeline_layout, 0, 1, &sets[s],
+                                    0, NULL);
+        }
+    }
+
+    b->bind_ns += gettime_ns() - start;
+    b->binds += NUM_ITERATIONS * NUM_SETS;
+}
+
+static void
+run_update(struct bench *b)
+{
+    VkDescriptorPool pool = create_pool(b, NUM_SETS);
+    VkDescriptorSet sets[NUM_SETS];
+    allocate_sets(b, pool, sets, NUM_SETS);
+
+    VkDescriptorBufferInfo buffer_infos[MAX_COUNT];
+    VkDescriptorImageInfo image_infos[MAX_COUNT];
+
+    uint64_t start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            fill_infos(b, s, buffer_infos, image_infos);
+            VkWriteDescriptorSet write =
+                make_write(b, sets[s], buffer_infos, image_infos);
+            vkUpdateDescriptorSets(t_device, 1, &write, 0, NULL);
+        }
+    }
+
+    b->write_ns += gettime_ns() - start;
+    b->descriptors_written +=
+        (uint64_t) NUM_ITERATIONS * NUM_SETS * b->params->count;
+
+    bind_sets(b, sets);
+}
+
+static void
+run_template(struct bench *b)
+{
+    VkDescriptorPool pool = create_pool(b, NUM_SETS);
+    VkDescriptorSet sets[NUM_SETS];
+    allocate_sets(b, pool, sets, NUM_SETS);
+
+    bool sampler = is_sampler(b->params->type);
+    size_t stride = sampler ? sizeof(VkDescriptorImageInfo)
+                            : sizeof(VkDescriptorBufferInfo);
+
+    VkDescriptorUpdateTemplate template;
+    VkResult result = vkCreateDescriptorUpdateTemplate(t_device,
+        &(VkDescriptorUpdateTemplateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            .descriptorUpdateEntryCount = 1,
+            .pDescriptorUpdateEntries = &(VkDescriptorUpdateTemplateEntry) {
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = b->params->count,
+                .descriptorType = b->params->type,
+                .offset = 0,
+                .stride = stride,
+            },
+            .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            .descriptorSetLayout = b->set_layout,
+        }, NULL, &template);
+    t_assert(result == VK_SUCCESS);
+
+    VkDescriptorBufferInfo buffer_infos[MAX_COUNT];
+    VkDescriptorImageInfo image_infos[MAX_COUNT];
+    const void *data = sampler ? (const void *) image_infos
+                               : (const void *) buffer_infos;
+
+    uint64_t start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            fill_infos(b, s, buffer_infos, image_infos);
+            vkUpdateDescriptorSetWithTemplate(t_device, sets[s], template,
+                                              data);
+        }
+    }
+
+    b->write_ns += gettime_ns() - start;
+    b->descriptors_written +=
+        (uint64_t) NUM_ITERATIONS * NUM_SETS * b->params->count;
+
+    vkDestroyDescriptorUpdateTemplate(t_device, template, NULL);
+
+    bind_sets(b, sets);
+}
+
+static void
+run_push(struct bench *b)
+{
+    GET_DEVICE_FUNCTION_PTR(vkCmdPushDescriptorSetKHR);
+
+    VkDescriptorBufferInfo buffer_infos[MAX_COUNT];
+    VkDescriptorImageInfo image_infos[MAX_COUNT];
+
+    uint64_t start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            fill_infos(b, s, buffer_infos, image_infos);
+            VkWriteDescriptorSet write =
+                make_write(b, VK_NULL_HANDLE, buffer_infos, image_infos);
+            vkCmdPushDescriptorSetKHR(b->cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                      b->pipeline_layout, 0, 1, &write);
+        }
+    }
+
+    // The write and the bind are the same call, so charge the whole cost to
+    // both.
+    uint64_t ns = gettime_ns() - start;
+    b->write_ns += ns;
+    b->bind_ns += ns;
+    b->descriptors_written +=
+        (uint64_t) NUM_ITERATIONS * NUM_SETS * b->params->count;
+    b->binds += NUM_ITERATIONS * NUM_SETS;
+}
+
+static void
+run_dynamic(struct bench *b)
+{
+    VkDescriptorPool pool = create_pool(b, 1);
+    VkDescriptorSet set;
+    allocate_sets(b, pool, &set, 1);
+
+    VkDescriptorBufferInfo buffer_infos[MAX_COUNT];
+    fill_infos(b, 0, buffer_infos, NULL);
+
+    // Dynamic descriptors carry their offset at bind time, so every
+    // descriptor starts at zero and only one write is needed.
+    for (uint32_t i = 0; i < b->params->count; i++)
+        buffer_infos[i].offset = 0;
+
+    uint64_t start = gettime_ns();
+
+    VkWriteDescriptorSet write = make_write(b, set, buffer_infos, NULL);
+    vkUpdateDescriptorSets(t_device, 1, &write, 0, NULL);
+
+    b->write_ns += gettime_ns() - start;
+    b->descriptors_written += b->params->count;
+
+    uint32_t offsets[MAX_COUNT];
+
+    start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            for (uint32_t i = 0; i < b->params->count; i++)
+                offsets[i] = slot_offset(s, i);
+
+            vkCmdBindDescriptorSets(b->cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    b->pipeline_layout, 0, 1, &set,
+                                    b->params->count, offsets);
+        }
+    }
+
+    b->bind_ns += gettime_ns() - start;
+    b->binds += NUM_ITERATIONS * NUM_SETS;
+}
+
+static void
+run_bda(struct bench *b)
+{
+    GET_DEVICE_FUNCTION_PTR(vkGetBufferDeviceAddressKHR);
+
+    VkDeviceSize table_size =
+        (VkDeviceSize) NUM_SETS * b->params->count * sizeof(VkDeviceAddress);
+
+    VkBuffer table = qoCreateBuffer(t_device,
+        .size = table_size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR);
+    VkDeviceMemory table_mem = qoAllocBufferMemory(t_device, table,
+        .properties = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    qoBindBufferMemory(t_device, table, table_mem, 0);
+    VkDeviceAddress *table_map =
+        qoMapMemory(t_device, table_mem, 0, table_size, 0);
+
+    VkDeviceAddress buffer_addr = vkGetBufferDeviceAddressKHR(t_device,
+        &(VkBufferDeviceAddressInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR,
+            .buffer = b->buffer,
+        });
+    VkDeviceAddress table_addr = vkGetBufferDeviceAddressKHR(t_device,
+        &(VkBufferDeviceAddressInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR,
+            .buffer = table,
+        });
+
+    uint64_t start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            VkDeviceAddress *entry = &table_map[s * b->params->count];
+            for (uint32_t i = 0; i < b->params->count; i++)
+                entry[i] = buffer_addr + slot_offset(s, i);
+        }
+    }
+
+    b->write_ns += gettime_ns() - start;
+    b->descriptors_written +=
+        (uint64_t) NUM_ITERATIONS * NUM_SETS * b->params->count;
+
+    start = gettime_ns();
+
+    for (uint32_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (uint32_t s = 0; s < NUM_SETS; s++) {
+            VkDeviceAddress addr = table_addr +
+                s * b->params->count * sizeof(VkDeviceAddress);
+            vkCmdPushConstants(b->cmd, b->pipeline_layout,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(addr), &addr);
+        }
+    }
+
+    b->bind_ns += gettime_ns() - start;
+    b->binds += NUM_ITERATIONS * NUM_SETS;
+}
+
+static void
+test(void)
+{
+    const struct params *p = t_user_data;
+    struct bench b = { .params = p };
+
+    t_assert(p->count <= MAX_COUNT);
+    check_limits(p);
+
+    if (p->method == METHOD_PUSH)
+        t_require_ext("VK_KHR_push_descriptor");
+    if (p->method == METHOD_BDA)
+        t_require_ext("VK_KHR_buffer_device_address");
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    if (p->method == METHOD_BDA)
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+
+    b.buffer = qoCreateBuffer(t_device,
+        .size = NUM_SLOTS * SLOT_SIZE,
+        .usage = usage);
+    VkDeviceMemory mem = qoAllocBufferMemory(t_device, b.buffer);
+    qoBindBufferMemory(t_device, b.buffer, mem, 0);
+
+    if (is_sampler(p->type)) {
+        b.sampler = qoCreateSampler(t_device,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .maxLod = 0.0f);
+    }
+
+    if (p->method == METHOD_BDA) {
+        b.pipeline_layout = qoCreatePipelineLayout(t_device,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &(VkPushConstantRange) {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(VkDeviceAddress),
+            });
+    } else {
+        b.set_layout = qoCreateDescriptorSetLayout(t_device,
+            .flags = p->method == METHOD_PUSH ?
+                     VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0,
+            .bindingCount = 1,
+            .pBindings = (VkDescriptorSetLayoutBinding[]) {
+                {
+                    .binding = 0,
+                    .descriptorType = p->type,
+                    .descriptorCount = p->count,
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .pImmutableSamplers = NULL,
+                },
+            });
+
+        b.pipeline_layout = qoCreatePipelineLayout(t_device,
+            .setLayoutCount = 1,
+            .pSetLayouts = &b.set_layout);
+    }
+
+    b.cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(b.cmd);
+
+    switch (p->method) {
+    case METHOD_UPDATE:     run_update(&b);     break;
+    case METHOD_TEMPLATE:   run_template(&b);   break;
+    case METHOD_PUSH:       run_push(&b);       break;
+    case METHOD_DYNAMIC:    run_dynamic(&b);    break;
+    case METHOD_BDA:        run_bda(&b);        break;
+    }
+
+    qoEndCommandBuffer(b.cmd);
+
+    logi("%s: %u x %u descriptors: %.1f ns/descriptor written, "
+         "%.1f ns/bind\n", method_name(p->method), NUM_SETS, p->count,
+         (double) b.write_ns / b.descriptors_written,
+         (double) b.bind_ns / b.binds);
+}
+
+#define UBO VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+#define UBO_DYNAMIC VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+#define SSBO VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+#define SAMPLER VK_DESCRIPTOR_TYPE_SAMPLER
+
+#define BENCH(__method, __method_name, __type_name, __type, __count, ...) \
+    test_define {                                                       \
+        .name = "bench.descriptor." #__method_name "." #__type_name     \
+                "." #__count,                                           \
+        .start = test,                                                  \
+        .no_image = true,                                               \
+        .user_data = &(struct params) {                                 \
+            .method = METHOD_##__method,                                \
+            .type = __type,                                             \
+            .count = __count,                                           \
+        },                                                              \
+        ##__VA_ARGS__                                                   \
+    }
+
+#define BENCH_COUNTS(__method, __method_name, __type_name, __type, ...)  \
+    BENCH(__method, __method_name, __type_name, __type, 1,              \
+          ##__VA_ARGS__);                                               \
+    BENCH(__method, __method_name, __type_name, __type, 4,              \
+          ##__VA_ARGS__);                                               \
+    BENCH(__method, __method_name, __type_name, __type, 16,             \
+          ##__VA_ARGS__)
+
+BENCH_COUNTS(UPDATE, update, ubo, UBO);
+BENCH_COUNTS(UPDATE, update, ssbo, SSBO);
+BENCH_COUNTS(UPDATE, update, sampler, SAMPLER);
+
+BENCH_COUNTS(TEMPLATE, template, ubo, UBO,
+             .api_version = VK_MAKE_VERSION(1, 1, 0));
+BENCH_COUNTS(TEMPLATE, template, ssbo, SSBO,
+             .api_version = VK_MAKE_VERSION(1, 1, 0));
+BENCH_COUNTS(TEMPLATE, template, sampler, SAMPLER,
+             .api_version = VK_MAKE_VERSION(1, 1, 0));
+
+BENCH_COUNTS(PUSH, push, ubo, UBO);
+BENCH_COUNTS(PUSH, push, ssbo, SSBO);
+BENCH_COUNTS(PUSH, push, sampler, SAMPLER);
+
+BENCH_COUNTS(DYNAMIC, dynamic, ubo, UBO_DYNAMIC);
+
+BENCH_COUNTS(BDA, bda, ssbo, SSBO);
@@ -0,0 +1,529 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Cost of device memory operations, per memory type
+///
+/// Each test walks the memory types in t_physical_dev_mem_props and prints
+/// one line per type, so the output reads as a table of allocation
+/// latency, mapping cost and CPU bandwidth that can be used to pick an
+/// upload strategy.
+
+#include "tapi/t.h"
+#include "util/misc.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define KB (1024)
+#define MB (1024 * 1024)
+
+#define ALLOCS_PER_SIZE 256
+#define MAPS_PER_TYPE 1024
+#define BANDWIDTH_SIZE (16 * MB)
+#define BANDWIDTH_RUNS 4
+#define FD_ROUND_TRIPS 256
+
+#define GET_DEVICE_FUNCTION_PTR(name) \
+    PFN_vk##name name = (PFN_vk##name)vkGetDeviceProcAddr(t_device, "vk"#name)
+
+static const VkDeviceSize size_classes[] = {
+    4 * KB,
+    64 * KB,
+    1 * MB,
+    16 * MB,
+    64 * MB,
+};
+
+static uint64_t
+gettime_ns()
+{
+    struct timespec current;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &current);
+    t_assert (ret >= 0);
+    if (ret < 0)
+        return 0;
+
+    return (uint64_t) current.tv_sec * 1000000000ULL + current.tv_nsec;
+}
+
+static double
+gb_per_sec(uint64_t bytes, uint64_t ns)
+{
+    return (double) bytes / ns;
+}
+
+/// Short, fixed-width description of a memory type's property flags.
+static const char *
+type_flags_str(uint32_t type_index, char buf[static 8])
+{
+    VkMemoryPropertyFlags flags =
+        t_physical_dev_mem_props->memoryTypes[type_index].propertyFlags;
+
+    snprintf(buf, 8, "%c%c%c%c%c",
+             (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? 'D' : '-',
+             (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? 'V' : '-',
+             (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? 'O' : '-',
+             (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? 'C' : '-',
+             (flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? 'L' : '-');
+
+    return buf;
+}
+
+static bool
+type_is_host_visible(uint32_t type_index)
+{
+    return t_physical_dev_mem_props->memoryTypes[type_index].propertyFlags &
+           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+static bool
+type_fits(uint32_t type_index, VkDeviceSize size)
+{
+    uint32_t heap = t_physical_dev_mem_props->memoryTypes[type_index].heapIndex;
+
+    // Stay well clear of the heap size so that we don't measure eviction.
+    return size <= t_physical_dev_mem_props->memoryHeaps[heap].size / 4;
+}
+
+static VkResult
+alloc_memory(uint32_t type_index, VkDeviceSize size, const void *pNext,
+             VkDeviceMemory *mem)
+{
+    return vkAllocateMemory(t_device,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = pNext,
+            .allocationSize = size,
+            .memoryTypeIndex = type_index,
+        }, NULL, mem);
+}
+
+static void
+log_header(const char *columns)
+{
+    logi("flags: D=device-local V=host-visible O=host-coherent "
+         "C=host-cached L=lazily-allocated\n");
+    logi("type flags  %s\n", columns);
+}
+
+static void
+test_alloc(void)
+{
+    const uint32_t type_count = t_physical_dev_mem_props->memoryTypeCount;
+    VkDeviceMemory mems[ALLOCS_PER_SIZE];
+    char flags[8];
+
+    log_header("size      alloc ns  free ns");
+
+    for (uint32_t type = 0; type < type_count; type++) {
+        for (uint32_t s = 0; s < ARRAY_LENGTH(size_classes); s++) {
+            VkDeviceSize size = size_classes[s];
+            if (!type_fits(type, size * ALLOCS_PER_SIZE / 16))
+                continue;
+
+            // Allocate in batches of 16 live allocations so that drivers
+            // with a free-list don't just hand back the same block.
+            uint64_t alloc_ns = 0, free_ns = 0;
+            uint32_t count = 0;
+            bool failed = false;
+
+            for (uint32_t i = 0; i < ALLOCS_PER_SIZE && !failed; i += 16) {
+                uint32_t n = 0;
+
+                uint64_t start = gettime_ns();
+                for (; n < 16; n++) {
+                    if (alloc_memory(type, size, NULL, &mems[n]) != VK_SUCCESS) {
+                        failed = true;
+                        break;
+                    }
+                }
+                alloc_ns += gettime_ns() - start;
+
+                start = gettime_ns();
+                for (uint32_t j = 0; j < n; j++)
+                    vkFreeMemory(t_device, mems[j], NULL);
+                free_ns += gettime_ns() - start;
+
+                count += n;
+            }
+
+            if (failed) {
+                logi("%4u %s  %-8lu  allocation failed after %u\n",
+                     type, type_flags_str(type, flags), size / KB, count);
+                continue;
+            }
+
+            logi("%4u %s  %6luK  %8.0f  %7.0f\n",
+                 type, type_flags_str(type, flags), size / KB,
+                 (double) alloc_ns / count, (double) free_ns / count);
+        }
+    }
+}
+
+test_define {
+    .name = "bench.memory.alloc",
+    .start = test_alloc,
+    .no_image = true,
+};
+
+static void
+test_map(void)
+{
+    const uint32_t type_count = t_physical_dev_mem_props->memoryTypeCount;
+    char flags[8];
+
+    log_header("size      map ns    unmap ns  first-touch ns/page");
+
+    for (uint32_t type = 0; type < type_count; type++) {
+        if (!type_is_host_visible(type))
+            continue;
+
+        for (uint32_t s = 0; s < ARRAY_LENGTH(size_classes); s++) {
+            VkDeviceSize size = size_classes[s];
+            if (!type_fits(type, size))
+                continue;
+
+            VkDeviceMemory mem;
+            if (alloc_memory(type, size, NULL, &mem) != VK_SUCCESS)
+                continue;
+
+            uint64_t map_ns = 0, unmap_ns = 0;
+            for (uint32_t i = 0; i < MAPS_PER_TYPE; i++) {
+                void *map;
+
+                uint64_t start = gettime_ns();
+                VkResult result = vkMapMemory(t_device, mem, 0, size, 0, &map);
+                map_ns += gettime_ns() - start;
+                t_assert(result == VK_SUCCESS);
+
+                start = gettime_ns();
+                vkUnmapMemory(t_device, mem);
+                unmap_ns += gettime_ns() - start;
+            }
+
+            // The first write to each page of a fresh mapping pays for the
+            // page fault, which is part of the real cost of mapping.
+            long page_size = sysconf(_SC_PAGESIZE);
+            void *touch_map;
+            VkResult result = vkMapMemory(t_device, mem, 0, size, 0,
+                                          &touch_map);
+            t_assert(result == VK_SUCCESS);
+            volatile uint8_t *map = touch_map;
+
+            uint64_t start = gettime_ns();
+            for (VkDeviceSize off = 0; off < size; off += page_size)
+                map[off] = 0;
+            uint64_t touch_ns = gettime_ns() - start;
+
+            vkUnmapMemory(t_device, mem);
+            vkFreeMemory(t_device, mem, NULL);
+
+            logi("%4u %s  %6luK  %8.0f  %8.0f  %8.0f\n",
+                 type, type_flags_str(type, flags), size / KB,
+                 (double) map_ns / MAPS_PER_TYPE,
+                 (double) unmap_ns / MAPS_PER_TYPE,
+                 (double) touch_ns / (size / page_size));
+        }
+    }
+}
+
+test_define {
+    .name = "bench.memory.map",
+    .start = test_map,
+    .no_image = true,
+};
+
+static void
+write_memset(void *dst, size_t size)
+{
+    memset(dst, 0x5a, size);
+}
+
+static void
+write_stream(void *dst, size_t size)
+{
+#ifdef __SSE2__
+    // Non-temporal stores bypass the cache, which is what an upload path
+    // into write-combined memory should be doing.
+    __m128i v = _mm_set1_epi8(0x5a);
+    __m128i *p = dst;
+
+    for (size_t i = 0; i < size / sizeof(*p); i += 4) {
+        _mm_stream_si128(&p[i + 0], v);
+        _mm_stream_si128(&p[i + 1], v);
+        _mm_stream_si128(&p[i + 2], v);
+        _mm_stream_si128(&p[i + 3], v);
+    }
+
+    _mm_sfence();
+#else
+    memset(dst, 0x5a, size);
+#endif
+}
+
+static uint64_t
+read_sum(const void *src, size_t size)
+{
+    const uint64_t *p = src;
+    uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+    for (size_t i = 0; i < size / sizeof(*p); i += 4) {
+        sum0 += p[i + 0];
+        sum1 += p[i + 1];
+        sum2 += p[i + 2];
+        sum3 += p[i + 3];
+    }
+
+    return sum0 + sum1 + sum2 + sum3;
+}
+
+static void
+test_bandwidth(void)
+{
+    const uint32_t type_count = t_physical_dev_mem_props->memoryTypeCount;
+    char flags[8];
+
+    log_header("write GB/s  stream GB/s  read GB/s");
+
+    for (uint32_t type = 0; type < type_count; type++) {
+        if (!type_is_host_visible(type) || !type_fits(type, BANDWIDTH_SIZE))
+            continue;
+
+        VkDeviceMemory mem;
+        if (alloc_memory(type, BANDWIDTH_SIZE, NULL, &mem) != VK_SUCCESS)
+            continue;
+
+        // Map by hand rather than with qoMapMemory() because the memory is
+        // unmapped and freed before the next type is tested.
+        void *map;
+        VkResult result = vkMapMemory(t_device, mem, 0, BANDWIDTH_SIZE, 0,
+                                      &map);
+        t_assert(result == VK_SUCCESS);
+
+        // Fault the pages in before timing anything.
+        write_memset(map, BANDWIDTH_SIZE);
+
+        uint64_t write_ns = 0, stream_ns = 0, read_ns = 0;
+        volatile uint64_t sink = 0;
+
+        for (uint32_t run = 0; run < BANDWIDTH_RUNS; run++) {
+            uint64_t start = gettime_ns();
+            write_memset(map, BANDWIDTH_SIZE);
+            write_ns += gettime_ns() - start;
+
+            start = gettime_ns();
+            write_stream(map, BANDWIDTH_SIZE);
+            stream_ns += gettime_ns() - start;
+
+            // Reads from non-coherent memory need an invalidate to be
+            // meaningful, and its cost belongs to the read path.
+            start = gettime_ns();
+            vkInvalidateMappedMemoryRanges(t_device, 1,
+                &(VkMappedMemoryRange) {
+                    .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                    .memory = mem,
+                    .offset = 0,
+                    .size = VK_WHOLE_SIZE,
+                });
+            sink += read_sum(map, BANDWIDTH_SIZE);
+            read_ns += gettime_ns() - start;
+        }
+
+        (void) sink;
+
+        vkUnmapMemory(t_device, mem);
+        vkFreeMemory(t_device, mem, NULL);
+
+        uint64_t bytes = (uint64_t) BANDWIDTH_SIZE * BANDWIDTH_RUNS;
+        logi("%4u %s  %10.2f  %11.2f  %9.2f\n",
+             type, type_flags_str(type, flags),
+             gb_per_sec(bytes, write_ns),
+             gb_per_sec(bytes, stream_ns),
+             gb_per_sec(bytes, read_ns));
+    }
+}
+
+test_define {
+    .name = "bench.memory.bandwidth",
+    .start = test_bandwidth,
+    .no_image = true,
+};
+
+static void
+test_dedicated(void)
+{
+    const uint32_t type_count = t_physical_dev_mem_props->memoryTypeCount;
+    char flags[8];
+
+    log_header("size      plain ns  dedicated ns  (alloc + free)");
+
+    for (uint32_t s = 0; s < ARRAY_LENGTH(size_classes); s++) {
+        VkDeviceSize size = size_classes[s];
+
+        VkBuffer buffer = qoCreateBuffer(t_device, .size = size);
+        VkMemoryRequirements reqs =
+            qoGetBufferMemoryRequirements(t_device, buffer);
+
+        for (uint32_t type = 0; type < type_count; type++) {
+            if (!(reqs.memoryTypeBits & (1u << type)) ||
+                !type_fits(type, reqs.size))
+                continue;
+
+            uint64_t plain_ns = 0, dedicated_ns = 0;
+            VkDeviceMemory mem;
+
+            for (uint32_t i = 0; i < ALLOCS_PER_SIZE; i++) {
+                uint64_t start = gettime_ns();
+                VkResult result = alloc_memory(type, reqs.size, NULL, &mem);
+                t_assert(result == VK_SUCCESS);
+                vkFreeMemory(t_device, mem, NULL);
+                plain_ns += gettime_ns() - start;
+
+                start = gettime_ns();
+                result = alloc_memory(type, reqs.size,
+                    &(VkMemoryDedicatedAllocateInfo) {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+                        .buffer = buffer,
+                    }, &mem);
+                t_assert(result == VK_SUCCESS);
+                vkFreeMemory(t_device, mem, NULL);
+                dedicated_ns += gettime_ns() - start;
+            }
+
+            logi("%4u %s  %6luK  %8.0f  %12.0f\n",
+                 type, type_flags_str(type, flags), size / KB,
+                 (double) plain_ns / ALLOCS_PER_SIZE,
+                 (double) dedicated_ns / ALLOCS_PER_SIZE);
+        }
+    }
+}
+
+test_define {
+    .name = "bench.memory.dedicated",
+    .start = test_dedicated,
+    .no_image = true,
+    .api_version = VK_MAKE_VERSION(1, 1, 0),
+};
+
+static void
+test_fd(VkExternalMemoryHandleTypeFlagBits handle_type)
+{
+    t_require_ext("VK_KHR_external_memory_fd");
+
+    GET_DEVICE_FUNCTION_PTR(GetMemoryFdKHR);
+
+    const uint32_t type_count = t_physical_dev_mem_props->memoryTypeCount;
+    char flags[8];
+
+    log_header("size      export ns  import ns  (export + import + free)");
+
+    for (uint32_t type = 0; type < type_count; type++) {
+        for (uint32_t s = 0; s < ARRAY_LENGTH(size_classes); s++) {
+            VkDeviceSize size = size_classes[s];
+            if (!type_fits(type, size))
+                continue;
+
+            VkDeviceMemory mem;
+            VkResult result = alloc_memory(type, size,
+                &(VkExportMemoryAllocateInfo) {
+                    .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+                    .handleTypes = handle_type,
+                }, &mem);
+            if (result != VK_SUCCESS)
+                continue;
+
+            uint64_t export_ns = 0, import_ns = 0;
+            for (uint32_t i = 0; i < FD_ROUND_TRIPS; i++) {
+                int fd;
+
+                uint64_t start = gettime_ns();
+                result = GetMemoryFdKHR(t_device,
+                    &(VkMemoryGetFdInfoKHR) {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+                        .memory = mem,
+                        .handleType = handle_type,
+                    }, &fd);
+                export_ns += gettime_ns() - start;
+                t_assert(result == VK_SUCCESS);
+
+                // A successful import takes ownership of the fd.
+                VkDeviceMemory imported;
+                start = gettime_ns();
+                result = alloc_memory(type, size,
+                    &(VkImportMemoryFdInfoKHR) {
+                        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+                        .handleType = handle_type,
+                        .fd = fd,
+                    }, &imported);
+                if (result == VK_SUCCESS)
+                    vkFreeMemory(t_device, imported, NULL);
+                import_ns += gettime_ns() - start;
+
+                if (result != VK_SUCCESS) {
+                    close(fd);
+                    break;
+                }
+            }
+
+            vkFreeMemory(t_device, mem, NULL);
+
+            if (result != VK_SUCCESS)
+                continue;
+
+            logi("%4u %s  %6luK  %9.0f  %9.0f\n",
+                 type, type_flags_str(type, flags), size / KB,
+                 (double) export_ns / FD_ROUND_TRIPS,
+                 (double) import_ns / FD_ROUND_TRIPS);
+        }
+    }
+}
+
+static void
+test_fd_opaque(void)
+{
+    test_fd(VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT);
+}
+
+test_define {
+    .name = "bench.memory.fd.opaque",
+    .start = test_fd_opaque,
+    .no_image = true,
+    .api_version = VK_MAKE_VERSION(1, 1, 0),
+};
+
+static void
+test_fd_dma_buf(void)
+{
+    t_require_ext("VK_EXT_external_memory_dma_buf");
+    test_fd(VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
+}
+
+test_define {
+    .name = "bench.memory.fd.dma-buf",
+    .start = test_fd_dma_buf,
+    .no_image = true,
+    .api_version = VK_MAKE_VERSION(1, 1, 0),
+};
@@ -20,6 +20,7 @@
 // IN THE SOFTWARE.
 
 #include "tapi/t.h"
+#include "util/misc.h"
 #include "util/string.h"
 
 #include "src/tests/bench/multiview-spirv.h"
@@ -27,8 +28,9 @@
 #include <math.h>
 #include <time.h>
 
-static const int width = 1024;
-static const int height = 1024;
+// Set from the "width" and "height" parameters, which default to 1024.
+static int width;
+static int height;
 
 static uint64_t
 gettime_ns()
@@ -328,8 +330,14 @@ test()
 
     t_assert(multiview_props.maxMultiviewViewCount >= 6);
 
-    const unsigned run_count = 1 << 7;
-    const unsigned triangle_count = 1 << 17;
+    width = CLAMP(t_param_u64("width", 1024), 1, 16384);
+    height = CLAMP(t_param_u64("height", 1024), 1, 16384);
+
+    // Clamp the triangle count so that the vertex data size fits in
+    // unsigned.
+    const unsigned run_count = CLAMP(t_param_u64("runs", 1 << 7), 1, 1 << 16);
+    const unsigned triangle_count =
+        CLAMP(t_param_u64("triangles", 1 << 17), 1, 1 << 22);
     const unsigned vertex_count = triangle_count * 3;
 
     /* Set up the data to be used by all tests.  Fill the area with
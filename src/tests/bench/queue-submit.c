@@ -20,13 +20,20 @@
 // IN THE SOFTWARE.
 
 #include "tapi/t.h"
+#include "util/misc.h"
 #include <time.h>
 
 #define MIN_BUFFER_COUNT 8
-#define MAX_BUFFER_COUNT 4096
 #define BUFFER_SIZE 256
+
+// Defaults of the "max_buffers" and "execs" parameters.
+#define MAX_BUFFER_COUNT 4096
 #define NUM_EXECS 1000
 
+// Upper bound of both parameters. It keeps the buffer count from wrapping
+// when it doubles.
+#define MAX_PARAM (1u << 20)
+
 static uint64_t
 gettime_ns()
 {
@@ -40,7 +47,8 @@ gettime_ns()
 }
 
 static void
-test_queue_submit_variable(unsigned buffer_count, VkBuffer *buffers)
+test_queue_submit_variable(unsigned buffer_count, VkBuffer *buffers,
+                           unsigned num_execs)
 {
     /* It's fine to re-begin a command buffer */
     qoBeginCommandBuffer(t_cmd_buffer,
@@ -63,42 +71,58 @@ test_queue_submit_variable(unsigned buffer_count, VkBuffer *buffers)
     qoQueueSubmit(t_queue, 1, &t_cmd_buffer, VK_NULL_HANDLE);
     qoQueueWaitIdle(t_queue);
 
-    /* We do all NUM_EXECS submissions in one go so that we get the inner
+    /* We do all num_execs submissions in one go so that we get the inner
      * most loop we can inside the driver.
      */
-    VkCommandBuffer cmd_buffers[NUM_EXECS];
-    for (unsigned i = 0; i < NUM_EXECS; i++)
+    VkCommandBuffer *cmd_buffers = t_arena_allocn(num_execs,
+                                                  sizeof(*cmd_buffers));
+    for (unsigned i = 0; i < num_execs; i++)
         cmd_buffers[i] = t_cmd_buffer;
 
     uint64_t start = gettime_ns();
 
-    qoQueueSubmit(t_queue, NUM_EXECS, cmd_buffers, VK_NULL_HANDLE);
+    qoQueueSubmit(t_queue, num_execs, cmd_buffers, VK_NULL_HANDLE);
 
     uint64_t end = gettime_ns();
 
     qoQueueWaitIdle(t_queue);
 
     logi("Called vkQueueSubmit with %u buffers %u times, took %uus (%uus each)",
-         buffer_count, NUM_EXECS, (unsigned)((end - start) / 1000),
-         (unsigned)((end - start) / (1000 * NUM_EXECS)));
+         buffer_count, num_execs, (unsigned)((end - start) / 1000),
+         (unsigned)((end - start) / (1000 * num_execs)));
 }
 
 static void
 test_queue_submit(void)
 {
+    const uint64_t max_buffers = t_param_u64("max_buffers", MAX_BUFFER_COUNT);
+    const uint64_t execs = t_param_u64("execs", NUM_EXECS);
+
+    t_assertf(max_buffers >= MIN_BUFFER_COUNT && max_buffers <= MAX_PARAM,
+              "max_buffers must be in [%u, %u]", MIN_BUFFER_COUNT, MAX_PARAM);
+    t_assertf(execs >= 1 && execs <= MAX_PARAM,
+              "execs must be in [1, %u]", MAX_PARAM);
+
+    const unsigned max_buffer_count = max_buffers;
+    const unsigned num_execs = execs;
+
     // Make some small buffers
-    VkBuffer buffers[MAX_BUFFER_COUNT];
+    VkBuffer *buffers = t_arena_allocn(max_buffer_count, sizeof(*buffers));
     unsigned buffer_count = 0;
 
-    for (unsigned i = MIN_BUFFER_COUNT; i <= MAX_BUFFER_COUNT; i *= 2) {
+    for (unsigned i = MIN_BUFFER_COUNT; i <= max_buffer_count; i *= 2) {
         while (buffer_count < i) {
             VkBuffer buffer = qoCreateBuffer(t_device, .size = BUFFER_SIZE);
-            VkDeviceMemory mem = qoAllocBufferMemory(t_device, buffer);
-            vkBindBufferMemory(t_device, buffer, mem, 0);
+            qoAllocBufferMemory(t_device, buffer, .suballocate = true);
             buffers[buffer_count++] = buffer;
         }
-        test_queue_submit_variable(buffer_count, buffers);
+        test_queue_submit_variable(buffer_count, buffers, num_execs);
     }
+
+    QoMemoryArenaStats stats;
+    qoGetMemoryArenaStats(t_memory_arena, &stats);
+    logi("Placed %u buffers in %u memory blocks, %.1f%% used",
+         stats.allocationCount, stats.blockCount, 100.0f * stats.utilization);
 }
 
 test_define {
@@ -0,0 +1,589 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Latency of the synchronization primitives
+///
+/// Every test times NUM_ITERATIONS round trips through one primitive and
+/// reports the median and 99th percentile. All submissions are empty, so the
+/// numbers are the cost of the synchronization itself.
+
+#include "tapi/t.h"
+#include "util/misc.h"
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_ITERATIONS 4096
+#define NUM_WARMUP_ITERATIONS 64
+#define CHAIN_LENGTH 8
+
+// How long to poll an event that the device should set, before deciding
+// that the queue is hung.
+#define EVENT_TIMEOUT_NS 1000000000ull
+
+#define GET_FUNCTION_PTR(name, device) \
+    PFN_vk##name name = (PFN_vk##name)vkGetDeviceProcAddr(device, "vk"#name)
+
+/// A private device with up to two queues, for the tests that need to hop
+/// between queues or enable features the default test device does not.
+struct sync_context {
+    VkDevice device;
+    VkQueue queues[2];
+
+    /// Number of distinct queues in queues[]. If 1, queues[1] == queues[0].
+    uint32_t queue_count;
+};
+
+static uint64_t
+gettime_ns()
+{
+    struct timespec current;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &current);
+    t_assert (ret >= 0);
+    if (ret < 0)
+        return 0;
+
+    return (uint64_t) current.tv_sec * 1000000000ULL + current.tv_nsec;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+report_latency(const char *what, uint64_t *samples, uint32_t count)
+{
+    qsort(samples, count, sizeof(*samples), compare_u64);
+
+    logi("%s: p50 %.2f us, p99 %.2f us, min %.2f us, max %.2f us "
+         "(%u iterations)\n", what,
+         samples[count / 2] / 1000.0,
+         samples[(uint64_t) count * 99 / 100] / 1000.0,
+         samples[0] / 1000.0,
+         samples[count - 1] / 1000.0,
+         count);
+}
+
+static VkFence
+create_fence(VkDevice device)
+{
+    VkFence fence;
+    VkResult result = vkCreateFence(device,
+        &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        }, NULL, &fence);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_fence(device, fence);
+
+    return fence;
+}
+
+static VkSemaphore
+create_semaphore(VkDevice device, const void *pNext)
+{
+    VkSemaphore sem;
+    VkResult result = vkCreateSemaphore(device,
+        &(VkSemaphoreCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = pNext,
+        }, NULL, &sem);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_semaphore(device, sem);
+
+    return sem;
+}
+
+static void
+wait_and_reset_fence(VkDevice device, VkFence fence)
+{
+    VkResult result = vkWaitForFences(device, 1, &fence, true, UINT64_MAX);
+    t_assert(result == VK_SUCCESS);
+    result = vkResetFences(device, 1, &fence);
+    t_assert(result == VK_SUCCESS);
+}
+
+static void
+init_context(struct sync_context *ctx, const void *features_pNext)
+{
+    static const char *const wanted_extensions[] = {
+        "VK_KHR_external_semaphore",
+        "VK_KHR_external_semaphore_fd",
+        "VK_KHR_timeline_semaphore",
+    };
+
+    const char *extensions[ARRAY_LENGTH(wanted_extensions)];
+    uint32_t extension_count = 0;
+    for (uint32_t i = 0; i < ARRAY_LENGTH(wanted_extensions); i++) {
+        if (t_has_ext(wanted_extensions[i]))
+            extensions[extension_count++] = wanted_extensions[i];
+    }
+
+    uint32_t family_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(t_physical_dev, &family_count,
+                                             NULL);
+    VkQueueFamilyProperties family_props[family_count];
+    vkGetPhysicalDeviceQueueFamilyProperties(t_physical_dev, &family_count,
+                                             family_props);
+
+    // Prefer two queues of the first family; fall back to the first queue
+    // of the second family; otherwise ping-pong on a single queue.
+    const float priorities[2] = { 1.0, 1.0 };
+    VkDeviceQueueCreateInfo qci[2];
+    uint32_t qci_count;
+    uint32_t families[2], indices[2];
+
+    if (family_props[0].queueCount >= 2) {
+        qci[0] = (VkDeviceQueueCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = 0,
+            .queueCount = 2,
+            .pQueuePriorities = priorities,
+        };
+        qci_count = 1;
+        families[0] = 0; indices[0] = 0;
+        families[1] = 0; indices[1] = 1;
+        ctx->queue_count = 2;
+    } else {
+        qci_count = MIN(family_count, 2);
+        for (uint32_t i = 0; i < qci_count; i++) {
+            qci[i] = (VkDeviceQueueCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = i,
+                .queueCount = 1,
+                .pQueuePriorities = priorities,
+            };
+        }
+        families[0] = 0; indices[0] = 0;
+        families[1] = qci_count - 1; indices[1] = 0;
+        ctx->queue_count = qci_count;
+    }
+
+    VkResult result = vkCreateDevice(t_physical_dev,
+        &(VkDeviceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .pNext = features_pNext,
+            .enabledExtensionCount = extension_count,
+            .ppEnabledExtensionNames = extensions,
+            .queueCreateInfoCount = qci_count,
+            .pQueueCreateInfos = qci,
+        }, NULL, &ctx->device);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_device(ctx->device, NULL);
+
+    for (uint32_t i = 0; i < 2; i++)
+        vkGetDeviceQueue(ctx->device, families[i], indices[i], &ctx->queues[i]);
+
+    if (ctx->queue_count < 2)
+        logi("only one queue available; chains stay on one queue\n");
+}
+
+static void
+require_semaphore_handle_type(VkExternalSemaphoreHandleTypeFlagBitsKHR type)
+{
+    t_require_ext("VK_KHR_external_semaphore");
+    t_require_ext("VK_KHR_external_semaphore_capabilities");
+    t_require_ext("VK_KHR_external_semaphore_fd");
+
+    PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR
+        GetPhysicalDeviceExternalSemaphorePropertiesKHR =
+        (PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR)
+        vkGetInstanceProcAddr(t_instance,
+            "vkGetPhysicalDeviceExternalSemaphorePropertiesKHR");
+
+    VkExternalSemaphorePropertiesKHR props = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES_KHR,
+    };
+    GetPhysicalDeviceExternalSemaphorePropertiesKHR(t_physical_dev,
+        &(VkPhysicalDeviceExternalSemaphoreInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO_KHR,
+            .handleType = type,
+        }, &props);
+
+    const uint32_t features =
+        VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT_KHR |
+        VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT_KHR;
+
+    if ((props.externalSemaphoreFeatures & features) != features)
+        t_skipf("semaphore handle type 0x%x is not exportable and importable",
+                type);
+}
+
+static void
+test_fence_round_trip(void)
+{
+    VkFence fence = create_fence(t_device);
+    uint64_t samples[NUM_ITERATIONS];
+
+    for (uint32_t i = 0; i < NUM_WARMUP_ITERATIONS + NUM_ITERATIONS; i++) {
+        uint64_t start = gettime_ns();
+
+        VkResult result = vkQueueSubmit(t_queue, 0, NULL, fence);
+        t_assert(result == VK_SUCCESS);
+        wait_and_reset_fence(t_device, fence);
+
+        if (i >= NUM_WARMUP_ITERATIONS)
+            samples[i - NUM_WARMUP_ITERATIONS] = gettime_ns() - start;
+    }
+
+    report_latency("empty submit -> fence", samples, NUM_ITERATIONS);
+}
+
+test_define {
+    .name = "bench.sync.fence-round-trip",
+    .start = test_fence_round_trip,
+    .no_image = true,
+};
+
+static void
+test_binary_semaphore_chain(void)
+{
+    struct sync_context ctx;
+    init_context(&ctx, NULL);
+
+    VkFence fence = create_fence(ctx.device);
+    VkSemaphore sems[CHAIN_LENGTH];
+    for (uint32_t j = 0; j < CHAIN_LENGTH; j++)
+        sems[j] = create_semaphore(ctx.device, NULL);
+
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    uint64_t samples[NUM_ITERATIONS];
+
+    for (uint32_t i = 0; i < NUM_WARMUP_ITERATIONS + NUM_ITERATIONS; i++) {
+        uint64_t start = gettime_ns();
+
+        // Link j waits on sems[j - 1] and signals sems[j], alternating
+        // queues. The last link only signals the fence.
+        for (uint32_t j = 0; j < CHAIN_LENGTH; j++) {
+            bool last = j == CHAIN_LENGTH - 1;
+            VkResult result = vkQueueSubmit(ctx.queues[j % 2], 1,
+                &(VkSubmitInfo) {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .waitSemaphoreCount = j > 0 ? 1 : 0,
+                    .pWaitSemaphores = j > 0 ? &sems[j - 1] : NULL,
+                    .pWaitDstStageMask = &wait_stage,
+                    .signalSemaphoreCount = last ? 0 : 1,
+                    .pSignalSemaphores = last ? NULL : &sems[j],
+                }, last ? fence : VK_NULL_HANDLE);
+            t_assert(result == VK_SUCCESS);
+        }
+
+        wait_and_reset_fence(ctx.device, fence);
+
+        if (i >= NUM_WARMUP_ITERATIONS)
+            samples[i - NUM_WARMUP_ITERATIONS] = gettime_ns() - start;
+    }
+
+    report_latency("binary semaphore chain",
+                   samples, NUM_ITERATIONS);
+}
+
+test_define {
+    .name = "bench.sync.semaphore-chain.binary",
+    .start = test_binary_semaphore_chain,
+    .no_image = true,
+};
+
+static void
+test_timeline_semaphore_chain(void)
+{
+    t_require_ext("VK_KHR_timeline_semaphore");
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &timeline_features,
+    };
+    vkGetPhysicalDeviceFeatures2(t_physical_dev, &features);
+    if (!timeline_features.timelineSemaphore)
+        t_skipf("timelineSemaphore feature not supported");
+
+    struct sync_context ctx;
+    init_context(&ctx, &(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        .timelineSemaphore = true,
+    });
+
+    GET_FUNCTION_PTR(WaitSemaphoresKHR, ctx.device);
+
+    VkSemaphore sem = create_semaphore(ctx.device,
+        &(VkSemaphoreTypeCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+            .initialValue = 0,
+        });
+
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    uint64_t samples[NUM_ITERATIONS];
+    uint64_t value = 0;
+
+    for (uint32_t i = 0; i < NUM_WARMUP_ITERATIONS + NUM_ITERATIONS; i++) {
+        uint64_t start = gettime_ns();
+
+        // Link j waits on value v and signals v + 1, alternating queues.
+        // The host then waits for the final value instead of a fence.
+        for (uint32_t j = 0; j < CHAIN_LENGTH; j++) {
+            uint64_t wait_value = value;
+            uint64_t signal_value = ++value;
+
+            VkResult result = vkQueueSubmit(ctx.queues[j % 2], 1,
+                &(VkSubmitInfo) {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .pNext = &(VkTimelineSemaphoreSubmitInfoKHR) {
+                        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+                        .waitSemaphoreValueCount = 1,
+                        .pWaitSemaphoreValues = &wait_value,
+                        .signalSemaphoreValueCount = 1,
+                        .pSignalSemaphoreValues = &signal_value,
+                    },
+                    .waitSemaphoreCount = 1,
+                    .pWaitSemaphores = &sem,
+                    .pWaitDstStageMask = &wait_stage,
+                    .signalSemaphoreCount = 1,
+                    .pSignalSemaphores = &sem,
+                }, VK_NULL_HANDLE);
+            t_assert(result == VK_SUCCESS);
+        }
+
+        VkResult result = WaitSemaphoresKHR(ctx.device,
+            &(VkSemaphoreWaitInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+                .semaphoreCount = 1,
+                .pSemaphores = &sem,
+                .pValues = &value,
+            }, UINT64_MAX);
+        t_assert(result == VK_SUCCESS);
+
+        if (i >= NUM_WARMUP_ITERATIONS)
+            samples[i - NUM_WARMUP_ITERATIONS] = gettime_ns() - start;
+    }
+
+    report_latency("timeline semaphore chain",
+                   samples, NUM_ITERATIONS);
+}
+
+test_define {
+    .name = "bench.sync.semaphore-chain.timeline",
+    .start = test_timeline_semaphore_chain,
+    .no_image = true,
+    .api_version = VK_MAKE_VERSION(1, 1, 0),
+};
+
+static VkEvent
+create_event(void)
+{
+    VkEvent event;
+    VkResult result = vkCreateEvent(t_device,
+        &(VkEventCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO,
+        }, NULL, &event);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_event(t_device, event);
+
+    return event;
+}
+
+static void
+test_event_host_to_device(void)
+{
+    VkEvent host_event = create_event();
+    VkEvent device_event = create_event();
+    VkFence fence = create_fence(t_device);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdWaitEvents(cmd, 1, &host_event,
+                    VK_PIPELINE_STAGE_HOST_BIT,
+                    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                    0, NULL, 0, NULL, 0, NULL);
+    vkCmdSetEvent(cmd, device_event, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    qoEndCommandBuffer(cmd);
+
+    uint64_t samples[NUM_ITERATIONS];
+
+    for (uint32_t i = 0; i < NUM_WARMUP_ITERATIONS + NUM_ITERATIONS; i++) {
+        VkResult result = vkResetEvent(t_device, host_event);
+        t_assert(result == VK_SUCCESS);
+        result = vkResetEvent(t_device, device_event);
+        t_assert(result == VK_SUCCESS);
+
+        qoQueueSubmit(t_queue, 1, &cmd, fence);
+
+        // Give the queue a moment to reach the wait so that we time the
+        // wake-up and not the submission.
+        usleep(100);
+
+        uint64_t start = gettime_ns();
+
+        result = vkSetEvent(t_device, host_event);
+        t_assert(result == VK_SUCCESS);
+        uint64_t end;
+        for (;;) {
+            result = vkGetEventStatus(t_device, device_event);
+            end = gettime_ns();
+
+            t_assertf(result >= 0, "vkGetEventStatus failed with VkResult %d",
+                      result);
+            if (result == VK_EVENT_SET)
+                break;
+
+            t_assertf(end - start < EVENT_TIMEOUT_NS,
+                      "device did not set the event within %llu ms",
+                      EVENT_TIMEOUT_NS / 1000000);
+        }
+
+        wait_and_reset_fence(t_device, fence);
+
+        if (i >= NUM_WARMUP_ITERATIONS)
+            samples[i - NUM_WARMUP_ITERATIONS] = end - start;
+    }
+
+    report_latency("vkSetEvent -> vkCmdWaitEvents -> vkCmdSetEvent",
+                   samples, NUM_ITERATIONS);
+}
+
+test_define {
+    .name = "bench.sync.event-host-to-device",
+    .start = test_event_host_to_device,
+    .no_image = true,
+};
+
+/// Time cross-device semaphore round trips, and separately the fd export and
+/// import that each round trip includes. As in func.sync.semaphore-fd.*,
+/// the two "processes" are two VkDevices in this process, which exercises
+/// the same kernel export/import path without forking a Vulkan process.
+static void
+test_external_semaphore(VkExternalSemaphoreHandleTypeFlagBitsKHR type)
+{
+    require_semaphore_handle_type(type);
+
+    struct sync_context ctx1, ctx2;
+    init_context(&ctx1, NULL);
+    init_context(&ctx2, NULL);
+
+    GET_FUNCTION_PTR(GetSemaphoreFdKHR, ctx1.device);
+    GET_FUNCTION_PTR(ImportSemaphoreFdKHR, ctx2.device);
+
+    const VkExportSemaphoreCreateInfoKHR export_info = {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR,
+        .handleTypes = type,
+    };
+
+    VkSemaphore signal_sem = create_semaphore(ctx1.device, &export_info);
+    VkSemaphore wait_sem = create_semaphore(ctx2.device, NULL);
+    VkFence fence = create_fence(ctx2.device);
+
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    uint64_t export_import_samples[NUM_ITERATIONS];
+    uint64_t round_trip_samples[NUM_ITERATIONS];
+
+    for (uint32_t i = 0; i < NUM_WARMUP_ITERATIONS + NUM_ITERATIONS; i++) {
+        uint64_t start = gettime_ns();
+
+        VkResult result = vkQueueSubmit(ctx1.queues[0], 1,
+            &(VkSubmitInfo) {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .signalSemaphoreCount = 1,
+                .pSignalSemaphores = &signal_sem,
+            }, VK_NULL_HANDLE);
+        t_assert(result == VK_SUCCESS);
+
+        uint64_t export_start = gettime_ns();
+
+        // Hand the payload over on every iteration, as a producer passing
+        // each frame's semaphore to another process would. The import is
+        // temporary, so wait_sem reverts to its own payload after the wait.
+        int fd;
+        result = GetSemaphoreFdKHR(ctx1.device,
+            &(VkSemaphoreGetFdInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+                .semaphore = signal_sem,
+                .handleType = type,
+            }, &fd);
+        t_assert(result == VK_SUCCESS);
+
+        result = ImportSemaphoreFdKHR(ctx2.device,
+            &(VkImportSemaphoreFdInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+                .semaphore = wait_sem,
+                .flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT_KHR,
+                .handleType = type,
+                .fd = fd,
+            });
+        t_assert(result == VK_SUCCESS);
+
+        uint64_t export_end = gettime_ns();
+
+        result = vkQueueSubmit(ctx2.queues[0], 1,
+            &(VkSubmitInfo) {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores = &wait_sem,
+                .pWaitDstStageMask = &wait_stage,
+            }, fence);
+        t_assert(result == VK_SUCCESS);
+
+        wait_and_reset_fence(ctx2.device, fence);
+
+        if (i >= NUM_WARMUP_ITERATIONS) {
+            uint32_t n = i - NUM_WARMUP_ITERATIONS;
+            export_import_samples[n] = export_end - export_start;
+            round_trip_samples[n] = gettime_ns() - start;
+        }
+    }
+
+    report_latency("fd export + import", export_import_samples,
+                   NUM_ITERATIONS);
+
+    report_latency("signal -> cross-device wait -> fence",
+                   round_trip_samples, NUM_ITERATIONS);
+}
+
+static void
+test_opaque_fd(void)
+{
+    test_external_semaphore(VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR);
+}
+
+test_define {
+    .name = "bench.sync.semaphore-fd.opaque-fd",
+    .start = test_opaque_fd,
+    .no_image = true,
+};
+
+static void
+test_sync_fd(void)
+{
+    test_external_semaphore(VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT_KHR);
+}
+
+test_define {
+    .name = "bench.sync.semaphore-fd.sync-fd",
+    .start = test_sync_fd,
+    .no_image = true,
+};
@@ -25,10 +25,18 @@
 
 #include "src/tests/func/amd/gcn_shader-spirv.h"
 
+static const char *const gcn_shader_exts[] = {
+    "VK_AMD_gcn_shader",
+    NULL,
+};
+
+static const VkPhysicalDeviceFeatures int64_features = {
+    .shaderInt64 = true,
+};
+
 static void
 time(void)
 {
-    t_require_ext("VK_AMD_gcn_shader");
     VkShaderModule fs = qoCreateShaderModuleGLSL(
         t_device, FRAGMENT,
         QO_EXTENSION GL_ARB_gpu_shader_int64 : enable
@@ -57,13 +65,14 @@ time(void)
 test_define {
     .name = "func.amd.gcn-shader.time",
     .start = time,
+    .device_extensions = gcn_shader_exts,
+    .device_features = &int64_features,
     .image_filename = "32x32-green.ref.png",
 };
 
 static void
 cubeFaceCoordTC(void)
 {
-    t_require_ext("VK_AMD_gcn_shader");
     VkShaderModule cs = qoCreateShaderModuleGLSL(
         t_device, COMPUTE,
         QO_EXTENSION GL_AMD_gcn_shader : enable
@@ -102,13 +111,13 @@ cubeFaceCoordTC(void)
 test_define {
     .name = "func.amd.gcn-shader.cube-face-coord-tc",
     .start = cubeFaceCoordTC,
+    .device_extensions = gcn_shader_exts,
     .no_image = true,
 };
 
 static void
 cubeFaceCoordSC(void)
 {
-    t_require_ext("VK_AMD_gcn_shader");
     VkShaderModule cs = qoCreateShaderModuleGLSL(
         t_device, COMPUTE,
         QO_EXTENSION GL_AMD_gcn_shader : enable
@@ -147,13 +156,13 @@ cubeFaceCoordSC(void)
 test_define {
     .name = "func.amd.gcn-shader.cube-face-coord-sc",
     .start = cubeFaceCoordSC,
+    .device_extensions = gcn_shader_exts,
     .no_image = true,
 };
 
 static void
 cubeFaceIndex(void)
 {
-    t_require_ext("VK_AMD_gcn_shader");
     VkShaderModule cs = qoCreateShaderModuleGLSL(
         t_device, COMPUTE,
         QO_EXTENSION GL_AMD_gcn_shader : enable
@@ -192,6 +201,7 @@ cubeFaceIndex(void)
 test_define {
     .name = "func.amd.gcn-shader.cube-face-index",
     .start = cubeFaceIndex,
+    .device_extensions = gcn_shader_exts,
     .no_image = true,
 };
 
@@ -199,7 +209,6 @@ test_define {
 static void
 constant_folding(void)
 {
-    t_require_ext("VK_AMD_gcn_shader");
     VkShaderModule fs = qoCreateShaderModuleGLSL(
         t_device, FRAGMENT,
         QO_EXTENSION GL_AMD_gcn_shader : enable
@@ -257,5 +266,6 @@ constant_folding(void)
 test_define {
     .name = "func.amd.gcn-shader.constant",
     .start = constant_folding,
+    .device_extensions = gcn_shader_exts,
     .image_filename = "32x32-green.ref.png",
 };
@@ -47,7 +47,9 @@
 /// TODO: Test multisampled images.
 /// TODO: Test non-square, non-power-of-two image sizes.
 
+#include <inttypes.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdnoreturn.h>
 
 #include "util/cru_format.h"
@@ -82,6 +84,15 @@ enum miptree_intermediate_method {
     MIPTREE_INTERMEDIATE_METHOD_COPY_IMAGE,
 };
 
+/// The GPU work of each test, in submission order. Used to index the
+/// timestamp queries of the bench.miptree.* tests.
+enum miptree_stage {
+    MIPTREE_STAGE_UPLOAD,
+    MIPTREE_STAGE_INTERMEDIATE,
+    MIPTREE_STAGE_DOWNLOAD,
+    MIPTREE_STAGE_COUNT,
+};
+
 struct test_params {
     VkFormat format;
     VkImageAspectFlagBits aspect;
@@ -106,9 +117,16 @@ struct test_data {
         VkDeviceSize vertex_buffer_offset;
         VkRenderPass render_pass;
         VkDescriptorSetLayout set_layout;
+        VkDescriptorPool desc_pool;
         VkPipelineLayout pipeline_layout;
         VkPipeline pipeline;
     } draw;
+
+    /// Used only by the bench.miptree.* tests. If not VK_NULL_HANDLE, each
+    /// stage writes a pair of timestamps around each level, starting at
+    /// query timestamps_base + 2 * (stage * levels + level).
+    VkQueryPool timestamps;
+    uint32_t timestamps_base;
 };
 
 struct mipslice {
@@ -273,16 +291,21 @@ mipslice_perturb_pixels(void *pixels,
      }
 }
 
+/// Return the name of the file from which to load the template, and the
+/// extent of the template. Grayscale templates are scaled from a single large
+/// file.
 static string_t
 mipslice_get_template_filename(const cru_format_info_t *format_info,
                                uint32_t image_width, uint32_t image_height,
                                uint32_t level, uint32_t num_levels,
-                               uint32_t layer, uint32_t num_layers, bool *has_mipmaps)
+                               uint32_t layer, uint32_t num_layers, bool *has_mipmaps,
+                               uint32_t *file_width, uint32_t *file_height)
 {
     const test_params_t *params = t_user_data;
 
     string_t filename = STRING_INIT;
     const char *ext = "png";
+    bool scaled = false;
     *has_mipmaps = false;
     // The test attempts to make each pair of adjact mipslices visually
     // distinct to (1) reduce the probability of the test falsely passing and
@@ -306,6 +329,7 @@ mipslice_get_template_filename(const cru_format_info_t *format_info,
         } else {
             string_appendf(&filename, "pink-leaves-grayscale");
         }
+        scaled = true;
         break;
     case VK_FORMAT_BC3_UNORM_BLOCK:
         string_appendf(&filename, "mandrill-dxt5");
@@ -331,18 +355,27 @@ mipslice_get_template_filename(const cru_format_info_t *format_info,
                 height = 16;
         }
         // Reuse 2d image files for 1d images.
-        string_appendf(&filename, "-%ux%u.%s", level_width, height, ext);
+        *file_width = level_width;
+        *file_height = height;
         break;
     }
     case VK_IMAGE_VIEW_TYPE_2D:
     case VK_IMAGE_VIEW_TYPE_2D_ARRAY:
     case VK_IMAGE_VIEW_TYPE_3D:
-        string_appendf(&filename, "-%ux%u.%s", level_width, level_height, ext);
+        *file_width = level_width;
+        *file_height = level_height;
         break;
     default:
         t_failf("FINISHME: VkImageViewType %d", params->view_type);
     }
 
+    if (scaled) {
+        string_appendf(&filename, "-2048x1024.%s", ext);
+    } else {
+        string_appendf(&filename, "-%ux%u.%s", *file_width, *file_height,
+                       ext);
+    }
+
     return filename;
 }
 
@@ -436,15 +469,23 @@ mipslice_make_template_image(const struct cru_format_info *format_info,
 {
     const test_params_t *params = t_user_data;
     bool has_mipmaps = false;
+    uint32_t file_width, file_height;
     string_t filename = mipslice_get_template_filename(
             format_info, image_width, image_height,
-            level, num_levels, layer, num_layers, &has_mipmaps);
-
-    // FIXME: Don't load the same file multiple times. It slows down the test
-    // run.
-    cru_image_array_t *file_ia =
-        t_new_cru_image_array_from_filename(string_data(&filename));
-    cru_image_t *file_img = cru_image_array_get_image(file_ia, has_mipmaps ? level : 0);
+            level, num_levels, layer, num_layers, &has_mipmaps,
+            &file_width, &file_height);
+
+    cru_image_t *file_img;
+    if (has_mipmaps) {
+        cru_image_array_t *file_ia =
+            t_new_cru_image_array_from_filename(string_data(&filename));
+        file_img = cru_image_array_get_image(file_ia, level);
+    } else {
+        // Each file is decoded, and each extent generated, once per process.
+        file_img = t_new_cru_image_from_filename_scaled(string_data(&filename),
+                                                        file_width,
+                                                        file_height);
+    }
     switch (params->view_type) {
     case VK_IMAGE_VIEW_TYPE_1D:
     case VK_IMAGE_VIEW_TYPE_1D_ARRAY: {
@@ -826,6 +867,57 @@ miptree_create(void)
     return mt;
 }
 
+/// Index of the first of the pair of timestamp queries that bracket the given
+/// stage of the given level.
+static uint32_t
+level_query(const test_data_t *data, enum miptree_stage stage, uint32_t level)
+{
+    return data->timestamps_base + 2 * (stage * data->mt->levels + level);
+}
+
+/// Called before the commands that copy a mipslice. If the slice is the first
+/// of its level, write the level's start timestamp. The mipslices are ordered
+/// by level, so the slices of each level are contiguous.
+static void
+cmd_begin_slice(const test_data_t *data, VkCommandBuffer cmd,
+                enum miptree_stage stage, const mipslice_t *slice)
+{
+    if (data->timestamps == VK_NULL_HANDLE)
+        return;
+
+    if (slice != data->mt->mipslices.data && slice[-1].level == slice->level)
+        return;
+
+    // Finish the previous level before starting this one, so that each
+    // level's timestamps bracket only its own work.
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0, 0, NULL, 0, NULL, 0, NULL);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        data->timestamps,
+                        level_query(data, stage, slice->level));
+}
+
+/// Called after the commands that copy a mipslice. If the slice is the last
+/// of its level, write the level's end timestamp.
+static void
+cmd_end_slice(const test_data_t *data, VkCommandBuffer cmd,
+              enum miptree_stage stage, const mipslice_t *slice)
+{
+    const mipslice_vec_t *slices = &data->mt->mipslices;
+
+    if (data->timestamps == VK_NULL_HANDLE)
+        return;
+
+    if (slice + 1 != slices->data + slices->len &&
+        slice[1].level == slice->level)
+        return;
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        data->timestamps,
+                        level_query(data, stage, slice->level) + 1);
+}
+
 static void
 miptree_upload_copy_from_buffer(const test_data_t *data)
 {
@@ -855,6 +947,8 @@ miptree_upload_copy_from_buffer(const test_data_t *data)
                              }
                          });
     cru_vec_foreach(slice, &mt->mipslices) {
+        cmd_begin_slice(data, cmd, MIPTREE_STAGE_UPLOAD, slice);
+
         VkBufferImageCopy copy = {
             .bufferOffset = slice->buffer_offset,
             .imageSubresource = {
@@ -877,6 +971,7 @@ miptree_upload_copy_from_buffer(const test_data_t *data)
 
         vkCmdCopyBufferToImage(cmd, mt->src_buffer, mt->image,
                                VK_IMAGE_LAYOUT_GENERAL, 1, &copy);
+        cmd_end_slice(data, cmd, MIPTREE_STAGE_UPLOAD, slice);
     }
 
     qoEndCommandBuffer(cmd);
@@ -894,6 +989,8 @@ miptree_download_copy_to_buffer(const test_data_t *data, VkImage download_image)
     qoBeginCommandBuffer(cmd);
 
     cru_vec_foreach(slice, &mt->mipslices) {
+        cmd_begin_slice(data, cmd, MIPTREE_STAGE_DOWNLOAD, slice);
+
         VkBufferImageCopy copy = {
             .bufferOffset = slice->buffer_offset,
             .imageSubresource = {
@@ -916,6 +1013,7 @@ miptree_download_copy_to_buffer(const test_data_t *data, VkImage download_image)
 
         vkCmdCopyImageToBuffer(cmd, download_image, VK_IMAGE_LAYOUT_GENERAL,
                                mt->dest_buffer, 1, &copy);
+        cmd_end_slice(data, cmd, MIPTREE_STAGE_DOWNLOAD, slice);
     }
 
     qoEndCommandBuffer(cmd);
@@ -952,6 +1050,8 @@ miptree_upload_copy_from_linear_image(const test_data_t *data)
                              }
                          });
     cru_vec_foreach(slice, &mt->mipslices) {
+        cmd_begin_slice(data, cmd, MIPTREE_STAGE_UPLOAD, slice);
+
         VkImageCopy copy = {
             .srcSubresource = {
                 .aspectMask = params->aspect,
@@ -1001,6 +1101,7 @@ miptree_upload_copy_from_linear_image(const test_data_t *data)
         vkCmdCopyImage(cmd, slice->src_vk_image, VK_IMAGE_LAYOUT_GENERAL,
                        mt->image, VK_IMAGE_LAYOUT_GENERAL,
                        1, &copy);
+        cmd_end_slice(data, cmd, MIPTREE_STAGE_UPLOAD, slice);
     }
 
     qoEndCommandBuffer(cmd);
@@ -1018,6 +1119,8 @@ miptree_download_copy_to_linear_image(const test_data_t *data, VkImage download_
     qoBeginCommandBuffer(cmd);
 
     cru_vec_foreach(slice, &mt->mipslices) {
+        cmd_begin_slice(data, cmd, MIPTREE_STAGE_DOWNLOAD, slice);
+
         VkImageCopy copy = {
             .srcSubresource = {
                 .aspectMask = params->aspect,
@@ -1067,6 +1170,7 @@ miptree_download_copy_to_linear_image(const test_data_t *data, VkImage download_
         vkCmdCopyImage(cmd, download_image, VK_IMAGE_LAYOUT_GENERAL,
                        slice->dest_vk_image, VK_IMAGE_LAYOUT_GENERAL,
                        1, &copy);
+        cmd_end_slice(data, cmd, MIPTREE_STAGE_DOWNLOAD, slice);
     }
 
     qoEndCommandBuffer(cmd);
@@ -1075,6 +1179,7 @@ miptree_download_copy_to_linear_image(const test_data_t *data, VkImage download_
 
 static void
 copy_color_images_with_draw(const test_data_t *data,
+                            enum miptree_stage stage,
                             VkExtent2D extents[],
                             VkImageView tex_views[],
                             VkImageView attachment_views[],
@@ -1083,7 +1188,7 @@ copy_color_images_with_draw(const test_data_t *data,
     VkDescriptorSet desc_sets[count];
     for (uint32_t i = 0; i < count; i++) {
         desc_sets[i] = qoAllocateDescriptorSet(t_device,
-            .descriptorPool = t_descriptor_pool,
+            .descriptorPool = data->draw.desc_pool,
             .pSetLayouts = &data->draw.set_layout);
     }
 
@@ -1095,9 +1200,12 @@ copy_color_images_with_draw(const test_data_t *data,
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, data->draw.pipeline);
 
     for (uint32_t i = 0; i < count; ++i) {
+        const mipslice_t *slice = &data->mt->mipslices.data[i];
         const uint32_t width = extents[i].width;
         const uint32_t height = extents[i].height;
 
+        cmd_begin_slice(data, cmd, stage, slice);
+
         vkCmdSetViewport(cmd, 0, 1,
             &(VkViewport) {
                 .x = 0,
@@ -1168,6 +1276,7 @@ copy_color_images_with_draw(const test_data_t *data,
         vkCmdDraw(cmd, data->draw.num_vertices, /*instanceCount*/ 1,
                   /*firstVertex*/ 0, /*firstInstance*/ 0);
         vkCmdEndRenderPass(cmd);
+        cmd_end_slice(data, cmd, stage, slice);
     }
 
     qoEndCommandBuffer(cmd);
@@ -1219,8 +1328,8 @@ miptree_upload_copy_with_draw(const test_data_t *data)
             });
     }
 
-    copy_color_images_with_draw(data, extents, tex_views, att_views,
-                                num_views);
+    copy_color_images_with_draw(data, MIPTREE_STAGE_UPLOAD, extents,
+                                tex_views, att_views, num_views);
 }
 
 static void
@@ -1270,8 +1379,8 @@ miptree_download_copy_with_draw(const test_data_t *data, VkImage download_image)
             });
     }
 
-    copy_color_images_with_draw(data, extents, tex_views, att_views,
-                                num_views);
+    copy_color_images_with_draw(data, MIPTREE_STAGE_DOWNLOAD, extents,
+                                tex_views, att_views, num_views);
 }
 
 static void
@@ -1334,6 +1443,8 @@ miptree_intermediate_copy_image(const test_data_t *data)
     qoBeginCommandBuffer(cmd);
 
     cru_vec_foreach(slice, &mt->mipslices) {
+        cmd_begin_slice(data, cmd, MIPTREE_STAGE_INTERMEDIATE, slice);
+
         vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
                              VK_PIPELINE_STAGE_TRANSFER_BIT,
                              0, 0, NULL, 0, NULL, 1,
@@ -1387,6 +1498,7 @@ miptree_intermediate_copy_image(const test_data_t *data)
         vkCmdCopyImage(cmd, mt->image, VK_IMAGE_LAYOUT_GENERAL,
                        mt->intermediate_image, VK_IMAGE_LAYOUT_GENERAL, 1,
                        &copy);
+        cmd_end_slice(data, cmd, MIPTREE_STAGE_INTERMEDIATE, slice);
     }
     qoEndCommandBuffer(cmd);
     qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
@@ -1430,8 +1542,11 @@ miptree_compare_images(const miptree_t *mt)
     t_end(result);
 }
 
+/// The draw methods allocate one descriptor set per mipslice on each upload
+/// or download, \a num_copies times over.
 static void
-init_draw_data(test_draw_data_t *draw_data)
+init_draw_data(test_draw_data_t *draw_data, const miptree_t *mt,
+               uint32_t num_copies)
 {
     const test_params_t *params = t_user_data;
 
@@ -1507,6 +1622,23 @@ init_draw_data(test_draw_data_t *draw_data)
             },
         });
 
+    const uint32_t max_sets = num_copies * mt->mipslices.len;
+
+    VkDescriptorPool desc_pool;
+    VkResult result = vkCreateDescriptorPool(t_device,
+        &(VkDescriptorPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+            .maxSets = max_sets,
+            .poolSizeCount = 1,
+            .pPoolSizes = &(VkDescriptorPoolSize) {
+                .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                .descriptorCount = max_sets,
+            },
+        }, NULL, &desc_pool);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_descriptor_pool(t_device, desc_pool);
+
     VkPipelineLayout pipeline_layout = qoCreatePipelineLayout(t_device,
         .setLayoutCount = 1,
         .pSetLayouts = &set_layout);
@@ -1548,15 +1680,15 @@ init_draw_data(test_draw_data_t *draw_data)
         }});
 
     VkBuffer vb = qoCreateBuffer(t_device, .size = vb_size,
-                                 .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-
-    VkDeviceMemory vb_mem = qoAllocBufferMemory(t_device, vb,
-        .properties = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                                 .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 
-    qoBindBufferMemory(t_device, vb, vb_mem, /*offset*/ 0);
+    qoAllocBufferMemory(t_device, vb,
+        .properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .suballocate = true);
 
-    memcpy(qoMapMemory(t_device, vb_mem, /*offset*/ 0, vb_size, /*flags*/ 0),
-           position_data, sizeof(position_data));
+    qoUploadBuffer(t_device, vb, /*offset*/ 0,
+                   position_data, sizeof(position_data));
 
     // Prevent dumb bugs by initializing the struct in one shot.
     *draw_data = (test_draw_data_t) {
@@ -1564,6 +1696,7 @@ init_draw_data(test_draw_data_t *draw_data)
         .vertex_buffer_offset = 0,
         .num_vertices = num_vertices,
         .set_layout = set_layout,
+        .desc_pool = desc_pool,
         .pipeline_layout = pipeline_layout,
         .pipeline = pipeline,
         .render_pass = pass,
@@ -1576,7 +1709,9 @@ test(void)
     test_data_t data = {0};
 
     data.mt = miptree_create();
-    init_draw_data(&data.draw);
+
+    // Upload and download may both draw.
+    init_draw_data(&data.draw, data.mt, 2);
 
     miptree_upload(&data);
 
@@ -1585,4 +1720,136 @@ test(void)
     miptree_compare_images(data.mt);
 }
 
+/// Bytes of pixel data in one level of the miptree, which is what each stage
+/// moves for that level.
+static uint64_t
+miptree_calc_level_bytes(const miptree_t *mt, uint32_t level)
+{
+    const test_params_t *params = t_user_data;
+    const cru_format_info_t *format_info = t_format_info(params->format);
+    const mipslice_t *slice;
+    uint64_t bytes = 0;
+
+    cru_vec_foreach(slice, &mt->mipslices) {
+        if (slice->level != level)
+            continue;
+
+        // BC3 packs a 4x4 block into 16 bytes, one byte per pixel.
+        uint32_t bytes_per_pixel =
+            params->format == VK_FORMAT_BC3_UNORM_BLOCK ? 1 : format_info->cpp;
+        bytes += (uint64_t) slice->width * slice->height * bytes_per_pixel;
+    }
+
+    return bytes;
+}
+
+#define BENCH_RUNS 8
+
+/// Log the best and mean of BENCH_RUNS GPU times, and the throughput for the
+/// given number of bytes. Bytes per nanosecond is GB/s.
+static void
+bench_report(const char *stage_name, const char *level_name, uint64_t bytes,
+             const double ns[])
+{
+    double best_ns = INFINITY, total_ns = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        best_ns = MIN(best_ns, ns[run]);
+        total_ns += ns[run];
+    }
+
+    logi("%-12s %-6s %10" PRIu64 " bytes  best %9.1f us %7.2f GB/s  "
+         "mean %9.1f us %7.2f GB/s\n", stage_name, level_name, bytes,
+         best_ns / 1000.0, bytes / best_ns,
+         total_ns / BENCH_RUNS / 1000.0, bytes / (total_ns / BENCH_RUNS));
+}
+
+/// Run the test's upload, intermediate and download stages BENCH_RUNS times
+/// and report the GPU time of each level of each stage, and of each stage as
+/// a whole, from timestamp queries. The last run's result is still checked
+/// against the reference images.
+static void
+bench(void)
+{
+    const test_params_t *params = t_user_data;
+    test_data_t data = {0};
+
+    if (!t_physical_dev_props->limits.timestampComputeAndGraphics)
+        t_skipf("timestamps not supported on graphics queues");
+
+    data.mt = miptree_create();
+    init_draw_data(&data.draw, data.mt, 2 * BENCH_RUNS);
+
+    const uint32_t levels = data.mt->levels;
+    const uint32_t queries_per_run = 2 * MIPTREE_STAGE_COUNT * levels;
+    const uint32_t num_queries = BENCH_RUNS * queries_per_run;
+
+    data.timestamps = qoCreateQueryPool(t_device,
+                                        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                                        .queryCount = num_queries);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdResetQueryPool(cmd, data.timestamps, 0, num_queries);
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        data.timestamps_base = run * queries_per_run;
+
+        miptree_upload(&data);
+        miptree_intermediate(&data);
+        miptree_download(&data);
+
+        // Keep the stages of consecutive runs from overlapping.
+        qoQueueWaitIdle(t_queue);
+    }
+
+    static const char *stage_names[] = {
+        [MIPTREE_STAGE_UPLOAD] = "upload",
+        [MIPTREE_STAGE_INTERMEDIATE] = "intermediate",
+        [MIPTREE_STAGE_DOWNLOAD] = "download",
+    };
+
+    const double period = t_physical_dev_props->limits.timestampPeriod;
+
+    for (uint32_t stage = 0; stage < MIPTREE_STAGE_COUNT; stage++) {
+        if (stage == MIPTREE_STAGE_INTERMEDIATE &&
+            params->intermediate_method == MIPTREE_INTERMEDIATE_METHOD_NONE)
+            continue;
+
+        double stage_ns[BENCH_RUNS] = {0};
+        uint64_t stage_bytes = 0;
+
+        for (uint32_t l = 0; l < levels; l++) {
+            double level_ns[BENCH_RUNS];
+
+            for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+                // Only query the stages that ran. Waiting on a query that
+                // was never written would never return.
+                uint64_t ts[2];
+                VkResult result = vkGetQueryPoolResults(t_device,
+                    data.timestamps,
+                    run * queries_per_run + 2 * (stage * levels + l),
+                    2, sizeof(ts), ts, sizeof(ts[0]),
+                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                t_assert(result == VK_SUCCESS);
+
+                level_ns[run] = (ts[1] - ts[0]) * period;
+                stage_ns[run] += level_ns[run];
+            }
+
+            const uint64_t bytes = miptree_calc_level_bytes(data.mt, l);
+            char level_name[16];
+            snprintf(level_name, sizeof(level_name), "level%u", l);
+
+            bench_report(stage_names[stage], level_name, bytes, level_ns);
+            stage_bytes += bytes;
+        }
+
+        bench_report(stage_names[stage], "total", stage_bytes, stage_ns);
+    }
+
+    miptree_compare_images(data.mt);
+}
+
 #include "src/tests/func/miptree/miptree_gen.h"
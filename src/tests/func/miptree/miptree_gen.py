@@ -332,9 +332,22 @@ def all_params_iter():
     for p in stencil_3d_params_iter:
         yield p
 
+# The bench.miptree.* tests reuse the upload, intermediate and download paths
+# of the 2D and 3D functional tests, and time each level of each stage on the
+# GPU.
+def bench_params_iter(all_params):
+    for p in all_params:
+        if p.view == '1d':
+            continue
+        if p.levels != 2 or p.array_length != 1:
+            continue
+        if p.extent in (Extent3D(16384, 32, 1), Extent3D(32, 16384, 1)):
+            continue
+        yield p
+
 template = dedent("""
     test_define {{
-        .name = "func.miptree"
+        .name = "{kind}.miptree"
                 ".{format[0]}"
                 ".aspect-{aspect}"
                 ".view-{view}"
@@ -342,7 +355,7 @@ template = dedent("""
                 "{array_length_str}"
                 ".extent-{extent_str}"
                 ".upload-{upload}.download-{download}.intermediate-{intermediate}",
-        .start = test,
+        .start = {start},
         .skip = {skip},
         .no_image = true,
         .user_data = &(test_params_t) {{
@@ -414,8 +427,16 @@ def main():
     with open(out_filename, 'w') as out_file:
         out_file.write(copyright)
 
-        for p in all_params_iter():
+        # The *_params_iter generators can only be consumed once.
+        all_params = list(all_params_iter())
+
+        all_tests = [('func', 'test', p) for p in all_params]
+        all_tests += [('bench', 'bench', p) for p in bench_params_iter(all_params)]
+
+        for kind, start, p in all_tests:
             test_def = template.format(
+                kind = kind,
+                start = start,
                 format = p.format,
                 aspect = p.aspect,
                 view = p.view,
@@ -24,11 +24,17 @@
 
 #include "src/tests/func/shader/pack_unpack-spirv.h"
 
+static const VkPhysicalDeviceFeatures float64_features = {
+    .shaderFloat64 = true,
+};
+
+static const VkPhysicalDeviceFeatures int64_features = {
+    .shaderInt64 = true,
+};
+
 static void
 pack_double(void)
 {
-    t_require_feature(shaderFloat64);
-
     VkShaderModule fs = qoCreateShaderModuleGLSL(t_device, FRAGMENT,
         layout(location = 0) out vec4 f_color;
         layout(push_constant) uniform push_consts {
@@ -59,14 +65,13 @@ pack_double(void)
 test_define {
     .name = "func.shader.packDouble2x32.basic",
     .start = pack_double,
+    .device_features = &float64_features,
     .image_filename = "32x32-green.ref.png",
 };
 
 static void
 unpack_double(void)
 {
-    t_require_feature(shaderFloat64);
-
     VkShaderModule fs = qoCreateShaderModuleGLSL(t_device, FRAGMENT,
         layout(location = 0) out vec4 f_color;
         layout(push_constant) uniform push_consts {
@@ -97,14 +102,13 @@ unpack_double(void)
 test_define {
     .name = "func.shader.unpackDouble2x32.basic",
     .start = unpack_double,
+    .device_features = &float64_features,
     .image_filename = "32x32-green.ref.png",
 };
 
 static void
 pack_int64(void)
 {
-    t_require_feature(shaderInt64);
-
     VkShaderModule fs = qoCreateShaderModuleGLSL(t_device, FRAGMENT,
     QO_EXTENSION GL_ARB_gpu_shader_int64 : enable
         layout(location = 0) out vec4 f_color;
@@ -136,14 +140,13 @@ pack_int64(void)
 test_define {
     .name = "func.shader.packUint2x32.basic",
     .start = pack_int64,
+    .device_features = &int64_features,
     .image_filename = "32x32-green.ref.png",
 };
 
 static void
 unpack_int64(void)
 {
-    t_require_feature(shaderInt64);
-
     VkShaderModule fs = qoCreateShaderModuleGLSL(t_device, FRAGMENT,
     QO_EXTENSION GL_ARB_gpu_shader_int64 : enable
         layout(location = 0) out vec4 f_color;
@@ -175,6 +178,7 @@ unpack_int64(void)
 test_define {
     .name = "func.shader.unpackUint2x32.basic",
     .start = unpack_int64,
+    .device_features = &int64_features,
     .image_filename = "32x32-green.ref.png",
 };
 
@@ -0,0 +1,161 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+/// \file
+/// \brief Test cru_format_convert_rect().
+///
+/// Every format here holds 8-bit unorm values exactly, so converting an
+/// R8G8B8A8_UNORM image to it and back must reproduce the original bytes.
+
+#include "tapi/t.h"
+#include "util/cru_format.h"
+
+#define WIDTH 67
+#define HEIGHT 5
+
+static void
+fill_random(uint8_t *pixels, size_t size)
+{
+    // A fixed seed keeps failures reproducible.
+    uint32_t x = 0x12345678;
+
+    for (size_t i = 0; i < size; i++) {
+        x = x * 1103515245 + 12345;
+        pixels[i] = x >> 24;
+    }
+}
+
+static void
+test_round_trip(void)
+{
+    const VkFormat format = (VkFormat) (uintptr_t) t_user_data;
+    const cru_format_info_t *rgba8 = t_format_info(VK_FORMAT_R8G8B8A8_UNORM);
+    const cru_format_info_t *info = t_format_info(format);
+
+    const uint32_t stride = WIDTH * info->cpp;
+    uint8_t src[WIDTH * HEIGHT * 4];
+    uint8_t dest[WIDTH * HEIGHT * 4];
+    uint8_t *tmp = xmalloc(stride * HEIGHT);
+    t_cleanup_push_free(tmp);
+
+    fill_random(src, sizeof(src));
+
+    t_assert(cru_format_convert_rect(info, tmp, stride,
+                                     rgba8, src, WIDTH * 4, WIDTH, HEIGHT));
+    t_assert(cru_format_convert_rect(rgba8, dest, WIDTH * 4,
+                                     info, tmp, stride, WIDTH, HEIGHT));
+
+    for (uint32_t i = 0; i < WIDTH * HEIGHT * 4; i++) {
+        t_assertf(src[i] == dest[i],
+                  "byte %u: expected 0x%02x, got 0x%02x", i, src[i], dest[i]);
+    }
+
+    t_pass();
+}
+
+#define ROUND_TRIP_TEST(_name, _format) \
+test_define { \
+    .name = "self.format-convert.round-trip." _name, \
+    .start = test_round_trip, \
+    .no_image = true, \
+    .user_data = (void *) (uintptr_t) _format, \
+};
+
+ROUND_TRIP_TEST("b8g8r8a8-unorm", VK_FORMAT_B8G8R8A8_UNORM)
+ROUND_TRIP_TEST("r8g8b8a8-uint", VK_FORMAT_R8G8B8A8_UINT)
+ROUND_TRIP_TEST("r16g16b16a16-unorm", VK_FORMAT_R16G16B16A16_UNORM)
+ROUND_TRIP_TEST("r16g16b16a16-sfloat", VK_FORMAT_R16G16B16A16_SFLOAT)
+ROUND_TRIP_TEST("r32g32b32a32-sfloat", VK_FORMAT_R32G32B32A32_SFLOAT)
+ROUND_TRIP_TEST("r32g32b32a32-uint", VK_FORMAT_R32G32B32A32_UINT)
+
+static void
+test_swizzle(void)
+{
+    const uint8_t r8[] = { 0x10, 0x20 };
+    const uint8_t bgra8[] = { 0x01, 0x02, 0x03, 0x04 };
+    uint8_t rgba8[8];
+
+    // Missing components read as 0 and missing alpha as 1.
+    t_assert(cru_format_convert_rect(t_format_info(VK_FORMAT_R8G8B8A8_UNORM),
+                                     rgba8, sizeof(rgba8),
+                                     t_format_info(VK_FORMAT_R8_UNORM),
+                                     r8, sizeof(r8), 2, 1));
+    t_assert(memcmp(rgba8, (uint8_t[]) { 0x10, 0, 0, 0xff, 0x20, 0, 0, 0xff },
+                    8) == 0);
+
+    t_assert(cru_format_convert_rect(t_format_info(VK_FORMAT_R8G8B8A8_UNORM),
+                                     rgba8, sizeof(rgba8),
+                                     t_format_info(VK_FORMAT_B8G8R8A8_UNORM),
+                                     bgra8, sizeof(bgra8), 1, 1));
+    t_assert(memcmp(rgba8, (uint8_t[]) { 0x03, 0x02, 0x01, 0x04 }, 4) == 0);
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.format-convert.swizzle",
+    .start = test_swizzle,
+    .no_image = true,
+};
+
+static void
+test_uint_expand(void)
+{
+    const uint8_t r8[] = { 5, 200 };
+    uint16_t rgba16f[8];
+    float rgba32f[8];
+    int8_t rgba8_snorm[8];
+
+    // UINT values convert to float by value, and the missing alpha is 1.0.
+    t_assert(cru_format_convert_rect(
+        t_format_info(VK_FORMAT_R16G16B16A16_SFLOAT),
+        rgba16f, sizeof(rgba16f),
+        t_format_info(VK_FORMAT_R8_UINT), r8, sizeof(r8), 2, 1));
+    t_assert(memcmp(rgba16f, (uint16_t[]) {
+                        0x4500, 0, 0, 0x3c00, 0x5a40, 0, 0, 0x3c00,
+                    }, sizeof(rgba16f)) == 0);
+
+    t_assert(cru_format_convert_rect(
+        t_format_info(VK_FORMAT_R32G32B32A32_SFLOAT),
+        rgba32f, sizeof(rgba32f),
+        t_format_info(VK_FORMAT_R8_UINT), r8, sizeof(r8), 2, 1));
+    t_assert(memcmp(rgba32f, (float[]) {
+                        5.0f, 0.0f, 0.0f, 1.0f, 200.0f, 0.0f, 0.0f, 1.0f,
+                    }, sizeof(rgba32f)) == 0);
+
+    // SNORM is clamped to its positive range, and 1.0 is 0x7f.
+    t_assert(cru_format_convert_rect(
+        t_format_info(VK_FORMAT_R8G8B8A8_SNORM),
+        rgba8_snorm, sizeof(rgba8_snorm),
+        t_format_info(VK_FORMAT_R8_UINT), r8, sizeof(r8), 2, 1));
+    t_assert(memcmp(rgba8_snorm, (int8_t[]) {
+                        5, 0, 0, 0x7f, 0x7f, 0, 0, 0x7f,
+                    }, sizeof(rgba8_snorm)) == 0);
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.format-convert.uint-expand",
+    .start = test_uint_expand,
+    .no_image = true,
+};
@@ -0,0 +1,226 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Test gpu_image_compare() against cru_image_compare().
+///
+/// Each test uploads the same pixels to a VkImage and compares it against a
+/// reference on both paths. The GPU result must agree with the CPU result
+/// and report exactly the pixels that were changed.
+
+#include "tapi/t.h"
+#include "util/gpu_image_compare.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+// Not multiples of the shader's 8x8 workgroup, to cover the edges.
+#define WIDTH 67
+#define HEIGHT 29
+
+enum compare_case {
+    CASE_EQUAL,
+    CASE_DIFFERENT,
+    CASE_TOLERANCE,
+};
+
+static void
+fill_random(uint8_t *pixels, size_t size)
+{
+    // A fixed seed keeps failures reproducible.
+    uint32_t x = 0x12345678;
+
+    for (size_t i = 0; i < size; i++) {
+        x = x * 1103515245 + 12345;
+        pixels[i] = x >> 24;
+    }
+}
+
+static VkImage
+create_image(const uint8_t *pixels)
+{
+    VkImage image = qoCreateImage(t_device,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .extent = {
+            .width = WIDTH,
+            .height = HEIGHT,
+            .depth = 1,
+        });
+    qoAllocImageMemory(t_device, image,
+        .properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .suballocate = true);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, 1,
+                         &(VkImageMemoryBarrier) {
+                             .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                             .srcAccessMask = 0,
+                             .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                             .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                             .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                             .image = image,
+                             .subresourceRange = {
+                                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .levelCount = 1,
+                                 .layerCount = 1,
+                             },
+                         });
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+
+    qoUploadImage(t_device, image, pixels, WIDTH * HEIGHT * 4,
+                  .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                  .imageExtent = { WIDTH, HEIGHT, 1 });
+    qoFinishUploads(t_device);
+
+    return image;
+}
+
+static void
+test(void)
+{
+    const enum compare_case c = (enum compare_case) (uintptr_t) t_user_data;
+
+    const size_t size = WIDTH * HEIGHT * 4;
+    uint8_t *actual = xmalloc(size);
+    uint8_t *ref = xmalloc(size);
+    uint32_t tolerance = 0;
+
+    t_cleanup_push_free(actual);
+    t_cleanup_push_free(ref);
+
+    fill_random(actual, size);
+    memcpy(ref, actual, size);
+
+    // The pixels that the reference changes, and the bits it flips. Flipping
+    // a bit changes the channel by exactly that bit's value.
+    static const struct {
+        uint32_t x, y, channel;
+        uint8_t flip;
+    } changes[] = {
+        { 3, 4, 0, 0x04 },
+        { 66, 28, 3, 0x80 },
+        { 40, 9, 1, 1 },
+    };
+
+    switch (c) {
+    case CASE_EQUAL:
+        break;
+    case CASE_DIFFERENT:
+        for (uint32_t i = 0; i < ARRAY_LENGTH(changes); i++) {
+            ref[(changes[i].y * WIDTH + changes[i].x) * 4 +
+                changes[i].channel] ^= changes[i].flip;
+        }
+        break;
+    case CASE_TOLERANCE:
+        // Move every channel by 1 toward the middle. The images differ,
+        // but match within a tolerance of 1.
+        for (size_t i = 0; i < size; i++)
+            ref[i] += ref[i] < 0x80 ? 1 : -1;
+        tolerance = 1;
+        break;
+    }
+
+    VkImage image = create_image(actual);
+    cru_image_t *actual_image = t_new_cru_image_from_pixels(actual,
+        VK_FORMAT_R8G8B8A8_UNORM, WIDTH, HEIGHT);
+    cru_image_t *ref_image = t_new_cru_image_from_pixels(ref,
+        VK_FORMAT_R8G8B8A8_UNORM, WIDTH, HEIGHT);
+
+    const bool cpu_match = cru_image_compare(actual_image, ref_image);
+    t_assert(cpu_match == (c == CASE_EQUAL));
+
+    gpu_image_compare_result_t res;
+    t_assert(gpu_image_compare(image, VK_FORMAT_R8G8B8A8_UNORM,
+                               VK_IMAGE_ASPECT_COLOR_BIT, WIDTH, HEIGHT,
+                               ref_image, tolerance, &res));
+    t_cleanup_push_free(res.mask);
+
+    // cru_image_compare() is exact, so at a tolerance of 0 both paths must
+    // agree.
+    if (tolerance == 0)
+        t_assert((res.mismatch_count == 0) == cpu_match);
+
+    switch (c) {
+    case CASE_EQUAL:
+        t_assert(res.mismatch_count == 0);
+        t_assert(res.max_error == 0);
+        t_assert(res.mask == NULL);
+        break;
+    case CASE_DIFFERENT:
+        t_assertf(res.mismatch_count == ARRAY_LENGTH(changes),
+                  "expected %zu mismatches, got %u",
+                  ARRAY_LENGTH(changes), res.mismatch_count);
+        t_assertf(res.max_error == 0x80, "max error %u", res.max_error);
+        t_assertf(res.min_x == 3 && res.min_y == 4 &&
+                  res.max_x == 66 && res.max_y == 28,
+                  "bounding box (%u, %u)-(%u, %u)",
+                  res.min_x, res.min_y, res.max_x, res.max_y);
+
+        t_assert(res.mask != NULL);
+        for (uint32_t y = 0; y < HEIGHT; y++) {
+            for (uint32_t x = 0; x < WIDTH; x++) {
+                bool changed = false;
+                for (uint32_t i = 0; i < ARRAY_LENGTH(changes); i++) {
+                    if (changes[i].x == x && changes[i].y == y)
+                        changed = true;
+                }
+
+                t_assertf(res.mask[y * WIDTH + x] == (changed ? 0xff : 0),
+                          "mask at (%u, %u) is 0x%02x", x, y,
+                          res.mask[y * WIDTH + x]);
+            }
+        }
+        break;
+    case CASE_TOLERANCE:
+        t_assert(res.mismatch_count == 0);
+        t_assert(res.max_error == 1);
+
+        // Without the tolerance, every pixel mismatches.
+        t_assert(gpu_image_compare(image, VK_FORMAT_R8G8B8A8_UNORM,
+                                   VK_IMAGE_ASPECT_COLOR_BIT, WIDTH, HEIGHT,
+                                   ref_image, 0, &res));
+        t_cleanup_push_free(res.mask);
+        t_assertf(res.mismatch_count == WIDTH * HEIGHT,
+                  "expected %u mismatches, got %u",
+                  WIDTH * HEIGHT, res.mismatch_count);
+        break;
+    }
+
+    t_pass();
+}
+
+#define COMPARE_TEST(_name, _case) \
+test_define { \
+    .name = "self.gpu-image-compare." _name, \
+    .start = test, \
+    .no_image = true, \
+    .user_data = (void *) (uintptr_t) _case, \
+};
+
+COMPARE_TEST("equal", CASE_EQUAL)
+COMPARE_TEST("different", CASE_DIFFERENT)
+COMPARE_TEST("tolerance", CASE_TOLERANCE)
@@ -0,0 +1,95 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Test loading KTX2 files.
+///
+/// mandrill-8x8-array2.ktx2 is a 2-layer, 2-level R8G8B8A8_UNORM array.
+/// Layer 0 holds mandrill-8x8.png and mandrill-4x4.png. Layer 1 holds the
+/// same pixels with the color channels inverted, so that swapped layers
+/// are caught. mandrill-8x8-array2.ktx is the same texture as a KTX1 file.
+
+#include "tapi/t.h"
+
+static void
+test_array(void)
+{
+    cru_image_array_t *ktx2 =
+        t_new_cru_image_array_from_filename("mandrill-8x8-array2.ktx2");
+    cru_image_array_t *ktx1 =
+        t_new_cru_image_array_from_filename("mandrill-8x8-array2.ktx");
+
+    // One image per 2D slice, ordered by level, then layer.
+    t_assert(cru_image_array_get_num_images(ktx2) == 4);
+    t_assert(cru_image_array_get_num_images(ktx1) == 4);
+
+    for (int i = 0; i < 4; i++) {
+        cru_image_t *a = cru_image_array_get_image(ktx2, i);
+        cru_image_t *b = cru_image_array_get_image(ktx1, i);
+        const uint32_t width = i < 2 ? 8 : 4;
+
+        t_assertf(cru_image_get_format(a) == VK_FORMAT_R8G8B8A8_UNORM,
+                  "image %d has format %d", i, cru_image_get_format(a));
+        t_assertf(cru_image_get_width(a) == width &&
+                  cru_image_get_height(a) == width,
+                  "image %d is %ux%u", i, cru_image_get_width(a),
+                  cru_image_get_height(a));
+        t_assertf(cru_image_compare(a, b),
+                  "image %d differs between KTX2 and KTX1", i);
+    }
+
+    cru_image_t *png8 = t_new_cru_image_from_filename("mandrill-8x8.png");
+    cru_image_t *png4 = t_new_cru_image_from_filename("mandrill-4x4.png");
+
+    t_assert(cru_image_compare(cru_image_array_get_image(ktx2, 0), png8));
+    t_assert(!cru_image_compare(cru_image_array_get_image(ktx2, 1), png8));
+    t_assert(cru_image_compare(cru_image_array_get_image(ktx2, 2), png4));
+    t_assert(!cru_image_compare(cru_image_array_get_image(ktx2, 3), png4));
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.ktx-image.ktx2-array",
+    .start = test_array,
+    .no_image = true,
+};
+
+static void
+test_supercompressed(void)
+{
+    // The same texture, but with a Zstandard supercompression scheme in the
+    // header, which the loader does not support.
+    cru_image_array_t *ia =
+        cru_image_array_from_filename("mandrill-8x8-array2-zstd.ktx2");
+
+    if (ia)
+        cru_image_array_release(ia);
+
+    t_assert(ia == NULL);
+    t_pass();
+}
+
+test_define {
+    .name = "self.ktx-image.ktx2-supercompressed",
+    .start = test_supercompressed,
+    .no_image = true,
+};
@@ -0,0 +1,307 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Test qoCreateComputePipelines() and qoTryCreateComputePipelines().
+///
+/// The batch is split across threads, so these tests check that each
+/// pipeline and each VkResult lands in the slot of its create info.
+
+#include <time.h>
+
+#include "tapi/t.h"
+#include "util/misc.h"
+
+#include "src/tests/self/qonos-pipelines-spirv.h"
+
+// More pipelines than most machines have CPUs, so every thread creates
+// several.
+#define NUM_PIPELINES 64
+
+/// Fill infos[i] for a pipeline whose specialization constant 0 is
+/// values[i]. \a spec_infos must outlive \a infos.
+static void
+fill_infos(VkShaderModule cs, VkPipelineLayout layout, const uint32_t *values,
+           VkSpecializationInfo *spec_infos,
+           VkComputePipelineCreateInfo *infos, uint32_t count)
+{
+    static const VkSpecializationMapEntry entry = {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(uint32_t),
+    };
+
+    for (uint32_t i = 0; i < count; i++) {
+        spec_infos[i] = (VkSpecializationInfo) {
+            .mapEntryCount = 1,
+            .pMapEntries = &entry,
+            .dataSize = sizeof(values[i]),
+            .pData = &values[i],
+        };
+
+        infos[i] = (VkComputePipelineCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = cs,
+                .pName = "main",
+                .pSpecializationInfo = &spec_infos[i],
+            },
+            .layout = layout,
+        };
+    }
+}
+
+/// Each pipeline writes its specialization constant to the slot given by a
+/// push constant. If the pipelines came back out of order, the values
+/// would land in the wrong slots.
+static void
+test_order(void)
+{
+    VkDescriptorSetLayout set_layout = qoCreateDescriptorSetLayout(t_device,
+        .bindingCount = 1,
+        .pBindings = &(VkDescriptorSetLayoutBinding) {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        });
+
+    VkPipelineLayout pipeline_layout = qoCreatePipelineLayout(t_device,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(uint32_t),
+        });
+
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x = 1) in;
+        layout(constant_id = 0) const uint VALUE = 0;
+
+        layout(push_constant) uniform Push {
+            uint slot;
+        };
+
+        layout(set = 0, binding = 0, std430) buffer Out {
+            uint data[];
+        };
+
+        void main()
+        {
+            data[slot] = VALUE;
+        }
+    );
+
+    uint32_t values[NUM_PIPELINES];
+    VkSpecializationInfo spec_infos[NUM_PIPELINES];
+    VkComputePipelineCreateInfo infos[NUM_PIPELINES];
+    VkPipeline pipelines[NUM_PIPELINES];
+
+    for (uint32_t i = 0; i < NUM_PIPELINES; i++)
+        values[i] = 1000 + 7 * i;
+
+    fill_infos(cs, pipeline_layout, values, spec_infos, infos, NUM_PIPELINES);
+    qoCreateComputePipelines(t_device, t_pipeline_cache, NUM_PIPELINES,
+                             infos, pipelines);
+
+    const VkDeviceSize size = NUM_PIPELINES * sizeof(uint32_t);
+    VkBuffer buffer = qoCreateBuffer(t_device, .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    VkDeviceMemory mem = qoAllocBufferMemory(t_device, buffer,
+        .properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    qoBindBufferMemory(t_device, buffer, mem, 0);
+
+    uint32_t *data = qoMapMemory(t_device, mem, 0, size, 0);
+    memset(data, 0, size);
+
+    VkDescriptorSet set = qoAllocateDescriptorSet(t_device,
+        .descriptorPool = t_descriptor_pool,
+        .pSetLayouts = &set_layout);
+
+    vkUpdateDescriptorSets(t_device, 1,
+        &(VkWriteDescriptorSet) {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &(VkDescriptorBufferInfo) {
+                .buffer = buffer,
+                .offset = 0,
+                .range = size,
+            },
+        }, 0, NULL);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout, 0, 1, &set, 0, NULL);
+
+    for (uint32_t i = 0; i < NUM_PIPELINES; i++) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[i]);
+        vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(i), &i);
+        vkCmdDispatch(cmd, 1, 1, 1);
+    }
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                         },
+                         0, NULL, 0, NULL);
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+
+    for (uint32_t i = 0; i < NUM_PIPELINES; i++) {
+        t_assertf(data[i] == values[i], "slot %u: expected %u, got %u",
+                  i, values[i], data[i]);
+    }
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.qonos.create-pipelines.order",
+    .start = test_order,
+    .no_image = true,
+};
+
+/// Request every other pipeline with
+/// VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT, from an
+/// empty pipeline cache. Those pipelines must fail without a compile, and
+/// the failures must be reported in their own slots.
+static void
+test_errors(void)
+{
+    t_require_ext("VK_EXT_pipeline_creation_cache_control");
+
+    VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cache_control = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &cache_control,
+    };
+    vkGetPhysicalDeviceFeatures2(t_physical_dev, &features);
+
+    if (!cache_control.pipelineCreationCacheControl)
+        t_skipf("pipelineCreationCacheControl is not supported");
+
+    // The test device doesn't enable the feature, so make a device that
+    // does.
+    VkDevice device;
+    VkResult result = vkCreateDevice(t_physical_dev,
+        &(VkDeviceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .pNext = &cache_control,
+            .queueCreateInfoCount = 1,
+            .pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = 0,
+                .queueCount = 1,
+                .pQueuePriorities = (float[]) { 1.0f },
+            },
+            .enabledExtensionCount = 1,
+            .ppEnabledExtensionNames = (const char *[]) {
+                "VK_EXT_pipeline_creation_cache_control",
+            },
+        }, NULL, &device);
+    t_assert(result == VK_SUCCESS);
+    t_cleanup_push_vk_device(device, NULL);
+
+    VkPipelineLayout pipeline_layout = qoCreatePipelineLayout(device);
+    VkPipelineCache cache = qoCreatePipelineCache(device);
+
+    VkShaderModule cs = qoCreateShaderModuleGLSL(device, COMPUTE,
+        layout(local_size_x = 1) in;
+        layout(constant_id = 0) const uint VALUE = 0;
+
+        shared uint value;
+
+        void main()
+        {
+            value = VALUE;
+        }
+    );
+
+    uint32_t values[NUM_PIPELINES];
+    VkSpecializationInfo spec_infos[NUM_PIPELINES];
+    VkComputePipelineCreateInfo infos[NUM_PIPELINES];
+    VkPipeline pipelines[NUM_PIPELINES];
+    VkResult results[NUM_PIPELINES];
+
+    // Make the pipelines unique to this run, so that no on-disk cache in
+    // the driver already has them.
+    const uint32_t seed = time(NULL);
+    for (uint32_t i = 0; i < NUM_PIPELINES; i++)
+        values[i] = seed * NUM_PIPELINES + i;
+
+    fill_infos(cs, pipeline_layout, values, spec_infos, infos, NUM_PIPELINES);
+    for (uint32_t i = 1; i < NUM_PIPELINES; i += 2)
+        infos[i].flags = VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT;
+
+    result = qoTryCreateComputePipelines(device, cache, NUM_PIPELINES, infos,
+                                         pipelines, results);
+
+    uint32_t num_failed = 0;
+    VkResult first_failure = VK_SUCCESS;
+
+    for (uint32_t i = 0; i < NUM_PIPELINES; i++) {
+        if (i % 2 == 0 || results[i] == VK_SUCCESS) {
+            t_assertf(results[i] == VK_SUCCESS &&
+                      pipelines[i] != VK_NULL_HANDLE,
+                      "pipeline %u: VkResult %d", i, results[i]);
+        } else {
+            t_assertf(results[i] == VK_PIPELINE_COMPILE_REQUIRED_EXT &&
+                      pipelines[i] == VK_NULL_HANDLE,
+                      "pipeline %u: VkResult %d", i, results[i]);
+
+            if (num_failed++ == 0)
+                first_failure = results[i];
+        }
+    }
+
+    t_assertf(result == first_failure,
+              "returned VkResult %d, expected %d", result, first_failure);
+
+    // A driver may have compiled the pipelines anyway, for example if it
+    // found them in a cache of its own. Then the failure path didn't run.
+    if (num_failed == 0)
+        t_skipf("no pipeline required a compile");
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.qonos.create-pipelines.errors",
+    .start = test_errors,
+    .no_image = true,
+    .api_version = VK_MAKE_VERSION(1, 1, 0),
+};
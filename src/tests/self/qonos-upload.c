@@ -0,0 +1,271 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Test qoUploadBuffer() and qoUploadImage().
+///
+/// The upload ring has 16 MiB of staging memory in four segments. These
+/// tests upload more than that in pieces of mixed sizes, so that the ring
+/// wraps around and reuses each segment's fence, and read the data back.
+
+#include "tapi/t.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+#define MiB (1024 * 1024)
+
+// More than the ring's staging memory.
+#define BUFFER_SIZE (24 * MiB)
+
+// Larger than a segment, so the image takes the path with its own staging
+// buffer.
+#define LARGE_WIDTH 1280
+#define LARGE_HEIGHT 1024
+
+#define SMALL_WIDTH 67
+#define SMALL_HEIGHT 29
+
+static void
+fill_random(uint8_t *pixels, size_t size, uint32_t seed)
+{
+    uint32_t x = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        x = x * 1103515245 + 12345;
+        pixels[i] = x >> 24;
+    }
+}
+
+/// Create a buffer in host-visible memory, for reading results back.
+static VkBuffer
+create_host_buffer(VkDeviceSize size, void **map)
+{
+    VkBuffer buffer = qoCreateBuffer(t_device, .size = size);
+    VkDeviceMemory mem = qoAllocBufferMemory(t_device, buffer,
+        .properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    qoBindBufferMemory(t_device, buffer, mem, 0);
+    *map = qoMapMemory(t_device, mem, 0, size, 0);
+
+    return buffer;
+}
+
+/// Make the transfer writes submitted so far visible to the host, and wait
+/// for them.
+static void
+finish_transfers(VkCommandBuffer cmd)
+{
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                         },
+                         0, NULL, 0, NULL);
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+}
+
+static void
+check_bytes(const uint8_t *actual, const uint8_t *expected, size_t size)
+{
+    if (memcmp(actual, expected, size) == 0)
+        return;
+
+    for (size_t i = 0; i < size; i++) {
+        if (actual[i] != expected[i]) {
+            t_failf("byte %zu: expected 0x%02x, got 0x%02x",
+                    i, expected[i], actual[i]);
+        }
+    }
+}
+
+static void
+test_buffer(void)
+{
+    // Small pieces fill segments without splitting, and the pieces larger
+    // than a segment are split into chunks. The odd sizes leave the staging
+    // offsets unaligned until the ring aligns them.
+    static const VkDeviceSize piece_sizes[] = {
+        1 * MiB + 13,
+        9 * MiB + 5,
+        300 * 1024 + 1,
+        17,
+        5 * MiB + 3,
+        3 * MiB,
+    };
+
+    uint8_t *data = xmalloc(BUFFER_SIZE);
+    t_cleanup_push_free(data);
+    fill_random(data, BUFFER_SIZE, 0x12345678);
+
+    void *map;
+    VkBuffer buffer = create_host_buffer(BUFFER_SIZE, &map);
+    memset(map, 0, BUFFER_SIZE);
+
+    VkDeviceSize offset = 0;
+    for (uint32_t i = 0; offset < BUFFER_SIZE; i++) {
+        VkDeviceSize size = MIN(piece_sizes[i % ARRAY_LENGTH(piece_sizes)],
+                                BUFFER_SIZE - offset);
+
+        qoUploadBuffer(t_device, buffer, offset, data + offset, size);
+        offset += size;
+    }
+
+    qoFinishUploads(t_device);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    finish_transfers(cmd);
+
+    check_bytes(map, data, BUFFER_SIZE);
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.qonos.upload.buffer",
+    .start = test_buffer,
+    .no_image = true,
+};
+
+static VkImage
+create_image(VkCommandBuffer cmd, uint32_t width, uint32_t height)
+{
+    VkImage image = qoCreateImage(t_device,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .extent = {
+            .width = width,
+            .height = height,
+            .depth = 1,
+        });
+    qoAllocImageMemory(t_device, image,
+        .properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, 1,
+                         &(VkImageMemoryBarrier) {
+                             .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                             .srcAccessMask = 0,
+                             .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                             .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                             .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                             .image = image,
+                             .subresourceRange = {
+                                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .levelCount = 1,
+                                 .layerCount = 1,
+                             },
+                         });
+
+    return image;
+}
+
+static void
+copy_image_to_buffer(VkCommandBuffer cmd, VkImage image, VkBuffer buffer,
+                     VkDeviceSize offset, uint32_t width, uint32_t height)
+{
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_GENERAL, buffer, 1,
+        &(VkBufferImageCopy) {
+            .bufferOffset = offset,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .layerCount = 1,
+            },
+            .imageExtent = { width, height, 1 },
+        });
+}
+
+/// Upload a small image, a large one, and the small one again with other
+/// pixels into a second image. The large image is uploaded outside the
+/// ring's segments, and must not be reordered with the uploads around it.
+static void
+test_image(void)
+{
+    const size_t small_size = SMALL_WIDTH * SMALL_HEIGHT * 4;
+    const size_t large_size = LARGE_WIDTH * LARGE_HEIGHT * 4;
+    const size_t total_size = 2 * small_size + large_size;
+
+    uint8_t *data = xmalloc(total_size);
+    t_cleanup_push_free(data);
+    fill_random(data, total_size, 0x9abcdef0);
+
+    uint8_t *small_data[2] = { data, data + small_size };
+    uint8_t *large_data = data + 2 * small_size;
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    VkImage small[2] = {
+        create_image(cmd, SMALL_WIDTH, SMALL_HEIGHT),
+        create_image(cmd, SMALL_WIDTH, SMALL_HEIGHT),
+    };
+    VkImage large = create_image(cmd, LARGE_WIDTH, LARGE_HEIGHT);
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+
+    qoUploadImage(t_device, small[0], small_data[0], small_size,
+                  .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                  .imageExtent = { SMALL_WIDTH, SMALL_HEIGHT, 1 });
+    qoUploadImage(t_device, large, large_data, large_size,
+                  .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                  .imageExtent = { LARGE_WIDTH, LARGE_HEIGHT, 1 });
+    qoUploadImage(t_device, small[1], small_data[1], small_size,
+                  .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                  .imageExtent = { SMALL_WIDTH, SMALL_HEIGHT, 1 });
+
+    void *map;
+    VkBuffer buffer = create_host_buffer(total_size, &map);
+
+    // qoQueueSubmit() flushes the uploads ahead of the readback.
+    cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                         },
+                         0, NULL, 0, NULL);
+    copy_image_to_buffer(cmd, small[0], buffer, 0,
+                         SMALL_WIDTH, SMALL_HEIGHT);
+    copy_image_to_buffer(cmd, small[1], buffer, small_size,
+                         SMALL_WIDTH, SMALL_HEIGHT);
+    copy_image_to_buffer(cmd, large, buffer, 2 * small_size,
+                         LARGE_WIDTH, LARGE_HEIGHT);
+    finish_transfers(cmd);
+
+    check_bytes(map, data, total_size);
+
+    t_pass();
+}
+
+test_define {
+    .name = "self.qonos.upload.image",
+    .start = test_image,
+    .no_image = true,
+};
@@ -0,0 +1,116 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "util/cru_arena.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+/// Size of the chunks that the arena bumps through. Larger allocations get
+/// a chunk of their own.
+#define CHUNK_SIZE (16 * 1024)
+
+struct cru_arena_chunk {
+    cru_arena_chunk_t *next;
+    alignas(max_align_t) char data[];
+};
+
+void
+cru_arena_init(cru_arena_t *arena)
+{
+    *arena = (cru_arena_t) {0};
+    pthread_mutex_init(&arena->mutex, NULL);
+}
+
+void
+cru_arena_finish(cru_arena_t *arena)
+{
+    cru_arena_chunk_t *chunk = arena->chunks;
+
+    while (chunk) {
+        cru_arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&arena->mutex);
+}
+
+static cru_arena_chunk_t *
+new_chunk(size_t size)
+{
+    return xzalloc(sizeof(cru_arena_chunk_t) + size);
+}
+
+void *
+cru_arena_alloc(cru_arena_t *arena, size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    void *p;
+
+    if (size > SIZE_MAX - align)
+        cru_oom();
+
+    size = (MAX(size, 1) + align - 1) & ~(align - 1);
+
+    pthread_mutex_lock(&arena->mutex);
+
+    if (size > CHUNK_SIZE / 4) {
+        // Keep bumping the current chunk, which likely has more room than
+        // a new one would have left over.
+        cru_arena_chunk_t *chunk = new_chunk(size);
+        if (arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            arena->chunks = chunk;
+            arena->next = arena->end = chunk->data + size;
+        }
+        p = chunk->data;
+    } else {
+        if (size > (size_t) (arena->end - arena->next)) {
+            cru_arena_chunk_t *chunk = new_chunk(CHUNK_SIZE);
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+            arena->next = chunk->data;
+            arena->end = chunk->data + CHUNK_SIZE;
+        }
+        p = arena->next;
+        arena->next += size;
+    }
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return p;
+}
+
+void *
+cru_arena_allocn(cru_arena_t *arena, size_t n, size_t size)
+{
+    size_t total_size;
+
+    if (!unlikely(cru_mul_size_checked(&total_size, n, size)))
+        cru_oom();
+
+    return cru_arena_alloc(arena, total_size);
+}
@@ -0,0 +1,263 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Decoded reference images, packed at build time.
+///
+/// misc/gen_data_bundle decodes the PNG files of the data directory into
+/// BUILD_DIR/data/data.bundle. Crucible maps the bundle read-only on first use
+/// and returns images that point into the mapping, so loading a packed file
+/// neither opens it nor runs libpng. Forked slaves inherit the mapping.
+///
+/// A file is served from the bundle only if its size and mtime still match
+/// those recorded at build time, so files regenerated by `crucible bootstrap`
+/// or found through a different CRU_DATA_DIR are decoded from disk.
+///
+/// The bundle is little-endian:
+///
+///     struct bundle_header
+///     uint32_t buckets[num_buckets]      // entry index + 1, or 0 if empty
+///     struct bundle_entry entries[num_entries]
+///     char names[]                       // not NUL-terminated
+///     pixels                             // each aligned to 64 bytes
+///
+/// Entries whose names hash to the same bucket are chained through
+/// bundle_entry::next. The hash is 32-bit FNV-1a over the filename.
+
+#include <endian.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/log.h"
+
+#include "cru_image.h"
+
+static const char bundle_magic[8] = "CRUBNDL1";
+
+struct bundle_header {
+    char magic[8];
+    uint32_t num_entries;
+    uint32_t num_buckets;
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+};
+
+struct bundle_entry {
+    uint32_t name_offset;
+    uint32_t name_len;
+
+    /// Index + 1 of the next entry in the bucket, or 0.
+    uint32_t next;
+
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+
+    /// Size and mtime of the source file.
+    uint64_t file_size;
+    int64_t file_mtime_ns;
+
+    uint64_t pixels_offset;
+};
+
+static struct {
+    pthread_once_t once;
+    const uint8_t *data;
+    size_t size;
+    const struct bundle_header *header;
+    const uint32_t *buckets;
+    const struct bundle_entry *entries;
+    const char *names;
+} bundle = {
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static uint32_t
+fnv1a(const char *s)
+{
+    uint32_t h = 0x811c9dc5;
+
+    for (; *s; s++)
+        h = (h ^ (uint8_t) *s) * 0x01000193;
+
+    return h;
+}
+
+static bool
+bundle_range_ok(uint64_t offset, uint64_t size)
+{
+    return offset <= bundle.size && size <= bundle.size - offset;
+}
+
+static void
+bundle_map(void)
+{
+    struct stat st;
+
+    char *filename = cru_image_get_abspath("data.bundle");
+    if (!filename)
+        return;
+
+    // The bundle is optional.
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        goto out;
+
+    if (fstat(fd, &st) == -1 ||
+        (size_t) st.st_size < sizeof(struct bundle_header)) {
+        close(fd);
+        goto fail;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        goto fail;
+
+    bundle.data = data;
+    bundle.size = st.st_size;
+
+    const struct bundle_header *h = data;
+    uint32_t num_entries = le32toh(h->num_entries);
+    uint32_t num_buckets = le32toh(h->num_buckets);
+    uint64_t buckets_offset = le64toh(h->buckets_offset);
+    uint64_t entries_offset = le64toh(h->entries_offset);
+    uint64_t names_offset = le64toh(h->names_offset);
+
+    if (memcmp(h->magic, bundle_magic, sizeof(bundle_magic)) != 0 ||
+        num_buckets == 0 ||
+        buckets_offset % sizeof(uint32_t) != 0 ||
+        entries_offset % sizeof(uint64_t) != 0 ||
+        !bundle_range_ok(buckets_offset,
+                         (uint64_t) num_buckets * sizeof(uint32_t)) ||
+        !bundle_range_ok(entries_offset,
+                         (uint64_t) num_entries *
+                         sizeof(struct bundle_entry)) ||
+        !bundle_range_ok(names_offset, 0)) {
+        munmap(data, st.st_size);
+        bundle.data = NULL;
+        goto fail;
+    }
+
+    bundle.header = h;
+    bundle.buckets = (const uint32_t *) (bundle.data + buckets_offset);
+    bundle.entries = (const struct bundle_entry *)
+                     (bundle.data + entries_offset);
+    bundle.names = (const char *) (bundle.data + names_offset);
+    goto out;
+
+fail:
+    logw("ignoring invalid data bundle %s", filename);
+out:
+    free(filename);
+}
+
+static const struct bundle_entry *
+bundle_find(const char *filename)
+{
+    uint32_t num_entries = le32toh(bundle.header->num_entries);
+    uint32_t num_buckets = le32toh(bundle.header->num_buckets);
+    size_t len = strlen(filename);
+
+    uint32_t i = le32toh(bundle.buckets[fnv1a(filename) % num_buckets]);
+
+    // Bound the walk in case the chain is corrupt.
+    for (uint32_t n = 0; i != 0 && n < num_entries; n++) {
+        if (i > num_entries)
+            return NULL;
+
+        const struct bundle_entry *e = &bundle.entries[i - 1];
+        uint32_t name_offset = le32toh(e->name_offset);
+        uint32_t name_len = le32toh(e->name_len);
+
+        if (name_len == len &&
+            bundle_range_ok((const uint8_t *) bundle.names - bundle.data +
+                            (uint64_t) name_offset, name_len) &&
+            memcmp(bundle.names + name_offset, filename, len) == 0)
+            return e;
+
+        i = le32toh(e->next);
+    }
+
+    return NULL;
+}
+
+/// Return the packed image for the file, or NULL if the caller must load the
+/// file from disk.
+cru_image_t *
+cru_data_bundle_load_image(const char *filename)
+{
+    struct stat st;
+
+    if (pthread_once(&bundle.once, bundle_map))
+        abort();
+
+    if (!bundle.data)
+        return NULL;
+
+    const struct bundle_entry *e = bundle_find(filename);
+    if (!e)
+        return NULL;
+
+    const cru_format_info_t *format_info =
+        cru_format_get_info(le32toh(e->format));
+    if (!format_info || format_info->cpp == 0)
+        return NULL;
+
+    uint32_t width = le32toh(e->width);
+    uint32_t height = le32toh(e->height);
+    uint64_t pixels_offset = le64toh(e->pixels_offset);
+
+    if (!bundle_range_ok(pixels_offset,
+                         (uint64_t) width * height * format_info->cpp))
+        return NULL;
+
+    char *abs_filename = cru_image_get_abspath(filename);
+    if (!abs_filename)
+        return NULL;
+
+    int err = stat(abs_filename, &st);
+    free(abs_filename);
+
+    if (err == -1 ||
+        (uint64_t) st.st_size != le64toh(e->file_size) ||
+        (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec !=
+            (int64_t) le64toh(e->file_mtime_ns))
+        return NULL;
+
+    cru_image_t *image =
+        cru_image_from_pixels((void *) (bundle.data + pixels_offset),
+                              format_info->format, width, height);
+    if (!image)
+        return NULL;
+
+    // The pixels live in the read-only mapping, which is never unmapped.
+    image->read_only = true;
+
+    return image;
+}
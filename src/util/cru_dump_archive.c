@@ -0,0 +1,578 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Single-file archive of dumped images.
+///
+/// All integers are little-endian. The file layout is:
+///
+///     file magic "CRUDUMP1"
+///     record*
+///     index entry*        (absent if the writer didn't close the archive)
+///     trailer             (absent if the writer didn't close the archive)
+///
+/// A record is a record header, the test name, the label, and the pixel
+/// data. An index entry is the record's offset followed by a copy of the
+/// record header, test name, and label. The trailer holds the index offset,
+/// the number of entries, and the index magic.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "util/cru_dump_archive.h"
+#include "util/cru_vec.h"
+#include "util/log.h"
+#include "util/xalloc.h"
+
+#include "cru_image.h"
+
+#define RECORD_MAGIC 0x52414443 // "CDAR"
+#define INDEX_MAGIC 0x49414443 // "CDAI"
+
+#define RECORD_HEADER_SIZE 48
+#define TRAILER_SIZE 16
+
+/// Sanity limit on the length of test names and labels.
+#define MAX_NAME_LEN 4096
+
+static const char file_magic[8] = "CRUDUMP1";
+
+enum encoding {
+    ENCODING_RAW = 0,
+    ENCODING_DEFLATE = 1,
+};
+
+struct entry {
+    cru_dump_archive_entry_t pub;
+    enum encoding encoding;
+    uint64_t record_offset;
+    uint64_t data_offset;
+};
+
+typedef struct entry_vec entry_vec_t;
+CRU_VEC_DEFINE(struct entry_vec, struct entry)
+
+struct cru_dump_archive {
+    pthread_mutex_t mutex;
+    FILE *file;
+    char *filename;
+    bool writable;
+    int zlib_level;
+
+    /// Set when a write fails, which leaves the archive truncated.
+    bool failed;
+
+    entry_vec_t entries;
+};
+
+static uint8_t *
+put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        *p++ = v >> (8 * i);
+    return p;
+}
+
+static uint8_t *
+put_u64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        *p++ = v >> (8 * i);
+    return p;
+}
+
+static uint32_t
+get_u32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+           (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t
+get_u64(const uint8_t *p)
+{
+    return (uint64_t) get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+static void
+put_record_header(uint8_t *p, const struct entry *e)
+{
+    p = put_u32(p, RECORD_MAGIC);
+    p = put_u32(p, e->pub.format);
+    p = put_u32(p, e->pub.width);
+    p = put_u32(p, e->pub.height);
+    p = put_u32(p, e->encoding);
+    p = put_u32(p, strlen(e->pub.test_name));
+    p = put_u32(p, strlen(e->pub.label));
+    p = put_u32(p, 0);
+    p = put_u64(p, e->pub.raw_size);
+    p = put_u64(p, e->pub.data_size);
+}
+
+/// Write the record header, test name, and label.
+static bool
+write_record_header(FILE *f, const struct entry *e)
+{
+    uint8_t header[RECORD_HEADER_SIZE];
+    put_record_header(header, e);
+
+    const size_t test_len = strlen(e->pub.test_name);
+    const size_t label_len = strlen(e->pub.label);
+
+    return fwrite(header, sizeof(header), 1, f) == 1 &&
+           fwrite(e->pub.test_name, 1, test_len, f) == test_len &&
+           fwrite(e->pub.label, 1, label_len, f) == label_len;
+}
+
+/// Read the record header, test name, and label into a new entry. On success,
+/// the file is positioned at the end of the label.
+static bool
+read_record_header(FILE *f, struct entry *e)
+{
+    uint8_t header[RECORD_HEADER_SIZE];
+
+    if (fread(header, sizeof(header), 1, f) != 1)
+        return false;
+
+    if (get_u32(header + 0) != RECORD_MAGIC)
+        return false;
+
+    const uint32_t test_len = get_u32(header + 20);
+    const uint32_t label_len = get_u32(header + 24);
+    if (test_len > MAX_NAME_LEN || label_len > MAX_NAME_LEN)
+        return false;
+
+    *e = (struct entry) {
+        .pub = {
+            .format = get_u32(header + 4),
+            .width = get_u32(header + 8),
+            .height = get_u32(header + 12),
+            .raw_size = get_u64(header + 32),
+            .data_size = get_u64(header + 40),
+        },
+        .encoding = get_u32(header + 16),
+    };
+
+    char *test_name = xmalloc(test_len + 1);
+    char *label = xmalloc(label_len + 1);
+
+    if ((test_len > 0 && fread(test_name, test_len, 1, f) != 1) ||
+        (label_len > 0 && fread(label, label_len, 1, f) != 1)) {
+        free(test_name);
+        free(label);
+        return false;
+    }
+
+    test_name[test_len] = 0;
+    label[label_len] = 0;
+    e->pub.test_name = test_name;
+    e->pub.label = label;
+
+    return true;
+}
+
+static void
+entry_finish(struct entry *e)
+{
+    free((char *) e->pub.test_name);
+    free((char *) e->pub.label);
+}
+
+static cru_dump_archive_t *
+archive_new(FILE *file, const char *filename, bool writable)
+{
+    cru_dump_archive_t *ar = xzalloc(sizeof(*ar));
+
+    pthread_mutex_init(&ar->mutex, NULL);
+    ar->file = file;
+    ar->filename = xstrdup(filename);
+    ar->writable = writable;
+    cru_vec_init(&ar->entries);
+
+    return ar;
+}
+
+static void
+archive_free(cru_dump_archive_t *ar)
+{
+    struct entry *e;
+
+    cru_vec_foreach(e, &ar->entries) {
+        entry_finish(e);
+    }
+
+    cru_vec_finish(&ar->entries);
+    pthread_mutex_destroy(&ar->mutex);
+    free(ar->filename);
+    free(ar);
+}
+
+cru_dump_archive_t *
+cru_dump_archive_create(const char *filename, int zlib_level)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        loge("failed to create dump archive %s: %s", filename,
+             strerror(errno));
+        return NULL;
+    }
+
+    if (fwrite(file_magic, sizeof(file_magic), 1, f) != 1) {
+        loge("failed to write dump archive %s", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    cru_dump_archive_t *ar = archive_new(f, filename, true);
+    ar->zlib_level = zlib_level < 0 ? Z_BEST_SPEED : zlib_level;
+
+    return ar;
+}
+
+/// Copy the image's pixels into a tightly packed array.
+static uint8_t *
+pack_pixels(cru_image_t *image, uint64_t *out_size)
+{
+    const uint32_t width = cru_image_get_width(image);
+    const uint32_t height = cru_image_get_height(image);
+    const size_t row_size = (size_t) image->format_info->cpp * width;
+    const size_t stride = cru_image_get_pitch_bytes(image);
+
+    const uint8_t *src = cru_image_map(image, CRU_IMAGE_MAP_ACCESS_READ);
+    if (!src)
+        return NULL;
+
+    uint8_t *pixels = xmalloc(row_size * height);
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(pixels + y * row_size, src + y * stride, row_size);
+
+    cru_image_unmap(image);
+
+    *out_size = row_size * height;
+    return pixels;
+}
+
+bool
+cru_dump_archive_add_image(cru_dump_archive_t *ar, const char *test_name,
+                           const char *label, cru_image_t *image)
+{
+    struct entry e = {
+        .pub = {
+            .test_name = test_name,
+            .label = label,
+            .format = cru_image_get_format(image),
+            .width = cru_image_get_width(image),
+            .height = cru_image_get_height(image),
+        },
+        .encoding = ENCODING_RAW,
+    };
+    uint8_t *compressed = NULL;
+    bool result = false;
+
+    assert(ar->writable);
+
+    if (strlen(test_name) > MAX_NAME_LEN || strlen(label) > MAX_NAME_LEN) {
+        loge("dump archive: name of image %s.%s is too long", test_name,
+             label);
+        return false;
+    }
+
+    uint8_t *pixels = pack_pixels(image, &e.pub.raw_size);
+    if (!pixels)
+        return false;
+
+    const uint8_t *data = pixels;
+    e.pub.data_size = e.pub.raw_size;
+
+    // Compress outside the lock so that writer threads compress in parallel.
+    if (ar->zlib_level > 0) {
+        uLongf size = compressBound(e.pub.raw_size);
+        compressed = xmalloc(size);
+
+        if (compress2(compressed, &size, pixels, e.pub.raw_size,
+                      ar->zlib_level) == Z_OK && size < e.pub.raw_size) {
+            e.encoding = ENCODING_DEFLATE;
+            e.pub.data_size = size;
+            data = compressed;
+        }
+    }
+
+    pthread_mutex_lock(&ar->mutex);
+
+    if (ar->failed)
+        goto unlock;
+
+    e.record_offset = ftello(ar->file);
+
+    // Flush each record so that a crashing test leaves its earlier dumps
+    // readable.
+    if (!write_record_header(ar->file, &e) ||
+        fwrite(data, 1, e.pub.data_size, ar->file) != e.pub.data_size ||
+        fflush(ar->file) != 0) {
+        loge("failed to write dump archive %s", ar->filename);
+        ar->failed = true;
+        goto unlock;
+    }
+
+    e.pub.test_name = xstrdup(test_name);
+    e.pub.label = xstrdup(label);
+    *cru_vec_push(&ar->entries, 1) = e;
+    result = true;
+
+unlock:
+    pthread_mutex_unlock(&ar->mutex);
+    free(compressed);
+    free(pixels);
+
+    return result;
+}
+
+/// Read the index that the writer appended on close.
+static bool
+read_index(cru_dump_archive_t *ar)
+{
+    FILE *f = ar->file;
+    uint8_t trailer[TRAILER_SIZE];
+
+    if (fseeko(f, 0, SEEK_END) != 0)
+        return false;
+
+    const off_t file_size = ftello(f);
+    if (file_size < (off_t) (sizeof(file_magic) + TRAILER_SIZE))
+        return false;
+
+    if (fseeko(f, file_size - TRAILER_SIZE, SEEK_SET) != 0 ||
+        fread(trailer, sizeof(trailer), 1, f) != 1 ||
+        get_u32(trailer + 12) != INDEX_MAGIC)
+        return false;
+
+    const uint64_t index_offset = get_u64(trailer);
+    const uint32_t num_entries = get_u32(trailer + 8);
+
+    if (index_offset < sizeof(file_magic) ||
+        index_offset > (uint64_t) file_size - TRAILER_SIZE ||
+        fseeko(f, index_offset, SEEK_SET) != 0)
+        return false;
+
+    for (uint32_t i = 0; i < num_entries; i++) {
+        uint8_t offset[8];
+        struct entry e;
+
+        if (fread(offset, sizeof(offset), 1, f) != 1 ||
+            !read_record_header(f, &e))
+            return false;
+
+        e.record_offset = get_u64(offset);
+        e.data_offset = e.record_offset + RECORD_HEADER_SIZE +
+                        strlen(e.pub.test_name) + strlen(e.pub.label);
+        *cru_vec_push(&ar->entries, 1) = e;
+
+        if (e.data_offset + e.pub.data_size > index_offset)
+            return false;
+    }
+
+    return true;
+}
+
+/// Rebuild the index by walking the records. A truncated final record is
+/// dropped.
+static void
+scan_records(cru_dump_archive_t *ar)
+{
+    FILE *f = ar->file;
+    off_t offset = sizeof(file_magic);
+
+    if (fseeko(f, 0, SEEK_END) != 0)
+        return;
+
+    const off_t file_size = ftello(f);
+
+    for (;;) {
+        struct entry e;
+
+        if (fseeko(f, offset, SEEK_SET) != 0 || !read_record_header(f, &e))
+            break;
+
+        e.record_offset = offset;
+        e.data_offset = ftello(f);
+
+        if (e.pub.data_size > (uint64_t) (file_size - e.data_offset)) {
+            entry_finish(&e);
+            break;
+        }
+
+        *cru_vec_push(&ar->entries, 1) = e;
+        offset = e.data_offset + e.pub.data_size;
+    }
+}
+
+cru_dump_archive_t *
+cru_dump_archive_open(const char *filename)
+{
+    char magic[sizeof(file_magic)];
+
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        loge("failed to open dump archive %s: %s", filename,
+             strerror(errno));
+        return NULL;
+    }
+
+    if (fread(magic, sizeof(magic), 1, f) != 1 ||
+        memcmp(magic, file_magic, sizeof(magic)) != 0) {
+        loge("%s is not a dump archive", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    cru_dump_archive_t *ar = archive_new(f, filename, false);
+
+    if (!read_index(ar)) {
+        struct entry *e;
+
+        cru_vec_foreach(e, &ar->entries) {
+            entry_finish(e);
+        }
+        cru_vec_clear(&ar->entries);
+
+        logw("dump archive %s has no valid index; scanning its records",
+             filename);
+        scan_records(ar);
+    }
+
+    return ar;
+}
+
+uint32_t
+cru_dump_archive_get_num_entries(cru_dump_archive_t *ar)
+{
+    return ar->entries.len;
+}
+
+const cru_dump_archive_entry_t *
+cru_dump_archive_get_entry(cru_dump_archive_t *ar, uint32_t index)
+{
+    assert(index < ar->entries.len);
+    return &ar->entries.data[index].pub;
+}
+
+void *
+cru_dump_archive_read_pixels(cru_dump_archive_t *ar, uint32_t index)
+{
+    assert(!ar->writable);
+    assert(index < ar->entries.len);
+
+    const struct entry *e = &ar->entries.data[index];
+    const cru_format_info_t *info = cru_format_get_info(e->pub.format);
+
+    if (!info || e->pub.raw_size !=
+                 (uint64_t) info->cpp * e->pub.width * e->pub.height) {
+        loge("dump archive %s: image %s.%s has a bad format or extent",
+             ar->filename, e->pub.test_name, e->pub.label);
+        return NULL;
+    }
+
+    uint8_t *data = xmalloc(e->pub.data_size);
+
+    // pread() leaves the file position alone, so threads may read entries
+    // concurrently.
+    if (pread(fileno(ar->file), data, e->pub.data_size, e->data_offset) !=
+        (ssize_t) e->pub.data_size) {
+        loge("failed to read dump archive %s", ar->filename);
+        free(data);
+        return NULL;
+    }
+
+    switch (e->encoding) {
+    case ENCODING_RAW:
+        return data;
+    case ENCODING_DEFLATE: {
+        uint8_t *pixels = xmalloc(e->pub.raw_size);
+        uLongf size = e->pub.raw_size;
+
+        if (uncompress(pixels, &size, data, e->pub.data_size) != Z_OK ||
+            size != e->pub.raw_size) {
+            loge("dump archive %s: image %s.%s is corrupt", ar->filename,
+                 e->pub.test_name, e->pub.label);
+            free(pixels);
+            pixels = NULL;
+        }
+
+        free(data);
+        return pixels;
+    }
+    default:
+        loge("dump archive %s: image %s.%s has unknown encoding %u",
+             ar->filename, e->pub.test_name, e->pub.label, e->encoding);
+        free(data);
+        return NULL;
+    }
+}
+
+static bool
+write_index(cru_dump_archive_t *ar)
+{
+    FILE *f = ar->file;
+    const uint64_t index_offset = ftello(f);
+    const struct entry *e;
+    uint8_t buf[TRAILER_SIZE];
+
+    cru_vec_foreach(e, &ar->entries) {
+        put_u64(buf, e->record_offset);
+        if (fwrite(buf, 8, 1, f) != 1 || !write_record_header(f, e))
+            return false;
+    }
+
+    uint8_t *p = put_u64(buf, index_offset);
+    p = put_u32(p, ar->entries.len);
+    put_u32(p, INDEX_MAGIC);
+
+    return fwrite(buf, sizeof(buf), 1, f) == 1;
+}
+
+bool
+cru_dump_archive_close(cru_dump_archive_t *ar)
+{
+    bool result = true;
+
+    if (!ar)
+        return true;
+
+    if (ar->writable && !ar->failed && !write_index(ar))
+        result = false;
+
+    if (fclose(ar->file) != 0 && ar->writable)
+        result = false;
+
+    if (!result)
+        loge("failed to write index of dump archive %s", ar->filename);
+
+    archive_free(ar);
+
+    return result;
+}
@@ -19,109 +19,582 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "util/cru_format.h"
+#include "util/macros.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
 
-#define FMT(__vk_token) .format = __vk_token, .name = #__vk_token
-
-static const struct cru_format_info
-cru_format_info_table[] = {
-    {
-        FMT(VK_FORMAT_R8_UNORM),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .num_channels = 1,
-        .cpp = 1,
-        .is_color = true,
-    },
-    {
-        FMT(VK_FORMAT_R8G8B8A8_UNORM),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .num_channels = 4,
-        .cpp = 4,
-        .is_color = true,
-        .has_alpha = true,
-    },
-    {
-        FMT(VK_FORMAT_R16_UNORM),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .num_channels = 1,
-        .cpp = 2,
-        .is_color = true,
-    },
-    {
-        FMT(VK_FORMAT_D16_UNORM),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .num_channels = 1,
-        .cpp = 2,
-        .depth_format = VK_FORMAT_D16_UNORM,
-    },
-    {
-        FMT(VK_FORMAT_X8_D24_UNORM_PACK32),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .num_channels = 1,
-        .cpp = 3,
-        .depth_format = VK_FORMAT_X8_D24_UNORM_PACK32,
-    },
-    {
-        FMT(VK_FORMAT_D32_SFLOAT),
-        .num_type = CRU_NUM_TYPE_SFLOAT,
-        .num_channels = 1,
-        .cpp = 4,
-        .depth_format = VK_FORMAT_D32_SFLOAT,
-    },
-    {
-        FMT(VK_FORMAT_S8_UINT),
-        .num_type = CRU_NUM_TYPE_UINT,
-        .num_channels = 1,
-        .cpp = 1,
-        .stencil_format = VK_FORMAT_S8_UINT,
-    },
-    {
-        FMT(VK_FORMAT_D16_UNORM_S8_UINT),
-        .num_type = CRU_NUM_TYPE_UNDEFINED,
-        .num_channels = 2,
-        .cpp = 3,
-        .depth_format = VK_FORMAT_D16_UNORM,
-        .stencil_format = VK_FORMAT_S8_UINT,
-    },
-    {
-        FMT(VK_FORMAT_D24_UNORM_S8_UINT),
-        .num_type = CRU_NUM_TYPE_UNDEFINED,
-        .num_channels = 2,
-        .cpp = 4,
-        .depth_format = VK_FORMAT_X8_D24_UNORM_PACK32,
-        .stencil_format = VK_FORMAT_S8_UINT,
-    },
-    {
-        FMT(VK_FORMAT_D32_SFLOAT_S8_UINT),
-        .num_type = CRU_NUM_TYPE_UNDEFINED,
-        .num_channels = 2,
-        .cpp = 5,
-        .depth_format = VK_FORMAT_D32_SFLOAT,
-        .stencil_format = VK_FORMAT_S8_UINT,
-    },
-    {
-        FMT(VK_FORMAT_BC3_UNORM_BLOCK),
-        .num_type = CRU_NUM_TYPE_UNORM,
-        .is_color = true,
-    },
-    {
-        FMT(VK_FORMAT_UNDEFINED),
-    },
-};
-
-#undef FMT
+#include "src/util/cru_format_gen.h"
 
 const struct cru_format_info *
 cru_format_get_info(VkFormat format)
 {
-    const struct cru_format_info *info;
+    // VkFormat may be unsigned, so check the range of the index only once.
+    const uint32_t index = (uint32_t) format;
+    if (index >= ARRAY_LENGTH(cru_format_info_table))
+        return NULL;
+
+    const struct cru_format_info *info = &cru_format_info_table[index];
+    if (!info->name)
+        return NULL;
+
+    return info;
+}
+
+bool
+cru_format_is_convertible(const struct cru_format_info *info)
+{
+    return info->num_type != CRU_NUM_TYPE_UNDEFINED && info->num_channels > 0;
+}
+
+static inline uint32_t
+bits_max(uint32_t bits)
+{
+    return bits == 32 ? UINT32_MAX : (1u << bits) - 1;
+}
+
+static float
+half_to_float(uint16_t h)
+{
+    const uint32_t exp = (h >> 10) & 0x1f;
+    const uint32_t mant = h & 0x3ff;
+    float f;
+
+    if (exp == 0)
+        f = ldexpf(mant, -24);
+    else if (exp == 0x1f)
+        f = mant ? NAN : INFINITY;
+    else
+        f = ldexpf(mant | 0x400, exp - 25);
+
+    return (h & 0x8000) ? -f : f;
+}
+
+/// Round to nearest even, as the GPU does.
+static uint16_t
+float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    const uint16_t sign = (x >> 16) & 0x8000;
+    const uint32_t abs = x & 0x7fffffff;
+
+    // Infinity and NaN.
+    if (abs >= 0x7f800000)
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+
+    // Rounds to a value larger than 65504, the largest half.
+    if (abs >= 0x477ff000)
+        return sign | 0x7c00;
+
+    // Smaller than 2^-14, the smallest normal half.
+    if (abs < 0x38800000) {
+        float a;
+        memcpy(&a, &abs, sizeof(a));
+        return sign | (uint16_t) lrintf(a * 16777216.0f);
+    }
+
+    uint32_t h = (abs - 0x38000000) >> 13;
+    const uint32_t rem = abs & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+
+    return sign | h;
+}
+
+static uint8_t
+float_to_srgb8(float f)
+{
+    f = CLAMP(f, 0.0f, 1.0f);
+
+    if (f <= 0.0031308f)
+        f *= 12.92f;
+    else
+        f = 1.055f * powf(f, 1.0f / 2.4f) - 0.055f;
+
+    return f * 255.0f + 0.5f;
+}
+
+static void
+unorm8_to_float(const uint8_t *src, float *dst, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    const __m256 max8 = _mm256_set1_ps(255.0f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *) (src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_cvtepi32_ps(v), max8));
+    }
+#endif
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 max4 = _mm_set1_ps(255.0f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *) (src + i)), zero);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+        _mm_storeu_ps(dst + i, _mm_div_ps(lo, max4));
+        _mm_storeu_ps(dst + i + 4, _mm_div_ps(hi, max4));
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = (float) src[i] / UINT8_MAX;
+}
+
+static void
+unorm16_to_float(const uint16_t *src, float *dst, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    const __m256 max8 = _mm256_set1_ps(65535.0f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i *) (src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_cvtepi32_ps(v), max8));
+    }
+#endif
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 max4 = _mm_set1_ps(65535.0f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+        _mm_storeu_ps(dst + i, _mm_div_ps(lo, max4));
+        _mm_storeu_ps(dst + i + 4, _mm_div_ps(hi, max4));
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = (float) src[i] / UINT16_MAX;
+}
+
+// The vector paths below clamp with max(x, 0) before min(x, 1), which maps NaN
+// to 0 just like the scalar CLAMP().
+
+static void
+float_to_unorm8(const float *src, uint8_t *dst, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 one8 = _mm256_set1_ps(1.0f);
+    const __m256 max8 = _mm256_set1_ps(255.0f);
+    const __m256 half8 = _mm256_set1_ps(0.5f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_loadu_ps(src + i);
+        f = _mm256_min_ps(_mm256_max_ps(f, zero8), one8);
+        __m256i v = _mm256_cvttps_epi32(
+            _mm256_add_ps(_mm256_mul_ps(f, max8), half8));
+        __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                    _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(w, w));
+    }
+#endif
+
+#ifdef __SSE2__
+    const __m128 zero4 = _mm_setzero_ps();
+    const __m128 one4 = _mm_set1_ps(1.0f);
+    const __m128 max4 = _mm_set1_ps(255.0f);
+    const __m128 half4 = _mm_set1_ps(0.5f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128 lo = _mm_loadu_ps(src + i);
+        __m128 hi = _mm_loadu_ps(src + i + 4);
+        lo = _mm_min_ps(_mm_max_ps(lo, zero4), one4);
+        hi = _mm_min_ps(_mm_max_ps(hi, zero4), one4);
+        __m128i w = _mm_packs_epi32(
+            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(lo, max4), half4)),
+            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(hi, max4), half4)));
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(w, w));
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = CLAMP(src[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+}
+
+static void
+float_to_unorm16(const float *src, uint16_t *dst, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    // SSE2 has no unsigned 32-to-16 pack, so bias into the signed range and
+    // flip the sign bit back after packing.
+    const __m128 zero4 = _mm_setzero_ps();
+    const __m128 one4 = _mm_set1_ps(1.0f);
+    const __m128 max4 = _mm_set1_ps(65535.0f);
+    const __m128 half4 = _mm_set1_ps(0.5f);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short) 0x8000);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128 lo = _mm_loadu_ps(src + i);
+        __m128 hi = _mm_loadu_ps(src + i + 4);
+        lo = _mm_min_ps(_mm_max_ps(lo, zero4), one4);
+        hi = _mm_min_ps(_mm_max_ps(hi, zero4), one4);
+        __m128i lo32 = _mm_sub_epi32(
+            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(lo, max4), half4)), bias32);
+        __m128i hi32 = _mm_sub_epi32(
+            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(hi, max4), half4)), bias32);
+        __m128i w = _mm_xor_si128(_mm_packs_epi32(lo32, hi32), bias16);
+        _mm_storeu_si128((__m128i *) (dst + i), w);
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = CLAMP(src[i], 0.0f, 1.0f) * 65535.0f + 0.5f;
+}
+
+/// Unpack a row of pixels into one float per channel, in storage order.
+static void
+unpack_row_float(const cru_format_info_t *info, const void *src,
+                 float *dst, uint32_t width)
+{
+    const uint32_t num_channels = info->num_channels;
+    const uint32_t n = width * num_channels;
+    const uint32_t bits = info->channels[0].bits;
+
+    assert(info->num_type != CRU_NUM_TYPE_UINT);
+
+    if (info->is_packed) {
+        const uint32_t *words = src;
+
+        for (uint32_t x = 0; x < width; x++) {
+            for (uint32_t c = 0; c < num_channels; c++) {
+                const cru_format_channel_t *ch = &info->channels[c];
+                const uint32_t max = bits_max(ch->bits);
+                dst[x * num_channels + c] =
+                    (float) ((words[x] >> ch->offset) & max) / max;
+            }
+        }
+    } else if (info->is_srgb) {
+        const uint8_t *bytes = src;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (info->channels[i % num_channels].component == 3)
+                dst[i] = (float) bytes[i] / UINT8_MAX;
+            else
+                dst[i] = cru_srgb8_to_float_table[bytes[i]];
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_UNORM && bits == 8) {
+        unorm8_to_float(src, dst, n);
+    } else if (info->num_type == CRU_NUM_TYPE_UNORM && bits == 16) {
+        unorm16_to_float(src, dst, n);
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM && bits == 8) {
+        const int8_t *s8 = src;
+
+        // Both -128 and -127 are -1.0.
+        for (uint32_t i = 0; i < n; i++)
+            dst[i] = MAX(s8[i] / (float) INT8_MAX, -1.0f);
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM && bits == 16) {
+        const int16_t *s16 = src;
+
+        for (uint32_t i = 0; i < n; i++)
+            dst[i] = MAX(s16[i] / (float) INT16_MAX, -1.0f);
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT && bits == 16) {
+        const uint16_t *halves = src;
+
+        for (uint32_t i = 0; i < n; i++)
+            dst[i] = half_to_float(halves[i]);
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT && bits == 32) {
+        memcpy(dst, src, n * sizeof(float));
+    } else {
+        cru_unreachable;
+    }
+}
+
+/// Inverse of unpack_row_float().
+static void
+pack_row_float(const cru_format_info_t *info, const float *src,
+               void *dst, uint32_t width)
+{
+    const uint32_t num_channels = info->num_channels;
+    const uint32_t n = width * num_channels;
+    const uint32_t bits = info->channels[0].bits;
+
+    assert(info->num_type != CRU_NUM_TYPE_UINT);
+
+    if (info->is_packed) {
+        uint32_t *words = dst;
+
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t word = 0;
+            for (uint32_t c = 0; c < num_channels; c++) {
+                const cru_format_channel_t *ch = &info->channels[c];
+                const uint32_t max = bits_max(ch->bits);
+                const float f = CLAMP(src[x * num_channels + c], 0.0f, 1.0f);
+
+                // Float can't hold 24-bit depth values plus one half.
+                word |= (uint32_t) (f * (double) max + 0.5) << ch->offset;
+            }
+            words[x] = word;
+        }
+    } else if (info->is_srgb) {
+        uint8_t *bytes = dst;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (info->channels[i % num_channels].component == 3)
+                bytes[i] = CLAMP(src[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+            else
+                bytes[i] = float_to_srgb8(src[i]);
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_UNORM && bits == 8) {
+        float_to_unorm8(src, dst, n);
+    } else if (info->num_type == CRU_NUM_TYPE_UNORM && bits == 16) {
+        float_to_unorm16(src, dst, n);
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM && bits == 8) {
+        int8_t *s8 = dst;
+
+        for (uint32_t i = 0; i < n; i++)
+            s8[i] = lroundf(CLAMP(src[i], -1.0f, 1.0f) * INT8_MAX);
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM && bits == 16) {
+        int16_t *s16 = dst;
+
+        for (uint32_t i = 0; i < n; i++)
+            s16[i] = lroundf(CLAMP(src[i], -1.0f, 1.0f) * INT16_MAX);
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT && bits == 16) {
+        uint16_t *halves = dst;
+
+        for (uint32_t i = 0; i < n; i++)
+            halves[i] = float_to_half(src[i]);
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT && bits == 32) {
+        memcpy(dst, src, n * sizeof(float));
+    } else {
+        cru_unreachable;
+    }
+}
+
+/// Unpack a row of pixels into the raw integer value of each channel, in
+/// storage order. Float channels are truncated, and negative values read as
+/// 0.
+static void
+unpack_row_uint(const cru_format_info_t *info, const void *src,
+                uint32_t *dst, uint32_t width)
+{
+    const uint32_t num_channels = info->num_channels;
+    const uint32_t n = width * num_channels;
+    const uint32_t bits = info->channels[0].bits;
 
-    for (info = cru_format_info_table;
-         info->format != VK_FORMAT_UNDEFINED; ++info) {
-        if (info->format == format) {
-            return info;
+    if (info->is_packed) {
+        const uint32_t *words = src;
+
+        for (uint32_t x = 0; x < width; x++) {
+            for (uint32_t c = 0; c < num_channels; c++) {
+                const cru_format_channel_t *ch = &info->channels[c];
+                dst[x * num_channels + c] =
+                    (words[x] >> ch->offset) & bits_max(ch->bits);
+            }
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT) {
+        for (uint32_t i = 0; i < n; i++) {
+            float f;
+            if (bits == 16) {
+                f = half_to_float(((const uint16_t *) src)[i]);
+            } else {
+                f = ((const float *) src)[i];
+            }
+            dst[i] = CLAMP(f, 0.0f, (float) UINT32_MAX);
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM) {
+        for (uint32_t i = 0; i < n; i++) {
+            int32_t v;
+            if (bits == 8) {
+                v = ((const int8_t *) src)[i];
+            } else {
+                v = ((const int16_t *) src)[i];
+            }
+            dst[i] = MAX(v, 0);
         }
+    } else if (bits == 8) {
+        const uint8_t *u8 = src;
+        for (uint32_t i = 0; i < n; i++)
+            dst[i] = u8[i];
+    } else if (bits == 16) {
+        const uint16_t *u16 = src;
+        for (uint32_t i = 0; i < n; i++)
+            dst[i] = u16[i];
+    } else if (bits == 32) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    } else {
+        cru_unreachable;
     }
+}
+
+/// Inverse of unpack_row_uint(). Values are clamped to the channel's range.
+static void
+pack_row_uint(const cru_format_info_t *info, const uint32_t *src,
+              void *dst, uint32_t width)
+{
+    const uint32_t num_channels = info->num_channels;
+    const uint32_t n = width * num_channels;
+    const uint32_t bits = info->channels[0].bits;
+
+    if (info->is_packed) {
+        uint32_t *words = dst;
+
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t word = 0;
+            for (uint32_t c = 0; c < num_channels; c++) {
+                const cru_format_channel_t *ch = &info->channels[c];
+                word |= MIN(src[x * num_channels + c], bits_max(ch->bits))
+                        << ch->offset;
+            }
+            words[x] = word;
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_SFLOAT) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (bits == 16) {
+                ((uint16_t *) dst)[i] = float_to_half(src[i]);
+            } else {
+                ((float *) dst)[i] = src[i];
+            }
+        }
+    } else if (info->num_type == CRU_NUM_TYPE_SNORM) {
+        const uint32_t max = bits_max(bits - 1);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (bits == 8) {
+                ((int8_t *) dst)[i] = MIN(src[i], max);
+            } else {
+                ((int16_t *) dst)[i] = MIN(src[i], max);
+            }
+        }
+    } else if (bits == 8) {
+        uint8_t *u8 = dst;
+        for (uint32_t i = 0; i < n; i++)
+            u8[i] = MIN(src[i], UINT8_MAX);
+    } else if (bits == 16) {
+        uint16_t *u16 = dst;
+        for (uint32_t i = 0; i < n; i++)
+            u16[i] = MIN(src[i], UINT16_MAX);
+    } else if (bits == 32) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    } else {
+        cru_unreachable;
+    }
+}
+
+bool
+cru_format_convert_rect(const struct cru_format_info *dest_info,
+                        void *dest, uint32_t dest_stride,
+                        const struct cru_format_info *src_info,
+                        const void *src, uint32_t src_stride,
+                        uint32_t width, uint32_t height)
+{
+    if (!cru_format_is_convertible(dest_info) ||
+        !cru_format_is_convertible(src_info))
+        return false;
+
+    const uint32_t src_channels = src_info->num_channels;
+    const uint32_t dest_channels = dest_info->num_channels;
+    const bool use_uint = src_info->num_type == CRU_NUM_TYPE_UINT ||
+                          dest_info->num_type == CRU_NUM_TYPE_UINT;
+
+    // For each destination channel, the source channel holding the same
+    // component, or -1 if the source lacks it.
+    int map[4];
+    bool identity = src_channels == dest_channels;
+
+    for (uint32_t d = 0; d < dest_channels; d++) {
+        map[d] = -1;
+        for (uint32_t s = 0; s < src_channels; s++) {
+            if (src_info->channels[s].component ==
+                dest_info->channels[d].component) {
+                map[d] = s;
+                break;
+            }
+        }
+        identity &= map[d] == (int) d;
+    }
+
+    // Missing components read as 0, and missing alpha as 1. The uint path
+    // holds raw values, so alpha is the destination's encoding of 1.
+    // pack_row_uint() converts values to float formats by value.
+    uint32_t defaults[4] = {0};
+    for (uint32_t d = 0; d < dest_channels; d++) {
+        const uint32_t bits = dest_info->channels[d].bits;
+
+        if (dest_info->channels[d].component != 3) {
+            continue;
+        } else if (use_uint) {
+            switch (dest_info->num_type) {
+            case CRU_NUM_TYPE_UNORM:
+                defaults[d] = bits_max(bits);
+                break;
+            case CRU_NUM_TYPE_SNORM:
+                defaults[d] = bits_max(bits - 1);
+                break;
+            default:
+                defaults[d] = 1;
+                break;
+            }
+        } else {
+            const float one = 1.0f;
+            memcpy(&defaults[d], &one, sizeof(one));
+        }
+    }
+
+    // The row buffers hold either floats or uints, so move values between
+    // them with memcpy rather than through either type.
+    void *unpacked = xmalloc(4 * width * sizeof(uint32_t));
+    void *remapped = identity ? unpacked :
+                     xmalloc(4 * width * sizeof(uint32_t));
+
+    for (uint32_t y = 0; y < height; y++) {
+        const void *src_row = src + y * src_stride;
+        void *dest_row = dest + y * dest_stride;
+
+        if (use_uint)
+            unpack_row_uint(src_info, src_row, unpacked, width);
+        else
+            unpack_row_float(src_info, src_row, unpacked, width);
+
+        if (!identity) {
+            for (uint32_t x = 0; x < width; x++) {
+                for (uint32_t d = 0; d < dest_channels; d++) {
+                    const void *value = map[d] < 0 ? &defaults[d] :
+                        unpacked + 4 * (x * src_channels + map[d]);
+                    memcpy(remapped + 4 * (x * dest_channels + d), value, 4);
+                }
+            }
+        }
+
+        if (use_uint)
+            pack_row_uint(dest_info, remapped, dest_row, width);
+        else
+            pack_row_float(dest_info, remapped, dest_row, width);
+    }
+
+    if (remapped != unpacked)
+        free(remapped);
+    free(unpacked);
 
-    return NULL;
+    return true;
 }
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+
+# Copyright 2021 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Generate cru_format_info_table, indexed by VkFormat, from the format names.
+# The channel layout of an uncompressed single-aspect format is fully described
+# by its name, so only formats that don't follow the naming scheme need to be
+# spelled out by hand.
+
+import re
+from textwrap import dedent
+
+# Uncompressed formats whose layout is parsed from the name.
+parsed_formats = (
+    'VK_FORMAT_R8_UNORM',
+    'VK_FORMAT_R8_SNORM',
+    'VK_FORMAT_R8_UINT',
+    'VK_FORMAT_R8G8_UNORM',
+    'VK_FORMAT_R8G8B8A8_UNORM',
+    'VK_FORMAT_R8G8B8A8_SNORM',
+    'VK_FORMAT_R8G8B8A8_UINT',
+    'VK_FORMAT_R8G8B8A8_SRGB',
+    'VK_FORMAT_B8G8R8A8_UNORM',
+    'VK_FORMAT_B8G8R8A8_SRGB',
+    'VK_FORMAT_A2R10G10B10_UNORM_PACK32',
+    'VK_FORMAT_A2B10G10R10_UNORM_PACK32',
+    'VK_FORMAT_A2B10G10R10_UINT_PACK32',
+    'VK_FORMAT_R16_UNORM',
+    'VK_FORMAT_R16_SFLOAT',
+    'VK_FORMAT_R16G16_UNORM',
+    'VK_FORMAT_R16G16_SFLOAT',
+    'VK_FORMAT_R16G16B16A16_UNORM',
+    'VK_FORMAT_R16G16B16A16_SNORM',
+    'VK_FORMAT_R16G16B16A16_SFLOAT',
+    'VK_FORMAT_R32_UINT',
+    'VK_FORMAT_R32_SFLOAT',
+    'VK_FORMAT_R32G32_SFLOAT',
+    'VK_FORMAT_R32G32B32A32_UINT',
+    'VK_FORMAT_R32G32B32A32_SFLOAT',
+    'VK_FORMAT_D16_UNORM',
+    'VK_FORMAT_X8_D24_UNORM_PACK32',
+    'VK_FORMAT_D32_SFLOAT',
+    'VK_FORMAT_S8_UINT',
+)
+
+# Formats that have no per-pixel channel layout.
+special_formats = (
+    dict(name = 'VK_FORMAT_D16_UNORM_S8_UINT',
+         num_type = 'UNDEFINED',
+         num_channels = 2,
+         cpp = 3,
+         depth_format = 'VK_FORMAT_D16_UNORM',
+         stencil_format = 'VK_FORMAT_S8_UINT'),
+    dict(name = 'VK_FORMAT_D24_UNORM_S8_UINT',
+         num_type = 'UNDEFINED',
+         num_channels = 2,
+         cpp = 4,
+         depth_format = 'VK_FORMAT_X8_D24_UNORM_PACK32',
+         stencil_format = 'VK_FORMAT_S8_UINT'),
+    dict(name = 'VK_FORMAT_D32_SFLOAT_S8_UINT',
+         num_type = 'UNDEFINED',
+         num_channels = 2,
+         cpp = 5,
+         depth_format = 'VK_FORMAT_D32_SFLOAT',
+         stencil_format = 'VK_FORMAT_S8_UINT'),
+    dict(name = 'VK_FORMAT_BC3_UNORM_BLOCK',
+         num_type = 'UNORM',
+         is_color = True),
+)
+
+components = {
+    'R': 0,
+    'G': 1,
+    'B': 2,
+    'A': 3,
+    'D': 0,
+    'S': 0,
+}
+
+def parse_format(name):
+    m = re.fullmatch(r'VK_FORMAT_(?P<layout>[RGBADSX0-9_]+?)_'
+                     r'(?P<type>UNORM|SNORM|UINT|SFLOAT|SRGB)(?P<pack>_PACK32)?',
+                     name)
+    if not m:
+        raise Exception('cannot parse format name {}'.format(name))
+
+    fields = re.findall(r'([RGBADSX])(\d+)', m.group('layout'))
+    is_packed = m.group('pack') is not None
+
+    # Packed formats list their fields from the most significant bit.
+    if is_packed:
+        fields.reverse()
+
+    channels = []
+    offset = 0
+    for letter, bits in fields:
+        bits = int(bits)
+        if letter != 'X':
+            channels.append((components[letter], offset, bits))
+        offset += bits
+
+    if is_packed:
+        assert offset == 32
+
+    letters = [f[0] for f in fields]
+    num_type = m.group('type')
+
+    info = dict(
+        name = name,
+        num_type = 'UNORM' if num_type == 'SRGB' else num_type,
+        num_channels = len(channels),
+        cpp = offset // 8,
+        channels = channels,
+        is_packed = is_packed,
+        is_srgb = num_type == 'SRGB',
+    )
+
+    if 'D' in letters:
+        info['depth_format'] = name
+    elif 'S' in letters:
+        info['stencil_format'] = name
+    else:
+        info['is_color'] = True
+        info['has_alpha'] = 'A' in letters
+
+    return info
+
+def format_info_str(info):
+    lines = [
+        '[{}] = {{'.format(info['name']),
+        '    .name = "{}",'.format(info['name']),
+        '    .format = {},'.format(info['name']),
+        '    .num_type = CRU_NUM_TYPE_{},'.format(info['num_type']),
+    ]
+
+    for key in ('num_channels', 'cpp'):
+        if key in info:
+            lines.append('    .{} = {},'.format(key, info[key]))
+
+    if info.get('channels'):
+        lines.append('    .channels = {')
+        for component, offset, bits in info['channels']:
+            lines.append('        {{ .component = {}, .offset = {}, '
+                         '.bits = {} }},'.format(component, offset, bits))
+        lines.append('    },')
+
+    for key in ('depth_format', 'stencil_format'):
+        if key in info:
+            lines.append('    .{} = {},'.format(key, info[key]))
+
+    for key in ('is_color', 'has_alpha', 'is_packed', 'is_srgb'):
+        if info.get(key):
+            lines.append('    .{} = true,'.format(key))
+
+    lines.append('},')
+
+    return ''.join('    ' + l + '\n' for l in lines)
+
+def srgb_to_linear(c):
+    if c <= 0.04045:
+        return c / 12.92
+    else:
+        return ((c + 0.055) / 1.055) ** 2.4
+
+copyright = dedent("""\
+    // Copyright 2021 Intel Corporation
+    //
+    // Permission is hereby granted, free of charge, to any person obtaining a
+    // copy of this software and associated documentation files (the "Software"),
+    // to deal in the Software without restriction, including without limitation
+    // the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    // and/or sell copies of the Software, and to permit persons to whom the
+    // Software is furnished to do so, subject to the following conditions:
+    //
+    // The above copyright notice and this permission notice (including the next
+    // paragraph) shall be included in all copies or substantial portions of the
+    // Software.
+    //
+    // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    // IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    // FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+    // THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    // IN THE SOFTWARE.
+    """)
+
+def main():
+    import sys
+    out_filename = sys.argv[1]
+
+    infos = [parse_format(name) for name in parsed_formats]
+    infos += special_formats
+
+    with open(out_filename, 'w') as out_file:
+        out_file.write(copyright)
+        out_file.write('\n')
+        out_file.write('static const struct cru_format_info\n')
+        out_file.write('cru_format_info_table[] = {\n')
+        for info in infos:
+            out_file.write(format_info_str(info))
+        out_file.write('};\n')
+        out_file.write('\n')
+        out_file.write('static const float\n')
+        out_file.write('cru_srgb8_to_float_table[256] = {\n')
+        for i in range(256):
+            out_file.write('    {!r}f,\n'.format(
+                float('{:.9g}'.format(srgb_to_linear(i / 255.0)))))
+        out_file.write('};\n')
+
+main()
@@ -19,6 +19,7 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,11 +31,6 @@
 
 #include "cru_image.h"
 
-typedef bool (*pixel_copy_func_t)(
-                uint32_t width, uint32_t height,
-                void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-                void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride);
-
 /// Caller must free the returned string.
 char *
 cru_image_get_abspath(const char *filename)
@@ -121,6 +117,8 @@ cru_image_init(cru_image_t *image, enum cru_image_type type,
     image->type = type;
     image->read_only = read_only;
     image->pitch_bytes = 0;
+    image->read_rows = NULL;
+    image->end_read_rows = NULL;
 
     return true;
 }
@@ -140,12 +138,8 @@ cru_image_check_compatible(const char *func,
         return false;
     }
 
-    if (a->format_info->num_channels != b->format_info->num_channels) {
-        loge("%s: image formats differ in number of channels", func);
-        return false;
-    }
-
-    // FIXME: Reject images whose channel order differs.
+    // Formats may differ in channel count and order because
+    // cru_format_convert_rect() matches channels by component.
 
     if (a->width != b->width) {
         loge("%s: image widths differ", func);
@@ -169,8 +163,13 @@ cru_image_from_filename(const char *_filename)
     string_copy_cstr(&filename, _filename);
 
     if (string_endswith_cstr(&filename, ".png")) {
-        image = cru_png_image_load_file(_filename);
-    } else if (string_endswith_cstr(&filename, ".ktx")) {
+        image = cru_data_bundle_load_image(_filename);
+        if (!image)
+            image = cru_png_image_load_file(_filename);
+    } else if (string_endswith_cstr(&filename, ".qoi")) {
+        image = cru_qoi_image_load_file(_filename);
+    } else if (string_endswith_cstr(&filename, ".ktx") ||
+               string_endswith_cstr(&filename, ".ktx2")) {
         loge("loading ktx requires array in %s", _filename);
     } else {
         loge("unknown file extension in %s", _filename);
@@ -191,6 +190,8 @@ cru_image_write_file(cru_image_t *image, const char *_filename)
 
     if (string_endswith_cstr(&filename, ".png")) {
         res = cru_png_image_write_file(image, &filename);
+    } else if (string_endswith_cstr(&filename, ".qoi")) {
+        res = cru_qoi_image_write_file(image, &filename);
     } else {
         loge("unknown file extension in %s", _filename);
         res = false;
@@ -201,115 +202,12 @@ cru_image_write_file(cru_image_t *image, const char *_filename)
     return res;
 }
 
-static bool
-copy_unorm8_to_uint8(
-    uint32_t width, uint32_t height,
-    void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-    void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride)
-{
-    const uint32_t cpp = 1;
-
-    for (uint32_t y = 0; y < height; ++y) {
-        void *src_row = src + ((src_y + y) * src_stride + src_x * cpp);
-        void *dest_row = dest + ((dest_y + y) * dest_stride + dest_x * cpp);
-        memcpy(dest_row, src_row, width * cpp);
-    }
-
-    return true;
-}
-
-static bool
-copy_uint8_to_unorm8(
-    uint32_t width, uint32_t height,
-    void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-    void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride)
-{
-    return copy_unorm8_to_uint8(width, height,
-                                src, src_x, src_y, src_stride,
-                                dest, dest_x, dest_y, dest_stride);
-}
-
-static bool
-copy_unorm8_to_f32(
-    uint32_t width, uint32_t height,
-    void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-    void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride)
-{
-    const uint32_t src_cpp = 1;
-    const uint32_t dest_cpp = 4;
-
-    for (uint32_t y = 0; y < height; ++y) {
-        void *src_row = src + ((src_y + y) * src_stride +
-                               src_x * src_cpp);
-
-        void *dest_row = dest + ((dest_y + y) * dest_stride +
-                                 dest_x * dest_cpp);
-
-        for (uint32_t x = 0; x < width; ++x) {
-            uint8_t *src_pix = src_row + (x * src_cpp);
-            float *dest_pix = dest_row + (x * dest_cpp);
-
-            dest_pix[0] = (float) src_pix[0] / UINT8_MAX;
-        }
-    }
-
-    return true;
-}
-
-static bool
-copy_f32_to_unorm8(
-    uint32_t width, uint32_t height,
-    void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-    void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride)
-{
-    const uint32_t src_cpp = 4;
-    const uint32_t dest_cpp = 1;
-
-    for (uint32_t y = 0; y < height; ++y) {
-        void *src_row = src + ((src_y + y) * src_stride +
-                               src_x * src_cpp);
-
-        void *dest_row = dest + ((dest_y + y) * dest_stride +
-                                 dest_x * dest_cpp);
-
-        for (uint32_t x = 0; x < width; ++x) {
-            float *src_pix = src_row + (x * src_cpp);
-            uint8_t *dest_pix = dest_row + (x * dest_cpp);
-
-            dest_pix[0] = UINT8_MAX * src_pix[0];
-        }
-    }
-
-    return true;
-}
-
-static bool
-copy_oneshot_memcpy(
-    uint32_t width, uint32_t height,
-    void *src, uint32_t src_x, uint32_t src_y, uint32_t src_stride,
-    void *dest, uint32_t dest_x, uint32_t dest_y, uint32_t dest_stride)
-{
-    assert(src_x == 0);
-    assert(src_y == 0);
-    assert(dest_x == 0);
-    assert(dest_y == 0);
-    assert(src_stride == dest_stride);
-
-    memcpy(dest, src, height * src_stride);
-
-    return true;
-}
-
 static bool
 cru_image_copy_pixels_to_pixels(cru_image_t *dest, cru_image_t *src)
 {
     bool result = false;
     uint8_t *src_pixels = NULL;
     uint8_t *dest_pixels = NULL;
-    pixel_copy_func_t copy_func;
-
-    const VkFormat src_format = src->format_info->format;
-    const VkFormat dest_format = dest->format_info->format;
 
     const uint32_t width = src->width;
     const uint32_t height = src->height;
@@ -334,30 +232,19 @@ cru_image_copy_pixels_to_pixels(cru_image_t *dest, cru_image_t *src)
 
     if (src->format_info == dest->format_info
         && src_stride == dest_stride) {
-        copy_func = copy_oneshot_memcpy;
-    } else if (src_format == VK_FORMAT_R8_UNORM &&
-               dest_format == VK_FORMAT_D32_SFLOAT) {
-        copy_func = copy_unorm8_to_f32;
-    } else if (src_format == VK_FORMAT_D32_SFLOAT &&
-               dest_format == VK_FORMAT_R8_UNORM) {
-        copy_func = copy_f32_to_unorm8;
-    } else if (src_format == VK_FORMAT_R8_UNORM &&
-               dest_format == VK_FORMAT_S8_UINT) {
-        copy_func = copy_unorm8_to_uint8;
-    } else if (src_format == VK_FORMAT_S8_UINT &&
-               dest_format == VK_FORMAT_R8_UNORM) {
-        copy_func = copy_uint8_to_unorm8;
+        memcpy(dest_pixels, src_pixels, height * src_stride);
+        result = true;
     } else {
-        loge("%s: unsupported format combination", __func__);
-        goto fail_no_copy_func;
+        result = cru_format_convert_rect(dest->format_info, dest_pixels,
+                                         dest_stride,
+                                         src->format_info, src_pixels,
+                                         src_stride, width, height);
+        if (!result) {
+            loge("%s: unsupported format combination %s -> %s", __func__,
+                 src->format_info->name, dest->format_info->name);
+        }
     }
 
-    result = copy_func(width, height,
-                       src_pixels, 0, 0, src_stride,
-                       dest_pixels, 0, 0, dest_stride);
-
-fail_no_copy_func:
-
     // Check the result of unmapping the destination image because writeback
     // can fail during unmap.
     result &= dest->unmap_pixels(dest);
@@ -402,27 +289,81 @@ cru_image_compare(cru_image_t *a, cru_image_t *b)
     return cru_image_compare_rect(a, 0, 0, b, 0, 0, a->width, a->height);
 }
 
+/// cru_image_compare_rect() compares bands of rows of about this size, so that
+/// images that implement read_rows() hold only a few bands in memory.
+#define COMPARE_BAND_BYTES (256 * 1024)
+
+/// Reads bands of rows through cru_image::read_rows() when the image has it,
+/// and through a single read mapping otherwise.
+struct row_reader {
+    cru_image_t *image;
+    uint8_t *map;
+};
+
+static bool
+row_reader_init(struct row_reader *r, cru_image_t *image)
+{
+    r->image = image;
+    r->map = NULL;
+
+    if (image->read_rows)
+        return true;
+
+    r->map = image->map_pixels(image, CRU_IMAGE_MAP_ACCESS_READ);
+    return r->map != NULL;
+}
+
+/// Return rows [y, y + height) and their stride.
+static const uint8_t *
+row_reader_read(struct row_reader *r, uint32_t y, uint32_t height,
+                uint32_t *stride)
+{
+    cru_image_t *image = r->image;
+
+    if (r->map) {
+        *stride = cru_image_get_pitch_bytes(image);
+        return r->map + y * *stride;
+    }
+
+    *stride = image->format_info->cpp * image->width;
+    return image->read_rows(image, y, height);
+}
+
+static void
+row_reader_finish(struct row_reader *r)
+{
+    if (!r->image)
+        return;
+
+    if (r->map)
+        r->image->unmap_pixels(r->image);
+    else if (r->image->read_rows)
+        r->image->end_read_rows(r->image);
+}
+
 bool
 cru_image_compare_rect(cru_image_t *a, uint32_t a_x, uint32_t a_y,
                        cru_image_t *b, uint32_t b_x, uint32_t b_y,
                        uint32_t width, uint32_t height)
 {
     bool result = false;
-    void *a_map = NULL;
-    void *b_map = NULL;
+    struct row_reader a_reader = {0};
+    struct row_reader b_reader = {0};
+    void *b_converted = NULL;
 
     if (a == b)
         return true;
 
-    if (a->format_info != b->format_info &&
-
-        !((a->format_info->format == VK_FORMAT_S8_UINT &&
-           b->format_info->format == VK_FORMAT_R8_UNORM) ||
-
-          (a->format_info->format == VK_FORMAT_R8_UNORM &&
-           b->format_info->format == VK_FORMAT_S8_UINT))) {
+    // S8_UINT and R8_UNORM have the same bits, so stencil images compare
+    // directly against their PNG references.
+    const bool same_bits = a->format_info == b->format_info ||
+        (a->format_info->format == VK_FORMAT_S8_UINT &&
+         b->format_info->format == VK_FORMAT_R8_UNORM) ||
+        (a->format_info->format == VK_FORMAT_R8_UNORM &&
+         b->format_info->format == VK_FORMAT_S8_UINT);
 
-        // Maybe one day we'll want to support more formats.
+    if (!same_bits && (!cru_format_is_convertible(a->format_info) ||
+                       !cru_format_is_convertible(b->format_info))) {
         loge("%s: image formats are incompatible", __func__);
         goto cleanup;
     }
@@ -433,40 +374,219 @@ cru_image_compare_rect(cru_image_t *a, uint32_t a_x, uint32_t a_y,
         goto cleanup;
     }
 
+    if (width == 0 || height == 0)
+        return true;
+
     const uint32_t cpp = a->format_info->cpp;
     const uint32_t row_size = cpp * width;
-    const uint32_t a_stride = cru_image_get_pitch_bytes(a);
-    const uint32_t b_stride = cru_image_get_pitch_bytes(b);
 
-    a_map = a->map_pixels(a, CRU_IMAGE_MAP_ACCESS_READ);
-    if (!a_map)
+    // Bands span the images' full rows, so size them by the wider image.
+    const uint32_t max_row_bytes = MAX(a->format_info->cpp * a->width,
+                                       b->format_info->cpp * b->width);
+    const uint32_t band_height = CLAMP(COMPARE_BAND_BYTES / max_row_bytes,
+                                       1, height);
+
+    if (!row_reader_init(&a_reader, a))
         goto cleanup;
 
-    b_map = b->map_pixels(b, CRU_IMAGE_MAP_ACCESS_READ);
-    if (!b_map)
+    if (!row_reader_init(&b_reader, b))
         goto cleanup;
 
+    if (!same_bits)
+        b_converted = xmalloc(row_size * band_height);
+
     // FINISHME: Support a configurable tolerance.
-    // FINISHME: Support dumping the diff to file.
-    for (uint32_t y = 0; y < height; ++y) {
-        const void *a_row = a_map + ((a_y + y) * a_stride + a_x * cpp);
-        const void *b_row = b_map + ((b_y + y) * b_stride + b_x * cpp);
-
-        if (memcmp(a_row, b_row, row_size) != 0) {
-            loge("%s: diff found in row %u of rect", __func__, y);
-            result = false;
+    // FINISHME: Support dumping the diff to file. Until then, stop at the
+    // first mismatch, which also skips reading the remaining bands.
+    for (uint32_t band_y = 0; band_y < height; band_y += band_height) {
+        const uint32_t h = MIN(band_height, height - band_y);
+        uint32_t a_stride, b_stride;
+
+        const uint8_t *a_rows = row_reader_read(&a_reader, a_y + band_y, h,
+                                                &a_stride);
+        if (!a_rows)
             goto cleanup;
+
+        const uint8_t *b_rows = row_reader_read(&b_reader, b_y + band_y, h,
+                                                &b_stride);
+        if (!b_rows)
+            goto cleanup;
+
+        const void *b_pixels = b_rows + b_x * b->format_info->cpp;
+
+        // Otherwise, convert b's band to a's format and compare that.
+        if (!same_bits) {
+            if (!cru_format_convert_rect(a->format_info, b_converted,
+                                         row_size, b->format_info, b_pixels,
+                                         b_stride, width, h))
+                goto cleanup;
+
+            b_pixels = b_converted;
+            b_stride = row_size;
+        }
+
+        for (uint32_t y = 0; y < h; ++y) {
+            const void *a_row = a_rows + (y * a_stride + a_x * cpp);
+            const void *b_row = b_pixels + y * b_stride;
+
+            if (memcmp(a_row, b_row, row_size) != 0) {
+                loge("%s: diff found in row %u of rect", __func__,
+                     band_y + y);
+                result = false;
+                goto cleanup;
+            }
         }
     }
 
     result = true;
 
 cleanup:
-    if (a_map)
-        a->unmap_pixels(a);
+    free(b_converted);
+    row_reader_finish(&a_reader);
+    row_reader_finish(&b_reader);
+
+    return result;
+}
+
+/// Convert rows [y, y + h) of the image to RGBA32F.
+static bool
+read_rows_rgba32f(struct row_reader *r, uint32_t y, uint32_t h, float *dest)
+{
+    const cru_format_info_t *rgba32f =
+        cru_format_get_info(VK_FORMAT_R32G32B32A32_SFLOAT);
+    const uint32_t width = r->image->width;
+    uint32_t stride;
+
+    const uint8_t *rows = row_reader_read(r, y, h, &stride);
+    if (!rows)
+        return false;
+
+    return cru_format_convert_rect(rgba32f, dest, 4 * sizeof(float) * width,
+                                   r->image->format_info, rows, stride,
+                                   width, h);
+}
+
+static uint8_t
+unorm8(float f)
+{
+    return CLAMP(f, 0.0f, 1.0f) * 255.0f + 0.5f;
+}
+
+bool
+cru_image_diff(cru_image_t *a, cru_image_t *b, cru_image_t *diff_image,
+               cru_image_diff_t *out_diff)
+{
+    bool result = false;
+    struct row_reader a_reader = {0};
+    struct row_reader b_reader = {0};
+    uint8_t *diff_map = NULL;
+    float *a_band = NULL;
+    float *b_band = NULL;
+    double sum_sq = 0.0;
 
-    if (b_map)
-        b->unmap_pixels(b);
+    *out_diff = (cru_image_diff_t) {0};
+
+    if (a == b) {
+        loge("%s: images are same", __func__);
+        return false;
+    }
+
+    if (a->width != b->width || a->height != b->height) {
+        loge("%s: image dimensions differ", __func__);
+        return false;
+    }
+
+    if (!cru_format_is_convertible(a->format_info) ||
+        !cru_format_is_convertible(b->format_info)) {
+        loge("%s: image formats are incompatible", __func__);
+        return false;
+    }
+
+    if (diff_image) {
+        if (diff_image->format_info->format != VK_FORMAT_R8G8B8A8_UNORM ||
+            diff_image->width != a->width || diff_image->height != a->height) {
+            loge("%s: diff image has the wrong format or extent", __func__);
+            return false;
+        }
+
+        diff_map = diff_image->map_pixels(diff_image,
+                                          CRU_IMAGE_MAP_ACCESS_WRITE);
+        if (!diff_map)
+            return false;
+    }
+
+    const uint32_t width = a->width;
+    const uint32_t height = a->height;
+    const uint32_t band_height =
+        CLAMP(COMPARE_BAND_BYTES / (4 * sizeof(float) * width), 1, height);
+    const bool a_is_gray = a->format_info->num_channels == 1;
+
+    if (!row_reader_init(&a_reader, a) || !row_reader_init(&b_reader, b))
+        goto cleanup;
+
+    a_band = xmalloc(4 * sizeof(float) * width * band_height);
+    b_band = xmalloc(4 * sizeof(float) * width * band_height);
+
+    for (uint32_t band_y = 0; band_y < height; band_y += band_height) {
+        const uint32_t h = MIN(band_height, height - band_y);
+
+        if (!read_rows_rgba32f(&a_reader, band_y, h, a_band) ||
+            !read_rows_rgba32f(&b_reader, band_y, h, b_band))
+            goto cleanup;
+
+        for (uint32_t i = 0; i < width * h; i++) {
+            const float *pa = a_band + 4 * i;
+            const float *pb = b_band + 4 * i;
+            bool differs = false;
+
+            for (uint32_t c = 0; c < 4; c++) {
+                if (pa[c] == pb[c] || (isnan(pa[c]) && isnan(pb[c])))
+                    continue;
+
+                const double err = isnan(pa[c]) || isnan(pb[c]) ?
+                                   INFINITY : fabs((double) pa[c] - pb[c]);
+
+                differs = true;
+                out_diff->max_error = MAX(out_diff->max_error, err);
+                sum_sq += err * err;
+            }
+
+            if (differs)
+                out_diff->num_diff_pixels++;
+
+            if (!diff_map)
+                continue;
+
+            const uint32_t x = i % width;
+            const uint32_t y = band_y + i / width;
+            uint8_t *out = diff_map + y * cru_image_get_pitch_bytes(diff_image)
+                           + 4 * x;
+
+            if (differs) {
+                out[0] = 255;
+                out[1] = 0;
+                out[2] = 0;
+            } else {
+                const float v = a_is_gray ? pa[0] :
+                    0.299f * pa[0] + 0.587f * pa[1] + 0.114f * pa[2];
+                out[0] = out[1] = out[2] = unorm8(v / 4.0f);
+            }
+
+            out[3] = 255;
+        }
+    }
+
+    out_diff->num_pixels = (uint64_t) width * height;
+    out_diff->rms_error = sqrt(sum_sq / (4.0 * out_diff->num_pixels));
+    result = true;
+
+cleanup:
+    free(a_band);
+    free(b_band);
+    row_reader_finish(&a_reader);
+    row_reader_finish(&b_reader);
+    if (diff_map)
+        diff_image->unmap_pixels(diff_image);
 
     return result;
 }
@@ -513,6 +633,12 @@ cru_image_array_get_image(cru_image_array_t *ia, int index)
     return ia->images[index];
 }
 
+int
+cru_image_array_get_num_images(cru_image_array_t *ia)
+{
+    return ia->num_images;
+}
+
 cru_image_array_t *
 cru_image_array_from_filename(const char *_filename)
 {
@@ -538,7 +664,8 @@ cru_image_array_from_filename(const char *_filename)
             free(ia);
             return NULL;
         }
-    } else if (string_endswith_cstr(&filename, ".ktx")) {
+    } else if (string_endswith_cstr(&filename, ".ktx") ||
+               string_endswith_cstr(&filename, ".ktx2")) {
         ia = cru_ktx_image_array_load_file(_filename);
     }
 
@@ -30,6 +30,7 @@ enum cru_image_type {
     CRU_IMAGE_TYPE_PIXELS,
     CRU_IMAGE_TYPE_PNG,
     CRU_IMAGE_TYPE_KTX,
+    CRU_IMAGE_TYPE_QOI,
     CRU_IMAGE_TYPE_TEXTURE,
     CRU_IMAGE_TYPE_VULKAN,
 };
@@ -51,6 +52,19 @@ struct cru_image {
 
     /// \see cru_image_unmap()
     bool (*unmap_pixels)(cru_image_t *image);
+
+    /// Optional. Return rows [y, y + height) of the image, tightly packed, or
+    /// NULL on failure. The rows stay valid until the next call to
+    /// read_rows() or end_read_rows(). Callers read bands of equal height in
+    /// ascending order, so implementations may start fetching the next band
+    /// before returning. Images without read_rows() are read through
+    /// map_pixels().
+    const uint8_t *(*read_rows)(cru_image_t *image, uint32_t y,
+                                uint32_t height);
+
+    /// Release the resources held by read_rows(). Required if read_rows() is
+    /// set.
+    void (*end_read_rows)(cru_image_t *image);
 };
 
 struct cru_image_array {
@@ -65,10 +79,17 @@ cru_image_init(cru_image_t *image, enum cru_image_type type, VkFormat format,
                uint32_t width, uint32_t height, bool read_only);
 char *cru_image_get_abspath(const char *filename);
 
+// file: cru_data_bundle.c
+cru_image_t *cru_data_bundle_load_image(const char *filename);
+
 // file: cru_png_image.c
 cru_image_t *cru_png_image_load_file(const char *filename);
 bool cru_png_image_write_file(cru_image_t *image, const string_t *filename);
 bool cru_png_image_copy_to_pixels(cru_image_t *png_image, cru_image_t *dest);
 
+// file: cru_qoi_image.c
+cru_image_t *cru_qoi_image_load_file(const char *filename);
+bool cru_qoi_image_write_file(cru_image_t *image, const string_t *filename);
+
 // file: cru_ktx_image.c
 cru_image_array_t *cru_ktx_image_array_load_file(const char *filename);
@@ -0,0 +1,262 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Background image writer behind cru_image_write_file_async() and
+/// cru_dump_archive_add_image_async().
+///
+/// Each process has one bounded queue of image snapshots, drained by a small
+/// pool of writer threads. The writers start on first use. A forked child
+/// inherits the parent's queue but not its threads, so the child resets the
+/// queue and starts its own writers.
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/cru_dump_archive.h"
+#include "util/log.h"
+#include "util/xalloc.h"
+
+#include "cru_image.h"
+
+#define NUM_WRITERS 2
+#define QUEUE_LENGTH 8
+
+struct write_job {
+    cru_image_t *snapshot;
+    void *pixels;
+
+    /// If set, append the image to the archive under the test name and
+    /// label. Otherwise write it to the file.
+    cru_dump_archive_t *archive;
+    char *test_name;
+    char *filename_or_label;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+
+    /// The process whose writer threads are running.
+    pid_t pid;
+
+    struct write_job jobs[QUEUE_LENGTH];
+    uint32_t head;
+    uint32_t len;
+
+    /// Number of jobs that writers have dequeued but not finished.
+    uint32_t busy;
+} writer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+/// Write the job's image and free the job.
+static bool
+run_job(struct write_job *job)
+{
+    bool ok;
+
+    if (job->archive) {
+        ok = cru_dump_archive_add_image(job->archive, job->test_name,
+                                        job->filename_or_label,
+                                        job->snapshot);
+    } else {
+        ok = cru_image_write_file(job->snapshot, job->filename_or_label);
+        if (!ok)
+            loge("failed to write image %s", job->filename_or_label);
+    }
+
+    cru_image_release(job->snapshot);
+    free(job->pixels);
+    free(job->test_name);
+    free(job->filename_or_label);
+
+    return ok;
+}
+
+static void *
+writer_main(void *arg)
+{
+    pthread_mutex_lock(&writer.mutex);
+
+    for (;;) {
+        while (writer.len == 0)
+            pthread_cond_wait(&writer.not_empty, &writer.mutex);
+
+        struct write_job job = writer.jobs[writer.head];
+        writer.head = (writer.head + 1) % QUEUE_LENGTH;
+        writer.len--;
+        writer.busy++;
+        pthread_cond_signal(&writer.not_full);
+
+        pthread_mutex_unlock(&writer.mutex);
+
+        run_job(&job);
+
+        pthread_mutex_lock(&writer.mutex);
+
+        writer.busy--;
+        if (writer.len == 0 && writer.busy == 0)
+            pthread_cond_broadcast(&writer.idle);
+    }
+
+    return NULL;
+}
+
+/// Start the writer threads if this process has none. The mutex must be held.
+static bool
+start_writers_locked(void)
+{
+    const pid_t pid = getpid();
+
+    if (writer.pid == pid)
+        return true;
+
+    // Jobs inherited across fork belong to the parent, which writes them.
+    writer.head = 0;
+    writer.len = 0;
+    writer.busy = 0;
+
+    for (uint32_t i = 0; i < NUM_WRITERS; i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, writer_main, NULL) != 0) {
+            // Writers that did start are enough to drain the queue.
+            if (i == 0) {
+                loge("failed to start image writer thread");
+                return false;
+            }
+            break;
+        }
+
+        pthread_detach(thread);
+    }
+
+    writer.pid = pid;
+    return true;
+}
+
+/// Copy the image's pixels into a new, tightly packed pixel image.
+static cru_image_t *
+snapshot_image(cru_image_t *image, void **out_pixels)
+{
+    const uint32_t width = cru_image_get_width(image);
+    const uint32_t height = cru_image_get_height(image);
+    const uint32_t row_size = image->format_info->cpp * width;
+    const uint32_t stride = cru_image_get_pitch_bytes(image);
+
+    const uint8_t *src = cru_image_map(image, CRU_IMAGE_MAP_ACCESS_READ);
+    if (!src)
+        return NULL;
+
+    uint8_t *pixels = xmalloc((size_t) row_size * height);
+    for (uint32_t y = 0; y < height; y++) {
+        memcpy(pixels + (size_t) y * row_size, src + (size_t) y * stride,
+               row_size);
+    }
+
+    cru_image_unmap(image);
+
+    cru_image_t *snapshot = cru_image_from_pixels(pixels,
+                                                  image->format_info->format,
+                                                  width, height);
+    if (!snapshot) {
+        free(pixels);
+        return NULL;
+    }
+
+    *out_pixels = pixels;
+    return snapshot;
+}
+
+/// Queue the job, or run it now if the writer threads can't start.
+static bool
+queue_job(struct write_job *job)
+{
+    pthread_mutex_lock(&writer.mutex);
+
+    if (!start_writers_locked()) {
+        pthread_mutex_unlock(&writer.mutex);
+        return run_job(job);
+    }
+
+    while (writer.len == QUEUE_LENGTH)
+        pthread_cond_wait(&writer.not_full, &writer.mutex);
+
+    writer.jobs[(writer.head + writer.len) % QUEUE_LENGTH] = *job;
+    writer.len++;
+    pthread_cond_signal(&writer.not_empty);
+
+    pthread_mutex_unlock(&writer.mutex);
+
+    return true;
+}
+
+bool
+cru_image_write_file_async(cru_image_t *image, const char *filename)
+{
+    struct write_job job = {0};
+
+    job.snapshot = snapshot_image(image, &job.pixels);
+    if (!job.snapshot)
+        return false;
+
+    job.filename_or_label = xstrdup(filename);
+
+    return queue_job(&job);
+}
+
+bool
+cru_dump_archive_add_image_async(cru_dump_archive_t *ar,
+                                 const char *test_name, const char *label,
+                                 cru_image_t *image)
+{
+    struct write_job job = {0};
+
+    job.snapshot = snapshot_image(image, &job.pixels);
+    if (!job.snapshot)
+        return false;
+
+    job.archive = ar;
+    job.test_name = xstrdup(test_name);
+    job.filename_or_label = xstrdup(label);
+
+    return queue_job(&job);
+}
+
+void
+cru_image_wait_async_writes(void)
+{
+    pthread_mutex_lock(&writer.mutex);
+
+    if (writer.pid == getpid()) {
+        while (writer.len > 0 || writer.busy > 0)
+            pthread_cond_wait(&writer.idle, &writer.mutex);
+    }
+
+    pthread_mutex_unlock(&writer.mutex);
+}
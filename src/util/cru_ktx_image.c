@@ -19,13 +19,30 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
-#include <alloca.h>
+/// \file
+/// \brief Load KTX and KTX2 files.
+///
+/// The loader maps the file read-only and points each image into the mapping,
+/// so loading copies no pixels. Every process that loads the same file,
+/// including forked slaves, shares its pages through the page cache.
+///
+/// A file yields one image per 2D slice, ordered by miplevel, then array
+/// layer, then cube face, then depth slice. This is the order in which both
+/// container formats store the slices.
+
 #include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "util/cru_vec.h"
 #include "util/log.h"
+#include "util/misc.h"
 #include "util/xalloc.h"
 #include "cru_image.h"
 
@@ -33,63 +50,88 @@
 
 /* TODO add support for more compressed formats */
 #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#define GL_RGBA8 0x8058
+#define GL_SRGB8_ALPHA8 0x8C43
 
-typedef struct cru_ktx_image cru_ktx_image_t;
+#define KTX1_HEADER_SIZE 64
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_INDEX_ENTRY_SIZE 24
 
-struct ktx_image_info {
-    FILE *file;
-    const char *filename;
-    size_t size;
-    void *data;
-    VkFormat vk_format;
-    VkImageViewType target;
-    uint32_t gl_type;
-    uint32_t gl_type_size;
-    uint32_t gl_format;
-    uint32_t gl_internal_format;
-    uint32_t gl_base_internal_format;
-    uint32_t pixel_width;
-    uint32_t pixel_height;
-    uint32_t pixel_depth;
-    uint32_t array_length;
-    uint32_t num_faces;
-    uint32_t num_miplevels;
-    uint32_t num_images;
+typedef struct cru_ktx_image cru_ktx_image_t;
 
+/// A mapped KTX file, shared by the images that point into it.
+struct ktx_file {
     cru_refcount_t refcount;
+    const uint8_t *data;
+    size_t size;
+    const char *filename;
 };
 
 struct cru_ktx_image {
     cru_image_t image;
 
-    void *data;
-    struct ktx_image_info *info;
-
-    struct {
-        /// When mapping the cru_png_image for reading, we decode the file into
-        /// this pixel array.
-        uint8_t *pixels;
+    struct ktx_file *file;
+    const uint8_t *pixels;
+};
 
-        /// Concrete type is cru_pixel_image_t.  The image's backing storage is
-        /// `cru_ktx_image::map.pixels`.
-        cru_image_t *pixel_image;
+/// The container-independent shape of a texture.
+struct ktx_layout {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t num_layers;
+    uint32_t num_faces;
+    uint32_t num_levels;
+};
 
-        /// Bitmask of `CRU_IMAGE_MAP_ACCESS_*`.
-        uint32_t access;
-    } map;
+struct ktx_slice {
+    const uint8_t *pixels;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
 };
 
-static const int cru_ktx_header_length = 64;
-static const char cru_ktx_magic_number[12] =
+typedef struct ktx_slice_vec ktx_slice_vec_t;
+CRU_VEC_DEFINE(struct ktx_slice_vec, struct ktx_slice)
+
+static const char cru_ktx1_magic_number[12] =
         { 0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n' };
+static const char cru_ktx2_magic_number[12] =
+        { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+
+static uint32_t
+get_u32(const struct ktx_file *file, size_t offset)
+{
+    uint32_t v;
+    memcpy(&v, file->data + offset, sizeof(v));
+    return le32toh(v);
+}
+
+static uint64_t
+get_u64(const struct ktx_file *file, size_t offset)
+{
+    uint64_t v;
+    memcpy(&v, file->data + offset, sizeof(v));
+    return le64toh(v);
+}
+
+/// Return true if [offset, offset + size) lies within the file.
+static bool
+in_bounds(const struct ktx_file *file, uint64_t offset, uint64_t size)
+{
+    return offset <= file->size && size <= file->size - offset;
+}
 
 static void
-cru_ktx_image_info_unref(struct ktx_image_info *image_info)
+ktx_file_unref(struct ktx_file *file)
 {
-    if (cru_refcount_put(&image_info->refcount) == 0) {
-        fclose(image_info->file);
-        free(image_info);
-    }
+    if (cru_refcount_put(&file->refcount) > 0)
+        return;
+
+    munmap((void *) file->data, file->size);
+    free((char *) file->filename);
+    free(file);
 }
 
 static void
@@ -99,7 +141,7 @@ cru_ktx_image_destroy(cru_image_t *image)
     if (!ktx_image)
         return;
 
-    cru_ktx_image_info_unref(ktx_image->info);
+    ktx_file_unref(ktx_image->file);
     free(ktx_image);
 }
 
@@ -110,148 +152,164 @@ cru_ktx_image_map_pixels(cru_image_t *image, uint32_t access)
 
     if (access & CRU_IMAGE_MAP_ACCESS_WRITE) {
         loge("crucible ktx images are read-only; cannot image for writing");
-        goto fail;
+        return NULL;
     }
-    if (ktx_image->map.pixels)
-        return ktx_image->map.pixels;
-
-    ktx_image->map.access = access;
-    ktx_image->map.pixels = ktx_image->data;
-    return ktx_image->data;
- fail:
-    return NULL;
+
+    // The file is mapped read-only, so a stray write faults.
+    return (uint8_t *) ktx_image->pixels;
 }
 
 static bool
 cru_ktx_image_unmap_pixels(cru_image_t *image)
 {
-    cru_ktx_image_t *ktx_image = (cru_ktx_image_t *)image;
-    // PNG images are always read-only.
-    assert(!(ktx_image->map.access & CRU_IMAGE_MAP_ACCESS_WRITE));
-
     return true;
 }
 
-static bool
-cru_ktx_get_vk_format(struct ktx_image_info *image)
+/// Return the size of one 2D slice, or 0 if the format is unsupported.
+static uint64_t
+ktx_slice_size(VkFormat format, uint32_t width, uint32_t height)
 {
-    /* add more format translation */
-    if (image->gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
-        image->vk_format = VK_FORMAT_BC3_UNORM_BLOCK;
-        return true;
+    if (format == VK_FORMAT_BC3_UNORM_BLOCK) {
+        // 16 bytes per 4x4 block.
+        return (uint64_t) ((width + 3) / 4) * ((height + 3) / 4) * 16;
     }
-    return false;
+
+    const cru_format_info_t *info = cru_format_get_info(format);
+    if (!info || info->cpp == 0)
+        return 0;
+
+    return (uint64_t) info->cpp * width * height;
 }
 
+/// Check the layout and fill in defaults for unused dimensions.
 static bool
-cru_ktx_calc_target(struct ktx_image_info *image)
+ktx_validate_layout(const struct ktx_file *file, struct ktx_layout *layout)
 {
-    if (image->pixel_width == 0)
-        goto bad_target;
-    else if (image->pixel_height == 0) {
-        if (image->pixel_depth != 0)
-            goto bad_target;
-        if (image->num_faces != 1)
-            goto bad_target;
-        if (image->array_length == 0)
-            image->target = VK_IMAGE_VIEW_TYPE_1D;
-        else
-            image->target = VK_IMAGE_VIEW_TYPE_1D_ARRAY;
-    } else if (image->pixel_depth == 0) {
-        if (image->array_length == 0) {
-            if (image->num_faces == 1)
-                image->target = VK_IMAGE_VIEW_TYPE_2D;
-            else if (image->num_faces == 6)
-                image->target = VK_IMAGE_VIEW_TYPE_CUBE;
-            else
-                goto bad_target;
-        } else {
-            if (image->num_faces == 1)
-                image->target = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
-            else if (image->num_faces == 6)
-                image->target = VK_IMAGE_VIEW_TYPE_CUBE_ARRAY;
-            else
-                goto bad_target;
+    if (layout->width == 0) {
+        loge("%s: image has zero width", file->filename);
+        return false;
+    }
+
+    if (layout->height == 0) {
+        if (layout->depth != 0 || layout->num_faces != 1) {
+            loge("%s: 1D image has depth or faces", file->filename);
+            return false;
         }
-    } else {
-        if (image->array_length != 0)
-            goto bad_target;
-        if (image->num_faces != 1)
-            goto bad_target;
-        image->target = VK_IMAGE_VIEW_TYPE_3D;
+        layout->height = 1;
+    }
 
+    if (layout->depth == 0) {
+        layout->depth = 1;
+    } else if (layout->num_layers != 0 || layout->num_faces != 1) {
+        loge("%s: 3D image has layers or faces", file->filename);
+        return false;
+    }
+
+    if (layout->num_layers == 0)
+        layout->num_layers = 1;
+
+    if (layout->num_faces != 1 && layout->num_faces != 6) {
+        loge("%s: image has %u faces", file->filename, layout->num_faces);
+        return false;
+    }
+
+    if (layout->num_faces == 6 && layout->width != layout->height) {
+        loge("%s: cube image is not square", file->filename);
+        return false;
+    }
+
+    if (layout->num_levels == 0) {
+        loge("%s: file requests automatic mipmap generation, which crucible "
+             "does not support", file->filename);
+        return false;
+    }
+
+    const uint32_t max_extent = MAX(layout->width,
+                                    MAX(layout->height, layout->depth));
+    if (layout->num_levels > 32 ||
+        (max_extent >> (layout->num_levels - 1)) == 0) {
+        loge("%s: image has too many miplevels", file->filename);
+        return false;
     }
+
+    if (ktx_slice_size(layout->format, 1, 1) == 0) {
+        loge("%s: unsupported VkFormat %d", file->filename, layout->format);
+        return false;
+    }
+
     return true;
+}
 
- bad_target:
-    loge("invalid image parameters");
-    return false;
+static uint64_t
+ktx_level_num_slices(const struct ktx_layout *layout, uint32_t level)
+{
+    return (uint64_t) layout->num_layers * layout->num_faces *
+           cru_minify(layout->depth, level);
 }
 
-static void
-cru_ktx_calc_base_image_size(struct ktx_image_info *image,
-                             uint32_t *width,
-                             uint32_t *height,
-                             uint32_t *depth)
+/// Append the level's slices, which lie tightly packed at \a offset.
+static bool
+ktx_push_level(const struct ktx_file *file, const struct ktx_layout *layout,
+               uint32_t level, uint64_t offset, uint64_t size,
+               ktx_slice_vec_t *slices)
 {
-    switch (image->target) {
-    case VK_IMAGE_VIEW_TYPE_1D:
-        *width = image->pixel_width;
-        *height = 0;
-        *depth = 0;
-        break;
-    case VK_IMAGE_VIEW_TYPE_1D_ARRAY:
-        *width = image->pixel_width;
-        *height = image->array_length;
-        *depth = 0;
-        break;
-    case VK_IMAGE_VIEW_TYPE_2D:
-        *width = image->pixel_width;
-        *height = image->pixel_height;
-        *depth = 0;
-        break;
-    case VK_IMAGE_VIEW_TYPE_2D_ARRAY:
-        *width = image->pixel_width;
-        *height = image->pixel_height;
-        *depth = image->array_length;
-        break;
-    case VK_IMAGE_VIEW_TYPE_CUBE:
-        *width = image->pixel_width;
-        *height = image->pixel_height;
-        *depth = 0;
-        break;
-    case VK_IMAGE_VIEW_TYPE_CUBE_ARRAY:
-        *width = image->pixel_width;
-        *height = image->pixel_height;
-        *depth = 6 * image->array_length;
-        break;
-    case VK_IMAGE_VIEW_TYPE_3D:
-        *width = image->pixel_width;
-        *height = image->pixel_height;
-        *depth = image->pixel_depth;
-        break;
-    default:
-        assert(0);
-        break;
+    const uint32_t width = cru_minify(layout->width, level);
+    const uint32_t height = cru_minify(layout->height, level);
+    const uint64_t num_slices = ktx_level_num_slices(layout, level);
+    const uint64_t slice_size = ktx_slice_size(layout->format, width, height);
+
+    if (!in_bounds(file, offset, size)) {
+        loge("%s: level %u lies outside the file", file->filename, level);
+        return false;
+    }
+
+    if (size != num_slices * slice_size) {
+        loge("%s: level %u has size %" PRIu64 ", expected %" PRIu64,
+             file->filename, level, size, num_slices * slice_size);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < num_slices; i++) {
+        *cru_vec_push(slices, 1) = (struct ktx_slice) {
+            .pixels = file->data + offset + i * slice_size,
+            .format = layout->format,
+            .width = width,
+            .height = height,
+        };
     }
+
+    return true;
 }
 
 static bool
-cru_ktx_parse_header(struct ktx_image_info *image)
+cru_ktx_get_vk_format(uint32_t gl_internal_format, VkFormat *format)
 {
-    const uint32_t *u32 = image->data;
-
-    if (image->size < cru_ktx_header_length) {
-        loge("data size must be at least 64 bytes");
+    switch (gl_internal_format) {
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        *format = VK_FORMAT_BC3_UNORM_BLOCK;
+        return true;
+    case GL_RGBA8:
+        *format = VK_FORMAT_R8G8B8A8_UNORM;
+        return true;
+    case GL_SRGB8_ALPHA8:
+        *format = VK_FORMAT_R8G8B8A8_SRGB;
+        return true;
+    default:
         return false;
     }
+}
 
-    if (memcmp(u32, cru_ktx_magic_number, sizeof(cru_ktx_magic_number)) != 0) {
-        loge("KTX header missing");
+static bool
+cru_ktx1_parse(const struct ktx_file *file, ktx_slice_vec_t *slices)
+{
+    struct ktx_layout layout;
+
+    if (file->size < KTX1_HEADER_SIZE) {
+        loge("%s: file is smaller than the KTX header", file->filename);
         return false;
     }
 
-    switch (u32[3]) {
+    switch (get_u32(file, 12)) {
     case 0x04030201:
         break;
     case 0x01020304:
@@ -262,229 +320,224 @@ cru_ktx_parse_header(struct ktx_image_info *image)
         return false;
     }
 
-    image->gl_type = u32[4];
-    image->gl_type_size = u32[5];
-    image->gl_format = u32[6];
-    image->gl_internal_format = u32[7];
-    image->gl_base_internal_format = u32[8];
-    image->pixel_width = u32[9];
-    image->pixel_height = u32[10];
-    image->pixel_depth = u32[11];
-    image->array_length = u32[12];
-    image->num_faces = u32[13];
-    image->num_miplevels = u32[14];
-
-    if (image->num_miplevels == 0) {
-        loge("KTX header requests automatic mipmap generation, which crucible does not support");
+    const uint32_t gl_internal_format = get_u32(file, 28);
+    if (!cru_ktx_get_vk_format(gl_internal_format, &layout.format)) {
+        loge("%s: unsupported glInternalFormat 0x%x", file->filename,
+             gl_internal_format);
         return false;
     }
 
-    bool ok = cru_ktx_get_vk_format(image);
-    if (!ok)
+    layout.width = get_u32(file, 36);
+    layout.height = get_u32(file, 40);
+    layout.depth = get_u32(file, 44);
+    layout.num_layers = get_u32(file, 48);
+    layout.num_faces = get_u32(file, 52);
+    layout.num_levels = get_u32(file, 56);
+
+    const bool is_cube_nonarray = layout.num_faces == 6 &&
+                                  layout.num_layers == 0;
+
+    if (!ktx_validate_layout(file, &layout))
         return false;
-    ok = cru_ktx_calc_target(image);
-    if (!ok)
+
+    const uint32_t kv_size = get_u32(file, 60);
+    if (kv_size % 4 != 0 || !in_bounds(file, KTX1_HEADER_SIZE, kv_size)) {
+        loge("%s: bad key/value data size", file->filename);
         return false;
+    }
 
-    if (image->target == VK_IMAGE_VIEW_TYPE_CUBE)
-        image->num_images = 6 * image->num_miplevels;
-    else
-        image->num_images = image->num_miplevels;
+    uint64_t offset = KTX1_HEADER_SIZE + kv_size;
 
-    return true;
-}
+    for (uint32_t level = 0; level < layout.num_levels; level++) {
+        if (!in_bounds(file, offset, 4)) {
+            loge("%s: file ends before level %u", file->filename, level);
+            return false;
+        }
 
-static void
-minify(uint32_t *n)
-{
-        assert(*n != 0);
+        const uint32_t image_size = get_u32(file, offset);
+        offset += 4;
+
+        if (is_cube_nonarray) {
+            // image_size is the size of one face. Each face is padded to 4
+            // bytes, which is a no-op for the supported formats.
+            struct ktx_layout face_layout = layout;
+            face_layout.num_faces = 1;
+
+            for (uint32_t face = 0; face < 6; face++) {
+                if (!ktx_push_level(file, &face_layout, level, offset,
+                                    image_size, slices))
+                    return false;
+                offset += cru_align_size(image_size, 4);
+            }
+        } else {
+            if (!ktx_push_level(file, &layout, level, offset, image_size,
+                                slices))
+                return false;
+            offset += cru_align_size(image_size, 4);
+        }
+    }
 
-        if (*n > 1)
-                *n >>= 1;
+    return true;
 }
 
 static bool
-cru_ktx_parse_images(struct ktx_image_info *image_info,
-                     cru_image_array_t *ia)
+cru_ktx2_parse(const struct ktx_file *file, ktx_slice_vec_t *slices)
 {
-    /*
-     * Current byte being parsed. Used to traverse data with a step of
-     * either 8 or 32 bits.
-     */
-    union piglit_ktx_position {
-        uint8_t *u8;
-        uint32_t *u32;
-    } p;
-
-    uint32_t pixel_width;
-    uint32_t pixel_height;
-    uint32_t pixel_depth;
-
-    cru_ktx_calc_base_image_size(image_info, &pixel_width,
-                                 &pixel_height, &pixel_depth);
-    /* Loop counters */
-    int miplevel;
-    int face;
-
-    /* Skip header. */
-    p.u8 = image_info->data;
-    p.u8 += cru_ktx_header_length;
-
-    int idx = 0;
-    struct cru_ktx_image *ktx_image = (struct cru_ktx_image *)ia->images[0];
-
-#define CUR_SIZE (p.u8 - (uint8_t *) image_info->data)
-
-    for (miplevel = 0; miplevel < image_info->num_miplevels; ++miplevel) {
-        uint32_t image_size;
-
-        if (image_info->size < CUR_SIZE + 1) {
-            return false;
-        }
+    struct ktx_layout layout;
 
-        image_size = *p.u32;
-        ++p.u32;
-
-        for (face = 0; face < 6; ++face) {
-            cru_image_init(&ktx_image->image, CRU_IMAGE_TYPE_KTX,
-                           image_info->vk_format, pixel_width, pixel_height, true);
-
-            ktx_image->image.destroy = cru_ktx_image_destroy;
-            ktx_image->image.map_pixels = cru_ktx_image_map_pixels;
-            ktx_image->image.unmap_pixels = cru_ktx_image_unmap_pixels;
-            ktx_image->data = p.u8;
-            p.u8 += image_size;
-            idx++;
-            if (idx >= image_info->num_images)
-                break;
-            ktx_image = (struct cru_ktx_image *)ia->images[idx];
-
-            /* Padding */
-            while (CUR_SIZE % 4 != 0)
-                ++p.u8;
-
-            if (image_info->target != VK_IMAGE_VIEW_TYPE_CUBE)
-                break;
-        }
+    if (file->size < KTX2_HEADER_SIZE) {
+        loge("%s: file is smaller than the KTX2 header", file->filename);
+        return false;
+    }
 
-        switch (image_info->target) {
-        case VK_IMAGE_VIEW_TYPE_3D:
-            minify(&pixel_width);
-            minify(&pixel_height);
-            minify(&pixel_depth);
-            break;
-        case VK_IMAGE_VIEW_TYPE_2D:
-        case VK_IMAGE_VIEW_TYPE_2D_ARRAY:
-        case VK_IMAGE_VIEW_TYPE_CUBE:
-        case VK_IMAGE_VIEW_TYPE_CUBE_ARRAY:
-            minify(&pixel_width);
-            minify(&pixel_height);
-            break;
-        case VK_IMAGE_VIEW_TYPE_1D:
-        case VK_IMAGE_VIEW_TYPE_1D_ARRAY:
-            minify(&pixel_width);
-            break;
-        default:
-            assert(0);
-            break;
-        }
+    layout.format = get_u32(file, 12);
+    layout.width = get_u32(file, 20);
+    layout.height = get_u32(file, 24);
+    layout.depth = get_u32(file, 28);
+    layout.num_layers = get_u32(file, 32);
+    layout.num_faces = get_u32(file, 36);
+    layout.num_levels = get_u32(file, 40);
+
+    const uint32_t supercompression = get_u32(file, 44);
+    if (supercompression != 0) {
+        loge("%s: KTX2 supercompression scheme %u is not supported",
+             file->filename, supercompression);
+        return false;
+    }
+
+    if (layout.format == VK_FORMAT_UNDEFINED) {
+        loge("%s: KTX2 file has no VkFormat", file->filename);
+        return false;
+    }
+
+    if (!ktx_validate_layout(file, &layout))
+        return false;
+
+    // Data format descriptor, key/value data, and supercompression global
+    // data. Crucible reads none of them, but they must be in bounds.
+    if (!in_bounds(file, get_u32(file, 48), get_u32(file, 52)) ||
+        !in_bounds(file, get_u32(file, 56), get_u32(file, 60)) ||
+        !in_bounds(file, get_u64(file, 64), get_u64(file, 72))) {
+        loge("%s: KTX2 index lies outside the file", file->filename);
+        return false;
     }
 
-    if (image_info->size < CUR_SIZE) {
-        /*
-         * The last image's data lies, at least partially, in
-         * out-of-bounds memory.
-         */
-        loge("size of data stream incorrect");
+    if (!in_bounds(file, KTX2_HEADER_SIZE,
+                   (uint64_t) layout.num_levels *
+                   KTX2_LEVEL_INDEX_ENTRY_SIZE)) {
+        loge("%s: KTX2 level index lies outside the file", file->filename);
         return false;
     }
 
-    image_info->size = CUR_SIZE;
+    for (uint32_t level = 0; level < layout.num_levels; level++) {
+        const size_t entry = KTX2_HEADER_SIZE +
+                             level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+        const uint64_t offset = get_u64(file, entry);
+        const uint64_t size = get_u64(file, entry + 8);
+
+        if (!ktx_push_level(file, &layout, level, offset, size, slices))
+            return false;
+    }
+
     return true;
 }
 
+static struct ktx_file *
+ktx_file_map(const char *filename)
+{
+    struct stat st;
+    void *data;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        loge("failed to open file for reading: %s", filename);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        loge("failed to read file: %s", filename);
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        loge("failed to map file %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    struct ktx_file *file = xzalloc(sizeof(*file));
+    cru_refcount_init(&file->refcount);
+    file->data = data;
+    file->size = st.st_size;
+    file->filename = xstrdup(filename);
+
+    return file;
+}
+
 cru_image_array_t *
 cru_ktx_image_array_load_file(const char *filename)
 {
-    char *abs_filename = NULL;
-    FILE *file;
-    int error = 0;
+    cru_image_array_t *ia = NULL;
+    ktx_slice_vec_t slices = CRU_VEC_INIT;
     bool ok;
-    uint32_t size;
 
-    abs_filename = cru_image_get_abspath(filename);
+    char *abs_filename = cru_image_get_abspath(filename);
     if (!abs_filename)
-        goto fail_filename;
-
-    file = fopen(abs_filename, "rb");
-    if (!file) {
-        loge("failed to open file for reading: %s", abs_filename);
-        goto fail_fopen;
+        return NULL;
+
+    struct ktx_file *file = ktx_file_map(abs_filename);
+    free(abs_filename);
+    if (!file)
+        return NULL;
+
+    if (file->size >= sizeof(cru_ktx1_magic_number) &&
+        memcmp(file->data, cru_ktx1_magic_number,
+               sizeof(cru_ktx1_magic_number)) == 0) {
+        ok = cru_ktx1_parse(file, &slices);
+    } else if (file->size >= sizeof(cru_ktx2_magic_number) &&
+               memcmp(file->data, cru_ktx2_magic_number,
+                      sizeof(cru_ktx2_magic_number)) == 0) {
+        ok = cru_ktx2_parse(file, &slices);
+    } else {
+        loge("%s: KTX header missing", file->filename);
+        ok = false;
     }
 
-    error = fseek(file, 0, SEEK_END);
-    if (error)
-        goto bad_read;
-    size = ftell(file);
-    error = fseek(file, 0, SEEK_SET);
-    if (error)
-        goto bad_read;
-
-    struct ktx_image_info *image_info = calloc(1, sizeof(struct ktx_image_info) + size);
-    if (!image_info)
-        goto fail_alloc;
-
-    cru_refcount_init(&image_info->refcount);
-    image_info->file = file;
-    image_info->size = size;
-    image_info->filename = abs_filename;
-    image_info->data = image_info + 1;
-
-    size_t size_read = fread(image_info->data, 1, image_info->size, file);
-    if (size_read < image_info->size)
-        goto fail_read_file;
-
-    ok = cru_ktx_parse_header(image_info);
     if (!ok)
-        goto fail_read_file;
+        goto out;
 
-    cru_image_array_t *ia = calloc(1, sizeof(*ia));
-    if (!ia)
-        goto bad_ia_alloc;
+    ia = xzalloc(sizeof(*ia));
     cru_refcount_init(&ia->refcount);
-    ia->num_images = image_info->num_images;
-    /* allocate an array of images for each image in the ktx file. */
-    ia->images = calloc(image_info->num_images, sizeof(struct cru_ktx_image *));
-    if (!ia->images)
-        goto bad_ia_image_ptrs_alloc;
-    for (unsigned i = 0; i < image_info->num_images; i++) {
-        ia->images[i] = calloc(1, sizeof(struct cru_ktx_image));
-        struct cru_ktx_image *ktx_image = (struct cru_ktx_image *)ia->images[i];
-        ktx_image->info = image_info;
-        cru_refcount_get(&image_info->refcount);
-
-        if (!ia->images[i])
-            goto bad_ia_images_alloc;
+    ia->images = xzallocn(slices.len, sizeof(ia->images[0]));
+
+    for (size_t i = 0; i < slices.len; i++) {
+        cru_ktx_image_t *ktx_image = xzalloc(sizeof(*ktx_image));
+
+        if (!cru_image_init(&ktx_image->image, CRU_IMAGE_TYPE_KTX,
+                            slices.data[i].format, slices.data[i].width,
+                            slices.data[i].height, true)) {
+            free(ktx_image);
+            cru_image_array_release(ia);
+            ia = NULL;
+            goto out;
+        }
+
+        ktx_image->image.destroy = cru_ktx_image_destroy;
+        ktx_image->image.map_pixels = cru_ktx_image_map_pixels;
+        ktx_image->image.unmap_pixels = cru_ktx_image_unmap_pixels;
+        ktx_image->file = file;
+        ktx_image->pixels = slices.data[i].pixels;
+        cru_refcount_get(&file->refcount);
+
+        ia->images[ia->num_images++] = &ktx_image->image;
     }
-    ok = cru_ktx_parse_images(image_info, ia);
-    if (!ok)
-        goto bad_read;
 
-    cru_ktx_image_info_unref(image_info);
-    return ia;
+out:
+    cru_vec_finish(&slices);
+    ktx_file_unref(file);
 
-bad_ia_images_alloc:
-    for (unsigned i = 0; i < ia->num_images; i++)
-        cru_ktx_image_destroy((struct cru_image *)ia->images[i]);
-bad_ia_image_ptrs_alloc:
-    free(ia->images);
-bad_ia_alloc:
-fail_read_file:
-    free(image_info);
-fail_alloc:
-bad_read:
-    fclose(file);
-fail_fopen:
-fail_filename:
-    return NULL;
+    return ia;
 }
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "util/log.h"
 #include "util/xalloc.h"
 
 #include "cru_image.h"
@@ -56,6 +57,11 @@ cru_pixel_image_map_pixels(cru_image_t *image, uint32_t access)
     assert(kpix_image->map_access == 0);
     assert(access != 0);
 
+    if (image->read_only && (access & CRU_IMAGE_MAP_ACCESS_WRITE)) {
+        loge("cannot map read-only image for writing");
+        return NULL;
+    }
+
     kpix_image->map_access = access;
     return kpix_image->pixels;
 }
@@ -33,6 +33,9 @@
 
 typedef struct cru_png_image cru_png_image_t;
 
+/// \see cru_image_set_png_compression_level()
+static int png_compression_level = -1;
+
 struct cru_png_image {
     cru_image_t image;
 
@@ -55,6 +58,20 @@ struct cru_png_image {
         /// Bitmask of `CRU_IMAGE_MAP_ACCESS_*`.
         uint32_t access;
     } map;
+
+    /// State for read_rows(), which decodes the file incrementally instead of
+    /// decoding the whole image up front.
+    struct {
+        png_structp png_reader;
+        png_infop png_info;
+
+        /// Next row that png_reader will decode.
+        uint32_t next_row;
+
+        /// Holds the rows returned by the last read_rows().
+        uint8_t *rows;
+        uint32_t rows_capacity;
+    } stream;
 };
 
 static VkFormat
@@ -129,66 +146,44 @@ fail_create_png_reader:
     return result;
 }
 
+/// Create a reader positioned at the first row of the file, and set it up to
+/// transform the file's pixel format to the crucible image's pixel format.
 static bool
-copy_direct_from_png(cru_image_t *src, cru_image_t *dest)
+begin_png_read(cru_png_image_t *png_image, png_structp *out_png_reader,
+               png_infop *out_png_info)
 {
-    cru_png_image_t *png_image;
-
-    bool result = false;
     png_structp png_reader = NULL;
     png_infop png_info = NULL;
 
-    const uint32_t width = src->width;
-    const uint32_t height = src->height;
-    const uint32_t stride = width * src->format_info->cpp;
-    uint8_t *dest_pixels = NULL;
-    uint8_t *dest_rows[height];
-
-    assert(src->format_info == dest->format_info);
-    assert(src->type == CRU_IMAGE_TYPE_PNG);
-    assert(src->width == dest->width);
-    assert(src->height == dest->height);
-
-    png_image = (cru_png_image_t *) src;
-
-    assert(!dest->read_only);
-    dest_pixels = dest->map_pixels(dest, CRU_IMAGE_MAP_ACCESS_WRITE);
-    if (!dest_pixels)
-        return false;
-
-    for (uint32_t y = 0; y < height; ++y) {
-        dest_rows[y] = dest_pixels + y * stride;
-    }
-
     // FINISHME: Error callbacks for libpng
     png_reader = png_create_read_struct(PNG_LIBPNG_VER_STRING,
                                        NULL, NULL, NULL);
     if (!png_reader) {
         loge("failed to create png reader");
-        goto fail_create_png_reader;
+        return false;
     }
 
     png_info = png_create_info_struct(png_reader);
     if (!png_info) {
         loge("failed to create png reader info");
-        goto fail_create_png_info;
+        png_destroy_read_struct(&png_reader, NULL, NULL);
+        return false;
     }
 
     rewind(png_image->file);
     png_init_io(png_reader, png_image->file);
     png_read_info(png_reader, png_info);
 
-    // Transform the file's pixel format to the crucible image's pixel format.
     switch (png_image->png_color_type) {
     case PNG_COLOR_TYPE_RGB:
     case PNG_COLOR_TYPE_GRAY:
-        if (dest->format_info->has_alpha) {
+        if (png_image->image.format_info->has_alpha) {
             png_set_add_alpha(png_reader, UINT32_MAX, PNG_FILLER_AFTER);
         }
         break;
     case PNG_COLOR_TYPE_RGB_ALPHA:
     case PNG_COLOR_TYPE_GRAY_ALPHA:
-        if (!dest->format_info->has_alpha) {
+        if (!png_image->image.format_info->has_alpha) {
             png_set_strip_alpha(png_reader);
         }
         break;
@@ -198,15 +193,56 @@ copy_direct_from_png(cru_image_t *src, cru_image_t *dest)
         break;
     }
 
+    *out_png_reader = png_reader;
+    *out_png_info = png_info;
+
+    return true;
+}
+
+static bool
+copy_direct_from_png(cru_image_t *src, cru_image_t *dest)
+{
+    cru_png_image_t *png_image;
+
+    bool result = false;
+    png_structp png_reader = NULL;
+    png_infop png_info = NULL;
+
+    const uint32_t width = src->width;
+    const uint32_t height = src->height;
+    const uint32_t stride = width * src->format_info->cpp;
+    uint8_t *dest_pixels = NULL;
+    uint8_t *dest_rows[height];
+
+    assert(src->format_info == dest->format_info);
+    assert(src->type == CRU_IMAGE_TYPE_PNG);
+    assert(src->width == dest->width);
+    assert(src->height == dest->height);
+
+    png_image = (cru_png_image_t *) src;
+
+    assert(!dest->read_only);
+    dest_pixels = dest->map_pixels(dest, CRU_IMAGE_MAP_ACCESS_WRITE);
+    if (!dest_pixels)
+        return false;
+
+    for (uint32_t y = 0; y < height; ++y) {
+        dest_rows[y] = dest_pixels + y * stride;
+    }
+
+    // The reader below shares the file with read_rows().
+    src->end_read_rows(src);
+
+    if (!begin_png_read(png_image, &png_reader, &png_info))
+        goto fail_begin_read;
+
     png_read_rows(png_reader, dest_rows, NULL, height);
     png_read_end(png_reader, NULL);
+    png_destroy_read_struct(&png_reader, &png_info, NULL);
 
     result = true;
 
-fail_create_png_info:
-
-    png_destroy_read_struct(&png_reader, &png_info, NULL);
-fail_create_png_reader:
+fail_begin_read:
 
     if (!dest->unmap_pixels(dest)) {
         loge("failed to unmap pixel image");
@@ -314,6 +350,79 @@ cru_png_image_unmap_pixels(cru_image_t *image)
     return true;
 }
 
+static void
+cru_png_image_end_read_rows(cru_image_t *image)
+{
+    cru_png_image_t *png_image = (cru_png_image_t *) image;
+
+    if (png_image->stream.png_reader) {
+        png_destroy_read_struct(&png_image->stream.png_reader,
+                                &png_image->stream.png_info, NULL);
+    }
+
+    free(png_image->stream.rows);
+    png_image->stream = (typeof(png_image->stream)) {0};
+}
+
+static const uint8_t *
+cru_png_image_read_rows(cru_image_t *image, uint32_t y, uint32_t height)
+{
+    cru_png_image_t *png_image = (cru_png_image_t *) image;
+    const uint32_t stride = image->format_info->cpp * image->width;
+
+    assert(y + height <= image->height);
+
+    // Prefer the decoded pixels if the image has already been mapped.
+    if (png_image->map.pixels)
+        return png_image->map.pixels + y * stride;
+
+    if (!png_image->stream.png_reader || y < png_image->stream.next_row) {
+        cru_png_image_end_read_rows(image);
+
+        if (!begin_png_read(png_image, &png_image->stream.png_reader,
+                            &png_image->stream.png_info))
+            return NULL;
+
+        // png_read_row() returns the rows of interlaced images pass by pass,
+        // so decode those whole.
+        if (png_get_interlace_type(png_image->stream.png_reader,
+                                   png_image->stream.png_info) !=
+            PNG_INTERLACE_NONE) {
+            cru_png_image_end_read_rows(image);
+
+            uint8_t *pixels = image->map_pixels(image,
+                                                CRU_IMAGE_MAP_ACCESS_READ);
+            if (!pixels)
+                return NULL;
+
+            image->unmap_pixels(image);
+            return pixels + y * stride;
+        }
+    }
+
+    if (png_image->stream.rows_capacity < height) {
+        free(png_image->stream.rows);
+        png_image->stream.rows = xmalloc(stride * height);
+        png_image->stream.rows_capacity = height;
+    }
+
+    // Skip ahead to the first requested row.
+    while (png_image->stream.next_row < y) {
+        png_read_row(png_image->stream.png_reader, png_image->stream.rows,
+                     NULL);
+        png_image->stream.next_row++;
+    }
+
+    for (uint32_t i = 0; i < height; i++) {
+        png_read_row(png_image->stream.png_reader,
+                     png_image->stream.rows + i * stride, NULL);
+    }
+
+    png_image->stream.next_row += height;
+
+    return png_image->stream.rows;
+}
+
 static void
 cru_png_image_destroy(cru_image_t *image)
 {
@@ -322,6 +431,8 @@ cru_png_image_destroy(cru_image_t *image)
     if (!png_image)
         return;
 
+    cru_png_image_end_read_rows(image);
+
     if (png_image->map.pixel_image)
         cru_image_release(png_image->map.pixel_image);
 
@@ -375,6 +486,8 @@ cru_png_image_load_file(const char *filename)
     png_image->image.destroy = cru_png_image_destroy;
     png_image->image.map_pixels = cru_png_image_map_pixels;
     png_image->image.unmap_pixels = cru_png_image_unmap_pixels;
+    png_image->image.read_rows = cru_png_image_read_rows;
+    png_image->image.end_read_rows = cru_png_image_end_read_rows;
 
     png_image->filename = abs_filename;
     png_image->file = file;
@@ -480,6 +593,15 @@ write_direct_to_png(cru_image_t *image, const string_t *filename)
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                  PNG_FILTER_TYPE_DEFAULT);
 
+    if (png_compression_level >= 0) {
+        png_set_compression_level(png_writer, png_compression_level);
+
+        // At the fastest levels, row filtering costs more time than its
+        // better compression is worth.
+        if (png_compression_level <= 1)
+            png_set_filter(png_writer, 0, PNG_FILTER_NONE);
+    }
+
     png_write_info(png_writer, png_info);
     png_set_rows(png_writer, png_info, src_rows);
     png_write_png(png_writer, png_info, PNG_TRANSFORM_IDENTITY, NULL);
@@ -509,20 +631,18 @@ write_indirect_to_png(cru_image_t *image, const string_t *filename)
     cru_image_t *tmp_image = NULL;
     bool result = false;
 
-    switch (image->format_info->format) {
-    case VK_FORMAT_R8G8B8A8_UNORM:
-    case VK_FORMAT_R8_UNORM:
-        tmp_format = image->format_info->format;
-        break;
-    case VK_FORMAT_D32_SFLOAT:
-    case VK_FORMAT_S8_UINT:
-        tmp_format = VK_FORMAT_R8_UNORM;
-        break;
-    default:
+    if (!cru_format_is_convertible(image->format_info)) {
         loge("cannot write %s to PNG", image->format_info->name);
         return false;
     }
 
+    // Single-channel images, including depth and stencil, are written as
+    // grayscale and everything else as RGBA.
+    if (image->format_info->num_channels == 1)
+        tmp_format = VK_FORMAT_R8_UNORM;
+    else
+        tmp_format = VK_FORMAT_R8G8B8A8_UNORM;
+
     tmp_format_info = cru_format_get_info(tmp_format);
     if (!tmp_format_info) {
         loge("unknown VkFormat %d", tmp_format);
@@ -552,6 +672,12 @@ cleanup:
     return result;
 }
 
+void
+cru_image_set_png_compression_level(int level)
+{
+    png_compression_level = level;
+}
+
 bool
 cru_png_image_write_file(cru_image_t *image, const string_t *filename)
 {
@@ -0,0 +1,485 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Read and write images in the "Quite OK Image" format.
+///
+/// QOI encodes several times faster than PNG at a similar size for rendered
+/// images, which makes it a good fit for bulk image dumps. Crucible reads QOI
+/// only to compare dumps, with `crucible img-diff`. See https://qoiformat.org/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "util/log.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+#include "cru_image.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+// The limit of the reference implementation. It keeps a crafted header from
+// asking for an absurd allocation.
+#define QOI_PIXELS_MAX 400000000u
+
+static const uint8_t qoi_end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+/// Appended after the end marker of R8 images, which are stored as RGB.
+/// Decoders stop at the end marker, so the file remains valid QOI, and a
+/// 3-channel file without the tag is decoded as RGB.
+static const uint8_t qoi_r8_tag[4] = {'c', 'r', 'R', '8'};
+
+struct qoi_rgba {
+    uint8_t r, g, b, a;
+};
+
+static inline uint32_t
+qoi_hash(struct qoi_rgba px)
+{
+    return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+static inline bool
+qoi_rgba_eq(struct qoi_rgba x, struct qoi_rgba y)
+{
+    return x.r == y.r && x.g == y.g && x.b == y.b && x.a == y.a;
+}
+
+typedef struct cru_qoi_image cru_qoi_image_t;
+
+struct cru_qoi_image {
+    cru_image_t image;
+
+    /// Tightly packed, owned by the image.
+    uint8_t *pixels;
+};
+
+static uint8_t *
+put_u32_be(uint8_t *p, uint32_t v)
+{
+    *p++ = v >> 24;
+    *p++ = v >> 16;
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+/// Encode tightly packed R8 or RGBA8 pixels. Return the encoded size, which
+/// includes qoi_r8_tag for R8 pixels.
+static size_t
+qoi_encode(uint8_t *out, const uint8_t *pixels, uint32_t cpp,
+           uint32_t width, uint32_t height)
+{
+    const uint8_t channels = cpp == 4 ? 4 : 3;
+    const size_t num_pixels = (size_t) width * height;
+    struct qoi_rgba index[64] = {{0}};
+    struct qoi_rgba prev = { .a = 255 };
+    uint32_t run = 0;
+    uint8_t *p = out;
+
+    memcpy(p, "qoif", 4);
+    p = put_u32_be(p + 4, width);
+    p = put_u32_be(p, height);
+    *p++ = channels;
+    *p++ = 1; // All channels linear.
+
+    for (size_t i = 0; i < num_pixels; i++) {
+        struct qoi_rgba px;
+
+        if (cpp == 4) {
+            memcpy(&px, pixels + 4 * i, 4);
+        } else {
+            // Expand grayscale to RGB.
+            px.r = px.g = px.b = pixels[i];
+            px.a = 255;
+        }
+
+        if (qoi_rgba_eq(px, prev)) {
+            if (++run == QOI_MAX_RUN || i == num_pixels - 1) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            *p++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        const uint32_t h = qoi_hash(px);
+
+        if (qoi_rgba_eq(index[h], px)) {
+            *p++ = QOI_OP_INDEX | h;
+        } else if (px.a == prev.a) {
+            index[h] = px;
+
+            const int8_t dr = px.r - prev.r;
+            const int8_t dg = px.g - prev.g;
+            const int8_t db = px.b - prev.b;
+            const int8_t dr_dg = dr - dg;
+            const int8_t db_dg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                db >= -2 && db <= 1) {
+                *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                       db_dg >= -8 && db_dg <= 7) {
+                *p++ = QOI_OP_LUMA | (dg + 32);
+                *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+            } else {
+                *p++ = QOI_OP_RGB;
+                *p++ = px.r;
+                *p++ = px.g;
+                *p++ = px.b;
+            }
+        } else {
+            index[h] = px;
+
+            *p++ = QOI_OP_RGBA;
+            *p++ = px.r;
+            *p++ = px.g;
+            *p++ = px.b;
+            *p++ = px.a;
+        }
+
+        prev = px;
+    }
+
+    memcpy(p, qoi_end_marker, sizeof(qoi_end_marker));
+    p += sizeof(qoi_end_marker);
+
+    if (cpp != 4) {
+        memcpy(p, qoi_r8_tag, sizeof(qoi_r8_tag));
+        p += sizeof(qoi_r8_tag);
+    }
+
+    return p - out;
+}
+
+static bool
+write_direct_to_qoi(cru_image_t *image, const string_t *filename)
+{
+    const uint32_t width = image->width;
+    const uint32_t height = image->height;
+    const uint32_t cpp = image->format_info->cpp;
+    const uint32_t stride = cru_image_get_pitch_bytes(image);
+    bool result = false;
+    char *abspath = NULL;
+    uint8_t *packed = NULL;
+    uint8_t *encoded = NULL;
+    FILE *f = NULL;
+
+    abspath = cru_image_get_abspath(string_data(filename));
+    if (!abspath)
+        return false;
+
+    const uint8_t *pixels = image->map_pixels(image,
+                                              CRU_IMAGE_MAP_ACCESS_READ);
+    if (!pixels)
+        goto cleanup;
+
+    // The encoder wants tightly packed rows.
+    if (stride != cpp * width) {
+        packed = xmalloc((size_t) cpp * width * height);
+        for (uint32_t y = 0; y < height; y++) {
+            memcpy(packed + (size_t) y * cpp * width,
+                   pixels + (size_t) y * stride, cpp * width);
+        }
+        pixels = packed;
+    }
+
+    // Worst case is QOI_OP_RGBA for every pixel.
+    encoded = xmalloc(QOI_HEADER_SIZE + (size_t) width * height * 5 +
+                      sizeof(qoi_end_marker) + sizeof(qoi_r8_tag));
+    const size_t size = qoi_encode(encoded, pixels, cpp, width, height);
+
+    // Ignore the result of unmap because no write-back occurs when unmapping
+    // a read-only map.
+    image->unmap_pixels(image);
+
+    f = fopen(abspath, "wb");
+    if (!f) {
+        loge("failed to open file for writing: %s", abspath);
+        goto cleanup;
+    }
+
+    if (fwrite(encoded, 1, size, f) != size) {
+        loge("failed to write file: %s", abspath);
+        goto cleanup;
+    }
+
+    result = true;
+
+cleanup:
+    if (f)
+        fclose(f);
+    free(encoded);
+    free(packed);
+    free(abspath);
+
+    return result;
+}
+
+bool
+cru_qoi_image_write_file(cru_image_t *image, const string_t *filename)
+{
+    cru_image_t *tmp_image = NULL;
+    void *tmp_pixels = NULL;
+    bool result;
+
+    switch (image->format_info->format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8_UNORM:
+        return write_direct_to_qoi(image, filename);
+    default:
+        break;
+    }
+
+    if (!cru_format_is_convertible(image->format_info)) {
+        loge("cannot write %s to QOI", image->format_info->name);
+        return false;
+    }
+
+    const VkFormat tmp_format = image->format_info->num_channels == 1 ?
+                                VK_FORMAT_R8_UNORM :
+                                VK_FORMAT_R8G8B8A8_UNORM;
+    const uint32_t tmp_cpp = tmp_format == VK_FORMAT_R8_UNORM ? 1 : 4;
+
+    tmp_pixels = xmalloc((size_t) tmp_cpp * image->width * image->height);
+    tmp_image = cru_image_from_pixels(tmp_pixels, tmp_format,
+                                      image->width, image->height);
+
+    result = tmp_image &&
+             cru_image_copy(tmp_image, image) &&
+             write_direct_to_qoi(tmp_image, filename);
+
+    cru_image_release(tmp_image);
+    free(tmp_pixels);
+
+    return result;
+}
+
+static uint32_t
+get_u32_be(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/// Decode into tightly packed R8 pixels if \a cpp is 1, and into RGBA8 pixels
+/// otherwise. \a size excludes qoi_r8_tag. Return false if the data is
+/// truncated.
+static bool
+qoi_decode(uint8_t *pixels, uint32_t cpp, const uint8_t *data, size_t size,
+           size_t num_pixels)
+{
+    const uint8_t *p = data + QOI_HEADER_SIZE;
+    const uint8_t *end = data + size - sizeof(qoi_end_marker);
+    struct qoi_rgba index[64] = {{0}};
+    struct qoi_rgba px = { .a = 255 };
+    uint32_t run = 0;
+
+    for (size_t i = 0; i < num_pixels; i++) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (p >= end)
+                return false;
+
+            const uint8_t op = *p++;
+
+            if (op == QOI_OP_RGB) {
+                if (end - p < 3)
+                    return false;
+                px.r = p[0];
+                px.g = p[1];
+                px.b = p[2];
+                p += 3;
+            } else if (op == QOI_OP_RGBA) {
+                if (end - p < 4)
+                    return false;
+                px.r = p[0];
+                px.g = p[1];
+                px.b = p[2];
+                px.a = p[3];
+                p += 4;
+            } else if ((op & 0xc0) == QOI_OP_INDEX) {
+                px = index[op];
+            } else if ((op & 0xc0) == QOI_OP_DIFF) {
+                px.r += ((op >> 4) & 3) - 2;
+                px.g += ((op >> 2) & 3) - 2;
+                px.b += (op & 3) - 2;
+            } else if ((op & 0xc0) == QOI_OP_LUMA) {
+                if (p >= end)
+                    return false;
+                const int dg = (op & 0x3f) - 32;
+                px.r += dg + (*p >> 4) - 8;
+                px.g += dg;
+                px.b += dg + (*p & 0xf) - 8;
+                p++;
+            } else {
+                run = op & 0x3f;
+            }
+
+            index[qoi_hash(px)] = px;
+        }
+
+        if (cpp == 4)
+            memcpy(pixels + 4 * i, &px, 4);
+        else
+            pixels[i] = px.r;
+    }
+
+    return true;
+}
+
+static void
+cru_qoi_image_destroy(cru_image_t *image)
+{
+    cru_qoi_image_t *qoi_image = (cru_qoi_image_t *) image;
+
+    free(qoi_image->pixels);
+    free(qoi_image);
+}
+
+static uint8_t *
+cru_qoi_image_map_pixels(cru_image_t *image, uint32_t access_mask)
+{
+    cru_qoi_image_t *qoi_image = (cru_qoi_image_t *) image;
+
+    if (access_mask & CRU_IMAGE_MAP_ACCESS_WRITE) {
+        loge("cannot map read-only image for writing");
+        return NULL;
+    }
+
+    return qoi_image->pixels;
+}
+
+static bool
+cru_qoi_image_unmap_pixels(cru_image_t *image)
+{
+    return true;
+}
+
+cru_image_t *
+cru_qoi_image_load_file(const char *filename)
+{
+    cru_qoi_image_t *qoi_image = NULL;
+    uint8_t *data = NULL;
+    struct stat st;
+    FILE *f = NULL;
+
+    char *abspath = cru_image_get_abspath(filename);
+    if (!abspath)
+        return NULL;
+
+    f = fopen(abspath, "rb");
+    if (!f) {
+        loge("failed to open file for reading: %s", abspath);
+        goto fail;
+    }
+
+    if (fstat(fileno(f), &st) == -1 ||
+        (size_t) st.st_size < QOI_HEADER_SIZE + sizeof(qoi_end_marker)) {
+        loge("failed to read QOI file: %s", abspath);
+        goto fail;
+    }
+
+    data = xmalloc(st.st_size);
+    if (fread(data, 1, st.st_size, f) != (size_t) st.st_size) {
+        loge("failed to read QOI file: %s", abspath);
+        goto fail;
+    }
+
+    const uint32_t width = get_u32_be(data + 4);
+    const uint32_t height = get_u32_be(data + 8);
+    const uint8_t channels = data[12];
+    size_t size = st.st_size;
+    size_t pixels_size;
+
+    if (memcmp(data, "qoif", 4) != 0 || (channels != 3 && channels != 4) ||
+        width == 0 || height == 0 ||
+        (uint64_t) width * height > QOI_PIXELS_MAX ||
+        !cru_mul_size_checked(&pixels_size, 4, (size_t) width * height)) {
+        loge("invalid QOI header in %s", abspath);
+        goto fail;
+    }
+
+    // Only Crucible's own R8 images are decoded as R8. Any other 3-channel
+    // file is RGB, and is decoded as RGBA8 to keep G and B.
+    const bool is_r8 = channels == 3 &&
+        size >= QOI_HEADER_SIZE + sizeof(qoi_end_marker) +
+                sizeof(qoi_r8_tag) &&
+        memcmp(data + size - sizeof(qoi_r8_tag), qoi_r8_tag,
+               sizeof(qoi_r8_tag)) == 0;
+
+    if (is_r8)
+        size -= sizeof(qoi_r8_tag);
+
+    const VkFormat format = is_r8 ? VK_FORMAT_R8_UNORM
+                                  : VK_FORMAT_R8G8B8A8_UNORM;
+    const uint32_t cpp = is_r8 ? 1 : 4;
+
+    qoi_image = xzalloc(sizeof(*qoi_image));
+    if (!cru_image_init(&qoi_image->image, CRU_IMAGE_TYPE_QOI, format,
+                        width, height, /*read_only*/ true))
+        goto fail;
+
+    qoi_image->image.destroy = cru_qoi_image_destroy;
+    qoi_image->image.map_pixels = cru_qoi_image_map_pixels;
+    qoi_image->image.unmap_pixels = cru_qoi_image_unmap_pixels;
+    qoi_image->pixels = xmalloc((size_t) cpp * width * height);
+
+    if (!qoi_decode(qoi_image->pixels, cpp, data, size,
+                    (size_t) width * height)) {
+        loge("truncated QOI file: %s", abspath);
+        goto fail;
+    }
+
+    fclose(f);
+    free(data);
+    free(abspath);
+
+    return &qoi_image->image;
+
+fail:
+    if (qoi_image) {
+        free(qoi_image->pixels);
+        free(qoi_image);
+    }
+    if (f)
+        fclose(f);
+    free(data);
+    free(abspath);
+
+    return NULL;
+}
@@ -0,0 +1,271 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+/// \file
+/// \brief Scaled copies of image files, generated in memory.
+///
+/// cru_image_from_filename_scaled() decodes each file once per process and
+/// derives smaller extents from it with a box filter. Each extent has a fixed
+/// parent, so its pixels don't depend on the order in which extents are
+/// requested: the parent is the extent twice as large in each dimension that
+/// still divides the file's extent, or the file itself. For power-of-two
+/// extents this builds an ordinary mip chain.
+///
+/// The cache lives until the process exits.
+
+#include <pthread.h>
+#include <string.h>
+
+#include "util/cru_vec.h"
+#include "util/log.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+#include "cru_image.h"
+
+struct scaled_image {
+    char *filename;
+    VkFormat format;
+    uint32_t cpp;
+    uint32_t width;
+    uint32_t height;
+    bool is_file;
+
+    /// Tightly packed.
+    uint8_t *pixels;
+};
+
+typedef struct scaled_image_vec scaled_image_vec_t;
+CRU_VEC_DEFINE(struct scaled_image_vec, struct scaled_image)
+
+static struct {
+    pthread_mutex_t mutex;
+    scaled_image_vec_t images;
+} cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .images = CRU_VEC_INIT,
+};
+
+/// Average each 2x2 block of 8-bit channels. This is the hot loop of every
+/// mip chain, kept simple so that the compiler vectorizes it.
+static void
+downsample_2x2(uint8_t *restrict dst, const uint8_t *restrict src,
+               uint32_t cpp, uint32_t dst_width, uint32_t dst_height)
+{
+    const size_t src_stride = (size_t) 2 * dst_width * cpp;
+    const size_t dst_stride = (size_t) dst_width * cpp;
+
+    for (uint32_t y = 0; y < dst_height; y++) {
+        const uint8_t *restrict row0 = src + 2 * y * src_stride;
+        const uint8_t *restrict row1 = row0 + src_stride;
+        uint8_t *restrict out = dst + y * dst_stride;
+
+        for (uint32_t x = 0; x < dst_width; x++) {
+            for (uint32_t c = 0; c < cpp; c++) {
+                const size_t i = 2 * x * cpp + c;
+                out[x * cpp + c] = (row0[i] + row0[i + cpp] +
+                                    row1[i] + row1[i + cpp] + 2) >> 2;
+            }
+        }
+    }
+}
+
+/// Average each block of 8-bit channels, for any integer scale factors.
+static void
+downsample_box(uint8_t *restrict dst, const uint8_t *restrict src,
+               uint32_t cpp, uint32_t src_width,
+               uint32_t dst_width, uint32_t dst_height,
+               uint32_t scale_x, uint32_t scale_y)
+{
+    const size_t src_stride = (size_t) src_width * cpp;
+    const uint32_t n = scale_x * scale_y;
+
+    for (uint32_t y = 0; y < dst_height; y++) {
+        for (uint32_t x = 0; x < dst_width; x++) {
+            for (uint32_t c = 0; c < cpp; c++) {
+                uint32_t sum = 0;
+
+                for (uint32_t j = 0; j < scale_y; j++) {
+                    const uint8_t *row = src + (y * scale_y + j) * src_stride;
+                    for (uint32_t i = 0; i < scale_x; i++)
+                        sum += row[(x * scale_x + i) * cpp + c];
+                }
+
+                dst[(y * dst_width + x) * cpp + c] = (sum + n / 2) / n;
+            }
+        }
+    }
+}
+
+static bool
+find_locked(const char *filename, bool is_file, uint32_t width,
+            uint32_t height, struct scaled_image *out)
+{
+    struct scaled_image *s;
+
+    cru_vec_foreach(s, &cache.images) {
+        if (s->is_file == is_file && cru_streq(s->filename, filename) &&
+            (is_file || (s->width == width && s->height == height))) {
+            *out = *s;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Decode the file into the cache.
+static bool
+load_file_locked(const char *filename, struct scaled_image *out)
+{
+    if (find_locked(filename, true, 0, 0, out))
+        return true;
+
+    cru_image_t *image = cru_image_from_filename(filename);
+    if (!image)
+        return false;
+
+    const cru_format_info_t *info = image->format_info;
+    const uint32_t width = image->width;
+    const uint32_t height = image->height;
+
+    if (info->cpp != info->num_channels || info->is_packed ||
+        (info->num_type != CRU_NUM_TYPE_UNORM &&
+         info->num_type != CRU_NUM_TYPE_UINT)) {
+        loge("%s: cannot scale images of format %s", filename, info->name);
+        cru_image_release(image);
+        return false;
+    }
+
+    uint8_t *pixels = xmalloc((size_t) info->cpp * width * height);
+    cru_image_t *dest = cru_image_from_pixels(pixels, info->format,
+                                              width, height);
+    bool ok = dest && cru_image_copy(dest, image);
+
+    cru_image_release(dest);
+    cru_image_release(image);
+
+    if (!ok) {
+        free(pixels);
+        return false;
+    }
+
+    *out = (struct scaled_image) {
+        .filename = xstrdup(filename),
+        .format = info->format,
+        .cpp = info->cpp,
+        .width = width,
+        .height = height,
+        .is_file = true,
+        .pixels = pixels,
+    };
+    *cru_vec_push(&cache.images, 1) = *out;
+
+    return true;
+}
+
+static bool
+get_scaled_locked(const char *filename, uint32_t width, uint32_t height,
+                  struct scaled_image *out)
+{
+    struct scaled_image file, parent;
+
+    if (!load_file_locked(filename, &file))
+        return false;
+
+    if (width == file.width && height == file.height) {
+        *out = file;
+        return true;
+    }
+
+    if (width == 0 || height == 0 ||
+        file.width % width != 0 || file.height % height != 0) {
+        loge("%s: cannot scale %ux%u image to %ux%u", filename,
+             file.width, file.height, width, height);
+        return false;
+    }
+
+    if (find_locked(filename, false, width, height, out))
+        return true;
+
+    uint32_t parent_width = width;
+    uint32_t parent_height = height;
+
+    if (file.width % (2 * width) == 0)
+        parent_width = 2 * width;
+    if (file.height % (2 * height) == 0)
+        parent_height = 2 * height;
+
+    if (parent_width == width && parent_height == height) {
+        parent = file;
+    } else if (!get_scaled_locked(filename, parent_width, parent_height,
+                                  &parent)) {
+        return false;
+    }
+
+    const uint32_t scale_x = parent.width / width;
+    const uint32_t scale_y = parent.height / height;
+    uint8_t *pixels = xmalloc((size_t) file.cpp * width * height);
+
+    if (scale_x == 2 && scale_y == 2) {
+        downsample_2x2(pixels, parent.pixels, file.cpp, width, height);
+    } else {
+        downsample_box(pixels, parent.pixels, file.cpp, parent.width,
+                       width, height, scale_x, scale_y);
+    }
+
+    *out = (struct scaled_image) {
+        .filename = xstrdup(filename),
+        .format = file.format,
+        .cpp = file.cpp,
+        .width = width,
+        .height = height,
+        .pixels = pixels,
+    };
+    *cru_vec_push(&cache.images, 1) = *out;
+
+    return true;
+}
+
+cru_image_t *
+cru_image_from_filename_scaled(const char *filename, uint32_t width,
+                               uint32_t height)
+{
+    struct scaled_image s;
+    bool ok;
+
+    pthread_mutex_lock(&cache.mutex);
+    ok = get_scaled_locked(filename, width, height, &s);
+    pthread_mutex_unlock(&cache.mutex);
+
+    if (!ok)
+        return NULL;
+
+    cru_image_t *image = cru_image_from_pixels(s.pixels, s.format,
+                                               s.width, s.height);
+    if (!image)
+        return NULL;
+
+    // The pixels are shared by every image of this extent.
+    image->read_only = true;
+
+    return image;
+}
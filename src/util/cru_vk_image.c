@@ -19,6 +19,7 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <pthread.h>
 #include <stdlib.h>
 
 #include "qonos/qonos.h"
@@ -26,22 +27,54 @@
 #include "util/xalloc.h"
 #include "util/misc.h"
 #include "util/log.h"
+#include "util/cru_refcount.h"
 
 #include "cru_image.h"
 
 typedef struct cru_vk_image cru_vk_image_t;
+typedef struct cru_vk_staging cru_vk_staging_t;
+
+/// Staging buffers are rounded up to a power of two no smaller than this, so
+/// that images of similar size share pool entries.
+#define STAGING_MIN_SIZE (64 * 1024)
+
+/// Maximum number of idle staging buffers kept by a context.
+#define STAGING_MAX_FREE 8
 
 enum copy_direction {
     COPY_IMAGE_TO_BUFFER,
     COPY_BUFFER_TO_IMAGE,
 };
 
-struct cru_vk_image {
-    cru_image_t cru_image;
+struct cru_vk_staging {
+    VkBuffer vk_buffer;
+    VkDeviceMemory vk_mem;
+    VkDeviceSize size;
+    void *pixels;
+    bool coherent;
+
+    cru_vk_staging_t *next;
+};
+
+struct cru_vk_image_context {
+    cru_refcount_t refcount;
+    pthread_mutex_t mutex;
 
     VkDevice vk_dev;
     VkQueue vk_queue;
-    VkMemoryPropertyFlags vk_tmp_mem_props;
+    VkCommandPool vk_cmd_pool;
+    VkCommandBuffer vk_cmd;
+    VkFence vk_fence;
+
+    /// Idle staging buffers, sorted by ascending size.
+    cru_vk_staging_t *free_staging;
+    uint32_t num_free_staging;
+};
+
+struct cru_vk_image {
+    cru_image_t cru_image;
+
+    cru_vk_image_context_t *ctx;
 
     struct {
         VkImage vk_image;
@@ -50,67 +83,107 @@ struct cru_vk_image {
         uint32_t array_slice;
     } target;
 
-
     struct {
-        VkBuffer vk_buffer;
-        VkDeviceMemory vk_mem;
-        void *pixels;
+        cru_vk_staging_t *staging;
         uint32_t access; ///< Mask of CRU_IMAGE_MAP_ACCESS_* .
+
+        /// Set by cru_vk_image_prefetch(). The staging buffer already holds
+        /// the image's contents, so the next read mapping needs no copy.
+        bool prefetched;
     } map;
+
+    /// State for read_rows(). While the caller reads the band in one slot,
+    /// the GPU copies the next band into the other.
+    struct {
+        struct cru_vk_stream_slot {
+            cru_vk_staging_t *staging;
+            VkCommandBuffer vk_cmd;
+            VkFence vk_fence;
+            uint32_t y;
+            uint32_t height;
+            bool pending;
+        } slots[2];
+
+        /// Index of the slot returned by the last read_rows().
+        uint32_t current;
+    } stream;
 };
 
 static void
-cleanup_map(cru_vk_image_t *self)
+destroy_staging(VkDevice dev, cru_vk_staging_t *s)
 {
-    if (self->map.pixels)
-        vkUnmapMemory(self->vk_dev, self->map.vk_mem);
-    if (self->map.vk_mem != VK_NULL_HANDLE)
-        vkFreeMemory(self->vk_dev, self->map.vk_mem, NULL);
-    if (self->map.vk_buffer != VK_NULL_HANDLE)
-        vkDestroyBuffer(self->vk_dev, self->map.vk_buffer, NULL);
-
-    self->map = (typeof(self->map)) {0};
+    if (!s)
+        return;
+
+    if (s->pixels)
+        vkUnmapMemory(dev, s->vk_mem);
+    if (s->vk_mem != VK_NULL_HANDLE)
+        vkFreeMemory(dev, s->vk_mem, NULL);
+    if (s->vk_buffer != VK_NULL_HANDLE)
+        vkDestroyBuffer(dev, s->vk_buffer, NULL);
+
+    free(s);
 }
 
-/// Setup cru_vk_image::map.
-static VkResult
-setup_map(cru_vk_image_t *self)
+/// Choose a host-visible memory type for a staging buffer. Readback is the
+/// common case, so prefer cached memory, which is much faster for the CPU to
+/// read than the uncached write-combined memory that is often the only
+/// coherent type.
+static uint32_t
+choose_staging_mem_type(uint32_t type_bits, bool *coherent)
 {
-    VkDevice dev = self->vk_dev;
-    VkResult r = VK_SUCCESS;
+    static const VkMemoryPropertyFlags prefs[] = {
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
 
-    if (self->map.pixels)
-        return VK_SUCCESS;
+    const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
+
+    for (uint32_t p = 0; p < ARRAY_LENGTH(prefs); p++) {
+        for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+            const VkMemoryType *type = &props->memoryTypes[i];
+            if ((type_bits & (1 << i)) &&
+                (type->propertyFlags & prefs[p]) == prefs[p]) {
+                *coherent = type->propertyFlags &
+                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+                return i;
+            }
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+static cru_vk_staging_t *
+create_staging(VkDevice dev, VkDeviceSize min_size)
+{
+    cru_vk_staging_t *s = xzalloc(sizeof(*s));
+    VkResult r;
 
-    const size_t buffer_size = self->cru_image.format_info->cpp *
-                               self->cru_image.width *
-                               self->cru_image.height;
+    s->size = STAGING_MIN_SIZE;
+    while (s->size < min_size)
+        s->size *= 2;
 
     r = vkCreateBuffer(dev, &(VkBufferCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = buffer_size,
+            .size = s->size,
             .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         },
         NULL,
-        &self->map.vk_buffer);
+        &s->vk_buffer);
     if (r != VK_SUCCESS)
         goto fail;
 
     VkMemoryRequirements mem_reqs;
-    vkGetBufferMemoryRequirements(dev, self->map.vk_buffer, &mem_reqs);
+    vkGetBufferMemoryRequirements(dev, s->vk_buffer, &mem_reqs);
 
-    uint32_t type_index = UINT32_MAX;
-    const VkPhysicalDeviceMemoryProperties *props = t_physical_dev_mem_props;
-    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
-        const VkMemoryType *type = &props->memoryTypes[i];
-        if ((mem_reqs.memoryTypeBits & (1 << i)) &&
-            (type->propertyFlags & self->vk_tmp_mem_props) == self->vk_tmp_mem_props) {
-            type_index = i;
-            break;
-        }
-    }
-    assert(type_index < props->memoryTypeCount);
+    uint32_t type_index = choose_staging_mem_type(mem_reqs.memoryTypeBits,
+                                                  &s->coherent);
+    if (type_index == UINT32_MAX)
+        goto fail;
 
     r = vkAllocateMemory(dev, &(VkMemoryAllocateInfo) {
             .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
@@ -118,56 +191,167 @@ setup_map(cru_vk_image_t *self)
             .memoryTypeIndex = type_index,
         },
         NULL,
-        &self->map.vk_mem);
+        &s->vk_mem);
     if (r != VK_SUCCESS)
         goto fail;
 
-    r = vkBindBufferMemory(dev, self->map.vk_buffer, self->map.vk_mem, 0);
+    r = vkBindBufferMemory(dev, s->vk_buffer, s->vk_mem, 0);
     if (r != VK_SUCCESS)
         goto fail;
 
-    r = vkMapMemory(dev, self->map.vk_mem, /*offset*/ 0, buffer_size,
-                    /*flags*/ 0, &self->map.pixels);
+    r = vkMapMemory(dev, s->vk_mem, /*offset*/ 0, VK_WHOLE_SIZE,
+                    /*flags*/ 0, &s->pixels);
     if (r != VK_SUCCESS)
         goto fail;
 
-    return VK_SUCCESS;
+    return s;
 
 fail:
-    cleanup_map(self);
-    return r;
+    destroy_staging(dev, s);
+    return NULL;
 }
 
-static VkResult
-copy(cru_vk_image_t *self, enum copy_direction dir)
+/// Take the smallest idle staging buffer that holds \a size bytes, or create
+/// a new one. The context's mutex must be held.
+static cru_vk_staging_t *
+acquire_staging(cru_vk_image_context_t *ctx, VkDeviceSize size)
 {
-    VkDevice dev = self->vk_dev;
-    VkCommandPool cmd_pool = VK_NULL_HANDLE;
-    VkCommandBuffer cmd = VK_NULL_HANDLE;
-    VkFence fence = {0};
-    VkResult r = VK_SUCCESS;
+    for (cru_vk_staging_t **p = &ctx->free_staging; *p; p = &(*p)->next) {
+        cru_vk_staging_t *s = *p;
+        if (s->size >= size) {
+            *p = s->next;
+            s->next = NULL;
+            ctx->num_free_staging--;
+            return s;
+        }
+    }
+
+    return create_staging(ctx->vk_dev, size);
+}
+
+/// Return a staging buffer to the context's pool. The context's mutex must be
+/// held.
+static void
+release_staging(cru_vk_image_context_t *ctx, cru_vk_staging_t *s)
+{
+    if (!s)
+        return;
+
+    if (ctx->num_free_staging >= STAGING_MAX_FREE) {
+        // Evict the smallest buffer; the newcomer is at least as useful.
+        cru_vk_staging_t *smallest = ctx->free_staging;
+        ctx->free_staging = smallest->next;
+        ctx->num_free_staging--;
+        destroy_staging(ctx->vk_dev, smallest);
+    }
+
+    cru_vk_staging_t **p = &ctx->free_staging;
+    while (*p && (*p)->size < s->size)
+        p = &(*p)->next;
+
+    s->next = *p;
+    *p = s;
+    ctx->num_free_staging++;
+}
+
+static void
+context_destroy(cru_vk_image_context_t *ctx)
+{
+    while (ctx->free_staging) {
+        cru_vk_staging_t *s = ctx->free_staging;
+        ctx->free_staging = s->next;
+        destroy_staging(ctx->vk_dev, s);
+    }
+
+    if (ctx->vk_fence != VK_NULL_HANDLE)
+        vkDestroyFence(ctx->vk_dev, ctx->vk_fence, NULL);
+    if (ctx->vk_cmd_pool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(ctx->vk_dev, ctx->vk_cmd_pool, NULL);
+
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx);
+}
+
+malloclike cru_vk_image_context_t *
+cru_vk_image_context_create(VkDevice dev, VkQueue queue,
+                            uint32_t queue_family_index)
+{
+    cru_vk_image_context_t *ctx = xzalloc(sizeof(*ctx));
+    VkResult r;
+
+    cru_refcount_init(&ctx->refcount);
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    ctx->vk_dev = dev;
+    ctx->vk_queue = queue;
 
     r = vkCreateCommandPool(dev, &(VkCommandPoolCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                     VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queue_family_index,
         },
         NULL,
-        &cmd_pool);
+        &ctx->vk_cmd_pool);
+    if (r != VK_SUCCESS)
+        goto fail;
 
     r = vkAllocateCommandBuffers(dev, &(VkCommandBufferAllocateInfo) {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = cmd_pool,
+            .commandPool = ctx->vk_cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
             .commandBufferCount = 1,
         },
-        &cmd);
+        &ctx->vk_cmd);
     if (r != VK_SUCCESS)
-        goto cleanup;
+        goto fail;
 
-    r = vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        });
+    r = vkCreateFence(dev, &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        },
+        NULL,
+        &ctx->vk_fence);
     if (r != VK_SUCCESS)
-        goto cleanup;
+        goto fail;
 
+    return ctx;
+
+fail:
+    context_destroy(ctx);
+    return NULL;
+}
+
+void
+cru_vk_image_context_reference(cru_vk_image_context_t *ctx)
+{
+    cru_refcount_get(&ctx->refcount);
+}
+
+void
+cru_vk_image_context_release(cru_vk_image_context_t *ctx)
+{
+    if (!ctx)
+        return;
+
+    if (cru_refcount_put(&ctx->refcount) > 0)
+        return;
+
+    context_destroy(ctx);
+}
+
+static VkDeviceSize
+image_size(cru_vk_image_t *self)
+{
+    return (VkDeviceSize) self->cru_image.format_info->cpp *
+           self->cru_image.width * self->cru_image.height;
+}
+
+/// Record a copy of rows [y, y + height) between the image and \a buffer,
+/// which holds the rows tightly packed.
+static void
+record_copy(VkCommandBuffer cmd, cru_vk_image_t *self, VkBuffer buffer,
+            uint32_t y, uint32_t height, enum copy_direction dir)
+{
     const VkBufferImageCopy region = {
         .bufferOffset = 0,
         .imageSubresource = {
@@ -176,10 +360,10 @@ copy(cru_vk_image_t *self, enum copy_direction dir)
             .baseArrayLayer = self->target.array_slice,
             .layerCount = 1,
         },
-        .imageOffset = { .x = 0, .y = 0, .z = 0 },
+        .imageOffset = { .x = 0, .y = y, .z = 0 },
         .imageExtent = {
             .width = self->cru_image.width,
-            .height = self->cru_image.height,
+            .height = height,
             .depth = 1,
         },
     };
@@ -187,95 +371,428 @@ copy(cru_vk_image_t *self, enum copy_direction dir)
     switch (dir) {
     case COPY_IMAGE_TO_BUFFER:
         vkCmdCopyImageToBuffer(cmd, self->target.vk_image,
-                               VK_IMAGE_LAYOUT_GENERAL, self->map.vk_buffer,
-                               1, &region);
+                               VK_IMAGE_LAYOUT_GENERAL, buffer, 1, &region);
         break;
     case COPY_BUFFER_TO_IMAGE:
-        vkCmdCopyBufferToImage(cmd, self->map.vk_buffer,
-                               self->target.vk_image, VK_IMAGE_LAYOUT_GENERAL,
-                               1, &region);
+        vkCmdCopyBufferToImage(cmd, buffer, self->target.vk_image,
+                               VK_IMAGE_LAYOUT_GENERAL, 1, &region);
         break;
     }
+}
 
-    r = vkEndCommandBuffer(cmd);
+/// Make transfer writes visible to the host.
+static void
+record_host_read_barrier(VkCommandBuffer cmd)
+{
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                         },
+                         0, NULL, 0, NULL);
+}
+
+static VkResult
+invalidate_staging(VkDevice dev, cru_vk_staging_t *s)
+{
+    if (s->coherent)
+        return VK_SUCCESS;
+
+    return vkInvalidateMappedMemoryRanges(dev, 1, &(VkMappedMemoryRange) {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = s->vk_mem,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        });
+}
+
+/// Copy between each image and its staging buffer, in one submission on the
+/// context's queue. All images must share the context, whose mutex must be
+/// held, and must already own a staging buffer.
+static VkResult
+copy_locked(cru_vk_image_context_t *ctx, cru_vk_image_t *const images[],
+            uint32_t count, enum copy_direction dir)
+{
+    VkDevice dev = ctx->vk_dev;
+    VkCommandBuffer cmd = ctx->vk_cmd;
+    VkResult r;
+
+    if (dir == COPY_BUFFER_TO_IMAGE) {
+        for (uint32_t i = 0; i < count; i++) {
+            cru_vk_staging_t *s = images[i]->map.staging;
+            if (s->coherent)
+                continue;
+
+            r = vkFlushMappedMemoryRanges(dev, 1, &(VkMappedMemoryRange) {
+                    .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                    .memory = s->vk_mem,
+                    .offset = 0,
+                    .size = VK_WHOLE_SIZE,
+                });
+            if (r != VK_SUCCESS)
+                return r;
+        }
+    }
+
+    r = vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        });
     if (r != VK_SUCCESS)
-        goto cleanup;
+        return r;
 
-    r = vkCreateFence(dev, &(VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        },
-        NULL,
-        &fence);
+    for (uint32_t i = 0; i < count; i++) {
+        cru_vk_image_t *img = images[i];
+        record_copy(cmd, img, img->map.staging->vk_buffer,
+                    0, img->cru_image.height, dir);
+    }
+
+    if (dir == COPY_IMAGE_TO_BUFFER)
+        record_host_read_barrier(cmd);
+
+    r = vkEndCommandBuffer(cmd);
     if (r != VK_SUCCESS)
-        goto cleanup;
+        return r;
 
-    r = vkQueueSubmit(self->vk_queue, 1,
+    r = vkQueueSubmit(ctx->vk_queue, 1,
         &(VkSubmitInfo) {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .commandBufferCount = 1,
             .pCommandBuffers = &cmd,
-        }, fence);
+        }, ctx->vk_fence);
     if (r != VK_SUCCESS)
-        goto cleanup;
+        return r;
 
-    r = vkWaitForFences(dev, 1, &fence, true, /*timeout*/ UINT64_MAX);
+    r = vkWaitForFences(dev, 1, &ctx->vk_fence, true, /*timeout*/ UINT64_MAX);
     if (r != VK_SUCCESS) {
         if (r == VK_TIMEOUT)
             logw("vkWaitForFences timed out!");
-        goto cleanup;
+        return r;
     }
 
-cleanup:
-    if (fence != VK_NULL_HANDLE)
-        vkDestroyFence(dev, fence, NULL);
-    if (cmd)
-        vkFreeCommandBuffers(dev, cmd_pool, 1, &cmd);
-    if (cmd_pool)
-        vkDestroyCommandPool(dev, cmd_pool, NULL);
+    r = vkResetFences(dev, 1, &ctx->vk_fence);
+    if (r != VK_SUCCESS)
+        return r;
 
-    return r;
+    if (dir == COPY_IMAGE_TO_BUFFER) {
+        for (uint32_t i = 0; i < count; i++) {
+            r = invalidate_staging(dev, images[i]->map.staging);
+            if (r != VK_SUCCESS)
+                return r;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+static void
+put_staging_locked(cru_vk_image_t *self)
+{
+    release_staging(self->ctx, self->map.staging);
+    self->map.staging = NULL;
+    self->map.prefetched = false;
 }
 
 static uint8_t *
 map_pixels(cru_image_t *_self, uint32_t access)
 {
     cru_vk_image_t *self = (cru_vk_image_t *) _self;
+    cru_vk_image_context_t *ctx = self->ctx;
+    uint8_t *pixels = NULL;
 
     assert(!self->map.access);
 
-    if (setup_map(self) != VK_SUCCESS)
-        return NULL;
+    pthread_mutex_lock(&ctx->mutex);
 
-    if (access & CRU_IMAGE_MAP_ACCESS_READ) {
-        if (copy(self, COPY_IMAGE_TO_BUFFER) != VK_SUCCESS)
-            return NULL;
+    if (!self->map.staging) {
+        self->map.staging = acquire_staging(ctx, image_size(self));
+        if (!self->map.staging)
+            goto done;
+    }
+
+    if ((access & CRU_IMAGE_MAP_ACCESS_READ) && !self->map.prefetched) {
+        if (copy_locked(ctx, &self, 1, COPY_IMAGE_TO_BUFFER) != VK_SUCCESS) {
+            put_staging_locked(self);
+            goto done;
+        }
     }
 
     self->map.access = access;
+    pixels = self->map.staging->pixels;
 
-    return self->map.pixels;
+done:
+    pthread_mutex_unlock(&ctx->mutex);
+    return pixels;
 }
 
 static bool
 unmap_pixels(cru_image_t *_self)
 {
     cru_vk_image_t *self = (cru_vk_image_t *) _self;
+    cru_vk_image_context_t *ctx = self->ctx;
     bool r = false;
 
     assert(self->map.access);
 
+    pthread_mutex_lock(&ctx->mutex);
+
     if (self->map.access & CRU_IMAGE_MAP_ACCESS_WRITE) {
-        if (copy(self, COPY_BUFFER_TO_IMAGE) != VK_SUCCESS)
+        if (copy_locked(ctx, &self, 1, COPY_BUFFER_TO_IMAGE) != VK_SUCCESS)
             goto done;
     }
 
     r = true;
 
 done:
+    // The image may change on the GPU before the next mapping, so the
+    // staging copy can't be trusted any longer.
+    put_staging_locked(self);
     self->map.access = 0;
+
+    pthread_mutex_unlock(&ctx->mutex);
     return r;
 }
 
+bool
+cru_vk_image_prefetch(cru_image_t *const images[], uint32_t count)
+{
+    if (count == 0)
+        return true;
+
+    cru_vk_image_t *batch[count];
+    cru_vk_image_context_t *ctx = NULL;
+    uint32_t n = 0;
+    bool ok = false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!images[i] || images[i]->type != CRU_IMAGE_TYPE_VULKAN)
+            continue;
+
+        cru_vk_image_t *img = (cru_vk_image_t *) images[i];
+        if (img->map.access || img->map.prefetched)
+            continue;
+
+        if (ctx == NULL) {
+            ctx = img->ctx;
+        } else if (img->ctx != ctx) {
+            loge("%s: images do not share a context", __func__);
+            return false;
+        }
+
+        batch[n++] = img;
+    }
+
+    if (n == 0)
+        return true;
+
+    pthread_mutex_lock(&ctx->mutex);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (!batch[i]->map.staging) {
+            batch[i]->map.staging = acquire_staging(ctx, image_size(batch[i]));
+            if (!batch[i]->map.staging)
+                goto fail;
+        }
+    }
+
+    if (copy_locked(ctx, batch, n, COPY_IMAGE_TO_BUFFER) != VK_SUCCESS)
+        goto fail;
+
+    for (uint32_t i = 0; i < n; i++)
+        batch[i]->map.prefetched = true;
+
+    ok = true;
+    goto done;
+
+fail:
+    for (uint32_t i = 0; i < n; i++)
+        put_staging_locked(batch[i]);
+
+done:
+    pthread_mutex_unlock(&ctx->mutex);
+    return ok;
+}
+
+/// Submit a copy of rows [y, y + height) into the stream slot.
+static VkResult
+submit_band(cru_vk_image_t *self, struct cru_vk_stream_slot *slot,
+            uint32_t y, uint32_t height)
+{
+    cru_vk_image_context_t *ctx = self->ctx;
+    VkDevice dev = ctx->vk_dev;
+    const VkDeviceSize size = (VkDeviceSize) self->cru_image.format_info->cpp *
+                              self->cru_image.width * height;
+    VkResult r;
+
+    assert(!slot->pending);
+
+    pthread_mutex_lock(&ctx->mutex);
+
+    if (slot->staging && slot->staging->size < size) {
+        release_staging(ctx, slot->staging);
+        slot->staging = NULL;
+    }
+
+    if (!slot->staging) {
+        slot->staging = acquire_staging(ctx, size);
+        if (!slot->staging) {
+            r = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+            goto done;
+        }
+    }
+
+    if (slot->vk_cmd == VK_NULL_HANDLE) {
+        r = vkAllocateCommandBuffers(dev, &(VkCommandBufferAllocateInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = ctx->vk_cmd_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+            },
+            &slot->vk_cmd);
+        if (r != VK_SUCCESS)
+            goto done;
+    }
+
+    if (slot->vk_fence == VK_NULL_HANDLE) {
+        r = vkCreateFence(dev, &(VkFenceCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            },
+            NULL,
+            &slot->vk_fence);
+        if (r != VK_SUCCESS)
+            goto done;
+    }
+
+    r = vkBeginCommandBuffer(slot->vk_cmd, &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        });
+    if (r != VK_SUCCESS)
+        goto done;
+
+    record_copy(slot->vk_cmd, self, slot->staging->vk_buffer, y, height,
+                COPY_IMAGE_TO_BUFFER);
+    record_host_read_barrier(slot->vk_cmd);
+
+    r = vkEndCommandBuffer(slot->vk_cmd);
+    if (r != VK_SUCCESS)
+        goto done;
+
+    r = vkQueueSubmit(ctx->vk_queue, 1,
+        &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &slot->vk_cmd,
+        }, slot->vk_fence);
+    if (r != VK_SUCCESS)
+        goto done;
+
+    slot->y = y;
+    slot->height = height;
+    slot->pending = true;
+
+done:
+    pthread_mutex_unlock(&ctx->mutex);
+    return r;
+}
+
+static VkResult
+wait_band(cru_vk_image_t *self, struct cru_vk_stream_slot *slot)
+{
+    VkDevice dev = self->ctx->vk_dev;
+    VkResult r;
+
+    if (!slot->pending)
+        return VK_SUCCESS;
+
+    slot->pending = false;
+
+    r = vkWaitForFences(dev, 1, &slot->vk_fence, true, /*timeout*/ UINT64_MAX);
+    if (r != VK_SUCCESS) {
+        if (r == VK_TIMEOUT)
+            logw("vkWaitForFences timed out!");
+        return r;
+    }
+
+    r = vkResetFences(dev, 1, &slot->vk_fence);
+    if (r != VK_SUCCESS)
+        return r;
+
+    return invalidate_staging(dev, slot->staging);
+}
+
+static const uint8_t *
+read_rows(cru_image_t *_self, uint32_t y, uint32_t height)
+{
+    cru_vk_image_t *self = (cru_vk_image_t *) _self;
+    const uint32_t row_size = self->cru_image.format_info->cpp *
+                              self->cru_image.width;
+
+    assert(y + height <= self->cru_image.height);
+    assert(!self->map.access);
+
+    if (self->map.prefetched)
+        return (const uint8_t *) self->map.staging->pixels + y * row_size;
+
+    // Use the band that the previous call started copying, if it is the one
+    // requested.
+    uint32_t cur = !self->stream.current;
+    struct cru_vk_stream_slot *slot = &self->stream.slots[cur];
+
+    if (!slot->pending || slot->y != y || slot->height != height) {
+        if (wait_band(self, slot) != VK_SUCCESS)
+            return NULL;
+        if (submit_band(self, slot, y, height) != VK_SUCCESS)
+            return NULL;
+    }
+
+    if (wait_band(self, slot) != VK_SUCCESS)
+        return NULL;
+
+    self->stream.current = cur;
+
+    // Start copying the next band while the caller reads this one.
+    const uint32_t next_y = y + height;
+    if (next_y < self->cru_image.height) {
+        struct cru_vk_stream_slot *next = &self->stream.slots[!cur];
+        if (wait_band(self, next) == VK_SUCCESS) {
+            submit_band(self, next, next_y,
+                        MIN(height, self->cru_image.height - next_y));
+        }
+    }
+
+    return slot->staging->pixels;
+}
+
+static void
+end_read_rows(cru_image_t *_self)
+{
+    cru_vk_image_t *self = (cru_vk_image_t *) _self;
+    cru_vk_image_context_t *ctx = self->ctx;
+
+    for (uint32_t i = 0; i < ARRAY_LENGTH(self->stream.slots); i++)
+        wait_band(self, &self->stream.slots[i]);
+
+    pthread_mutex_lock(&ctx->mutex);
+
+    for (uint32_t i = 0; i < ARRAY_LENGTH(self->stream.slots); i++) {
+        struct cru_vk_stream_slot *slot = &self->stream.slots[i];
+
+        release_staging(ctx, slot->staging);
+        if (slot->vk_cmd != VK_NULL_HANDLE)
+            vkFreeCommandBuffers(ctx->vk_dev, ctx->vk_cmd_pool,
+                                 1, &slot->vk_cmd);
+        if (slot->vk_fence != VK_NULL_HANDLE)
+            vkDestroyFence(ctx->vk_dev, slot->vk_fence, NULL);
+    }
+
+    pthread_mutex_unlock(&ctx->mutex);
+
+    self->stream = (typeof(self->stream)) {0};
+}
+
 static void
 destroy(cru_image_t *_self)
 {
@@ -283,17 +800,26 @@ destroy(cru_image_t *_self)
         return;
 
     cru_vk_image_t *self = (cru_vk_image_t *) _self;
+    cru_vk_image_context_t *ctx = self->ctx;
+
+    if (ctx) {
+        end_read_rows(_self);
+
+        pthread_mutex_lock(&ctx->mutex);
+        put_staging_locked(self);
+        pthread_mutex_unlock(&ctx->mutex);
+
+        cru_vk_image_context_release(ctx);
+    }
 
-    cleanup_map(self);
     free(self);
 }
 
 malloclike cru_image_t *
-cru_image_from_vk_image(VkDevice dev, VkQueue queue, VkImage image,
+cru_image_from_vk_image(cru_vk_image_context_t *ctx, VkImage image,
                         VkFormat format, VkImageAspectFlagBits aspect,
                         uint32_t level0_width, uint32_t level0_height,
-                        uint32_t miplevel, uint32_t array_slice,
-                        VkMemoryPropertyFlags tmp_mem_props)
+                        uint32_t miplevel, uint32_t array_slice)
 {
     cru_vk_image_t *self = xzalloc(sizeof(*self));
 
@@ -304,9 +830,8 @@ cru_image_from_vk_image(VkDevice dev, VkQueue queue, VkImage image,
         goto fail;
     }
 
-    self->vk_dev = dev;
-    self->vk_queue = queue;
-    self->vk_tmp_mem_props = tmp_mem_props;
+    cru_vk_image_context_reference(ctx);
+    self->ctx = ctx;
     self->target.vk_image = image;
     self->target.vk_aspect = aspect;
     self->target.miplevel = miplevel;
@@ -315,6 +840,8 @@ cru_image_from_vk_image(VkDevice dev, VkQueue queue, VkImage image,
     self->cru_image.destroy = destroy;
     self->cru_image.map_pixels = map_pixels;
     self->cru_image.unmap_pixels = unmap_pixels;
+    self->cru_image.read_rows = read_rows;
+    self->cru_image.end_read_rows = end_read_rows;
 
     return &self->cru_image;
 
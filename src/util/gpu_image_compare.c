@@ -0,0 +1,360 @@
+// Copyright 2021 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice (including the next
+// paragraph) shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <string.h>
+
+#include "util/cru_format.h"
+#include "util/gpu_image_compare.h"
+#include "util/misc.h"
+#include "util/xalloc.h"
+
+#include "tapi/t.h"
+
+#include "src/util/gpu_image_compare-spirv.h"
+
+struct push_constants {
+    uint32_t width;
+    uint32_t height;
+    uint32_t cpp;
+    uint32_t tolerance;
+};
+
+struct summary {
+    uint32_t mismatch_count;
+    uint32_t max_error;
+    uint32_t min_x;
+    uint32_t min_y;
+    uint32_t max_x;
+    uint32_t max_y;
+};
+
+enum {
+    BINDING_ACTUAL,
+    BINDING_REF,
+    BINDING_SUMMARY,
+    BINDING_MASK,
+    NUM_BINDINGS,
+};
+
+bool
+gpu_image_compare_supports_format(VkFormat format)
+{
+    const cru_format_info_t *info = cru_format_get_info(format);
+
+    // The shader compares each pixel as one or four bytes.
+    return info && (info->cpp == 1 || info->cpp == 4) &&
+           info->num_channels == info->cpp && !info->is_packed &&
+           info->channels[0].bits == 8;
+}
+
+static VkBuffer
+create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+              VkMemoryPropertyFlags properties, VkDeviceMemory *mem)
+{
+    VkBuffer buffer = qoCreateBuffer(t_device, .size = size, .usage = usage);
+
+    *mem = qoAllocBufferMemory(t_device, buffer, .properties = properties);
+    qoBindBufferMemory(t_device, buffer, *mem, 0);
+
+    return buffer;
+}
+
+bool
+gpu_image_compare(VkImage image, VkFormat format,
+                  VkImageAspectFlagBits aspect,
+                  uint32_t width, uint32_t height,
+                  cru_image_t *ref, uint32_t tolerance,
+                  gpu_image_compare_result_t *result)
+{
+    if (!gpu_image_compare_supports_format(format))
+        return false;
+
+    if (cru_image_get_width(ref) != width ||
+        cru_image_get_height(ref) != height)
+        return false;
+
+    const uint32_t cpp = cru_format_get_info(format)->cpp;
+    const size_t num_pixels = (size_t) width * height;
+    const VkDeviceSize pixels_size = cru_align_size(num_pixels * cpp, 4);
+    const VkDeviceSize mask_size = cru_align_size(num_pixels, 4);
+    const VkMemoryPropertyFlags host_props =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    // The actual pixels never leave the device.
+    VkDeviceMemory actual_mem;
+    VkBuffer actual_buf = create_buffer(pixels_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &actual_mem);
+
+    // Upload the reference, converted to the image's format.
+    VkDeviceMemory ref_mem;
+    VkBuffer ref_buf = create_buffer(pixels_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_props, &ref_mem);
+
+    void *ref_map = qoMapMemory(t_device, ref_mem, 0, pixels_size, 0);
+    cru_image_t *ref_copy = cru_image_from_pixels(ref_map, format,
+                                                  width, height);
+    if (!ref_copy)
+        return false;
+
+    bool copied = cru_image_copy(ref_copy, ref);
+    cru_image_release(ref_copy);
+    if (!copied)
+        return false;
+
+    VkDeviceMemory summary_mem;
+    VkBuffer summary_buf = create_buffer(sizeof(struct summary),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_props, &summary_mem);
+
+    struct summary *summary = qoMapMemory(t_device, summary_mem, 0,
+                                          sizeof(*summary), 0);
+    *summary = (struct summary) {
+        .min_x = UINT32_MAX,
+        .min_y = UINT32_MAX,
+    };
+
+    VkDeviceMemory mask_mem;
+    VkBuffer mask_buf = create_buffer(mask_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        host_props, &mask_mem);
+
+    VkShaderModule cs = qoCreateShaderModuleGLSL(t_device, COMPUTE,
+        layout(local_size_x = 8, local_size_y = 8) in;
+
+        layout(push_constant) uniform Params {
+            uint width;
+            uint height;
+            uint cpp;
+            uint tolerance;
+        };
+
+        layout(set = 0, binding = 0, std430) readonly buffer Actual {
+            uint actual[];
+        };
+
+        layout(set = 0, binding = 1, std430) readonly buffer Ref {
+            uint ref[];
+        };
+
+        layout(set = 0, binding = 2, std430) buffer Summary {
+            uint mismatch_count;
+            uint max_error;
+            uint min_x;
+            uint min_y;
+            uint max_x;
+            uint max_y;
+        };
+
+        layout(set = 0, binding = 3, std430) buffer Mask {
+            uint mask[];
+        };
+
+        void main()
+        {
+            uvec2 p = gl_GlobalInvocationID.xy;
+            if (p.x >= width || p.y >= height)
+                return;
+
+            uint i = p.y * width + p.x;
+            uint shift = ((i * cpp) % 4) * 8;
+            uint a = actual[(i * cpp) / 4] >> shift;
+            uint r = ref[(i * cpp) / 4] >> shift;
+
+            uint err = 0u;
+            for (uint c = 0u; c < cpp; c++) {
+                int d = int((a >> (c * 8)) & 0xffu) -
+                        int((r >> (c * 8)) & 0xffu);
+                err = max(err, uint(abs(d)));
+            }
+
+            if (err == 0u)
+                return;
+
+            atomicMax(max_error, err);
+
+            if (err > tolerance) {
+                atomicAdd(mismatch_count, 1u);
+                atomicMin(min_x, p.x);
+                atomicMin(min_y, p.y);
+                atomicMax(max_x, p.x);
+                atomicMax(max_y, p.y);
+                atomicOr(mask[i / 4], 0xffu << ((i % 4) * 8));
+            }
+        }
+    );
+
+    VkDescriptorSetLayoutBinding bindings[NUM_BINDINGS];
+    for (uint32_t i = 0; i < NUM_BINDINGS; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding) {
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    VkDescriptorSetLayout set_layout = qoCreateDescriptorSetLayout(t_device,
+        .bindingCount = NUM_BINDINGS,
+        .pBindings = bindings);
+
+    VkPipelineLayout pipeline_layout = qoCreatePipelineLayout(t_device,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(struct push_constants),
+        });
+
+    VkPipeline pipeline;
+    VkResult res = vkCreateComputePipelines(t_device, t_pipeline_cache, 1,
+        &(VkComputePipelineCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = cs,
+                .pName = "main",
+            },
+            .layout = pipeline_layout,
+        }, NULL, &pipeline);
+    t_assert(res == VK_SUCCESS);
+    t_cleanup_push_vk_pipeline(t_device, pipeline);
+
+    // Use a private pool. The test may have used up t_descriptor_pool.
+    VkDescriptorPool pool;
+    res = vkCreateDescriptorPool(t_device,
+        &(VkDescriptorPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+            .maxSets = 1,
+            .poolSizeCount = 1,
+            .pPoolSizes = &(VkDescriptorPoolSize) {
+                .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = NUM_BINDINGS,
+            },
+        }, NULL, &pool);
+    t_assert(res == VK_SUCCESS);
+    t_cleanup_push_vk_descriptor_pool(t_device, pool);
+
+    VkDescriptorSet set = qoAllocateDescriptorSet(t_device,
+        .descriptorPool = pool,
+        .pSetLayouts = &set_layout);
+
+    const VkBuffer buffers[NUM_BINDINGS] = {
+        [BINDING_ACTUAL] = actual_buf,
+        [BINDING_REF] = ref_buf,
+        [BINDING_SUMMARY] = summary_buf,
+        [BINDING_MASK] = mask_buf,
+    };
+
+    VkDescriptorBufferInfo buffer_infos[NUM_BINDINGS];
+    VkWriteDescriptorSet writes[NUM_BINDINGS];
+    for (uint32_t i = 0; i < NUM_BINDINGS; i++) {
+        buffer_infos[i] = (VkDescriptorBufferInfo) {
+            .buffer = buffers[i],
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+        writes[i] = (VkWriteDescriptorSet) {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[i],
+        };
+    }
+    vkUpdateDescriptorSets(t_device, NUM_BINDINGS, writes, 0, NULL);
+
+    VkCommandBuffer cmd = qoAllocateCommandBuffer(t_device, t_cmd_pool);
+    qoBeginCommandBuffer(cmd);
+
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_GENERAL, actual_buf, 1,
+        &(VkBufferImageCopy) {
+            .imageSubresource = {
+                .aspectMask = aspect,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageExtent = { width, height, 1 },
+        });
+    vkCmdFillBuffer(cmd, mask_buf, 0, VK_WHOLE_SIZE, 0);
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                                             VK_ACCESS_SHADER_WRITE_BIT,
+                         },
+                         0, NULL, 0, NULL);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout, 0, 1, &set, 0, NULL);
+    vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(struct push_constants),
+                       &(struct push_constants) {
+                           .width = width,
+                           .height = height,
+                           .cpp = cpp,
+                           .tolerance = tolerance,
+                       });
+    vkCmdDispatch(cmd, (width + 7) / 8, (height + 7) / 8, 1);
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                         },
+                         0, NULL, 0, NULL);
+
+    qoEndCommandBuffer(cmd);
+    qoQueueSubmit(t_queue, 1, &cmd, VK_NULL_HANDLE);
+    qoQueueWaitIdle(t_queue);
+
+    *result = (gpu_image_compare_result_t) {
+        .mismatch_count = summary->mismatch_count,
+        .max_error = summary->max_error,
+        .min_x = summary->min_x,
+        .min_y = summary->min_y,
+        .max_x = summary->max_x,
+        .max_y = summary->max_y,
+    };
+
+    // Read the mask back only when there is something to show.
+    if (result->mismatch_count > 0) {
+        const uint8_t *mask = qoMapMemory(t_device, mask_mem, 0, mask_size, 0);
+        result->mask = xmalloc(num_pixels);
+        memcpy(result->mask, mask, num_pixels);
+    }
+
+    return true;
+}
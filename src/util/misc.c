@@ -76,6 +76,27 @@ cru_getenv_bool(const char *name, bool default_, bool *result)
     return 0;
 }
 
+/// Parse a whole string as a non-negative integer, in decimal or, with a "0x"
+/// or "0" prefix, hexadecimal or octal. Return false and leave \a result
+/// unchanged if the string isn't one.
+bool
+cru_parse_u64(const char *str, uint64_t *result)
+{
+    char *endptr;
+    unsigned long long ull;
+
+    if (str[0] < '0' || str[0] > '9')
+        return false;
+
+    errno = 0;
+    ull = strtoull(str, &endptr, 0);
+    if (endptr[0] != '\0' || errno != 0)
+        return false;
+
+    *result = ull;
+    return true;
+}
+
 static void
 cru_prefix_setup(void)
 {
@@ -432,6 +432,7 @@ path_vappendf(string_t *dest, const char *format, va_list va)
 
     string_vprintf(&tmp, format, va);
     path_append(dest, &tmp);
+    string_finish(&tmp);
 }
 
 /// Parse the dirname of path, in-place.